@@ -811,16 +811,30 @@ struct EmitSource : public Emit
         emit(0, "int %s_publish(zcm_t* zcm, const char* channel, const %s* p)", tn_, tn_);
         emit(0, "{");
         emit(0, "      uint32_t max_data_size = %s_encoded_size (p);", tn_);
+        // Outside of embedded, encode straight into the buffer that zcm will send
+        emit(0, "      #ifndef ZCM_EMBEDDED");
+        emit(0, "      uint8_t* buf = zcm_publish_acquire (zcm, channel, max_data_size);");
+        emit(0, "      if (!buf) return zcm_errno (zcm);");
+        emit(0, "      #else");
         emit(0, "      uint8_t* buf = (uint8_t*) malloc (max_data_size);");
         emit(0, "      if (!buf) return -1;");
+        emit(0, "      #endif");
         emit(0, "      int data_size = %s_encode (buf, 0, max_data_size, p);", tn_);
         emit(0, "      if (data_size < 0) {");
+        emit(0, "          #ifndef ZCM_EMBEDDED");
+        emit(0, "          zcm_publish_abort (zcm, buf);");
+        emit(0, "          #else");
         emit(0, "          free (buf);");
+        emit(0, "          #endif");
         emit(0, "          return data_size;");
         emit(0, "      }");
+        emit(0, "      #ifndef ZCM_EMBEDDED");
+        emit(0, "      return zcm_publish_commit (zcm, buf, (uint32_t)data_size);");
+        emit(0, "      #else");
         emit(0, "      int status = zcm_publish (zcm, channel, buf, (uint32_t)data_size);");
         emit(0, "      free (buf);");
         emit(0, "      return status;");
+        emit(0, "      #endif");
         emit(0, "}");
         emit(0, "");
     }
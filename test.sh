@@ -27,3 +27,24 @@ run   forking2        ./build/test/zcm/forking2
 run   flushing        ./build/test/zcm/flushing
 run   logging         ./build/test/zcm/logtest
 run   trackers        ./build/test/zcm/trackers
+run   loans           ./build/test/zcm/loans
+run   rcu-sub-unsub   ./build/test/zcm/rcu_sub_unsub
+run   dispatch-pool   ./build/test/zcm/dispatch_pool
+run   sub-queue-policy ./build/test/zcm/sub_queue_policy
+run   sub-latest      ./build/test/zcm/sub_latest
+run   batch-send      ./build/test/zcm/batch_send
+run   publish-inline  ./build/test/zcm/publish_inline
+run   publish-acquire ./build/test/zcm/publish_acquire
+run   nonblock-index  ./build/test/zcm/nonblock_index
+run   handle-budget   ./build/test/zcm/handle_budget
+run   busy-poll       ./build/test/zcm/busy_poll
+run   thread-opts     ./build/test/zcm/thread_opts
+run   stats           ./build/test/zcm/stats
+run   trace           ./build/test/zcm/trace
+run   udpm_recv_batch ./build/test/zcm/udpm_recv_batch
+run   udpm_multifrag  ./build/test/zcm/udpm_multifrag_send
+run   udpm_frag_inflight ./build/test/zcm/udpm_frag_inflight
+run   udpm_frag_reorder ./build/test/zcm/udpm_frag_reorder
+run   udpm_groups     ./build/test/zcm/udpm_channel_groups
+run   channel_table_full ./build/test/zcm/channel_table_full
+run   handle_batch    ./build/test/zcm/handle_batch
@@ -0,0 +1,68 @@
+#include <zcm/zcm.h>
+#include <zcm/util/queue.hpp>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <chrono>
+
+// Compares Queue against RingQueue on a queue of pointer sized elements that
+// is kept about half full, first one element at a time and then in batches.
+
+#define CAPACITY 1000
+#define BATCH 32
+#define N 50000000
+
+using namespace std::chrono;
+
+static double nsPerElement(steady_clock::time_point start)
+{
+    return duration<double, std::nano>(steady_clock::now() - start).count() / N;
+}
+
+template<class Q>
+static double single(Q& q, uintptr_t& sum)
+{
+    for (uintptr_t i = 0; i < CAPACITY / 2; ++i) q.push(i);
+    auto start = steady_clock::now();
+    for (uintptr_t i = 0; i < N; ++i) {
+        q.push(i);
+        sum += q.top();
+        q.pop();
+    }
+    double ret = nsPerElement(start);
+    while (q.hasMessage()) q.pop();
+    return ret;
+}
+
+static double batched(RingQueue<uintptr_t>& q, uintptr_t& sum)
+{
+    uintptr_t in[BATCH], out[BATCH];
+    for (uintptr_t i = 0; i < CAPACITY / 2; ++i) q.push(i);
+    auto start = steady_clock::now();
+    for (uintptr_t i = 0; i < N; i += BATCH) {
+        for (size_t j = 0; j < BATCH; ++j) in[j] = i + j;
+        q.pushN(in, BATCH);
+        size_t n = q.popN(out, BATCH);
+        for (size_t j = 0; j < n; ++j) sum += out[j];
+    }
+    double ret = nsPerElement(start);
+    while (q.hasMessage()) q.pop();
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    uintptr_t sum = 0;
+
+    // Queue keeps one slot empty
+    Queue<uintptr_t> queue(CAPACITY + 1);
+    RingQueue<uintptr_t> ring(CAPACITY);
+
+    printf("Queue              %6.2f ns/element\n", single(queue, sum));
+    printf("RingQueue          %6.2f ns/element\n", single(ring, sum));
+    printf("RingQueue batch %2d %6.2f ns/element\n", BATCH, batched(ring, sum));
+
+    // Keeps the loops from being optimized away
+    printf("(checksum %lu)\n", (unsigned long) sum);
+    return 0;
+}
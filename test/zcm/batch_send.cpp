@@ -0,0 +1,186 @@
+// Tests sending through sendmsg_batch(): queued messages go out in batches and in
+// order, and a message the transport fails on is dropped, counted against its own
+// channel, while the ones after it in the batch are still sent; a transport that
+// reports a failure past the end of the batch doesn't take the core down with it
+#include <atomic>
+#include <set>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "zcm/zcm.h"
+#include "zcm/transport.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define NUM_MSGS 50
+
+// Even sequence numbers go on CHANNEL_A, odd ones on CHANNEL_B
+#define CHANNEL_A "BATCH_A"
+#define CHANNEL_B "BATCH_B"
+
+// A blocking transport that only sends in batches and fails on some messages
+struct BatchTransport : public zcm_trans_t
+{
+    std::set<uint32_t> failOn;
+    // Breaks the contract by reporting the whole batch as sent when it fails
+    bool claimAllOnFailure = false;
+    std::vector<uint32_t> sent;
+    std::vector<size_t> batchSizes;
+
+    static zcm_trans_methods_t methods;
+
+    BatchTransport()
+    {
+        trans_type = ZCM_BLOCKING;
+        vtbl = &methods;
+    }
+
+    static BatchTransport* cast(zcm_trans_t* zt) { return (BatchTransport*) zt; }
+
+    static size_t getMtu(zcm_trans_t* zt) { return 1 << 20; }
+    static int recvmsgEnable(zcm_trans_t* zt, const char* channel, bool enable)
+    { return ZCM_EOK; }
+    static int recvmsg(zcm_trans_t* zt, zcm_msg_t* msg, int timeout) { return ZCM_EAGAIN; }
+    static int update(zcm_trans_t* zt) { return ZCM_EOK; }
+    static void destroy(zcm_trans_t* zt) {}
+
+    static int sendmsg(zcm_trans_t* zt, zcm_msg_t msg)
+    {
+        fprintf(stderr, "sendmsg() called although the transport can send batches\n");
+        exit(1);
+    }
+
+    static int sendmsgBatch(zcm_trans_t* zt, const zcm_msg_t* msgs, size_t n, size_t* nsent)
+    {
+        BatchTransport* t = cast(zt);
+        t->batchSizes.push_back(n);
+        for (*nsent = 0; *nsent < n; ++*nsent) {
+            const zcm_msg_t& msg = msgs[*nsent];
+            uint32_t seq;
+            ENSURE(msg.len == sizeof(seq));
+            memcpy(&seq, msg.buf, sizeof(seq));
+            const char* channel = seq % 2 ? CHANNEL_B : CHANNEL_A;
+            ENSURE(strcmp(msg.channel, channel) == 0);
+            if (t->failOn.count(seq)) {
+                if (t->claimAllOnFailure) *nsent = n;
+                return ZCM_EINVALID;
+            }
+            t->sent.push_back(seq);
+        }
+        return ZCM_EOK;
+    }
+};
+
+zcm_trans_methods_t BatchTransport::methods = {
+    &BatchTransport::getMtu,
+    &BatchTransport::sendmsg,
+    &BatchTransport::recvmsgEnable,
+    &BatchTransport::recvmsg,
+    &BatchTransport::update,
+    &BatchTransport::destroy,
+    NULL, // recvmsg_loan
+    NULL, // release_loan
+    &BatchTransport::sendmsgBatch,
+    NULL, // sendmsg_concurrent
+};
+
+static const zcm_channel_stats_t* findChannel(const zcm_stats_t& stats, const char* channel)
+{
+    for (size_t i = 0; i < stats.nchannels; ++i)
+        if (stats.channels[i].channel && strcmp(stats.channels[i].channel, channel) == 0)
+            return &stats.channels[i];
+    return NULL;
+}
+
+static void test_batch_with_failures()
+{
+    BatchTransport trans;
+    // Includes two failures in a row and a failure on the last message
+    trans.failOn = { 3, 10, 11, NUM_MSGS - 1 };
+
+    zcm_t *zcm = zcm_create_trans(&trans);
+    ENSURE(zcm);
+    zcm_set_queue_size(zcm, 2 * NUM_MSGS);
+    // Nobody subscribes, so only this gives the channels stats of their own
+    ENSURE(zcm_channel_intern(CHANNEL_A) != ZCM_CHANNEL_ID_NONE);
+    ENSURE(zcm_channel_intern(CHANNEL_B) != ZCM_CHANNEL_ID_NONE);
+
+    // While paused, all of these wait in the send queue for zcm_flush()
+    zcm_pause(zcm);
+    for (uint32_t seq = 0; seq < NUM_MSGS; ++seq) {
+        const char *channel = seq % 2 ? CHANNEL_B : CHANNEL_A;
+        ENSURE(zcm_publish(zcm, channel, (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+    }
+    zcm_flush(zcm);
+
+    std::vector<uint32_t> expected;
+    for (uint32_t seq = 0; seq < NUM_MSGS; ++seq)
+        if (!trans.failOn.count(seq)) expected.push_back(seq);
+    ENSURE(trans.sent == expected);
+
+    // The whole queue went out in a handful of calls, not one call per message
+    ENSURE(trans.batchSizes.size() == trans.failOn.size());
+    ENSURE(trans.batchSizes[0] == NUM_MSGS);
+
+    zcm_stats_t stats;
+    ENSURE(zcm_get_stats(zcm, &stats) == ZCM_EOK);
+    const zcm_channel_stats_t* a = findChannel(stats, CHANNEL_A);
+    const zcm_channel_stats_t* b = findChannel(stats, CHANNEL_B);
+    ENSURE(a && b);
+    ENSURE(a->msgs_out == NUM_MSGS / 2);
+    ENSURE(b->msgs_out == NUM_MSGS / 2);
+    ENSURE(a->drops[ZCM_DROP_SEND_FAILED] == 1); // 10
+    ENSURE(b->drops[ZCM_DROP_SEND_FAILED] == 3); // 3, 11, NUM_MSGS - 1
+    zcm_free_stats(&stats);
+
+    zcm_resume(zcm);
+    zcm_destroy(zcm);
+}
+
+static void test_failure_past_the_batch()
+{
+    BatchTransport trans;
+    trans.failOn = { 5 };
+    trans.claimAllOnFailure = true;
+
+    zcm_t *zcm = zcm_create_trans(&trans);
+    ENSURE(zcm);
+    zcm_set_queue_size(zcm, 2 * NUM_MSGS);
+
+    zcm_pause(zcm);
+    for (uint32_t seq = 0; seq < 10; ++seq) {
+        const char *channel = seq % 2 ? CHANNEL_B : CHANNEL_A;
+        ENSURE(zcm_publish(zcm, channel, (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+    }
+    zcm_flush(zcm);
+
+    // Taken at its word: the whole batch leaves the queue, with one drop for the
+    // message the core has to guess failed
+    ENSURE(trans.batchSizes.size() == 1);
+    ENSURE(trans.batchSizes[0] == 10);
+
+    zcm_stats_t stats;
+    ENSURE(zcm_get_stats(zcm, &stats) == ZCM_EOK);
+    uint64_t drops = 0;
+    for (size_t i = 0; i < stats.nchannels; ++i)
+        drops += stats.channels[i].drops[ZCM_DROP_SEND_FAILED];
+    ENSURE(drops == 1);
+    zcm_free_stats(&stats);
+
+    zcm_resume(zcm);
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_batch_with_failures();
+    test_failure_past_the_batch();
+    return 0;
+}
@@ -0,0 +1,148 @@
+// Tests busy polling (zcm_set_busy_poll()): an idle receiver keeps blocking in the
+// transport, a message opens a window in which the transport is polled without
+// waiting, the window closes again after 'spin_us' (or never, if negative), and
+// turning busy polling off while spinning stops it
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+#include "zcm/transport.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define CHANNEL "BUSY"
+
+// A blocking transport that receives whatever the test injects, and counts how it
+// is polled. Its blocking receives are kept short so the test runs quickly.
+struct PollTransport : public zcm_trans_t
+{
+    std::atomic<int> pending {0};
+    std::atomic<uint64_t> polls {0};    // recvmsg() with a timeout of 0
+    std::atomic<uint64_t> blocking {0}; // recvmsg() with a timeout
+    uint32_t data = 0;
+
+    static zcm_trans_methods_t methods;
+
+    PollTransport()
+    {
+        trans_type = ZCM_BLOCKING;
+        vtbl = &methods;
+    }
+
+    static PollTransport* cast(zcm_trans_t* zt) { return (PollTransport*) zt; }
+
+    static size_t getMtu(zcm_trans_t* zt) { return 1 << 20; }
+    static int sendmsg(zcm_trans_t* zt, zcm_msg_t msg) { return ZCM_EOK; }
+    static int recvmsgEnable(zcm_trans_t* zt, const char* channel, bool enable)
+    { return ZCM_EOK; }
+    static int update(zcm_trans_t* zt) { return ZCM_EOK; }
+    static void destroy(zcm_trans_t* zt) {}
+
+    static int recvmsg(zcm_trans_t* zt, zcm_msg_t* msg, int timeout)
+    {
+        PollTransport* t = cast(zt);
+        if (timeout == 0) t->polls++;
+        else              t->blocking++;
+
+        if (t->pending == 0) {
+            if (timeout != 0) usleep(1000);
+            return ZCM_EAGAIN;
+        }
+        t->pending--;
+        msg->utime = 0;
+        msg->channel = CHANNEL;
+        msg->len = sizeof(t->data);
+        msg->buf = (uint8_t*) &t->data;
+        return ZCM_EOK;
+    }
+};
+
+zcm_trans_methods_t PollTransport::methods = {
+    &PollTransport::getMtu,
+    &PollTransport::sendmsg,
+    &PollTransport::recvmsgEnable,
+    &PollTransport::recvmsg,
+    &PollTransport::update,
+    &PollTransport::destroy,
+    NULL, // recvmsg_loan
+    NULL, // release_loan
+    NULL, // sendmsg_batch
+    NULL, // sendmsg_concurrent
+};
+
+static std::atomic<int> numrecv {0};
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    numrecv++;
+}
+
+// Hands the receiver one message and waits for it to be dispatched
+static void inject(PollTransport& trans)
+{
+    int n = numrecv + 1;
+    trans.pending++;
+    for (int i = 0; i < 2000 && numrecv < n; ++i) usleep(1000);
+    ENSURE(numrecv == n);
+}
+
+// Whether the receiver polls without waiting during the next 'us' microseconds
+static bool pollsWithin(PollTransport& trans, useconds_t us)
+{
+    uint64_t before = trans.polls;
+    usleep(us);
+    return trans.polls != before;
+}
+
+static void test_window()
+{
+    PollTransport trans;
+    zcm_t *zcm = zcm_create_trans(&trans);
+    ENSURE(zcm);
+    ENSURE(zcm_subscribe(zcm, CHANNEL, handler, NULL));
+    ENSURE(zcm_set_busy_poll(zcm, 30000) == ZCM_EOK);
+    zcm_start(zcm);
+
+    // Idle: only blocking receives
+    ENSURE(!pollsWithin(trans, 50000));
+    ENSURE(trans.blocking > 0);
+
+    // A message opens the window...
+    inject(trans);
+    ENSURE(pollsWithin(trans, 5000));
+    // ...which closes 30ms later
+    usleep(50000);
+    ENSURE(!pollsWithin(trans, 50000));
+
+    // Spinning forever
+    ENSURE(zcm_set_busy_poll(zcm, -1) == ZCM_EOK);
+    inject(trans);
+    usleep(50000);
+    ENSURE(pollsWithin(trans, 20000));
+
+    // Turning it off while spinning stops it
+    ENSURE(zcm_set_busy_poll(zcm, 0) == ZCM_EOK);
+    usleep(10000);
+    ENSURE(!pollsWithin(trans, 50000));
+
+    // Off, a message opens no window
+    inject(trans);
+    ENSURE(!pollsWithin(trans, 20000));
+
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_window();
+    return 0;
+}
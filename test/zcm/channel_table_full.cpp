@@ -0,0 +1,148 @@
+// Tests the blocking core with a full channel table: publishing and regex subs that
+// see any number of channels don't use it up, and once it is full anyway, exact subs
+// on new channels are still made and still get their messages, looked up by name
+#include <atomic>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+#include "zcm/transport.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+// The table's capacity, ChannelTable::MAX_CHANNELS - 1
+#define TABLE_SIZE ((1 << 14) - 1)
+
+struct Received
+{
+    const char* expected;
+    std::atomic<int> count {0};
+    std::atomic<int> wrongName {0};
+};
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    Received* r = (Received*) usr;
+    if (r->expected && strcmp(r->expected, channel) != 0) r->wrongName++;
+    r->count++;
+}
+
+static void waitFor(std::atomic<int>& count, int n)
+{
+    for (int i = 0; i < 2000 && count < n; ++i) usleep(1000);
+    ENSURE(count == n);
+}
+
+// Waits out a full send queue rather than count on the dispatch thread keeping up
+static void publish(zcm_t *zcm, const char *channel)
+{
+    uint8_t data = 0;
+    int ret;
+    for (int i = 0; i < 2000; ++i) {
+        ret = zcm_publish(zcm, channel, &data, 1);
+        if (ret != ZCM_EAGAIN) break;
+        usleep(1000);
+    }
+    ENSURE(ret == ZCM_EOK);
+}
+
+// Runs first, while the table is still empty
+static void test_unbounded_channels()
+{
+    const int NCHANNELS = TABLE_SIZE;
+
+    zcm_t *zcm = zcm_create("block-inproc");
+    ENSURE(zcm);
+    Received all;
+    all.expected = nullptr;
+    ENSURE(zcm_subscribe(zcm, "DYN_.*", handler, &all));
+    zcm_start(zcm);
+
+    // As many distinct channels as the table can hold, all received by the regex
+    for (int i = 0; i < NCHANNELS; ++i) {
+        std::string channel = "DYN_" + std::to_string(i);
+        publish(zcm, channel.c_str());
+    }
+    waitFor(all.count, NCHANNELS);
+
+    // Only publishing, never any id
+    publish(zcm, "PUB_ONLY");
+    ENSURE(zcm_channel_find("PUB_ONLY") == ZCM_CHANNEL_ID_NONE);
+
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+
+    // The regex only took half the table
+    ENSURE(zcm_channel_find("DYN_0") != ZCM_CHANNEL_ID_NONE);
+    ENSURE(zcm_channel_find("DYN_16000") == ZCM_CHANNEL_ID_NONE);
+    ENSURE(zcm_channel_intern("AFTER_DYN") != ZCM_CHANNEL_ID_NONE);
+}
+
+static void fillTable()
+{
+    for (int i = 0; i < TABLE_SIZE; ++i) {
+        std::string channel = "FILL_" + std::to_string(i);
+        if (zcm_channel_intern(channel.c_str()) == ZCM_CHANNEL_ID_NONE) return;
+    }
+    ENSURE(false && "the channel table never filled up");
+}
+
+static void test_full_table()
+{
+    fillTable();
+    ENSURE(zcm_channel_intern("FULL_EXACT") == ZCM_CHANNEL_ID_NONE);
+
+    zcm_t *zcm = zcm_create("block-inproc");
+    ENSURE(zcm);
+
+    // Two subs on a new channel, one on an old one, and a regex over new ones
+    Received exact1, exact2, old, re;
+    exact1.expected = exact2.expected = "FULL_EXACT";
+    old.expected = "FILL_0";
+    re.expected = nullptr;
+    zcm_sub_t *sub1 = zcm_subscribe(zcm, "FULL_EXACT", handler, &exact1);
+    ENSURE(sub1);
+    ENSURE(zcm_subscribe(zcm, "FULL_EXACT", handler, &exact2));
+    ENSURE(zcm_subscribe(zcm, "FILL_0", handler, &old));
+    ENSURE(zcm_subscribe(zcm, "FULL_RE_.*", handler, &re));
+    zcm_start(zcm);
+
+    for (int i = 0; i < 10; ++i) {
+        // A fresh copy of the name, so nothing can get by on comparing pointers
+        std::string channel = "FULL_EXACT";
+        publish(zcm, channel.c_str());
+        publish(zcm, "FILL_0");
+        publish(zcm, ("FULL_RE_" + std::to_string(i)).c_str());
+        publish(zcm, "FULL_NOBODY");
+    }
+    waitFor(exact1.count, 10);
+    waitFor(exact2.count, 10);
+    waitFor(old.count, 10);
+    waitFor(re.count, 10);
+
+    // The remaining sub keeps its messages
+    ENSURE(zcm_unsubscribe(zcm, sub1) == ZCM_EOK);
+    publish(zcm, "FULL_EXACT");
+    waitFor(exact2.count, 11);
+    ENSURE(exact1.count == 10);
+
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+
+    ENSURE(exact1.wrongName == 0 && exact2.wrongName == 0 && old.wrongName == 0);
+}
+
+int main()
+{
+    test_unbounded_channels();
+    test_full_table();
+    return 0;
+}
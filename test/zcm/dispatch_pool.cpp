@@ -0,0 +1,162 @@
+// Tests dispatching with a pool of threads (zcm_set_dispatch_threads()): every
+// channel's callbacks run one at a time and in order, a regex subscription's
+// callback never runs concurrently with itself, and unordered channels lose nothing
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define URL "block-inproc"
+#define NUM_THREADS 4
+#define NUM_CHANNELS 8
+#define NUM_MSGS 200
+
+struct Channel
+{
+    std::string name;
+    std::atomic<uint32_t> next {0};
+    std::atomic<int> inFlight {0};
+    std::atomic<int> outOfOrder {0};
+    std::atomic<int> overlaps {0};
+};
+
+static Channel channels[NUM_CHANNELS];
+
+static std::mutex threadsLock;
+static std::set<std::thread::id> threadsSeen;
+
+static uint32_t seqOf(const zcm_recv_buf_t *rbuf)
+{
+    uint32_t seq;
+    ENSURE(rbuf->data_size == sizeof(seq));
+    memcpy(&seq, rbuf->data, sizeof(seq));
+    return seq;
+}
+
+static void orderedHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    Channel *c = (Channel*) usr;
+    ENSURE(c->name == channel);
+    if (c->inFlight++ != 0) c->overlaps++;
+
+    uint32_t seq = seqOf(rbuf);
+    if (seq != c->next) c->outOfOrder++;
+    c->next = seq + 1;
+    {
+        std::unique_lock<std::mutex> lk(threadsLock);
+        threadsSeen.insert(std::this_thread::get_id());
+    }
+    usleep(20);
+
+    c->inFlight--;
+}
+
+struct RegexSub
+{
+    std::atomic<int> calls {0};
+    std::atomic<int> inFlight {0};
+    std::atomic<int> overlaps {0};
+};
+
+static void regexHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    RegexSub *r = (RegexSub*) usr;
+    if (r->inFlight++ != 0) r->overlaps++;
+    usleep(20);
+    r->calls++;
+    r->inFlight--;
+}
+
+static void publishAll(zcm_t *zcm, const char *prefix)
+{
+    for (uint32_t seq = 0; seq < NUM_MSGS; ++seq) {
+        for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+            std::string name = prefix + std::to_string(i);
+            ENSURE(zcm_publish(zcm, name.c_str(), (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+        }
+    }
+}
+
+static void test_ordered_channels()
+{
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    ENSURE(zcm_set_dispatch_threads(zcm, NUM_THREADS) == ZCM_EOK);
+    zcm_set_queue_size(zcm, 2 * NUM_CHANNELS * NUM_MSGS);
+
+    for (size_t i = 0; i < NUM_CHANNELS; ++i) {
+        channels[i].name = "POOL_" + std::to_string(i);
+        ENSURE(zcm_subscribe(zcm, channels[i].name.c_str(), orderedHandler, &channels[i]));
+    }
+    RegexSub regex;
+    ENSURE(zcm_subscribe(zcm, "POOL_.*", regexHandler, &regex));
+
+    zcm_start(zcm);
+    // The pool can't be resized while it is running
+    ENSURE(zcm_set_dispatch_threads(zcm, 2) == ZCM_EINVALID);
+
+    publishAll(zcm, "POOL_");
+    for (int i = 0; i < 5000 && regex.calls < NUM_CHANNELS * NUM_MSGS; ++i) usleep(1000);
+    zcm_stop(zcm);
+
+    for (auto& c : channels) {
+        ENSURE(c.next == NUM_MSGS);
+        ENSURE(c.outOfOrder == 0);
+        ENSURE(c.overlaps == 0);
+    }
+    ENSURE(regex.calls == NUM_CHANNELS * NUM_MSGS);
+    ENSURE(regex.overlaps == 0);
+    // The channels were spread over more than one thread
+    ENSURE(threadsSeen.size() > 1);
+
+    zcm_destroy(zcm);
+}
+
+static std::atomic<int> unorderedCalls {0};
+
+static void unorderedHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    unorderedCalls++;
+}
+
+static void test_unordered_channel()
+{
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    ENSURE(zcm_set_dispatch_threads(zcm, NUM_THREADS) == ZCM_EOK);
+    zcm_set_queue_size(zcm, 2 * NUM_MSGS);
+
+    ENSURE(zcm_set_channel_unordered(zcm, "UNORDERED", 1) == ZCM_EOK);
+    ENSURE(zcm_set_channel_unordered(zcm, "UNORDERED.*", 1) == ZCM_EINVALID);
+    ENSURE(zcm_subscribe(zcm, "UNORDERED", unorderedHandler, NULL));
+
+    zcm_start(zcm);
+    for (uint32_t seq = 0; seq < NUM_MSGS; ++seq)
+        ENSURE(zcm_publish(zcm, "UNORDERED", (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+    for (int i = 0; i < 5000 && unorderedCalls < NUM_MSGS; ++i) usleep(1000);
+    zcm_stop(zcm);
+
+    ENSURE(unorderedCalls == NUM_MSGS);
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_ordered_channels();
+    test_unordered_channel();
+    return 0;
+}
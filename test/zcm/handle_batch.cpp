@@ -0,0 +1,150 @@
+// Tests zcm_handle_batch(): each call dispatches at most 'max_msgs' messages, in order,
+// and returns how many it dispatched, an idle instance comes back with 0 once
+// 'timeout' runs out, and the call is refused while the dispatch thread is running
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+#include "zcm/zcm-cpp.hpp"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define URL "block-inproc"
+#define CHANNEL "BATCH"
+#define NUM_MSGS 10
+
+static std::vector<uint32_t> received;
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    uint32_t seq;
+    ENSURE(rbuf->data_size == sizeof(seq));
+    memcpy(&seq, rbuf->data, sizeof(seq));
+    received.push_back(seq);
+}
+
+static void cppHandler(const zcm::ReceiveBuffer *rbuf, const std::string& channel, void *usr)
+{
+    ++*(int*) usr;
+}
+
+static void ensureInOrder(size_t n)
+{
+    ENSURE(received.size() == n);
+    for (size_t i = 0; i < n; ++i) ENSURE(received[i] == i);
+}
+
+static int64_t msSince(std::chrono::steady_clock::time_point start)
+{
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+static void test_max_msgs()
+{
+    received.clear();
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    ENSURE(zcm_subscribe(zcm, CHANNEL, handler, NULL));
+
+    // Nothing to do yet, but the first call starts the receive thread
+    ENSURE(zcm_handle_batch(zcm, 3, 0) == 0);
+
+    for (uint32_t seq = 0; seq < NUM_MSGS; ++seq)
+        ENSURE(zcm_publish(zcm, CHANNEL, (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+    // Give them all time to reach the receive queue. Not zcm_flush(), which would
+    // dispatch them as well
+    usleep(100000);
+
+    ENSURE(zcm_handle_batch(zcm, 3, 1000) == 3);
+    ensureInOrder(3);
+    ENSURE(zcm_handle_batch(zcm, 3, 1000) == 3);
+    ensureInOrder(6);
+    ENSURE(zcm_handle_batch(zcm, 1, 1000) == 1);
+    ensureInOrder(7);
+    // Runs out of messages before 'max_msgs'
+    ENSURE(zcm_handle_batch(zcm, 100, 1000) == NUM_MSGS - 7);
+    ensureInOrder(NUM_MSGS);
+
+    ENSURE(zcm_handle_batch(zcm, 0, 0) == -1);
+    ENSURE(zcm_errno(zcm) == ZCM_EINVALID);
+
+    zcm_destroy(zcm);
+}
+
+static void test_timeout()
+{
+    received.clear();
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    ENSURE(zcm_subscribe(zcm, CHANNEL, handler, NULL));
+
+    auto start = std::chrono::steady_clock::now();
+    ENSURE(zcm_handle_batch(zcm, 10, 0) == 0);
+    ENSURE(zcm_handle_batch(zcm, 10, 50) == 0);
+    int64_t ms = msSince(start);
+    ENSURE(ms >= 45 && ms < 1000);
+    ENSURE(zcm_errno(zcm) == ZCM_EOK);
+    ENSURE(received.empty());
+
+    // A message that shows up partway through the wait ends it early
+    uint32_t seq = 0;
+    ENSURE(zcm_publish(zcm, CHANNEL, (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+    start = std::chrono::steady_clock::now();
+    ENSURE(zcm_handle_batch(zcm, 10, 5000) == 1);
+    ENSURE(msSince(start) < 1000);
+    ensureInOrder(1);
+
+    zcm_destroy(zcm);
+}
+
+static void test_refused_while_started()
+{
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    ENSURE(zcm_subscribe(zcm, CHANNEL, handler, NULL));
+
+    zcm_start(zcm);
+    ENSURE(zcm_handle_batch(zcm, 10, 0) == -1);
+    ENSURE(zcm_errno(zcm) == ZCM_EINVALID);
+    zcm_stop(zcm);
+
+    zcm_destroy(zcm);
+}
+
+static void test_cpp()
+{
+    zcm::ZCM zcm(URL);
+    ENSURE(zcm.good());
+    int count = 0;
+    ENSURE(zcm.subscribe(CHANNEL, cppHandler, &count));
+    ENSURE(zcm.handleBatch(2, 0) == 0);
+
+    uint8_t data = 0;
+    for (int i = 0; i < 3; ++i) ENSURE(zcm.publish(CHANNEL, &data, 1) == ZCM_EOK);
+    usleep(100000);
+
+    ENSURE(zcm.handleBatch(2, 1000) == 2);
+    ENSURE(count == 2);
+    ENSURE(zcm.handleBatch(2, 1000) == 1);
+    ENSURE(count == 3);
+}
+
+int main()
+{
+    test_max_msgs();
+    test_timeout();
+    test_refused_while_started();
+    test_cpp();
+    return 0;
+}
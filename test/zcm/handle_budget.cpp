@@ -0,0 +1,101 @@
+// Tests zcm_handle_nonblock_budget(): it stops at whichever comes first of no more
+// messages, 'max_msgs' messages, or 'max_us' on the caller's clock (checked after
+// each message), and what it leaves behind is dispatched in order by the next call
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "zcm/zcm.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define URL "nonblock-inproc"
+#define CHANNEL "BUDGET"
+#define NUM_MSGS 10
+// How far the fake clock moves per dispatched message
+#define MSG_US 10
+
+static uint64_t fakeNow = 1000;
+static std::vector<uint32_t> received;
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    uint32_t seq;
+    ENSURE(rbuf->data_size == sizeof(seq));
+    memcpy(&seq, rbuf->data, sizeof(seq));
+    received.push_back(seq);
+    fakeNow += MSG_US;
+}
+
+static uint64_t timeNow(void *usr)
+{
+    ++*(int*) usr;
+    return fakeNow;
+}
+
+static zcm_t *setUp()
+{
+    received.clear();
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    ENSURE(zcm_subscribe(zcm, CHANNEL, handler, NULL));
+    for (uint32_t seq = 0; seq < NUM_MSGS; ++seq)
+        ENSURE(zcm_publish(zcm, CHANNEL, (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+    return zcm;
+}
+
+static void ensureInOrder(size_t n)
+{
+    ENSURE(received.size() == n);
+    for (size_t i = 0; i < n; ++i) ENSURE(received[i] == i);
+}
+
+static void test_max_msgs()
+{
+    zcm_t *zcm = setUp();
+    ENSURE(zcm_handle_nonblock_budget(zcm, 3, 0, NULL, NULL) == 3);
+    ensureInOrder(3);
+    ENSURE(zcm_handle_nonblock_budget(zcm, 3, 0, NULL, NULL) == 3);
+    ensureInOrder(6);
+    // Runs out of messages before the budget
+    ENSURE(zcm_handle_nonblock_budget(zcm, 100, 0, NULL, NULL) == NUM_MSGS - 6);
+    ensureInOrder(NUM_MSGS);
+    ENSURE(zcm_handle_nonblock_budget(zcm, 100, 0, NULL, NULL) == 0);
+    ENSURE(zcm_handle_nonblock_budget(zcm, 0, 0, NULL, NULL) == 0);
+    zcm_destroy(zcm);
+}
+
+static void test_max_us()
+{
+    zcm_t *zcm = setUp();
+    int calls = 0;
+    // 3 messages take 30us on the fake clock, which is the first time past 25us
+    ENSURE(zcm_handle_nonblock_budget(zcm, 100, 25, timeNow, &calls) == 3);
+    ensureInOrder(3);
+    // Once at the start and once after every message
+    ENSURE(calls == 4);
+
+    // The budget is checked after dispatching, so a message always gets through
+    ENSURE(zcm_handle_nonblock_budget(zcm, 100, 0, timeNow, &calls) == 1);
+    ensureInOrder(4);
+
+    // Whichever budget runs out first wins
+    ENSURE(zcm_handle_nonblock_budget(zcm, 2, 1000, timeNow, &calls) == 2);
+    ensureInOrder(6);
+    ENSURE(zcm_handle_nonblock_budget(zcm, 100, 1000, timeNow, &calls) == NUM_MSGS - 6);
+    ensureInOrder(NUM_MSGS);
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_max_msgs();
+    test_max_us();
+    return 0;
+}
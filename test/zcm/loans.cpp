@@ -0,0 +1,181 @@
+// Tests the loaned receive path (recvmsg_loan() / release_loan()): loaned messages
+// must reach their callbacks intact, and every loan must be handed back before the
+// transport is destroyed, including those of messages still queued at shutdown
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+#include "zcm/transport.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define CHANNEL "LOANS"
+#define NUM_MSGS 200
+
+struct Loan
+{
+    zcm_msg_t msg;
+    uint32_t data;
+};
+
+// A blocking transport that only hands out loans, NUM_MSGS of them
+struct LoanTransport : public zcm_trans_t
+{
+    std::atomic<int> loaned {0};
+    std::atomic<int> outstanding {0};
+    std::atomic<bool> destroyed {false};
+
+    static zcm_trans_methods_t methods;
+
+    LoanTransport()
+    {
+        trans_type = ZCM_BLOCKING;
+        vtbl = &methods;
+    }
+
+    static LoanTransport* cast(zcm_trans_t* zt) { return (LoanTransport*) zt; }
+
+    static size_t getMtu(zcm_trans_t* zt) { return 1 << 20; }
+    static int sendmsg(zcm_trans_t* zt, zcm_msg_t msg) { return ZCM_EOK; }
+    static int recvmsgEnable(zcm_trans_t* zt, const char* channel, bool enable)
+    { return ZCM_EOK; }
+    static int update(zcm_trans_t* zt) { return ZCM_EOK; }
+
+    static int recvmsg(zcm_trans_t* zt, zcm_msg_t* msg, int timeout)
+    {
+        fprintf(stderr, "recvmsg() called although the transport can loan\n");
+        exit(1);
+    }
+
+    static int recvmsgLoan(zcm_trans_t* zt, zcm_msg_t* msg, void** loan, int timeout)
+    {
+        LoanTransport* t = cast(zt);
+        int n = t->loaned.load();
+        if (n == NUM_MSGS) {
+            usleep(timeout * 1000);
+            return ZCM_EAGAIN;
+        }
+        Loan* l = new Loan();
+        l->data = n;
+        l->msg.utime = 0;
+        l->msg.channel = CHANNEL;
+        l->msg.channel_id = ZCM_CHANNEL_ID_NONE;
+        l->msg.len = sizeof(l->data);
+        l->msg.buf = (uint8_t*) &l->data;
+        *msg = l->msg;
+        *loan = l;
+        t->outstanding++;
+        t->loaned++;
+        return ZCM_EOK;
+    }
+
+    static void releaseLoan(zcm_trans_t* zt, void* loan)
+    {
+        LoanTransport* t = cast(zt);
+        ENSURE(!t->destroyed);
+        // Poison the memory, so a message used after its release is noticed
+        Loan* l = (Loan*) loan;
+        l->data = 0xdeadbeef;
+        delete l;
+        t->outstanding--;
+    }
+
+    static void destroy(zcm_trans_t* zt)
+    {
+        LoanTransport* t = cast(zt);
+        ENSURE(t->outstanding == 0);
+        t->destroyed = true;
+    }
+};
+
+zcm_trans_methods_t LoanTransport::methods = {
+    &LoanTransport::getMtu,
+    &LoanTransport::sendmsg,
+    &LoanTransport::recvmsgEnable,
+    &LoanTransport::recvmsg,
+    &LoanTransport::update,
+    &LoanTransport::destroy,
+    &LoanTransport::recvmsgLoan,
+    &LoanTransport::releaseLoan,
+    NULL, // sendmsg_batch
+    NULL, // sendmsg_concurrent
+};
+
+static std::atomic<int> numrecv {0};
+static std::atomic<bool> ordered {true};
+static int sleepUs = 0;
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    uint32_t data;
+    ENSURE(rbuf->data_size == sizeof(data));
+    memcpy(&data, rbuf->data, sizeof(data));
+    if (data != (uint32_t) numrecv.load()) ordered = false;
+    numrecv++;
+    if (sleepUs) usleep(sleepUs);
+}
+
+static void waitFor(int n)
+{
+    for (int i = 0; i < 1000 && numrecv < n; ++i) usleep(1000);
+}
+
+// Every loaned message is dispatched in order, and all loans come back
+static void test_dispatch()
+{
+    LoanTransport trans;
+    numrecv = 0;
+    sleepUs = 0;
+
+    zcm_t *zcm = zcm_create_trans(&trans);
+    ENSURE(zcm);
+    ENSURE(zcm_subscribe(zcm, CHANNEL, handler, NULL));
+
+    zcm_start(zcm);
+    waitFor(NUM_MSGS);
+    zcm_stop(zcm);
+
+    ENSURE(numrecv == NUM_MSGS);
+    ENSURE(ordered);
+    ENSURE(trans.outstanding == 0);
+
+    zcm_destroy(zcm);
+    ENSURE(trans.destroyed);
+}
+
+// Stopping with messages still queued must release their loans too
+static void test_teardown()
+{
+    LoanTransport trans;
+    numrecv = 0;
+    sleepUs = 5000;
+
+    zcm_t *zcm = zcm_create_trans(&trans);
+    ENSURE(zcm);
+    ENSURE(zcm_subscribe(zcm, CHANNEL, handler, NULL));
+
+    zcm_start(zcm);
+    waitFor(5);
+    zcm_stop(zcm);
+    ENSURE(numrecv < NUM_MSGS);
+
+    zcm_destroy(zcm);
+    ENSURE(trans.destroyed);
+    ENSURE(trans.outstanding == 0);
+    ENSURE(ordered);
+}
+
+int main()
+{
+    test_dispatch();
+    test_teardown();
+    return 0;
+}
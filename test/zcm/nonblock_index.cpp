@@ -0,0 +1,197 @@
+// Tests the subscription index of nonblocking instances: under random subscribe and
+// unsubscribe churn over many channels (so the channel index sees collisions and
+// deletions), every message reaches exactly the subscriptions a plain scan of all
+// of them would pick. Also checks the subscription limit and callbacks that
+// unsubscribe while their channel is being dispatched
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "zcm/zcm.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define URL "nonblock-inproc"
+#define NUM_CHANNELS 300
+#define SUBS_MAX 512 // ZCM_NONBLOCK_SUBS_MAX as built
+
+struct Sub
+{
+    std::string channel;
+    zcm_sub_t* sub;
+    int calls;
+};
+
+static void countHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    ((Sub*) usr)->calls++;
+}
+
+// What the nonblocking core promises: exact names, or "prefix.*" for channels
+// longer than two characters that start with 'prefix'
+static bool matches(const std::string& sub, const std::string& channel)
+{
+    size_t len = sub.size();
+    if (len >= 2 && sub.compare(len - 2, 2, ".*") == 0)
+        return channel.size() > 2 && channel.compare(0, len - 2, sub, 0, len - 2) == 0;
+    return sub == channel;
+}
+
+static void dispatchAll(zcm_t *zcm)
+{
+    while (zcm_handle_nonblock(zcm) == ZCM_EOK) {}
+}
+
+static void test_matches_scan()
+{
+    std::mt19937 rng(42);
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+
+    std::vector<std::string> channels;
+    for (int i = 0; i < NUM_CHANNELS; ++i) channels.push_back("CH_" + std::to_string(i));
+    channels.push_back("CH");
+    channels.push_back("OTHER_X");
+    std::vector<std::string> prefixes = { "CH_1.*", "CH_2.*", "C.*", "OTHER.*", "CH.*" };
+
+    std::map<Sub*, bool> live;
+    auto subscribe = [&](const std::string& channel) {
+        Sub* s = new Sub { channel, nullptr, 0 };
+        s->sub = zcm_subscribe(zcm, channel.c_str(), countHandler, s);
+        ENSURE(s->sub);
+        live[s] = true;
+    };
+
+    for (int round = 0; round < 20; ++round) {
+        // Top up to around 400 subscriptions, some channels more than once
+        while (live.size() < 400) {
+            if (rng() % 20 == 0) subscribe(prefixes[rng() % prefixes.size()]);
+            else                 subscribe(channels[rng() % NUM_CHANNELS]);
+        }
+
+        for (auto& l : live) l.first->calls = 0;
+        uint8_t data = 0;
+        for (auto& c : channels)
+            ENSURE(zcm_publish(zcm, c.c_str(), &data, 1) == ZCM_EOK);
+        dispatchAll(zcm);
+
+        for (auto& l : live) {
+            int expected = 0;
+            for (auto& c : channels) expected += matches(l.first->channel, c);
+            if (l.first->calls != expected)
+                fprintf(stderr, "round %d: '%s' got %d calls, expected %d\n",
+                        round, l.first->channel.c_str(), l.first->calls, expected);
+            ENSURE(l.first->calls == expected);
+        }
+
+        // Drop about half of them, which shifts entries around in the index
+        for (auto it = live.begin(); it != live.end();) {
+            if (rng() % 2) {
+                ++it;
+                continue;
+            }
+            ENSURE(zcm_unsubscribe(zcm, it->first->sub) == ZCM_EOK);
+            delete it->first;
+            it = live.erase(it);
+        }
+    }
+
+    for (auto& l : live) {
+        ENSURE(zcm_unsubscribe(zcm, l.first->sub) == ZCM_EOK);
+        // A second time is an error, not a crash
+        ENSURE(zcm_unsubscribe(zcm, l.first->sub) == ZCM_EINVALID);
+        delete l.first;
+    }
+    zcm_destroy(zcm);
+}
+
+static void test_limit()
+{
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+
+    std::vector<Sub> subs(SUBS_MAX);
+    for (int i = 0; i < SUBS_MAX; ++i) {
+        subs[i].channel = "LIMIT_" + std::to_string(i);
+        subs[i].sub = zcm_subscribe(zcm, subs[i].channel.c_str(), countHandler, &subs[i]);
+        ENSURE(subs[i].sub);
+    }
+    Sub extra { "LIMIT_EXTRA", nullptr, 0 };
+    ENSURE(!zcm_subscribe(zcm, extra.channel.c_str(), countHandler, &extra));
+
+    // Freeing one makes room again
+    ENSURE(zcm_unsubscribe(zcm, subs[7].sub) == ZCM_EOK);
+    extra.sub = zcm_subscribe(zcm, extra.channel.c_str(), countHandler, &extra);
+    ENSURE(extra.sub);
+
+    uint8_t data = 0;
+    ENSURE(zcm_publish(zcm, "LIMIT_7", &data, 1) == ZCM_EOK);
+    ENSURE(zcm_publish(zcm, "LIMIT_EXTRA", &data, 1) == ZCM_EOK);
+    dispatchAll(zcm);
+    ENSURE(subs[7].calls == 0);
+    ENSURE(extra.calls == 1);
+
+    zcm_destroy(zcm);
+}
+
+struct Unsubscriber
+{
+    zcm_t *zcm;
+    zcm_sub_t *self;
+    zcm_sub_t *victim;
+    int calls;
+};
+
+static void unsubHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    Unsubscriber *u = (Unsubscriber*) usr;
+    u->calls++;
+    ENSURE(zcm_unsubscribe(u->zcm, u->self) == ZCM_EOK);
+    if (u->victim) ENSURE(zcm_unsubscribe(u->zcm, u->victim) == ZCM_EOK);
+}
+
+// A callback that unsubscribes itself and the sub after it on the same channel:
+// neither is called again, and the rest of the channel's subs still are
+static void test_unsub_in_callback()
+{
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+
+    Sub before { "SELF", nullptr, 0 }, victim { "SELF", nullptr, 0 }, after { "SELF", nullptr, 0 };
+    before.sub = zcm_subscribe(zcm, "SELF", countHandler, &before);
+    Unsubscriber u { zcm, nullptr, nullptr, 0 };
+    u.self = zcm_subscribe(zcm, "SELF", unsubHandler, &u);
+    victim.sub = zcm_subscribe(zcm, "SELF", countHandler, &victim);
+    after.sub = zcm_subscribe(zcm, "SELF", countHandler, &after);
+    ENSURE(before.sub && u.self && victim.sub && after.sub);
+    u.victim = victim.sub;
+
+    uint8_t data = 0;
+    ENSURE(zcm_publish(zcm, "SELF", &data, 1) == ZCM_EOK);
+    ENSURE(zcm_publish(zcm, "SELF", &data, 1) == ZCM_EOK);
+    dispatchAll(zcm);
+
+    ENSURE(before.calls == 2);
+    ENSURE(u.calls == 1);
+    ENSURE(victim.calls == 0);
+    ENSURE(after.calls == 2);
+
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_matches_scan();
+    test_limit();
+    test_unsub_in_callback();
+    return 0;
+}
@@ -0,0 +1,129 @@
+// Tests two-phase publishing (zcm_publish_acquire() / zcm_publish_commit() /
+// zcm_publish_abort()) on blocking and nonblocking instances: committed messages
+// arrive with the committed length, aborted ones never do, bad commits fail and
+// set zcm errno, and acquired buffers are recycled through the pool
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define CHANNEL "ACQUIRE"
+#define ACQUIRE_LEN 64
+
+static std::vector<std::string> received;
+static std::atomic<int> numrecv {0};
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    received.push_back(std::string((const char*) rbuf->data, rbuf->data_size));
+    numrecv++;
+}
+
+// Acquires a buffer, writes 'text' into it and commits just that much
+static int publishText(zcm_t *zcm, const char *text)
+{
+    uint8_t *buf = zcm_publish_acquire(zcm, CHANNEL, ACQUIRE_LEN);
+    ENSURE(buf);
+    ENSURE(zcm_errno(zcm) == ZCM_EOK);
+    size_t len = strlen(text);
+    memcpy(buf, text, len);
+    return zcm_publish_commit(zcm, buf, len);
+}
+
+// Everything that can go wrong, and an abort, without publishing anything
+static void publishBad(zcm_t *zcm)
+{
+    uint8_t *buf = zcm_publish_acquire(zcm, CHANNEL, ACQUIRE_LEN);
+    ENSURE(buf);
+    ENSURE(zcm_publish_commit(zcm, buf, ACQUIRE_LEN + 1) == ZCM_EINVALID);
+    ENSURE(zcm_errno(zcm) == ZCM_EINVALID);
+
+    buf = zcm_publish_acquire(zcm, CHANNEL, ACQUIRE_LEN);
+    ENSURE(buf);
+    memcpy(buf, "aborted", 7);
+    zcm_publish_abort(zcm, buf);
+}
+
+static void test_blocking(enum zcm_publish_mode mode)
+{
+    received.clear();
+    numrecv = 0;
+
+    zcm_t *zcm = zcm_create("block-inproc");
+    ENSURE(zcm);
+    ENSURE(zcm_set_publish_mode(zcm, mode) == ZCM_EOK);
+    ENSURE(zcm_subscribe(zcm, CHANNEL, handler, NULL));
+    zcm_start(zcm);
+
+    // Too large for the transport
+    ENSURE(zcm_publish_acquire(zcm, CHANNEL, 0xffffffff) == NULL);
+    ENSURE(zcm_errno(zcm) == ZCM_EINVALID);
+
+    ENSURE(publishText(zcm, "first") == ZCM_EOK);
+    ENSURE(zcm_errno(zcm) == ZCM_EOK);
+    publishBad(zcm);
+    ENSURE(publishText(zcm, "second") == ZCM_EOK);
+    ENSURE(zcm_errno(zcm) == ZCM_EOK);
+
+    for (int i = 0; i < 2000 && numrecv < 2; ++i) usleep(1000);
+    // Give an aborted message a chance to show up anyway
+    usleep(20000);
+    ENSURE(numrecv == 2);
+    ENSURE(received[0] == "first");
+    ENSURE(received[1] == "second");
+
+    // Aborted buffers go back to the pool
+    zcm_pool_stats_t before, after;
+    zcm_get_pool_stats(zcm, &before);
+    for (int i = 0; i < 100; ++i)
+        zcm_publish_abort(zcm, zcm_publish_acquire(zcm, CHANNEL, ACQUIRE_LEN));
+    zcm_get_pool_stats(zcm, &after);
+    ENSURE(after.misses - before.misses <= 1);
+    ENSURE(after.hits + after.misses == before.hits + before.misses + 100);
+
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+}
+
+static void test_nonblocking()
+{
+    received.clear();
+    numrecv = 0;
+
+    zcm_t *zcm = zcm_create("nonblock-inproc");
+    ENSURE(zcm);
+    ENSURE(zcm_subscribe(zcm, CHANNEL, handler, NULL));
+
+    ENSURE(publishText(zcm, "first") == ZCM_EOK);
+    publishBad(zcm);
+    // A good commit after a bad one clears zcm errno again
+    ENSURE(publishText(zcm, "second") == ZCM_EOK);
+    ENSURE(zcm_errno(zcm) == ZCM_EOK);
+
+    while (zcm_handle_nonblock(zcm) == ZCM_EOK) {}
+    ENSURE(numrecv == 2);
+    ENSURE(received[0] == "first");
+    ENSURE(received[1] == "second");
+
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_blocking(ZCM_PUBLISH_QUEUED);
+    test_blocking(ZCM_PUBLISH_INLINE);
+    test_nonblocking();
+    return 0;
+}
@@ -0,0 +1,190 @@
+// Tests ZCM_PUBLISH_INLINE mode: zcm_publish() hands the caller's own buffer to the
+// transport from the caller's thread and reports its result, inline sends are
+// serialized for transports that can't take them concurrently, and messages
+// published while paused are queued and still go out in order
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+#include "zcm/transport.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define CHANNEL "INLINE"
+#define FAIL_SEQ 0xfa11
+
+// A blocking transport that records what it was asked to send, and by whom
+struct RecordingTransport : public zcm_trans_t
+{
+    std::mutex lock;
+    std::vector<uint32_t> sent;
+    std::thread::id lastThread;
+    const uint8_t* lastBuf = nullptr;
+    std::atomic<int> inFlight {0};
+    std::atomic<int> overlaps {0};
+
+    static zcm_trans_methods_t methods;
+
+    RecordingTransport()
+    {
+        trans_type = ZCM_BLOCKING;
+        vtbl = &methods;
+    }
+
+    static RecordingTransport* cast(zcm_trans_t* zt) { return (RecordingTransport*) zt; }
+
+    static size_t getMtu(zcm_trans_t* zt) { return 1 << 20; }
+    static int recvmsgEnable(zcm_trans_t* zt, const char* channel, bool enable)
+    { return ZCM_EOK; }
+    static int recvmsg(zcm_trans_t* zt, zcm_msg_t* msg, int timeout)
+    {
+        usleep(timeout * 1000);
+        return ZCM_EAGAIN;
+    }
+    static int update(zcm_trans_t* zt) { return ZCM_EOK; }
+    static void destroy(zcm_trans_t* zt) {}
+
+    static int sendmsg(zcm_trans_t* zt, zcm_msg_t msg)
+    {
+        RecordingTransport* t = cast(zt);
+        if (t->inFlight++ != 0) t->overlaps++;
+
+        uint32_t seq;
+        ENSURE(msg.len == sizeof(seq));
+        memcpy(&seq, msg.buf, sizeof(seq));
+        // Give another sender the chance to barge in
+        usleep(10);
+        {
+            std::unique_lock<std::mutex> lk(t->lock);
+            t->lastThread = std::this_thread::get_id();
+            t->lastBuf = msg.buf;
+            if (seq != FAIL_SEQ) t->sent.push_back(seq);
+        }
+
+        t->inFlight--;
+        return seq == FAIL_SEQ ? ZCM_EINVALID : ZCM_EOK;
+    }
+};
+
+zcm_trans_methods_t RecordingTransport::methods = {
+    &RecordingTransport::getMtu,
+    &RecordingTransport::sendmsg,
+    &RecordingTransport::recvmsgEnable,
+    &RecordingTransport::recvmsg,
+    &RecordingTransport::update,
+    &RecordingTransport::destroy,
+    NULL, // recvmsg_loan
+    NULL, // release_loan
+    NULL, // sendmsg_batch
+    NULL, // sendmsg_concurrent
+};
+
+static void test_sends_from_caller()
+{
+    RecordingTransport trans;
+    zcm_t *zcm = zcm_create_trans(&trans);
+    ENSURE(zcm);
+    ENSURE(zcm_set_publish_mode(zcm, (enum zcm_publish_mode) 42) == ZCM_EINVALID);
+    ENSURE(zcm_set_publish_mode(zcm, ZCM_PUBLISH_INLINE) == ZCM_EOK);
+
+    for (uint32_t seq = 0; seq < 10; ++seq) {
+        ENSURE(zcm_publish(zcm, CHANNEL, (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+        // Sent by the time zcm_publish() returns, from this thread and this buffer
+        std::unique_lock<std::mutex> lk(trans.lock);
+        ENSURE(trans.sent.size() == seq + 1);
+        ENSURE(trans.sent.back() == seq);
+        ENSURE(trans.lastThread == std::this_thread::get_id());
+        ENSURE(trans.lastBuf == (const uint8_t*) &seq);
+    }
+
+    // The transport's error reaches the caller
+    uint32_t fail = FAIL_SEQ;
+    ENSURE(zcm_publish(zcm, CHANNEL, (const uint8_t*) &fail, sizeof(fail)) == ZCM_EINVALID);
+
+    zcm_stats_t stats;
+    ENSURE(zcm_get_stats(zcm, &stats) == ZCM_EOK);
+    ENSURE(stats.nchannels == 1);
+    ENSURE(stats.channels[0].msgs_out == 10);
+    ENSURE(stats.channels[0].drops[ZCM_DROP_SEND_FAILED] == 1);
+    zcm_free_stats(&stats);
+
+    zcm_destroy(zcm);
+}
+
+static void test_paused_keeps_order()
+{
+    RecordingTransport trans;
+    zcm_t *zcm = zcm_create_trans(&trans);
+    ENSURE(zcm);
+    ENSURE(zcm_set_publish_mode(zcm, ZCM_PUBLISH_INLINE) == ZCM_EOK);
+    zcm_set_queue_size(zcm, 100);
+
+    uint32_t seq = 0;
+    zcm_pause(zcm);
+    for (; seq < 5; ++seq)
+        ENSURE(zcm_publish(zcm, CHANNEL, (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+    // Queued, not sent
+    usleep(10000);
+    {
+        std::unique_lock<std::mutex> lk(trans.lock);
+        ENSURE(trans.sent.empty());
+    }
+    zcm_resume(zcm);
+
+    for (; seq < 10; ++seq)
+        ENSURE(zcm_publish(zcm, CHANNEL, (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+    zcm_flush(zcm);
+
+    std::vector<uint32_t> expected;
+    for (uint32_t i = 0; i < 10; ++i) expected.push_back(i);
+    ENSURE(trans.sent == expected);
+
+    zcm_destroy(zcm);
+}
+
+static void test_serialized_for_transport()
+{
+    const int NTHREADS = 4;
+    const uint32_t NMSGS = 200;
+
+    RecordingTransport trans;
+    zcm_t *zcm = zcm_create_trans(&trans);
+    ENSURE(zcm);
+    ENSURE(zcm_set_publish_mode(zcm, ZCM_PUBLISH_INLINE) == ZCM_EOK);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < NTHREADS; ++t) {
+        threads.emplace_back([zcm, t, NMSGS]() {
+            for (uint32_t i = 0; i < NMSGS; ++i) {
+                uint32_t seq = t * NMSGS + i;
+                ENSURE(zcm_publish(zcm, CHANNEL, (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    // The transport doesn't claim sendmsg_concurrent(), so it never saw two at once
+    ENSURE(trans.overlaps == 0);
+    ENSURE(trans.sent.size() == NTHREADS * NMSGS);
+
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_sends_from_caller();
+    test_paused_keeps_order();
+    test_serialized_for_transport();
+    return 0;
+}
@@ -0,0 +1,182 @@
+// Tests changing subscriptions while messages are being dispatched: from inside
+// callbacks (which must neither deadlock nor be called again once unsubscribed)
+// and from other threads, with one and with several dispatch threads
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define URL "block-inproc"
+#define NUM_MSGS 50
+
+static void publishN(zcm_t *zcm, const char *channel, int n)
+{
+    uint8_t data = 0;
+    for (int i = 0; i < n; ++i) ENSURE(zcm_publish(zcm, channel, &data, 1) == ZCM_EOK);
+}
+
+static void waitFor(std::atomic<int>& count, int n)
+{
+    for (int i = 0; i < 2000 && count < n; ++i) usleep(1000);
+}
+
+struct SelfUnsub
+{
+    zcm_t *zcm;
+    zcm_sub_t *sub;
+    std::atomic<int> calls {0};
+    std::atomic<bool> unsubscribed {false};
+};
+
+static void selfUnsubHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    SelfUnsub *s = (SelfUnsub*) usr;
+    ENSURE(!s->unsubscribed);
+    if (++s->calls == 3) {
+        ENSURE(zcm_unsubscribe(s->zcm, s->sub) == ZCM_EOK);
+        s->unsubscribed = true;
+    }
+}
+
+static void countHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    (*(std::atomic<int>*) usr)++;
+}
+
+// A callback that unsubscribes itself is never called again, and the other
+// subscriptions of the channel keep getting every message
+static void test_unsub_self(uint32_t nthreads)
+{
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    ENSURE(zcm_set_dispatch_threads(zcm, nthreads) == ZCM_EOK);
+    zcm_set_queue_size(zcm, 2 * NUM_MSGS);
+
+    SelfUnsub s;
+    s.zcm = zcm;
+    s.sub = zcm_subscribe(zcm, "SELF", selfUnsubHandler, &s);
+    ENSURE(s.sub);
+    std::atomic<int> others {0};
+    ENSURE(zcm_subscribe(zcm, "SELF", countHandler, &others));
+
+    zcm_start(zcm);
+    publishN(zcm, "SELF", NUM_MSGS);
+    waitFor(others, NUM_MSGS);
+    zcm_stop(zcm);
+
+    ENSURE(others == NUM_MSGS);
+    ENSURE(s.calls == 3);
+    zcm_destroy(zcm);
+}
+
+struct LateSub
+{
+    zcm_t *zcm;
+    std::atomic<bool> subscribed {false};
+    std::atomic<int> late {0};
+};
+
+static void subscribingHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    LateSub *s = (LateSub*) usr;
+    if (s->subscribed) return;
+    ENSURE(zcm_subscribe(s->zcm, "LATE", countHandler, &s->late));
+    s->subscribed = true;
+}
+
+// A subscription made from a callback sees the messages published after it
+static void test_sub_in_callback(uint32_t nthreads)
+{
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    ENSURE(zcm_set_dispatch_threads(zcm, nthreads) == ZCM_EOK);
+    zcm_set_queue_size(zcm, 2 * NUM_MSGS);
+
+    LateSub s;
+    s.zcm = zcm;
+    ENSURE(zcm_subscribe(zcm, "TRIGGER", subscribingHandler, &s));
+
+    zcm_start(zcm);
+    publishN(zcm, "TRIGGER", 1);
+    for (int i = 0; i < 2000 && !s.subscribed; ++i) usleep(1000);
+    ENSURE(s.subscribed);
+    publishN(zcm, "LATE", NUM_MSGS);
+    waitFor(s.late, NUM_MSGS);
+    zcm_stop(zcm);
+
+    ENSURE(s.late == NUM_MSGS);
+    zcm_destroy(zcm);
+}
+
+struct Guarded
+{
+    std::atomic<bool> gone {false};
+    std::atomic<int> calls {0};
+    std::atomic<int> lateCalls {0};
+};
+
+static void guardedHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    Guarded *g = (Guarded*) usr;
+    if (g->gone) g->lateCalls++;
+    g->calls++;
+    usleep(100);
+}
+
+// Once zcm_unsubscribe() returns on another thread, the callback is done for good,
+// while subscriptions come and go under a steady stream of messages
+static void test_unsub_concurrent(uint32_t nthreads)
+{
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    ENSURE(zcm_set_dispatch_threads(zcm, nthreads) == ZCM_EOK);
+    zcm_set_queue_size(zcm, 2 * NUM_MSGS);
+    zcm_start(zcm);
+
+    std::atomic<bool> publishing {true};
+    std::thread publisher([&]() {
+        uint8_t data = 0;
+        while (publishing) {
+            // The queues may well fill up, which is fine here
+            zcm_publish(zcm, "CHURN", &data, 1);
+            usleep(50);
+        }
+    });
+
+    for (int i = 0; i < 50; ++i) {
+        Guarded g;
+        zcm_sub_t *sub = zcm_subscribe(zcm, "CHURN", guardedHandler, &g);
+        ENSURE(sub);
+        for (int j = 0; j < 1000 && g.calls == 0; ++j) usleep(100);
+        ENSURE(zcm_unsubscribe(zcm, sub) == ZCM_EOK);
+        g.gone = true;
+        usleep(500);
+        ENSURE(g.lateCalls == 0);
+    }
+
+    publishing = false;
+    publisher.join();
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    const uint32_t nthreads[] = { 1, 3 };
+    for (uint32_t n : nthreads) {
+        test_unsub_self(n);
+        test_sub_in_callback(n);
+        test_unsub_concurrent(n);
+    }
+    return 0;
+}
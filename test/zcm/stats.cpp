@@ -0,0 +1,166 @@
+// Tests zcm_get_stats(): per channel message and byte counts in every direction,
+// drops by reason, counts from publishing threads that have already exited, and
+// latency histograms that only fill up for traced messages
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+#include "zcm/transport.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+static void countHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    (*(std::atomic<int>*) usr)++;
+}
+
+// A copy of the stats of 'channel', all zeros if it had no activity
+static zcm_channel_stats_t channelStats(zcm_t *zcm, const char *channel)
+{
+    zcm_stats_t stats;
+    ENSURE(zcm_get_stats(zcm, &stats) == ZCM_EOK);
+    ENSURE(stats.utime != 0);
+    zcm_channel_stats_t ret;
+    memset(&ret, 0, sizeof(ret));
+    for (size_t i = 0; i < stats.nchannels; ++i)
+        if (stats.channels[i].channel && strcmp(stats.channels[i].channel, channel) == 0)
+            ret = stats.channels[i];
+    zcm_free_stats(&stats);
+    return ret;
+}
+
+static uint64_t latencyCount(const zcm_channel_stats_t& s)
+{
+    uint64_t n = 0;
+    for (size_t i = 0; i < ZCM_STATS_LATENCY_BUCKETS; ++i) n += s.latency_hist[i];
+    return n;
+}
+
+static void waitFor(std::atomic<int>& count, int n)
+{
+    for (int i = 0; i < 2000 && count < n; ++i) usleep(1000);
+    ENSURE(count == n);
+}
+
+static void test_counts(const char *url, bool traced)
+{
+    const int NMSGS = 20;
+    const uint32_t LEN = 100;
+
+    zcm_t *zcm = zcm_create(url);
+    ENSURE(zcm);
+    zcm_set_queue_size(zcm, 4 * NMSGS);
+    std::atomic<int> calls {0};
+    ENSURE(zcm_subscribe(zcm, "STATS_A", countHandler, &calls));
+    ENSURE(zcm_subscribe(zcm, "STATS_A", countHandler, &calls));
+    // Nobody subscribes, so only this gives the channel stats of its own
+    ENSURE(zcm_channel_intern("STATS_NOBODY") != ZCM_CHANNEL_ID_NONE);
+    zcm_start(zcm);
+
+    uint8_t data[LEN] = {0};
+    for (int i = 0; i < NMSGS; ++i) {
+        ENSURE(zcm_publish(zcm, "STATS_A", data, LEN) == ZCM_EOK);
+        ENSURE(zcm_publish(zcm, "STATS_NOBODY", data, LEN / 2) == ZCM_EOK);
+    }
+    waitFor(calls, 2 * NMSGS);
+    // Let the messages nobody wants make it through the recv thread as well
+    for (int i = 0; i < 2000; ++i) {
+        if (channelStats(zcm, "STATS_NOBODY").msgs_in == NMSGS) break;
+        usleep(1000);
+    }
+
+    zcm_channel_stats_t a = channelStats(zcm, "STATS_A");
+    ENSURE(a.msgs_out == NMSGS);
+    ENSURE(a.bytes_out == NMSGS * LEN);
+    ENSURE(a.msgs_in == NMSGS);
+    ENSURE(a.bytes_in == NMSGS * LEN);
+    ENSURE(a.msgs_dispatched == 2 * NMSGS); // Two subscriptions
+    ENSURE(a.queue_high_water >= 1);
+    for (size_t r = 0; r < ZCM_DROP_NUM_REASONS; ++r) ENSURE(a.drops[r] == 0);
+    ENSURE(latencyCount(a) == (traced ? a.msgs_dispatched : 0));
+
+    zcm_channel_stats_t nobody = channelStats(zcm, "STATS_NOBODY");
+    ENSURE(nobody.msgs_out == NMSGS);
+    ENSURE(nobody.bytes_out == NMSGS * LEN / 2);
+    ENSURE(nobody.msgs_in == NMSGS);
+    ENSURE(nobody.msgs_dispatched == 0);
+    ENSURE(nobody.drops[ZCM_DROP_NO_SUBSCRIBER] == NMSGS);
+
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+}
+
+static void test_send_queue_full()
+{
+    zcm_t *zcm = zcm_create("block-inproc");
+    ENSURE(zcm);
+    zcm_set_queue_size(zcm, 4);
+    ENSURE(zcm_channel_intern("STATS_FULL") != ZCM_CHANNEL_ID_NONE);
+    // While paused, nothing leaves the send queue
+    zcm_pause(zcm);
+
+    uint8_t data = 0;
+    int accepted = 0;
+    for (int i = 0; i < 10; ++i)
+        if (zcm_publish(zcm, "STATS_FULL", &data, 1) == ZCM_EOK) ++accepted;
+    ENSURE(accepted < 10);
+
+    zcm_channel_stats_t s = channelStats(zcm, "STATS_FULL");
+    ENSURE(s.msgs_out == (uint64_t) accepted);
+    ENSURE(s.drops[ZCM_DROP_SEND_QUEUE_FULL] == (uint64_t) (10 - accepted));
+
+    zcm_stats_t stats;
+    ENSURE(zcm_get_stats(zcm, &stats) == ZCM_EOK);
+    ENSURE(stats.send_queue_high_water == (uint64_t) accepted);
+    zcm_free_stats(&stats);
+
+    zcm_resume(zcm);
+    zcm_destroy(zcm);
+}
+
+// What threads counted is kept after they exit, however many come and go
+static void test_short_lived_threads()
+{
+    const int NTHREADS = 100;
+    const int NMSGS = 5;
+
+    zcm_t *zcm = zcm_create("block-inproc");
+    ENSURE(zcm);
+    zcm_set_queue_size(zcm, 2 * NTHREADS * NMSGS);
+    ENSURE(zcm_channel_intern("STATS_THREADS") != ZCM_CHANNEL_ID_NONE);
+    zcm_pause(zcm);
+
+    for (int t = 0; t < NTHREADS; ++t) {
+        std::thread thr([zcm]() {
+            uint8_t data = 0;
+            for (int i = 0; i < NMSGS; ++i)
+                ENSURE(zcm_publish(zcm, "STATS_THREADS", &data, 1) == ZCM_EOK);
+        });
+        thr.join();
+    }
+
+    ENSURE(channelStats(zcm, "STATS_THREADS").msgs_out == NTHREADS * NMSGS);
+
+    zcm_resume(zcm);
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_counts("block-inproc", false);
+    test_counts("block-inproc://?trace=true", true);
+    test_send_queue_full();
+    test_short_lived_threads();
+    return 0;
+}
@@ -0,0 +1,141 @@
+// Tests subscriptions that only keep the newest message (zcm_subscribe_latest()):
+// while the callback is stuck, each channel's messages replace each other and only
+// the last one of each channel is dispatched afterwards
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define URL "block-inproc"
+#define BURST 5
+
+struct Slow
+{
+    std::atomic<bool> entered {false};
+    std::atomic<bool> release {false};
+    std::vector<std::string> got; // "<channel>:<seq>"
+    std::atomic<size_t> count {0};
+};
+
+static void slowHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    Slow *s = (Slow*) usr;
+    uint32_t seq;
+    ENSURE(rbuf->data_size == sizeof(seq));
+    memcpy(&seq, rbuf->data, sizeof(seq));
+    s->got.push_back(std::string(channel) + ":" + std::to_string(seq));
+    s->count++;
+
+    // Hold on to the first message until the test lets go
+    s->entered = true;
+    while (!s->release) usleep(1000);
+}
+
+static void countHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    (*(std::atomic<int>*) usr)++;
+}
+
+static uint64_t channelStat(zcm_t *zcm, const char *channel, bool drops)
+{
+    zcm_stats_t stats;
+    ENSURE(zcm_get_stats(zcm, &stats) == ZCM_EOK);
+    uint64_t ret = 0;
+    for (size_t i = 0; i < stats.nchannels; ++i) {
+        if (!stats.channels[i].channel || strcmp(stats.channels[i].channel, channel) != 0)
+            continue;
+        ret = drops ? stats.channels[i].drops[ZCM_DROP_SUB_QUEUE] : stats.channels[i].msgs_in;
+    }
+    zcm_free_stats(&stats);
+    return ret;
+}
+
+static void publishSeq(zcm_t *zcm, const char *channel, uint32_t seq)
+{
+    ENSURE(zcm_publish(zcm, channel, (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+}
+
+// Gets the callback stuck on a first message of channels[0], then publishes
+// BURST messages on each channel, interleaved, and lets the callback go again
+static std::vector<std::string> runBurst(const char *subChannel,
+                                         const std::vector<const char*>& channels)
+{
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    zcm_set_queue_size(zcm, 4 * BURST * channels.size());
+
+    Slow slow;
+    ENSURE(zcm_subscribe_latest(zcm, subChannel, slowHandler, &slow));
+    std::atomic<int> fast {0};
+    ENSURE(zcm_subscribe(zcm, "FAST", countHandler, &fast));
+
+    zcm_start(zcm);
+
+    publishSeq(zcm, channels[0], 0);
+    for (int i = 0; i < 2000 && !slow.entered; ++i) usleep(1000);
+    ENSURE(slow.entered);
+
+    for (uint32_t seq = 1; seq <= BURST; ++seq)
+        for (const char *c : channels) publishSeq(zcm, c, seq);
+    // The recv thread handles messages in order, so once it has seen this one
+    // it is done with the burst
+    publishSeq(zcm, "FAST", 0);
+    for (int i = 0; i < 2000 && channelStat(zcm, "FAST", false) == 0; ++i) usleep(1000);
+    ENSURE(channelStat(zcm, "FAST", false) == 1);
+
+    slow.release = true;
+    for (int i = 0; i < 2000 && (slow.count < channels.size() + 1 || fast == 0); ++i)
+        usleep(1000);
+    // Give anything that shouldn't be there a chance to show up
+    usleep(20000);
+
+    // Every message of the burst but the last of each channel was replaced
+    for (const char *c : channels)
+        ENSURE(channelStat(zcm, c, true) == BURST - 1);
+
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+
+    ENSURE(fast == 1);
+    return slow.got;
+}
+
+static void test_single_channel()
+{
+    std::vector<std::string> got = runBurst("LATEST", { "LATEST" });
+    std::vector<std::string> expected = { "LATEST:0", "LATEST:" + std::to_string(BURST) };
+    ENSURE(got == expected);
+}
+
+// A regex subscription keeps the newest message of each channel it matches,
+// dispatched in the order the channels first became pending
+static void test_regex_channels()
+{
+    std::vector<std::string> got = runBurst("LATEST_.*", { "LATEST_A", "LATEST_B", "LATEST_C" });
+    std::vector<std::string> expected = {
+        "LATEST_A:0",
+        "LATEST_A:" + std::to_string(BURST),
+        "LATEST_B:" + std::to_string(BURST),
+        "LATEST_C:" + std::to_string(BURST),
+    };
+    ENSURE(got == expected);
+}
+
+int main()
+{
+    test_single_channel();
+    test_regex_channels();
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Tests subscriptions with a queue of their own (zcm_subscribe_queued()): while the
+// callback is stuck, the subscription's queue overflows as its policy says and the
+// messages that survive are dispatched in order afterwards
+#include <atomic>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define URL "block-inproc"
+#define DEPTH 3
+#define BURST 10
+
+struct Slow
+{
+    std::atomic<bool> entered {false};
+    std::atomic<bool> release {false};
+    std::vector<uint32_t> seqs;
+    std::atomic<size_t> count {0};
+};
+
+static void slowHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    Slow *s = (Slow*) usr;
+    uint32_t seq;
+    ENSURE(rbuf->data_size == sizeof(seq));
+    memcpy(&seq, rbuf->data, sizeof(seq));
+    s->seqs.push_back(seq);
+    s->count++;
+
+    // Hold on to the first message until the test lets go
+    s->entered = true;
+    while (!s->release) usleep(1000);
+}
+
+static void countHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    (*(std::atomic<int>*) usr)++;
+}
+
+static uint64_t channelStat(zcm_t *zcm, const char *channel, bool drops)
+{
+    zcm_stats_t stats;
+    ENSURE(zcm_get_stats(zcm, &stats) == ZCM_EOK);
+    uint64_t ret = 0;
+    for (size_t i = 0; i < stats.nchannels; ++i) {
+        if (!stats.channels[i].channel || strcmp(stats.channels[i].channel, channel) != 0)
+            continue;
+        ret = drops ? stats.channels[i].drops[ZCM_DROP_SUB_QUEUE] : stats.channels[i].msgs_in;
+    }
+    zcm_free_stats(&stats);
+    return ret;
+}
+
+// Publishes message 0, waits for the callback to get stuck on it, then publishes
+// BURST more and waits until the recv thread has handled all of them
+static std::vector<uint32_t> runBurst(enum zcm_queue_policy policy, uint64_t& drops)
+{
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    zcm_set_queue_size(zcm, 4 * BURST);
+
+    Slow slow;
+    ENSURE(zcm_subscribe_queued(zcm, "SLOW", slowHandler, &slow, DEPTH, policy));
+    std::atomic<int> fast {0};
+    ENSURE(zcm_subscribe(zcm, "FAST", countHandler, &fast));
+
+    zcm_start(zcm);
+
+    uint32_t seq = 0;
+    ENSURE(zcm_publish(zcm, "SLOW", (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+    for (int i = 0; i < 2000 && !slow.entered; ++i) usleep(1000);
+    ENSURE(slow.entered);
+
+    for (seq = 1; seq <= BURST; ++seq)
+        ENSURE(zcm_publish(zcm, "SLOW", (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+    // The recv thread handles messages in order, so once it has seen this one it
+    // is done with the burst. With ZCM_QUEUE_BLOCK it can't get this far.
+    ENSURE(zcm_publish(zcm, "FAST", (const uint8_t*) &seq, sizeof(seq)) == ZCM_EOK);
+    if (policy != ZCM_QUEUE_BLOCK) {
+        for (int i = 0; i < 2000 && channelStat(zcm, "FAST", false) == 0; ++i) usleep(1000);
+        ENSURE(channelStat(zcm, "FAST", false) == 1);
+    } else {
+        usleep(50000);
+        ENSURE(channelStat(zcm, "FAST", false) == 0);
+    }
+
+    slow.release = true;
+    size_t expected = policy == ZCM_QUEUE_BLOCK ? BURST + 1 : DEPTH + 1;
+    for (int i = 0; i < 2000 && (slow.count < expected || fast == 0); ++i) usleep(1000);
+    drops = channelStat(zcm, "SLOW", true);
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+
+    ENSURE(fast == 1);
+    return slow.seqs;
+}
+
+static void test_drop_oldest()
+{
+    uint64_t drops;
+    std::vector<uint32_t> seqs = runBurst(ZCM_QUEUE_DROP_OLDEST, drops);
+    // The one being handled, then the last DEPTH of the burst
+    std::vector<uint32_t> expected = { 0 };
+    for (uint32_t i = BURST - DEPTH + 1; i <= BURST; ++i) expected.push_back(i);
+    ENSURE(seqs == expected);
+    ENSURE(drops == BURST - DEPTH);
+}
+
+static void test_drop_newest()
+{
+    uint64_t drops;
+    std::vector<uint32_t> seqs = runBurst(ZCM_QUEUE_DROP_NEWEST, drops);
+    // The one being handled, then the first DEPTH of the burst
+    std::vector<uint32_t> expected = { 0 };
+    for (uint32_t i = 1; i <= DEPTH; ++i) expected.push_back(i);
+    ENSURE(seqs == expected);
+    ENSURE(drops == BURST - DEPTH);
+}
+
+static void test_block()
+{
+    uint64_t drops;
+    std::vector<uint32_t> seqs = runBurst(ZCM_QUEUE_BLOCK, drops);
+    ENSURE(seqs.size() == BURST + 1);
+    for (uint32_t i = 0; i <= BURST; ++i) ENSURE(seqs[i] == i);
+    ENSURE(drops == 0);
+}
+
+static void test_invalid()
+{
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    ENSURE(!zcm_subscribe_queued(zcm, "SLOW", countHandler, NULL, 0, ZCM_QUEUE_BLOCK));
+    ENSURE(!zcm_subscribe_queued(zcm, "SLOW", countHandler, NULL, 1, (enum zcm_queue_policy) 42));
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_drop_oldest();
+    test_drop_newest();
+    test_block();
+    test_invalid();
+    return 0;
+}
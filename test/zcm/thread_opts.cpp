@@ -0,0 +1,198 @@
+// Tests the options of the internal threads (zcm_set_thread_opts() and the url
+// options): bad options are rejected, url options show up in zcm_get_thread_opts(),
+// and the running threads get the names and CPU affinity they were given
+#include <atomic>
+#include <set>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define CHANNEL "THREADS"
+
+static zcm_thread_opts_t makeOpts(int32_t cpu, const char *name)
+{
+    zcm_thread_opts_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.cpu = cpu;
+    opts.ncpus = 1;
+    opts.policy = ZCM_SCHED_DEFAULT;
+    snprintf(opts.name, sizeof(opts.name), "%s", name);
+    return opts;
+}
+
+// The names of all threads of this process
+static std::set<std::string> threadNames()
+{
+    std::set<std::string> names;
+    DIR *dir = opendir("/proc/self/task");
+    ENSURE(dir);
+    while (struct dirent *ent = readdir(dir)) {
+        if (ent->d_name[0] == '.') continue;
+        std::string path = std::string("/proc/self/task/") + ent->d_name + "/comm";
+        FILE *f = fopen(path.c_str(), "r");
+        if (!f) continue;
+        char name[32] = {0};
+        if (fgets(name, sizeof(name), f)) {
+            name[strcspn(name, "\n")] = '\0';
+            names.insert(name);
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    return names;
+}
+
+static void test_validation()
+{
+    zcm_t *zcm = zcm_create("block-inproc");
+    ENSURE(zcm);
+
+    zcm_thread_opts_t opts;
+    ENSURE(zcm_get_thread_opts(zcm, ZCM_THREAD_RECV, &opts) == ZCM_EOK);
+    ENSURE(opts.cpu == -1);
+    ENSURE(opts.policy == ZCM_SCHED_DEFAULT);
+    ENSURE(opts.name[0] == '\0');
+    ENSURE(zcm_get_thread_opts(zcm, (enum zcm_thread) 42, &opts) == ZCM_EINVALID);
+
+    opts = makeOpts(0, "ok");
+    ENSURE(zcm_set_thread_opts(zcm, (enum zcm_thread) 42, &opts) == ZCM_EINVALID);
+    opts = makeOpts(-2, "");
+    ENSURE(zcm_set_thread_opts(zcm, ZCM_THREAD_RECV, &opts) == ZCM_EINVALID);
+    opts = makeOpts(-1, "");
+    memset(opts.name, 'x', sizeof(opts.name));
+    ENSURE(zcm_set_thread_opts(zcm, ZCM_THREAD_RECV, &opts) == ZCM_EINVALID);
+    opts = makeOpts(-1, "");
+    opts.policy = ZCM_SCHED_FIFO;
+    opts.priority = 0;
+    ENSURE(zcm_set_thread_opts(zcm, ZCM_THREAD_RECV, &opts) == ZCM_EINVALID);
+
+    // Nothing bad stuck
+    ENSURE(zcm_get_thread_opts(zcm, ZCM_THREAD_RECV, &opts) == ZCM_EOK);
+    ENSURE(opts.cpu == -1);
+    ENSURE(opts.policy == ZCM_SCHED_DEFAULT);
+
+    zcm_destroy(zcm);
+}
+
+static void test_url_opts()
+{
+    zcm_t *zcm = zcm_create("block-inproc://?recv_name=url-recv&dispatch_cpu=0-0"
+                            "&sched=rr:10&send_sched=default&send_cpu=bogus");
+    ENSURE(zcm);
+
+    zcm_thread_opts_t opts;
+    ENSURE(zcm_get_thread_opts(zcm, ZCM_THREAD_RECV, &opts) == ZCM_EOK);
+    ENSURE(strcmp(opts.name, "url-recv") == 0);
+    ENSURE(opts.cpu == -1);
+    ENSURE(opts.policy == ZCM_SCHED_RR);
+    ENSURE(opts.priority == 10);
+
+    ENSURE(zcm_get_thread_opts(zcm, ZCM_THREAD_DISPATCH, &opts) == ZCM_EOK);
+    ENSURE(opts.cpu == 0);
+    ENSURE(opts.ncpus == 1);
+    ENSURE(opts.policy == ZCM_SCHED_RR);
+
+    // "<thread>_sched" wins over "sched", and a bad option is ignored
+    ENSURE(zcm_get_thread_opts(zcm, ZCM_THREAD_SEND, &opts) == ZCM_EOK);
+    ENSURE(opts.policy == ZCM_SCHED_DEFAULT);
+    ENSURE(opts.cpu == -1);
+
+    zcm_destroy(zcm);
+}
+
+struct Seen
+{
+    pthread_mutex_t lock;
+    std::set<std::string> names;
+    bool pinned;
+    std::atomic<int> calls;
+};
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    Seen *s = (Seen*) usr;
+    char name[16];
+    ENSURE(pthread_getname_np(pthread_self(), name, sizeof(name)) == 0);
+
+    cpu_set_t cpus;
+    ENSURE(pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0);
+    bool pinned = CPU_COUNT(&cpus) == 1 && CPU_ISSET(0, &cpus);
+
+    pthread_mutex_lock(&s->lock);
+    s->names.insert(name);
+    if (!pinned) s->pinned = false;
+    pthread_mutex_unlock(&s->lock);
+    s->calls++;
+}
+
+static void test_running_threads()
+{
+    const int NTHREADS = 3;
+    const int NMSGS = 300;
+
+    zcm_t *zcm = zcm_create("block-inproc");
+    ENSURE(zcm);
+    ENSURE(zcm_set_dispatch_threads(zcm, NTHREADS) == ZCM_EOK);
+    zcm_set_queue_size(zcm, 2 * NMSGS);
+
+    zcm_thread_opts_t opts = makeOpts(-1, "t-recv");
+    ENSURE(zcm_set_thread_opts(zcm, ZCM_THREAD_RECV, &opts) == ZCM_EOK);
+    opts = makeOpts(0, "t-dispatch");
+    ENSURE(zcm_set_thread_opts(zcm, ZCM_THREAD_DISPATCH, &opts) == ZCM_EOK);
+
+    // Spread over enough channels that every thread of the pool gets some
+    Seen seen;
+    pthread_mutex_init(&seen.lock, NULL);
+    seen.pinned = true;
+    seen.calls = 0;
+    std::string channels[16];
+    for (int i = 0; i < 16; ++i) {
+        channels[i] = CHANNEL + std::to_string(i);
+        ENSURE(zcm_subscribe(zcm, channels[i].c_str(), handler, &seen));
+    }
+
+    zcm_start(zcm);
+    uint8_t data = 0;
+    for (int i = 0; i < NMSGS; ++i) {
+        const char *channel = channels[i % 16].c_str();
+        ENSURE(zcm_publish(zcm, channel, &data, 1) == ZCM_EOK);
+    }
+    for (int i = 0; i < 2000 && seen.calls < NMSGS; ++i) usleep(1000);
+    ENSURE(seen.calls == NMSGS);
+
+    std::set<std::string> names = threadNames();
+    ENSURE(names.count("t-recv"));
+    ENSURE(names.count("zcm-send"));
+    ENSURE(names.count("t-dispatch"));
+    ENSURE(names.count("t-dispatch-1"));
+    ENSURE(names.count("t-dispatch-2"));
+    // The callbacks ran on the dispatch threads, which were all pinned to CPU 0
+    for (auto& n : seen.names) ENSURE(n.compare(0, 10, "t-dispatch") == 0);
+    ENSURE(seen.names.size() > 1);
+    ENSURE(seen.pinned);
+
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+    pthread_mutex_destroy(&seen.lock);
+}
+
+int main()
+{
+    test_validation();
+    test_url_opts();
+    test_running_threads();
+    return 0;
+}
@@ -0,0 +1,206 @@
+// Tests tracing (the url option trace=true): traced messages arrive over inproc,
+// udpm (including fragmented ones) and the generic serial transport with their
+// payload intact, the publisher's utime and increasing sequence numbers, while
+// untraced senders still get through with no trace
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+#include "util/TimeUtil.hpp"
+#include "zcm/transport/generic_serial_transport.h"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define UDPM_URL "udpm://239.255.76.67:7667?ttl=0"
+
+struct Received
+{
+    std::string channel;
+    std::vector<uint8_t> data;
+    uint64_t recv_utime;
+    uint64_t trace_utime;
+    uint32_t trace_seqno;
+};
+
+static std::mutex receivedLock;
+static std::vector<Received> received;
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    std::unique_lock<std::mutex> lk(receivedLock);
+    received.push_back({ channel, std::vector<uint8_t>(rbuf->data, rbuf->data + rbuf->data_size),
+                         (uint64_t) rbuf->recv_utime, rbuf->trace_utime, rbuf->trace_seqno });
+}
+
+static size_t numReceived()
+{
+    std::unique_lock<std::mutex> lk(receivedLock);
+    return received.size();
+}
+
+static void waitFor(size_t n)
+{
+    for (int i = 0; i < 2000 && numReceived() < n; ++i) usleep(1000);
+    ENSURE(numReceived() == n);
+}
+
+static std::vector<uint8_t> payload(size_t len, uint8_t seed)
+{
+    std::vector<uint8_t> d(len);
+    for (size_t i = 0; i < len; ++i) d[i] = (uint8_t) (seed + i * 7);
+    return d;
+}
+
+// Traced messages from one sender carry increasing sequence numbers and a publish
+// time no later than their receive time
+static void ensureTraced(const std::vector<Received>& msgs, uint64_t before)
+{
+    for (size_t i = 0; i < msgs.size(); ++i) {
+        ENSURE(msgs[i].trace_utime >= before);
+        ENSURE(msgs[i].trace_utime <= msgs[i].recv_utime);
+        if (i > 0) ENSURE(msgs[i].trace_seqno > msgs[i - 1].trace_seqno);
+    }
+}
+
+static void test_inproc()
+{
+    received.clear();
+    zcm_t *zcm = zcm_create("block-inproc://?trace=true");
+    ENSURE(zcm);
+    ENSURE(zcm_subscribe(zcm, "TRACE", handler, NULL));
+    zcm_start(zcm);
+
+    uint64_t before = TimeUtil::utime();
+    for (uint8_t i = 0; i < 5; ++i) {
+        std::vector<uint8_t> d = payload(10, i);
+        ENSURE(zcm_publish(zcm, "TRACE", d.data(), d.size()) == ZCM_EOK);
+    }
+    waitFor(5);
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+
+    for (uint8_t i = 0; i < 5; ++i) ENSURE(received[i].data == payload(10, i));
+    ensureTraced(received, before);
+}
+
+static void test_udpm()
+{
+    received.clear();
+    zcm_t *rx = zcm_create(UDPM_URL);
+    zcm_t *traced = zcm_create(UDPM_URL "&trace=true");
+    zcm_t *plain = zcm_create(UDPM_URL);
+    ENSURE(rx && traced && plain);
+    ENSURE(zcm_subscribe(rx, "TRACED", handler, NULL));
+    ENSURE(zcm_subscribe(rx, "PLAIN", handler, NULL));
+    zcm_start(rx);
+
+    // Small ones, and ones that need fragmenting
+    const size_t lens[] = { 10, 70000, 10, 100000 };
+    uint64_t before = TimeUtil::utime();
+    for (size_t i = 0; i < 4; ++i) {
+        std::vector<uint8_t> d = payload(lens[i], i);
+        ENSURE(zcm_publish(traced, "TRACED", d.data(), d.size()) == ZCM_EOK);
+        zcm_flush(traced);
+        ENSURE(zcm_publish(plain, "PLAIN", d.data(), d.size()) == ZCM_EOK);
+        zcm_flush(plain);
+        waitFor(2 * (i + 1));
+    }
+
+    zcm_stop(rx);
+    zcm_destroy(plain);
+    zcm_destroy(traced);
+    zcm_destroy(rx);
+
+    std::vector<Received> tracedMsgs;
+    for (size_t i = 0; i < received.size(); ++i) {
+        const Received& r = received[i];
+        ENSURE(r.data == payload(lens[i / 2], i / 2));
+        if (r.channel == "TRACED") {
+            tracedMsgs.push_back(r);
+        } else {
+            ENSURE(r.trace_utime == 0);
+            ENSURE(r.trace_seqno == 0);
+        }
+    }
+    ENSURE(tracedMsgs.size() == 4);
+    ensureTraced(tracedMsgs, before);
+}
+
+// A loopback wire for the generic serial transport
+static uint8_t wire[8192];
+static size_t wireHead = 0, wireTail = 0;
+
+static size_t wirePut(const uint8_t *data, size_t n, void *usr)
+{
+    if (n > sizeof(wire) - wireHead) n = sizeof(wire) - wireHead;
+    memcpy(wire + wireHead, data, n);
+    wireHead += n;
+    return n;
+}
+
+static size_t wireGet(uint8_t *data, size_t n, void *usr)
+{
+    if (n > wireHead - wireTail) n = wireHead - wireTail;
+    memcpy(data, wire + wireTail, n);
+    wireTail += n;
+    if (wireTail == wireHead) wireHead = wireTail = 0;
+    return n;
+}
+
+#define SERIAL_NOW 123456
+
+static uint64_t serialNow(void *usr) { return SERIAL_NOW; }
+
+static void test_serial()
+{
+    received.clear();
+    zcm_trans_t *zt = zcm_trans_generic_serial_create(wireGet, wirePut, NULL,
+                                                      serialNow, NULL, 256, 1024);
+    ENSURE(zt);
+    zcm_t *zcm = zcm_create_trans(zt);
+    ENSURE(zcm);
+    ENSURE(zcm_subscribe(zcm, "SERIAL", handler, NULL));
+
+    // Includes the bytes that need escaping on the wire
+    std::vector<uint8_t> d = { 0xcc, 0x00, 0x01, 0xcc, 0xcc, 0x42 };
+
+    ENSURE(zcm_publish(zcm, "SERIAL", d.data(), d.size()) == ZCM_EOK);
+    zcm_trans_generic_serial_set_trace(zt, true);
+    ENSURE(zcm_publish(zcm, "SERIAL", d.data(), d.size()) == ZCM_EOK);
+    ENSURE(zcm_publish(zcm, "SERIAL", d.data(), d.size() - 1) == ZCM_EOK);
+    zcm_trans_generic_serial_set_trace(zt, false);
+    ENSURE(zcm_publish(zcm, "SERIAL", d.data(), d.size()) == ZCM_EOK);
+    for (int i = 0; i < 20; ++i) zcm_handle_nonblock(zcm);
+    zcm_destroy(zcm);
+
+    ENSURE(received.size() == 4);
+    ENSURE(received[0].data == d);
+    ENSURE(received[0].trace_utime == 0);
+    // Nonblocking publishes don't know the time, so the sender's clock stamps them
+    ENSURE(received[1].data == d);
+    ENSURE(received[1].trace_utime == SERIAL_NOW);
+    ENSURE(received[2].data == std::vector<uint8_t>(d.begin(), d.end() - 1));
+    ENSURE(received[2].trace_utime == SERIAL_NOW);
+    ENSURE(received[2].trace_seqno > received[1].trace_seqno);
+    ENSURE(received[3].data == d);
+    ENSURE(received[3].trace_utime == 0);
+}
+
+int main()
+{
+    test_inproc();
+    test_udpm();
+    test_serial();
+    return 0;
+}
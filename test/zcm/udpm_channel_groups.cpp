@@ -0,0 +1,221 @@
+// Tests udpm channel groups (the url option channel_groups=N): each channel goes to
+// the group its name hashes onto, receivers only get the groups of the channels they
+// subscribe to (so the kernel drops the rest before zcm ever sees it), leaving a
+// group on unsubscribe, and group ranges that would leave the multicast scope of the
+// url's address are refused
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+#include "udpm_packets.hpp"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define NGROUPS 8
+#define URL UDPM_TEST_URL "&channel_groups=8"
+
+// The group a channel is sent to: every process has to agree on it, so it's
+// FNV-1a of the name over groups 1 .. NGROUPS past the url's address
+static uint32_t groupOf(const char *channel)
+{
+    uint32_t hash = 2166136261u;
+    for (const char *c = channel; *c; ++c) {
+        hash ^= (uint8_t) *c;
+        hash *= 16777619u;
+    }
+    return hash % NGROUPS;
+}
+
+static std::string groupAddr(const char *channel)
+{
+    struct in_addr base;
+    inet_aton(UDPM_TEST_ADDR, &base);
+    struct in_addr group;
+    group.s_addr = htonl(ntohl(base.s_addr) + 1 + groupOf(channel));
+    return inet_ntoa(group);
+}
+
+// Two channels in different groups, and a third for syncing up in yet another
+static const char *CHAN_A = "A";
+static const char *CHAN_B = "B";
+static const char *CHAN_SYNC = "GROUP_SYNC";
+
+static void countHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    (*(std::atomic<int>*) usr)++;
+}
+
+static uint64_t msgsIn(zcm_t *zcm, const char *channel)
+{
+    zcm_stats_t stats;
+    ENSURE(zcm_get_stats(zcm, &stats) == ZCM_EOK);
+    uint64_t n = 0;
+    for (size_t i = 0; i < stats.nchannels; ++i)
+        if (stats.channels[i].channel && strcmp(stats.channels[i].channel, channel) == 0)
+            n = stats.channels[i].msgs_in;
+    zcm_free_stats(&stats);
+    return n;
+}
+
+static void waitFor(std::atomic<int>& count, int n)
+{
+    for (int i = 0; i < 2000 && count < n; ++i) usleep(1000);
+    ENSURE(count == n);
+}
+
+static void test_delivery()
+{
+    ENSURE(groupOf(CHAN_A) != groupOf(CHAN_B));
+    ENSURE(groupOf(CHAN_SYNC) != groupOf(CHAN_A) && groupOf(CHAN_SYNC) != groupOf(CHAN_B));
+
+    zcm_t *ra = zcm_create(URL);
+    zcm_t *rall = zcm_create(URL);
+    zcm_t *tx = zcm_create(URL);
+    ENSURE(ra && rall && tx);
+
+    std::atomic<int> gotA {0}, syncs {0}, gotAll {0};
+    zcm_sub_t *subA = zcm_subscribe(ra, CHAN_A, countHandler, &gotA);
+    ENSURE(subA);
+    ENSURE(zcm_subscribe(ra, CHAN_SYNC, countHandler, &syncs));
+    // A pattern could match anything, so it takes every group
+    ENSURE(zcm_subscribe(rall, "A|B", countHandler, &gotAll));
+    zcm_start(ra);
+    zcm_start(rall);
+
+    // Short and fragmented messages alike; the sync goes out last, so once it's
+    // in, 'ra' has seen everything it is going to
+    std::vector<uint8_t> big(70000), small(10);
+    ENSURE(zcm_publish(tx, CHAN_A, small.data(), small.size()) == ZCM_EOK);
+    ENSURE(zcm_publish(tx, CHAN_B, small.data(), small.size()) == ZCM_EOK);
+    zcm_flush(tx);
+    ENSURE(zcm_publish(tx, CHAN_A, big.data(), big.size()) == ZCM_EOK);
+    zcm_flush(tx);
+    waitFor(gotAll, 3);
+    ENSURE(zcm_publish(tx, CHAN_B, big.data(), big.size()) == ZCM_EOK);
+    zcm_flush(tx);
+    waitFor(gotAll, 4);
+    ENSURE(zcm_publish(tx, CHAN_SYNC, small.data(), small.size()) == ZCM_EOK);
+    zcm_flush(tx);
+    waitFor(syncs, 1);
+
+    ENSURE(gotA == 2);
+    ENSURE(msgsIn(ra, CHAN_A) == 2);
+    ENSURE(msgsIn(ra, CHAN_B) == 0);
+    ENSURE(msgsIn(rall, CHAN_B) == 2);
+
+    // Unsubscribing leaves the group again
+    ENSURE(zcm_unsubscribe(ra, subA) == ZCM_EOK);
+    ENSURE(zcm_publish(tx, CHAN_A, small.data(), small.size()) == ZCM_EOK);
+    zcm_flush(tx);
+    waitFor(gotAll, 5);
+    ENSURE(zcm_publish(tx, CHAN_SYNC, small.data(), small.size()) == ZCM_EOK);
+    zcm_flush(tx);
+    waitFor(syncs, 2);
+    ENSURE(msgsIn(ra, CHAN_A) == 2);
+
+    zcm_stop(rall);
+    zcm_stop(ra);
+    zcm_destroy(tx);
+    zcm_destroy(rall);
+    zcm_destroy(ra);
+}
+
+// A plain socket that only gets what is sent to 'group'
+static int openGroupListener(const std::string& group)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    ENSURE(fd >= 0);
+    int one = 1, zero = 0;
+    ENSURE(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0);
+    ENSURE(setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &zero, sizeof(zero)) == 0);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(UDPM_TEST_PORT);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    ENSURE(bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0);
+
+    struct ip_mreq mreq;
+    inet_aton(group.c_str(), &mreq.imr_multiaddr);
+    mreq.imr_interface.s_addr = INADDR_ANY;
+    ENSURE(setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0);
+    return fd;
+}
+
+static void test_wire()
+{
+    int listener = openGroupListener(groupAddr(CHAN_A));
+    zcm_t *tx = zcm_create(URL);
+    ENSURE(tx);
+
+    uint8_t data = 0;
+    ENSURE(zcm_publish(tx, CHAN_B, &data, 1) == ZCM_EOK);
+    ENSURE(zcm_publish(tx, CHAN_A, &data, 1) == ZCM_EOK);
+    zcm_flush(tx);
+
+    // Only A's packet, an ordinary short message
+    char buf[256];
+    struct pollfd pfd = { listener, POLLIN, 0 };
+    ENSURE(poll(&pfd, 1, 2000) == 1);
+    ssize_t n = recv(listener, buf, sizeof(buf), 0);
+    ENSURE(n == 8 + 2 + 1);
+    uint32_t magic;
+    memcpy(&magic, buf, 4);
+    ENSURE(ntohl(magic) == 0x4c433032);
+    ENSURE(strcmp(buf + 8, CHAN_A) == 0);
+    ENSURE(poll(&pfd, 1, 100) == 0);
+
+    zcm_destroy(tx);
+    close(listener);
+}
+
+static void test_scope()
+{
+    struct { const char *url; bool ok; } cases[] = {
+        { "udpm://239.255.76.67:7667?ttl=0&channel_groups=16",    true  },
+        { "udpm://239.255.76.67:7667?ttl=0&channel_groups=0",     true  },
+        // Runs off the end of 239.255.0.0/16
+        { "udpm://239.255.255.250:7667?ttl=0&channel_groups=16",  false },
+        { "udpm://239.255.255.200:7667?ttl=0&channel_groups=55",  true  },
+        { "udpm://239.255.255.200:7667?ttl=0&channel_groups=56",  false },
+        // Runs off the end of 224.0.0.0/24
+        { "udpm://224.0.0.250:7667?ttl=0&channel_groups=16",      false },
+        // Not multicast at all
+        { "udpm://10.0.0.1:7667?ttl=0&channel_groups=4",          false },
+        { "udpm://239.255.76.67:7667?ttl=0&channel_groups=257",   false },
+        { "udpm://239.255.76.67:7667?ttl=0&channel_groups=-1",    false },
+        { "udpm://239.255.76.67:7667?ttl=0&channel_groups=many",  false },
+    };
+    for (auto& c : cases) {
+        zcm_t *zcm = zcm_create(c.url);
+        if (!zcm) {
+            ENSURE(!c.ok);
+            continue;
+        }
+        ENSURE(c.ok);
+        zcm_destroy(zcm);
+    }
+}
+
+int main()
+{
+    test_delivery();
+    test_wire();
+    test_scope();
+    return 0;
+}
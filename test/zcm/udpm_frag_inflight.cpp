@@ -0,0 +1,178 @@
+// Tests reassembly of many fragmented udpm messages at once: one sender can have
+// several messages in flight, two senders can use the same sequence number without
+// mixing up their fragments, and when partial messages outgrow the reassembly
+// space the one updated longest ago is dropped to make room
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+#include "udpm_packets.hpp"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define CHANNEL "INFLIGHT"
+#define DONE_CHANNEL "INFLIGHT_DONE"
+// Partial messages never time out, however slowly the test runs
+#define URL UDPM_TEST_URL "&frag_timeout=0"
+
+static std::mutex receivedLock;
+static std::vector<std::vector<uint8_t>> received;
+static bool done = false;
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    std::unique_lock<std::mutex> lk(receivedLock);
+    received.push_back(std::vector<uint8_t>(rbuf->data, rbuf->data + rbuf->data_size));
+}
+
+static void doneHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    std::unique_lock<std::mutex> lk(receivedLock);
+    done = true;
+}
+
+static bool isDone()
+{
+    std::unique_lock<std::mutex> lk(receivedLock);
+    return done;
+}
+
+static zcm_t *startReceiver()
+{
+    received.clear();
+    done = false;
+    zcm_t *rx = zcm_create(URL);
+    ENSURE(rx);
+    ENSURE(zcm_subscribe(rx, CHANNEL, handler, NULL));
+    ENSURE(zcm_subscribe(rx, DONE_CHANNEL, doneHandler, NULL));
+    zcm_start(rx);
+    return rx;
+}
+
+// Packets from one socket are read in order, so once this arrives everything 'tx'
+// sent before it has been dealt with
+static void finish(zcm_t *rx, UdpmRawSender& tx)
+{
+    ENSURE(tx.sendShort(0, DONE_CHANNEL, std::vector<uint8_t>(1)));
+    for (int i = 0; i < 2000 && !isDone(); ++i) usleep(1000);
+    ENSURE(isDone());
+    zcm_stop(rx);
+    zcm_destroy(rx);
+}
+
+static void test_interleaved()
+{
+    const uint32_t FRAG_SIZE = 100;
+    const size_t LEN = 250;
+    const uint16_t NFRAGS = 3;
+    ENSURE(UdpmRawSender::numFragments(CHANNEL, LEN, FRAG_SIZE) == NFRAGS);
+
+    zcm_t *rx = startReceiver();
+    UdpmRawSender tx;
+    ENSURE(tx.good());
+
+    // Fragment by fragment across three messages
+    std::vector<uint8_t> msgs[3];
+    for (uint32_t s = 0; s < 3; ++s) msgs[s] = udpmTestPayload(10 + s, LEN);
+    for (uint16_t f = 0; f < NFRAGS; ++f)
+        for (uint32_t s = 0; s < 3; ++s)
+            ENSURE(tx.sendFragment(10 + s, CHANNEL, msgs[s], FRAG_SIZE, f, NFRAGS));
+
+    finish(rx, tx);
+    ENSURE(received.size() == 3);
+    for (uint32_t s = 0; s < 3; ++s) ENSURE(received[s] == msgs[s]);
+}
+
+static void test_same_seqno()
+{
+    const uint32_t FRAG_SIZE = 100;
+    const size_t LEN = 250;
+    const uint16_t NFRAGS = 3;
+
+    zcm_t *rx = startReceiver();
+    UdpmRawSender a, b;
+    ENSURE(a.good() && b.good());
+
+    std::vector<uint8_t> fromA = udpmTestPayload(1, LEN);
+    std::vector<uint8_t> fromB = udpmTestPayload(2, LEN);
+    for (uint16_t f = 0; f < NFRAGS; ++f) {
+        ENSURE(a.sendFragment(20, CHANNEL, fromA, FRAG_SIZE, f, NFRAGS));
+        ENSURE(b.sendFragment(20, CHANNEL, fromB, FRAG_SIZE, NFRAGS - 1 - f, NFRAGS));
+    }
+
+    // The two sockets' packets may be read in any order, so wait for both
+    for (int i = 0; i < 2000; ++i) {
+        {
+            std::unique_lock<std::mutex> lk(receivedLock);
+            if (received.size() == 2) break;
+        }
+        usleep(1000);
+    }
+    finish(rx, a);
+    ENSURE(received.size() == 2);
+    ENSURE((received[0] == fromA && received[1] == fromB) ||
+           (received[0] == fromB && received[1] == fromA));
+}
+
+// Messages that take 6MB each, sent 100 bytes per fragment: only two of them fit
+// in the 16MB set aside for reassembly
+#define BIG_LEN (6 << 20)
+#define BIG_FRAGS 3
+
+static void sendBigFragment(UdpmRawSender& tx, uint32_t seqno, uint16_t fragNo)
+{
+    std::vector<uint8_t> d(100);
+    for (size_t i = 0; i < d.size(); ++i) d[i] = udpmTestByte(seqno, fragNo * 100 + i);
+    ENSURE(tx.sendFragmentRaw(seqno, CHANNEL, BIG_LEN, fragNo * 100, fragNo, BIG_FRAGS, d));
+}
+
+static bool isBig(const std::vector<uint8_t>& msg, uint32_t seqno)
+{
+    if (msg.size() != BIG_LEN) return false;
+    for (size_t i = 0; i < 100 * BIG_FRAGS; ++i)
+        if (msg[i] != udpmTestByte(seqno, i)) return false;
+    return true;
+}
+
+static void test_eviction()
+{
+    zcm_t *rx = startReceiver();
+    UdpmRawSender tx;
+    ENSURE(tx.good());
+
+    // 1 is started first but updated after 2, so 3 pushes out 2
+    sendBigFragment(tx, 1, 2);
+    sendBigFragment(tx, 2, 2);
+    sendBigFragment(tx, 1, 1);
+    sendBigFragment(tx, 3, 2);
+
+    // 1 and 3 complete; 2 starts over without its last fragment and never does
+    sendBigFragment(tx, 3, 1);
+    sendBigFragment(tx, 3, 0);
+    sendBigFragment(tx, 1, 0);
+    sendBigFragment(tx, 2, 1);
+    sendBigFragment(tx, 2, 0);
+
+    finish(rx, tx);
+    ENSURE(received.size() == 2);
+    ENSURE(isBig(received[0], 3));
+    ENSURE(isBig(received[1], 1));
+}
+
+int main()
+{
+    test_interleaved();
+    test_same_seqno();
+    test_eviction();
+    return 0;
+}
@@ -0,0 +1,202 @@
+// Tests reassembly of udpm messages whose fragments don't arrive neatly: fragments
+// in any order make the message, duplicates are ignored and can't stand in for a
+// missing fragment, fragments that disagree about the message throw away what was
+// collected so far, and a message whose fragments stop coming is given up on
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+#include "udpm_packets.hpp"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define CHANNEL "REORDER"
+#define SYNC_CHANNEL "REORDER_SYNC"
+#define FRAG_TIMEOUT_MS 300
+
+#define FRAG_SIZE 100
+#define LEN 250
+#define NFRAGS 3
+
+static std::mutex receivedLock;
+static std::vector<std::vector<uint8_t>> received;
+static std::atomic<int> syncs {0};
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    std::unique_lock<std::mutex> lk(receivedLock);
+    received.push_back(std::vector<uint8_t>(rbuf->data, rbuf->data + rbuf->data_size));
+}
+
+static void syncHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    syncs++;
+}
+
+static size_t numReceived()
+{
+    std::unique_lock<std::mutex> lk(receivedLock);
+    return received.size();
+}
+
+// Packets from one socket are read in order, so once this comes back everything
+// 'tx' sent before it has been dealt with
+static void sync(UdpmRawSender& tx)
+{
+    int n = syncs + 1;
+    ENSURE(tx.sendShort(0, SYNC_CHANNEL, std::vector<uint8_t>(1)));
+    for (int i = 0; i < 2000 && syncs < n; ++i) usleep(1000);
+    ENSURE(syncs == n);
+}
+
+static zcm_t *startReceiver()
+{
+    received.clear();
+    std::string url = UDPM_TEST_URL "&frag_timeout=" + std::to_string(FRAG_TIMEOUT_MS);
+    zcm_t *rx = zcm_create(url.c_str());
+    ENSURE(rx);
+    ENSURE(zcm_subscribe(rx, CHANNEL, handler, NULL));
+    ENSURE(zcm_subscribe(rx, SYNC_CHANNEL, syncHandler, NULL));
+    zcm_start(rx);
+    return rx;
+}
+
+static void stopReceiver(zcm_t *rx)
+{
+    zcm_stop(rx);
+    zcm_destroy(rx);
+}
+
+static void test_any_order()
+{
+    ENSURE(UdpmRawSender::numFragments(CHANNEL, LEN, FRAG_SIZE) == NFRAGS);
+    zcm_t *rx = startReceiver();
+    UdpmRawSender tx;
+    ENSURE(tx.good());
+
+    // Last to first, with the channel last of all and a duplicate in between
+    std::vector<uint8_t> d = udpmTestPayload(1, LEN);
+    ENSURE(tx.sendFragment(1, CHANNEL, d, FRAG_SIZE, 2, NFRAGS));
+    ENSURE(tx.sendFragment(1, CHANNEL, d, FRAG_SIZE, 1, NFRAGS));
+    ENSURE(tx.sendFragment(1, CHANNEL, d, FRAG_SIZE, 1, NFRAGS));
+    ENSURE(tx.sendFragment(1, CHANNEL, d, FRAG_SIZE, 0, NFRAGS));
+    // Repeats of a delivered message start a new one that never completes
+    ENSURE(tx.sendFragment(1, CHANNEL, d, FRAG_SIZE, 2, NFRAGS));
+    sync(tx);
+    ENSURE(numReceived() == 1);
+    ENSURE(received[0] == d);
+
+    // Middle first
+    d = udpmTestPayload(2, LEN);
+    ENSURE(tx.sendFragment(2, CHANNEL, d, FRAG_SIZE, 1, NFRAGS));
+    ENSURE(tx.sendFragment(2, CHANNEL, d, FRAG_SIZE, 0, NFRAGS));
+    ENSURE(tx.sendFragment(2, CHANNEL, d, FRAG_SIZE, 2, NFRAGS));
+    sync(tx);
+    ENSURE(numReceived() == 2);
+    ENSURE(received[1] == d);
+
+    stopReceiver(rx);
+}
+
+static void test_duplicates()
+{
+    zcm_t *rx = startReceiver();
+    UdpmRawSender tx;
+    ENSURE(tx.good());
+
+    // As many fragments as the message has, but not all different ones
+    std::vector<uint8_t> d = udpmTestPayload(3, LEN);
+    ENSURE(tx.sendFragment(3, CHANNEL, d, FRAG_SIZE, 0, NFRAGS));
+    ENSURE(tx.sendFragment(3, CHANNEL, d, FRAG_SIZE, 1, NFRAGS));
+    ENSURE(tx.sendFragment(3, CHANNEL, d, FRAG_SIZE, 0, NFRAGS));
+    sync(tx);
+    ENSURE(numReceived() == 0);
+
+    ENSURE(tx.sendFragment(3, CHANNEL, d, FRAG_SIZE, 2, NFRAGS));
+    sync(tx);
+    ENSURE(numReceived() == 1);
+    ENSURE(received[0] == d);
+
+    stopReceiver(rx);
+}
+
+static void test_mismatch()
+{
+    zcm_t *rx = startReceiver();
+    UdpmRawSender tx;
+    ENSURE(tx.good());
+
+    std::vector<uint8_t> d = udpmTestPayload(4, LEN);
+    std::vector<uint8_t> longer = udpmTestPayload(5, LEN + 1);
+    ENSURE(UdpmRawSender::numFragments(CHANNEL, longer.size(), FRAG_SIZE) == NFRAGS);
+
+    // A different size in the middle throws out fragment 0, and fragment 2
+    // throws out the one with the other size in turn
+    ENSURE(tx.sendFragment(4, CHANNEL, d, FRAG_SIZE, 0, NFRAGS));
+    ENSURE(tx.sendFragment(4, CHANNEL, longer, FRAG_SIZE, 1, NFRAGS));
+    ENSURE(tx.sendFragment(4, CHANNEL, d, FRAG_SIZE, 2, NFRAGS));
+    sync(tx);
+    ENSURE(numReceived() == 0);
+
+    // So does a different number of fragments
+    ENSURE(tx.sendFragmentRaw(4, CHANNEL, LEN, 0, 0, NFRAGS + 1, std::vector<uint8_t>(10)));
+    sync(tx);
+    ENSURE(numReceived() == 0);
+
+    // What's left over doesn't get mixed into the message when it's resent
+    for (uint16_t f = 0; f < NFRAGS; ++f)
+        ENSURE(tx.sendFragment(4, CHANNEL, d, FRAG_SIZE, f, NFRAGS));
+    sync(tx);
+    ENSURE(numReceived() == 1);
+    ENSURE(received[0] == d);
+
+    stopReceiver(rx);
+}
+
+static void test_timeout()
+{
+    zcm_t *rx = startReceiver();
+    UdpmRawSender tx;
+    ENSURE(tx.good());
+
+    // The last fragment comes too late
+    std::vector<uint8_t> d = udpmTestPayload(6, LEN);
+    ENSURE(tx.sendFragment(6, CHANNEL, d, FRAG_SIZE, 0, NFRAGS));
+    ENSURE(tx.sendFragment(6, CHANNEL, d, FRAG_SIZE, 1, NFRAGS));
+    usleep(2 * FRAG_TIMEOUT_MS * 1000);
+    ENSURE(tx.sendFragment(6, CHANNEL, d, FRAG_SIZE, 2, NFRAGS));
+    sync(tx);
+    ENSURE(numReceived() == 0);
+
+    // Each fragment in time is enough, however long the whole message takes
+    d = udpmTestPayload(7, LEN);
+    for (uint16_t f = 0; f < NFRAGS; ++f) {
+        ENSURE(tx.sendFragment(7, CHANNEL, d, FRAG_SIZE, f, NFRAGS));
+        usleep(FRAG_TIMEOUT_MS * 1000 / 2);
+    }
+    sync(tx);
+    ENSURE(numReceived() == 1);
+    ENSURE(received[0] == d);
+
+    stopReceiver(rx);
+}
+
+int main()
+{
+    test_any_order();
+    test_duplicates();
+    test_mismatch();
+    test_timeout();
+    return 0;
+}
@@ -0,0 +1,190 @@
+// Tests sending large messages over udpm, where all the fragments of a message go
+// out together: messages on either side of the fragmenting threshold arrive intact,
+// and on the wire each one is still the LC03 fragments older receivers expect, in
+// order, contiguous, and all under the one sequence number
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+#include "udpm_packets.hpp"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define CHANNEL "MULTIFRAG"
+// Channel, its NUL and the data all fit in one packet up to 65499 bytes
+#define MAX_SHORT_LEN (65499 - sizeof(CHANNEL))
+#define FRAG_PAYLOAD 65487
+
+static std::mutex receivedLock;
+static std::vector<std::vector<uint8_t>> received;
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    std::unique_lock<std::mutex> lk(receivedLock);
+    received.push_back(std::vector<uint8_t>(rbuf->data, rbuf->data + rbuf->data_size));
+}
+
+static size_t numReceived()
+{
+    std::unique_lock<std::mutex> lk(receivedLock);
+    return received.size();
+}
+
+// A plain socket in the group, to look at the packets themselves
+static int openListener()
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    ENSURE(fd >= 0);
+    int one = 1;
+    ENSURE(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0);
+    int rcvbuf = 1 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(UDPM_TEST_PORT);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    ENSURE(bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0);
+
+    struct ip_mreq mreq;
+    inet_aton(UDPM_TEST_ADDR, &mreq.imr_multiaddr);
+    mreq.imr_interface.s_addr = INADDR_ANY;
+    ENSURE(setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0);
+    return fd;
+}
+
+struct Packet
+{
+    uint32_t magic;
+    uint32_t seqno;
+    // Only for fragments
+    uint32_t msgSize;
+    uint32_t offset;
+    uint16_t fragNo;
+    uint16_t nfrags;
+    std::vector<uint8_t> data;
+};
+
+static uint32_t get32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return ntohl(v); }
+static uint16_t get16(const uint8_t *p) { uint16_t v; memcpy(&v, p, 2); return ntohs(v); }
+
+// Everything the listener got within 'timeoutMs' of the last packet
+static std::vector<Packet> drain(int fd, int timeoutMs)
+{
+    std::vector<Packet> pkts;
+    static uint8_t buf[1 << 17];
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    while (poll(&pfd, 1, timeoutMs) == 1) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        ENSURE(n >= 8);
+        Packet p = Packet();
+        p.magic = get32(buf);
+        p.seqno = get32(buf + 4);
+        if (p.magic == 0x4c433033) {
+            ENSURE(n >= 20);
+            p.msgSize = get32(buf + 8);
+            p.offset = get32(buf + 12);
+            p.fragNo = get16(buf + 16);
+            p.nfrags = get16(buf + 18);
+            size_t start = 20;
+            if (p.fragNo == 0) {
+                ENSURE(strcmp((const char*) buf + 20, CHANNEL) == 0);
+                start += sizeof(CHANNEL);
+            }
+            p.data.assign(buf + start, buf + n);
+        } else {
+            ENSURE(p.magic == 0x4c433032);
+            ENSURE(strcmp((const char*) buf + 8, CHANNEL) == 0);
+            p.data.assign(buf + 8 + sizeof(CHANNEL), buf + n);
+        }
+        pkts.push_back(p);
+    }
+    return pkts;
+}
+
+static void test_sizes()
+{
+    const size_t lens[] = {
+        MAX_SHORT_LEN,
+        MAX_SHORT_LEN + 1,
+        100000,
+        2 * FRAG_PAYLOAD - sizeof(CHANNEL),     // Fills exactly 2 fragments
+        2 * FRAG_PAYLOAD - sizeof(CHANNEL) + 1, // 3 fragments, the last of 1 byte
+    };
+    const size_t expectFrags[] = { 1, 2, 2, 2, 3 };
+    // Two full fragments overflow the default kernel receive buffer of the
+    // receiver, so only the listener, whose buffer is bigger, sees those
+    const size_t MAX_DELIVERED_LEN = 100000;
+    const size_t NLENS = sizeof(lens) / sizeof(lens[0]);
+
+    int listener = openListener();
+    zcm_t *rx = zcm_create(UDPM_TEST_URL);
+    zcm_t *tx = zcm_create(UDPM_TEST_URL);
+    ENSURE(rx && tx);
+    ENSURE(zcm_subscribe(rx, CHANNEL, handler, NULL));
+    zcm_start(rx);
+
+    uint32_t lastSeqno = 0;
+    for (size_t i = 0; i < NLENS; ++i) {
+        std::vector<uint8_t> d = udpmTestPayload(i, lens[i]);
+        ENSURE(zcm_publish(tx, CHANNEL, d.data(), d.size()) == ZCM_EOK);
+        zcm_flush(tx);
+        if (lens[i] <= MAX_DELIVERED_LEN) {
+            for (int j = 0; j < 2000 && numReceived() < i + 1; ++j) usleep(1000);
+            ENSURE(numReceived() == i + 1);
+            ENSURE(received[i] == d);
+        }
+
+        std::vector<Packet> pkts = drain(listener, 100);
+        ENSURE(pkts.size() == expectFrags[i]);
+        if (i > 0) ENSURE(pkts[0].seqno == lastSeqno + 1);
+        lastSeqno = pkts[0].seqno;
+        if (expectFrags[i] == 1) {
+            ENSURE(pkts[0].magic == 0x4c433032);
+            ENSURE(pkts[0].data == d);
+            continue;
+        }
+
+        std::vector<uint8_t> whole;
+        for (size_t f = 0; f < pkts.size(); ++f) {
+            const Packet& p = pkts[f];
+            ENSURE(p.magic == 0x4c433033);
+            ENSURE(p.seqno == lastSeqno);
+            ENSURE(p.msgSize == lens[i]);
+            ENSURE(p.fragNo == f);
+            ENSURE(p.nfrags == expectFrags[i]);
+            ENSURE(p.offset == whole.size());
+            // Every fragment but the last is full
+            size_t fragLen = p.data.size() + (f == 0 ? sizeof(CHANNEL) : 0);
+            if (f + 1 < pkts.size()) ENSURE(fragLen == FRAG_PAYLOAD);
+            whole.insert(whole.end(), p.data.begin(), p.data.end());
+        }
+        ENSURE(whole == d);
+    }
+
+    zcm_stop(rx);
+    zcm_destroy(tx);
+    zcm_destroy(rx);
+    close(listener);
+}
+
+int main()
+{
+    test_sizes();
+    return 0;
+}
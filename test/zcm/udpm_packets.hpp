@@ -0,0 +1,125 @@
+#pragma once
+
+// Hand-made udpm packets, for tests that need to control exactly what a receiver
+// sees on the wire: short messages (LC02) and message fragments (LC03)
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define UDPM_TEST_ADDR "239.255.76.67"
+#define UDPM_TEST_PORT 7667
+#define UDPM_TEST_URL "udpm://239.255.76.67:7667?ttl=0"
+
+// The payload byte at 'offset' of test messages, so any misplaced data shows
+static inline uint8_t udpmTestByte(uint32_t seed, size_t offset)
+{
+    return (uint8_t) (seed * 31 + offset * 7);
+}
+
+static inline std::vector<uint8_t> udpmTestPayload(uint32_t seed, size_t len)
+{
+    std::vector<uint8_t> d(len);
+    for (size_t i = 0; i < len; ++i) d[i] = udpmTestByte(seed, i);
+    return d;
+}
+
+// A sender with its own socket, so the receiver sees it as a sender of its own
+class UdpmRawSender
+{
+  public:
+    UdpmRawSender()
+    {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        unsigned char ttl = 0;
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        memset(&dest, 0, sizeof(dest));
+        dest.sin_family = AF_INET;
+        dest.sin_port = htons(UDPM_TEST_PORT);
+        inet_aton(UDPM_TEST_ADDR, &dest.sin_addr);
+    }
+
+    ~UdpmRawSender() { if (fd >= 0) close(fd); }
+
+    bool good() const { return fd >= 0; }
+
+    bool sendShort(uint32_t seqno, const std::string& channel, const std::vector<uint8_t>& data)
+    {
+        std::vector<uint8_t> pkt;
+        put32(pkt, 0x4c433032); // "LC02"
+        put32(pkt, seqno);
+        pkt.insert(pkt.end(), channel.c_str(), channel.c_str() + channel.size() + 1);
+        pkt.insert(pkt.end(), data.begin(), data.end());
+        return send(pkt);
+    }
+
+    // Sends fragment 'fragNo' of 'nfrags' of a message whose payload is
+    // 'msg'. Fragment 0 carries the channel, then the first 'fragSize' - the
+    // channel's length bytes; every other fragment carries 'fragSize' bytes
+    bool sendFragment(uint32_t seqno, const std::string& channel, const std::vector<uint8_t>& msg,
+                      uint32_t fragSize, uint16_t fragNo, uint16_t nfrags)
+    {
+        uint32_t first = fragSize - (channel.size() + 1);
+        uint32_t offset = fragNo == 0 ? 0 : first + (fragNo - 1) * fragSize;
+        uint32_t len = fragNo == 0 ? first : fragSize;
+        if (offset > msg.size()) offset = msg.size();
+        if (offset + len > msg.size()) len = msg.size() - offset;
+        return sendFragmentRaw(seqno, channel, msg.size(), offset, fragNo, nfrags,
+                               std::vector<uint8_t>(msg.begin() + offset,
+                                                    msg.begin() + offset + len));
+    }
+
+    // How many fragments sendFragment() needs for 'msgSize' bytes on 'channel'
+    static uint16_t numFragments(const std::string& channel, size_t msgSize, uint32_t fragSize)
+    {
+        size_t first = fragSize - (channel.size() + 1);
+        if (msgSize <= first) return 1;
+        return (uint16_t) (1 + (msgSize - first + fragSize - 1) / fragSize);
+    }
+
+    // Any header at all, whether it makes sense or not
+    bool sendFragmentRaw(uint32_t seqno, const std::string& channel, uint32_t msgSize,
+                         uint32_t offset, uint16_t fragNo, uint16_t nfrags,
+                         const std::vector<uint8_t>& data)
+    {
+        std::vector<uint8_t> pkt;
+        put32(pkt, 0x4c433033); // "LC03"
+        put32(pkt, seqno);
+        put32(pkt, msgSize);
+        put32(pkt, offset);
+        put16(pkt, fragNo);
+        put16(pkt, nfrags);
+        if (fragNo == 0)
+            pkt.insert(pkt.end(), channel.c_str(), channel.c_str() + channel.size() + 1);
+        pkt.insert(pkt.end(), data.begin(), data.end());
+        return send(pkt);
+    }
+
+  private:
+    int fd;
+    struct sockaddr_in dest;
+
+    static void put32(std::vector<uint8_t>& pkt, uint32_t v)
+    {
+        v = htonl(v);
+        const uint8_t* p = (const uint8_t*) &v;
+        pkt.insert(pkt.end(), p, p + 4);
+    }
+
+    static void put16(std::vector<uint8_t>& pkt, uint16_t v)
+    {
+        v = htons(v);
+        const uint8_t* p = (const uint8_t*) &v;
+        pkt.insert(pkt.end(), p, p + 2);
+    }
+
+    bool send(const std::vector<uint8_t>& pkt)
+    {
+        return sendto(fd, pkt.data(), pkt.size(), 0,
+                      (const struct sockaddr*) &dest, sizeof(dest)) == (ssize_t) pkt.size();
+    }
+};
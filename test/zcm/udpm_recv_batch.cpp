@@ -0,0 +1,142 @@
+// Tests the batched receive path of the udpm transport: a burst of packets that
+// piled up in the kernel, many more than one batch, comes out as the same messages
+// in the same order, with fragmented messages reassembled across batch boundaries
+// and every message stamped with the time its own last packet arrived
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+#include "util/TimeUtil.hpp"
+#include "udpm_packets.hpp"
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+#define CHANNEL "BATCH"
+
+struct Received
+{
+    std::vector<uint8_t> data;
+    int64_t recv_utime;
+};
+
+static std::mutex receivedLock;
+static std::vector<Received> received;
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    std::unique_lock<std::mutex> lk(receivedLock);
+    received.push_back({ std::vector<uint8_t>(rbuf->data, rbuf->data + rbuf->data_size),
+                         rbuf->recv_utime });
+}
+
+static size_t numReceived()
+{
+    std::unique_lock<std::mutex> lk(receivedLock);
+    return received.size();
+}
+
+static void waitFor(size_t n)
+{
+    for (int i = 0; i < 2000 && numReceived() < n; ++i) usleep(1000);
+    ENSURE(numReceived() == n);
+}
+
+// Every fourth message goes in 3 small fragments, the rest in one packet each
+static void test_burst()
+{
+    const size_t NMSGS = 80;
+    const uint32_t FRAG_SIZE = 200;
+
+    received.clear();
+    zcm_t *rx = zcm_create(UDPM_TEST_URL);
+    ENSURE(rx);
+    zcm_set_queue_size(rx, 256);
+    ENSURE(zcm_subscribe(rx, CHANNEL, handler, NULL));
+
+    UdpmRawSender tx;
+    ENSURE(tx.good());
+
+    // Nobody reads while the burst is sent, so it all waits in the kernel
+    uint64_t before = TimeUtil::utime();
+    size_t npackets = 0;
+    std::vector<std::vector<uint8_t>> sent;
+    for (size_t i = 0; i < NMSGS; ++i) {
+        if (i % 4 == 3) {
+            std::vector<uint8_t> d = udpmTestPayload(i, 2 * FRAG_SIZE + 50);
+            uint16_t nfrags = UdpmRawSender::numFragments(CHANNEL, d.size(), FRAG_SIZE);
+            ENSURE(nfrags == 3);
+            for (uint16_t f = 0; f < nfrags; ++f, ++npackets)
+                ENSURE(tx.sendFragment(i, CHANNEL, d, FRAG_SIZE, f, nfrags));
+            sent.push_back(d);
+        } else {
+            std::vector<uint8_t> d = udpmTestPayload(i, 10 + i);
+            ENSURE(tx.sendShort(i, CHANNEL, d));
+            ++npackets;
+            sent.push_back(d);
+        }
+    }
+    ENSURE(npackets > 3 * 32); // Several receive batches
+    uint64_t after = TimeUtil::utime();
+
+    zcm_start(rx);
+    waitFor(NMSGS);
+    zcm_stop(rx);
+    zcm_destroy(rx);
+
+    for (size_t i = 0; i < NMSGS; ++i) {
+        ENSURE(received[i].data == sent[i]);
+        ENSURE(received[i].recv_utime >= (int64_t) before);
+        ENSURE(received[i].recv_utime <= (int64_t) after);
+        // Stamped on arrival, not when the batch was read
+        if (i > 0) ENSURE(received[i].recv_utime >= received[i - 1].recv_utime);
+    }
+    ENSURE(received.back().recv_utime > received.front().recv_utime);
+}
+
+// A running receiver keeps up with a sender that only waits for it every so
+// often (udp drops whatever overflows the kernel buffer, so it has to wait)
+static void test_live()
+{
+    const size_t NMSGS = 500;
+    const size_t BURST = 50;
+
+    received.clear();
+    zcm_t *rx = zcm_create(UDPM_TEST_URL);
+    zcm_t *tx = zcm_create(UDPM_TEST_URL);
+    ENSURE(rx && tx);
+    zcm_set_queue_size(rx, 2 * NMSGS);
+    zcm_set_queue_size(tx, 2 * NMSGS);
+    ENSURE(zcm_subscribe(rx, CHANNEL, handler, NULL));
+    zcm_start(rx);
+
+    for (size_t i = 0; i < NMSGS; ++i) {
+        std::vector<uint8_t> d = udpmTestPayload(i, 64);
+        ENSURE(zcm_publish(tx, CHANNEL, d.data(), d.size()) == ZCM_EOK);
+        if ((i + 1) % BURST == 0) {
+            zcm_flush(tx);
+            waitFor(i + 1);
+        }
+    }
+    zcm_stop(rx);
+    zcm_destroy(tx);
+    zcm_destroy(rx);
+
+    for (size_t i = 0; i < NMSGS; ++i) ENSURE(received[i].data == udpmTestPayload(i, 64));
+}
+
+int main()
+{
+    test_burst();
+    test_live();
+    return 0;
+}
@@ -2,13 +2,23 @@
 #include "zcm/zcm_private.h"
 #include "zcm/blocking.h"
 #include "zcm/transport.h"
-#include "zcm/util/threadsafe_queue.hpp"
+#include "zcm/util/lockfree_queue.hpp"
+#include "zcm/util/queue.hpp"
+#include "zcm/util/buffer_pool.hpp"
+#include "zcm/util/channel_matcher.hpp"
+#include "zcm/util/channel_table.hpp"
+#include "zcm/util/rcu.hpp"
+#include "zcm/util/stats.hpp"
 #include "zcm/util/debug.h"
 
 #include "util/TimeUtil.hpp"
 
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
 #include <unordered_map>
@@ -18,7 +28,8 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <regex>
+#include <atomic>
+#include <memory>
 using namespace std;
 
 #define RECV_TIMEOUT 100
@@ -28,24 +39,63 @@ struct Msg
 {
     zcm_msg_t msg;
 
-    // NOTE: copy the provided data into this object
-    Msg(uint64_t utime, const char* channel, size_t len, const uint8_t* buf)
+    // If 'loan' is set, 'msg' references memory loaned by 'zt' rather than our own copy
+    zcm_trans_t* zt = nullptr;
+    void* loan = nullptr;
+
+    // Otherwise, the data (and the channel, if it has no id) share a single
+    // allocation from 'pool'
+    BufferPool* pool = nullptr;
+    char* mem = nullptr;
+    size_t memsz = 0;
+
+    // NOTE: copy the provided data into this object. If 'channelId' is set,
+    //       'channel' must be its interned name, which is referenced, not copied
+    Msg(BufferPool& pool, uint64_t utime, const char* channel, uint32_t channelId,
+        size_t len, const uint8_t* buf)
+        : pool(&pool)
     {
+        size_t chanlen = channelId == ChannelTable::NONE ? strlen(channel) + 1 : 0;
+        memsz = len + chanlen;
+        mem = pool.alloc(memsz);
+
         msg.utime = utime;
-        msg.channel = strdup(channel);
         msg.len = len;
-        msg.buf = (uint8_t*)malloc(len);
+        msg.buf = (uint8_t*)mem;
         memcpy(msg.buf, buf, len);
+        msg.channel_id = channelId;
+        msg.trace_utime = 0;
+        msg.trace_seqno = 0;
+        if (chanlen == 0) {
+            msg.channel = channel;
+        } else {
+            char* chan = mem + len;
+            memcpy(chan, channel, chanlen);
+            msg.channel = chan;
+        }
+    }
+
+    Msg(BufferPool& pool, zcm_msg_t* msg)
+        : Msg(pool, msg->utime, msg->channel, msg->channel_id, msg->len, msg->buf)
+    {
+        this->msg.trace_utime = msg->trace_utime;
+        this->msg.trace_seqno = msg->trace_seqno;
     }
 
-    Msg(zcm_msg_t* msg) : Msg(msg->utime, msg->channel, msg->len, msg->buf) {}
+    // NOTE: takes ownership of 'mem', a block of 'memsz' bytes from 'pool' that
+    //       'msg' points into, no copying
+    Msg(BufferPool& pool, char* mem, size_t memsz, const zcm_msg_t& msg)
+        : msg(msg), pool(&pool), mem(mem), memsz(memsz) {}
+
+    // NOTE: takes ownership of a loan from zcm_trans_recvmsg_loan(), no copying
+    Msg(zcm_trans_t* zt, zcm_msg_t* msg, void* loan) : msg(*msg), zt(zt), loan(loan) {}
 
     ~Msg()
     {
-        if (msg.channel)
-            free((void*)msg.channel);
-        if (msg.buf)
-            free((void*)msg.buf);
+        if (loan)
+            zcm_trans_release_loan(zt, loan);
+        else
+            pool->free(mem, memsz);
         memset(&msg, 0, sizeof(msg));
     }
 
@@ -62,6 +112,247 @@ struct Msg
     Msg& operator=(Msg&& other) = delete;
 };
 
+// Sits in front of each buffer handed out by zcm_publish_acquire(). The whole block
+// comes from the instance's BufferPool and becomes the Msg's memory on commit.
+struct PublishLoan
+{
+    char* mem;
+    size_t memsz;
+    const char* channel;
+    uint32_t channelId;
+    uint32_t len;
+
+    // Keeps the buffer that follows suitably aligned to encode into
+    static constexpr size_t HDR_SIZE = 64;
+    static PublishLoan* of(uint8_t* buf) { return (PublishLoan*)(buf - HDR_SIZE); }
+    uint8_t* buf() { return (uint8_t*)this + HDR_SIZE; }
+};
+static_assert(sizeof(PublishLoan) <= PublishLoan::HDR_SIZE, "PublishLoan header too small");
+
+// A subscription's own queue of messages (see zcm_subscribe_queued() and
+// zcm_subscribe_latest()). The recvThread is its only producer and the dispatcher
+// that owns the sub its only consumer.
+class SubQueue
+{
+  public:
+    virtual ~SubQueue() {}
+
+    // Copies 'msg' in. Returns false if 'msg' itself was dropped. Sets 'dropped' if
+    // any message (this one or an older one) was dropped, and 'depth' to the number
+    // of messages queued afterwards.
+    virtual bool push(zcm_msg_t* msg, bool& dropped, size_t& depth) = 0;
+
+    // Returns the next message to dispatch, or nullptr if there is none. The
+    // message stays valid until the matching call to done().
+    virtual zcm_msg_t* front() = 0;
+    virtual void done() = 0;
+
+    virtual size_t size() = 0;
+
+    // A disabled queue never makes push() wait for room
+    virtual void disable() {}
+    virtual void enable() {}
+};
+
+// Holds up to 'depth' messages and makes room for new ones according to a
+// zcm_queue_policy. Queued Msgs are carved out of the instance's BufferPool
+// like their payloads.
+class BoundedSubQueue : public SubQueue
+{
+  public:
+    BoundedSubQueue(BufferPool& pool, uint32_t depth, enum zcm_queue_policy policy)
+        : pool(pool), ring(depth), policy(policy) {}
+
+    ~BoundedSubQueue()
+    {
+        if (taken) done();
+        while (front()) done();
+    }
+
+    bool push(zcm_msg_t* msg, bool& dropped, size_t& depth) override
+    {
+        // Don't bother copying a message that would be thrown away
+        if (policy == ZCM_QUEUE_DROP_NEWEST) {
+            unique_lock<mutex> lk(lock);
+            if (!ring.hasFreeSpace()) {
+                dropped = true;
+                depth = ring.numMessages();
+                return false;
+            }
+        }
+
+        Msg* m = new (pool.alloc(sizeof(Msg))) Msg(pool, msg);
+        Msg* lost = nullptr;
+        {
+            unique_lock<mutex> lk(lock);
+            if (policy == ZCM_QUEUE_BLOCK) {
+                notFull.wait(lk, [&]{ return disabled || ring.hasFreeSpace(); });
+                if (!ring.hasFreeSpace()) lost = m;
+            } else if (!ring.hasFreeSpace()) {
+                if (policy == ZCM_QUEUE_DROP_NEWEST) {
+                    lost = m;
+                } else {
+                    lost = ring.top();
+                    ring.pop();
+                }
+            }
+            if (lost != m) ring.push(m);
+            depth = ring.numMessages();
+        }
+        if (lost) release(lost);
+        dropped = lost != nullptr;
+        return lost != m;
+    }
+
+    zcm_msg_t* front() override
+    {
+        {
+            unique_lock<mutex> lk(lock);
+            if (!ring.hasMessage()) return nullptr;
+            taken = ring.top();
+            ring.pop();
+        }
+        if (policy == ZCM_QUEUE_BLOCK) notFull.notify_one();
+        return taken->get();
+    }
+
+    void done() override
+    {
+        release(taken);
+        taken = nullptr;
+    }
+
+    size_t size() override
+    {
+        unique_lock<mutex> lk(lock);
+        return ring.numMessages();
+    }
+
+    void disable() override { setDisabled(true); }
+    void enable() override { setDisabled(false); }
+
+  private:
+    void release(Msg* m)
+    {
+        m->~Msg();
+        pool.free((char*) m, sizeof(Msg));
+    }
+
+    void setDisabled(bool d)
+    {
+        {
+            unique_lock<mutex> lk(lock);
+            disabled = d;
+        }
+        notFull.notify_all();
+    }
+
+    BufferPool& pool;
+
+    mutex lock;
+    condition_variable notFull;
+    RingQueue<Msg*> ring;
+    bool disabled = false;
+
+    const enum zcm_queue_policy policy;
+
+    // Handed out by front(), owned by the consumer
+    Msg* taken = nullptr;
+};
+
+// Keeps only the newest message of each channel, overwriting it in place. Each
+// channel has two buffers that are reused for the life of the sub: the recvThread
+// writes into one while the dispatcher may still be reading the other.
+class LatestSubQueue : public SubQueue
+{
+  public:
+    // For a sub on a single channel, its slot is set up front
+    explicit LatestSubQueue(uint32_t channelId)
+    {
+        if (channelId != ChannelTable::NONE) slots[channelId];
+    }
+
+    bool push(zcm_msg_t* msg, bool& dropped, size_t& depth) override
+    {
+        unique_lock<mutex> lk(lock);
+        Slot& s = msg->channel_id != ChannelTable::NONE ? slots[msg->channel_id]
+                                                        : namedSlots[msg->channel];
+        // Overwriting a message that was never dispatched counts as dropping it
+        dropped = s.ready;
+        Buf& b = s.bufs[s.pending];
+        b.data.assign(msg->buf, msg->buf + msg->len);
+        b.msg = *msg;
+        b.msg.buf = b.data.data();
+        // Interned names outlive us; others need a copy
+        if (msg->channel_id == ChannelTable::NONE) {
+            b.channel.assign(msg->channel);
+            b.msg.channel = b.channel.c_str();
+        }
+        if (!s.ready) {
+            s.ready = true;
+            ready.push_back(&s);
+        }
+        depth = ready.size() - readyHead;
+        return true;
+    }
+
+    zcm_msg_t* front() override
+    {
+        unique_lock<mutex> lk(lock);
+        if (readyHead == ready.size()) return nullptr;
+        Slot* s = ready[readyHead++];
+        if (readyHead == ready.size()) {
+            ready.clear();
+            readyHead = 0;
+        }
+        s->ready = false;
+        // The consumer is done with the other buffer by now, so flip
+        Buf& b = s->bufs[s->pending];
+        s->pending ^= 1;
+        return &b.msg;
+    }
+
+    void done() override {}
+
+    size_t size() override
+    {
+        unique_lock<mutex> lk(lock);
+        return ready.size() - readyHead;
+    }
+
+  private:
+    struct Buf
+    {
+        zcm_msg_t msg;
+        vector<uint8_t> data;
+        string channel;
+    };
+    struct Slot
+    {
+        Buf bufs[2];
+        // The buffer that the next push() writes into
+        int pending = 0;
+        bool ready = false;
+    };
+
+    mutex lock;
+    // Keyed by channel id, or by name for channels without one
+    unordered_map<uint32_t, Slot> slots;
+    unordered_map<string, Slot> namedSlots;
+    // Slots with a message that hasn't been dispatched yet, oldest first
+    vector<Slot*> ready;
+    size_t readyHead = 0;
+};
+
+// Which kind of SubQueue, if any, a new sub gets
+struct SubQueueOpts
+{
+    enum Kind { SHARED, BOUNDED, LATEST } kind = SHARED;
+    // For BOUNDED only
+    uint32_t depth = 0;
+    enum zcm_queue_policy policy = ZCM_QUEUE_BLOCK;
+};
+
 static bool isRegexChannel(const string& channel)
 {
     // These chars are considered regex
@@ -77,10 +368,68 @@ static bool isRegexChannel(const string& channel)
     return false;
 }
 
+// The blocking core's subscription type. A dispatcher may still be looking at a
+// subscription table that references a sub after it has been unsubscribed, so
+// the sub is flagged as removed and only freed once no reader can see it.
+struct Sub : public zcm_sub_t
+{
+    atomic<bool> removed {false};
+    // ChannelTable::NONE for regex subs, and for exact ones whose channel no longer
+    // fit in the table
+    uint32_t channelId = ChannelTable::NONE;
+    // A regex sub matches channels that different dispatch workers own, so with
+    // more than one worker its callbacks are serialized with this. Recursive since
+    // a callback may dispatch again (e.g. through zcm_flush()).
+    recursive_mutex dispatchMutex;
+    // Set if the sub has its own queue rather than sharing the instance's. Shared so
+    // the recvThread can finish a push after the sub is gone.
+    shared_ptr<SubQueue> queue;
+};
+
+// Tracks the zcm_blocking instance (if any) whose dispatch is running callbacks
+// on the current thread
+static thread_local const void* tlsDispatching = nullptr;
+
 struct zcm_blocking
 {
   private:
-    using SubList = vector<zcm_sub_t*>;
+    using SubList = vector<Sub*>;
+
+    // Immutable once published (see 'subTable' below)
+    struct SubTable
+    {
+        // Unique per published table
+        uint64_t generation = 0;
+        // Keyed by channel id
+        unordered_map<uint32_t, SubList> subs;
+        // Exact subs on channels that got no id because the ChannelTable was full.
+        // The table never frees an id, so none of these channels can get one later.
+        unordered_map<string, SubList> subsByName;
+        SubList subRegex;
+        // Compiled from the channels of 'subRegex' (null if there are none)
+        shared_ptr<const ChannelMatcher> matcher;
+        // Every sub (exact or regex) that has its own queue
+        SubList queued;
+        // Indexed by channel id: channels whose messages may be dispatched out of order
+        vector<bool> unordered;
+
+        bool isUnordered(uint32_t channelId) const
+        { return channelId < unordered.size() && unordered[channelId]; }
+    };
+
+    // Remembers which subs want each channel for one generation of the SubTable, so
+    // the patterns are only matched once per distinct channel. Each reader thread
+    // owns its own cache, so lookups take no locks.
+    struct MatchCache
+    {
+        uint64_t generation = 0;
+        // Indexed by channel id
+        vector<SubList> entries;
+        vector<bool> valid;
+        // Result for a channel without an id, which can't be cached
+        SubList uncached;
+        vector<size_t> matched;
+    };
 
   public:
     zcm_blocking(zcm_t* z, zcm_trans_t* zt_);
@@ -90,48 +439,178 @@ struct zcm_blocking
     void start();
     int stop(bool block);
     int handle();
+    int handleBatch(uint32_t maxMsgs, int timeout, uint32_t* ndispatched);
 
     void pause();
     void resume();
 
-    int publish(const string& channel, const uint8_t* data, uint32_t len);
-    zcm_sub_t* subscribe(const string& channel, zcm_msg_handler_t cb, void* usr, bool block);
+    int publish(const char* channel, const uint8_t* data, uint32_t len);
+    int publishAcquire(const char* channel, uint32_t len, uint8_t** buf);
+    int publishCommit(uint8_t* buf, uint32_t len);
+    void publishAbort(uint8_t* buf);
+    zcm_sub_t* subscribe(const string& channel, zcm_msg_handler_t cb, void* usr, bool block,
+                         const SubQueueOpts& opts = SubQueueOpts());
     int unsubscribe(zcm_sub_t* sub, bool block);
     int flush(bool block);
 
     int setQueueSize(uint32_t numMsgs, bool block);
+    int setDispatchThreads(uint32_t nthreads);
+    int setChannelUnordered(const char* channel, bool unordered);
+    int setPublishMode(zcm_publish_mode mode);
+    int setBusyPoll(int64_t spinUs);
+    int setThreadOpts(zcm_thread which, const zcm_thread_opts_t* opts);
+    int getThreadOpts(zcm_thread which, zcm_thread_opts_t* opts);
+    void setUrlOpts(const zcm_url_opts_t* opts);
+
+    void getPoolStats(zcm_pool_stats_t* stats);
+    void getStats(zcm_stats_t* stats);
+    int setStatsPublish(uint32_t periodMs);
 
   private:
+    struct Worker;
+
     void sendThreadFunc();
+    // Decides whether a publish goes straight to the transport, and makes sure
+    // the sendThread is running if it doesn't
+    bool shouldSendInline();
+    int sendInline(const zcm_msg_t& msg);
+    // Records the outcome of pushing a message into the sendQueue
+    void countQueued(uint32_t channelId, size_t len, bool success);
     void recvThreadFunc();
-    void hndlThreadFunc();
-
-    void dispatchMsg(zcm_msg_t* msg);
+    void statsThreadFunc(uint64_t run);
+    // 'spawned' is false when zcm_run() lends us the caller's thread
+    void hndlThreadFunc(bool spawned);
+    // 'index' numbers the threads of the dispatch pool, the hndlThread being 0
+    void workerThreadFunc(Worker* w, size_t index);
+    // Applies the options of 'which' to the calling thread
+    void applyThreadOpts(zcm_thread which, size_t index);
+
+    int enterHandleMode();
+    void enableRecvQueues();
+    void disableRecvQueues();
+    Worker& workerFor(uint32_t channelId, bool unordered);
+    // The queue whose consumer also dispatches the sub queues of 'channelId'
+    SpscQueue<Msg>& dispatchQueueFor(uint32_t channelId);
+    // Dispatches from 'q' until the hndlThread is told to halt
+    void dispatchLoop(SpscQueue<Msg>& q, mutex& dispMutex, MatchCache& cache);
+    int flushRecvQueue(SpscQueue<Msg>& q, mutex& dispMutex, MatchCache& cache, bool block);
+    int resizeRecvQueue(SpscQueue<Msg>& q, mutex& dispMutex, uint32_t numMsgs, bool block);
+    // Requires being inside a subRcu read-side section
+    void dispatchMsg(const SubTable* tbl, MatchCache& cache, zcm_msg_t* msg);
+    void dispatchToSub(Sub* sub, zcm_msg_t* msg);
+    // Requires being inside a subRcu read-side section
+    size_t dispatchSubQueues(SpscQueue<Msg>& q, size_t maxMsgs);
+    // Number of messages waiting in the sub queues that 'q' is responsible for
+    size_t subQueueBacklog(SpscQueue<Msg>& q);
     bool dispatchOneMessage(bool returnIfPaused);
+    size_t dispatchMessages(SpscQueue<Msg>& q, MatchCache& cache, size_t maxMsgs,
+                            bool returnIfPaused, int timeout = -1);
     bool sendOneMessage(bool returnIfPaused);
+    // Hands everything already in the sendQueue (at most 'maxMsgs') to the
+    // transport in one sendmsg_batch() call, or one message at a time if the
+    // transport can't batch. Returns the number of messages taken off the queue.
+    size_t sendMessages(size_t maxMsgs, bool returnIfPaused);
 
     // Mutexes protecting the ...OneMessage() functions
     mutex dispOneMutex;
     mutex sendOneMutex;
 
-    bool deleteSubEntry(zcm_sub_t* sub, size_t nentriesleft);
-    bool deleteFromSubList(SubList& slist, zcm_sub_t* sub);
+    // Requires being inside a subRcu read-side section
+    uint32_t resolveChannelId(const SubTable* tbl, const zcm_msg_t& msg);
+    static const SubList& lookupSubs(MatchCache& cache, const SubTable* tbl,
+                                     uint32_t channelId, const char* channel);
+    static shared_ptr<const ChannelMatcher> compileMatcher(const SubList& subRegex);
+    static bool removeFromSubList(SubList& slist, Sub* sub);
+
+    // Requires that subWriteMutex is held
+    void publishSubTable(SubTable* next, Sub* removed);
+    // Frees what (un)subscribe retired once no reader can still see it. Without
+    // 'block' it never waits for readers: it starts a grace period or checks
+    // on the one in progress, and leaves the rest to a later call.
+    // Requires that subWriteMutex is *not* held and that the caller is not dispatching
+    void reclaimRetired(bool block);
 
     zcm_t* z;
     zcm_trans_t* zt;
-    unordered_map<string, SubList> subs;
-    SubList subRegex;
+    bool useLoan;
     size_t mtu;
 
-    // These 2 mutexes used to implement a read-write style infrastructure on the subscription
-    // lists. Both the recvThread and the message dispatch may read the subscriptions
-    // concurrently, but subscribe() and unsubscribe() need both locks in order to write to it.
-    mutex subDispMutex;
-    mutex subRecvMutex;
+    // Messages in the queues below and the subscription tables refer to channels by
+    // their id in here rather than by name
+    ChannelTable& channels = ChannelTable::instance();
+
+    // The subscriptions live in an immutable table that subscribe() and unsubscribe()
+    // replace wholesale (read-copy-update). The recvThread and the dispatchers read
+    // the current table inside a subRcu read-side section without taking any locks,
+    // which also makes it legal to (un)subscribe from within a callback. Replaced
+    // tables and removed subs are retired and freed once no reader can still see them.
+    atomic<const SubTable*> subTable;
+    uint64_t subTableGeneration = 0;
+    Rcu subRcu;
+    // Serializes writers of 'subTable' and protects the retired lists. It is never
+    // held while waiting for readers, since a reader may be a callback that
+    // wants to (un)subscribe
+    mutex subWriteMutex;
+    vector<const SubTable*> retiredTables;
+    vector<Sub*> retiredSubs;
+    // Serializes reclaimRetired() calls and protects what waits on the grace
+    // period in progress (at most one at a time)
+    mutex reclaimMutex;
+    vector<const SubTable*> graceTables;
+    vector<Sub*> graceSubs;
+    unsigned graceToken = 0;
+    // Set while anything above is waiting to be freed
+    atomic<bool> reclaimPending {false};
+
+    // Used only by the recvThread
+    MatchCache recvMatchCache;
+    struct SubQueueTarget
+    {
+        shared_ptr<SubQueue> queue;
+        SpscQueue<Msg>* dispatchQueue;
+    };
+    vector<SubQueueTarget> recvSubQueues;
+    // Protected by dispOneMutex
+    MatchCache dispMatchCache;
+
+    // Backs the channel and data of every non-loaned Msg in the queues below
+    BufferPool pool;
+
+    StatsRegistry stats;
+    // Publishes 'stats' every 'statsPeriodMs' while it is nonzero (see setStatsPublish())
+    thread             statsThread;
+    mutex              statsMutex;
+    condition_variable statsCond;
+    uint32_t           statsPeriodMs = 0;
+    // Bumped to tell the statsThread to quit
+    uint64_t           statsRun = 0;
 
     static constexpr size_t QUEUE_SIZE = 16;
-    ThreadsafeQueue<Msg> sendQueue {QUEUE_SIZE};
-    ThreadsafeQueue<Msg> recvQueue {QUEUE_SIZE};
+    // Max number of messages the hndlThread dispatches per lock acquisition
+    static constexpr size_t DISPATCH_BATCH_SIZE = 32;
+    // Any thread may publish, but only the recvThread pushes received messages.
+    // Consumers of each queue are serialized by sendOneMutex and dispOneMutex.
+    MpscQueue<Msg> sendQueue {QUEUE_SIZE};
+    // Scratch space for sendMessages(), only touched under sendOneMutex
+    vector<zcm_msg_t> sendBatch;
+    SpscQueue<Msg> recvQueue {QUEUE_SIZE};
+
+    // One thread of the dispatch pool, which replaces 'recvQueue' in run() and start()
+    // modes when there is more than one dispatch thread. The recvThread assigns each
+    // message to a worker by channel, so every channel is dispatched in order by a
+    // single worker while independent channels run in parallel.
+    struct Worker
+    {
+        SpscQueue<Msg> queue {QUEUE_SIZE};
+        // Serializes consumers of 'queue' (the worker and flush()) and protects 'matchCache'
+        mutex dispMutex;
+        MatchCache matchCache;
+        thread thr;
+    };
+    // Only changed while stopped. The first worker runs on the hndlThread itself.
+    vector<unique_ptr<Worker>> workers;
+    // Whether the recvThread feeds 'workers' rather than 'recvQueue'. Set before it starts.
+    bool dispatchToWorkers = false;
 
     typedef enum {
         RECV_MODE_NONE = 0,
@@ -171,32 +650,67 @@ struct zcm_blocking
     bool               paused {false};
     condition_variable sendPauseCond;
     condition_variable hndlPauseCond;
+
+    // Protected by sendStateMutex
+    zcm_publish_mode   publishMode {ZCM_PUBLISH_QUEUED};
+    // Whether the transport lets inline publishes skip sendOneMutex
+    bool               sendConcurrent;
+
+    // How long the recvThread keeps polling after a message (negative: forever)
+    atomic<int64_t>    busyPollUs {0};
+
+    // Indexed by zcm_thread, protected by threadOptsMutex
+    static const size_t NUM_THREAD_KINDS = ZCM_THREAD_DISPATCH + 1;
+    zcm_thread_opts_t  threadOpts[NUM_THREAD_KINDS];
+    mutex              threadOptsMutex;
 };
 
 zcm_blocking_t::zcm_blocking(zcm_t* z, zcm_trans_t* zt_)
 {
     zt = zt_;
     mtu = zcm_trans_get_mtu(zt);
+    useLoan = zcm_trans_can_loan(zt);
+    sendConcurrent = zcm_trans_sendmsg_concurrent(zt);
+    subTable = new SubTable();
+    for (auto& o : threadOpts) {
+        memset(&o, 0, sizeof(o));
+        o.cpu = -1;
+        o.policy = ZCM_SCHED_DEFAULT;
+    }
 }
 
 zcm_blocking_t::~zcm_blocking()
 {
-    // Shutdown all threads
+    // Shutdown all threads, starting with the one that may still publish
+    setStatsPublish(0);
     stop(true);
 
+    // Any queued messages may hold loans from the transport: release them first
+    while (recvQueue.hasMessage()) recvQueue.pop();
+    for (auto& w : workers)
+        while (w->queue.hasMessage()) w->queue.pop();
+    while (sendQueue.hasMessage()) sendQueue.pop();
+
     // Destroy the transport
     zcm_trans_destroy(zt);
 
-    // Need to delete all subs
-    for (auto& it : subs) {
-        for (auto& sub : it.second) {
+    // No readers remain, so everything can go (retired tables share their subs
+    // with the current table or the retired subs list)
+    for (auto* tbl : retiredTables) delete tbl;
+    for (auto* sub : retiredSubs) delete sub;
+    for (auto* tbl : graceTables) delete tbl;
+    for (auto* sub : graceSubs) delete sub;
+
+    const SubTable* tbl = subTable.load();
+    for (auto& it : tbl->subs)
+        for (auto* sub : it.second)
             delete sub;
-        }
-    }
-    for (auto& sub : subRegex) {
-        delete (regex*) sub->regexobj;
+    for (auto& it : tbl->subsByName)
+        for (auto* sub : it.second)
+            delete sub;
+    for (auto* sub : tbl->subRegex)
         delete sub;
-    }
+    delete tbl;
 }
 
 void zcm_blocking_t::run()
@@ -213,9 +727,9 @@ void zcm_blocking_t::run()
         unique_lock<mutex> lk2(hndlStateMutex);
         lk1.unlock();
         hndlThreadState = THREAD_STATE_RUNNING;
-        recvQueue.enable();
+        enableRecvQueues();
     }
-    hndlThreadFunc();
+    hndlThreadFunc(false);
 
     // Restore the "non-running" state
     lk1.lock();
@@ -236,8 +750,8 @@ void zcm_blocking_t::start()
     lk1.unlock();
     // Start the hndl thread
     hndlThreadState = THREAD_STATE_RUNNING;
-    recvQueue.enable();
-    hndlThread = thread{&zcm_blocking::hndlThreadFunc, this};
+    enableRecvQueues();
+    hndlThread = thread{&zcm_blocking::hndlThreadFunc, this, true};
 }
 
 int zcm_blocking_t::stop(bool block)
@@ -249,7 +763,7 @@ int zcm_blocking_t::stop(bool block)
         unique_lock<mutex> lk2(hndlStateMutex);
         if (hndlThreadState == THREAD_STATE_RUNNING) {
             hndlThreadState = THREAD_STATE_HALTING;
-            recvQueue.disable();
+            disableRecvQueues();
             lk2.unlock();
             hndlPauseCond.notify_all();
             if (block && recvMode == RECV_MODE_SPAWN) {
@@ -328,32 +842,52 @@ int zcm_blocking_t::stop(bool block)
     return ZCM_EOK;
 }
 
-int zcm_blocking_t::handle()
+int zcm_blocking_t::enterHandleMode()
 {
-    {
-        unique_lock<mutex> lk1(recvModeMutex);
-        if (recvMode != RECV_MODE_NONE && recvMode != RECV_MODE_HANDLE) {
-            ZCM_DEBUG("Err: call to handle() when 'recvMode != RECV_MODE_NONE && recvMode != RECV_MODE_HANDLE'");
-            return ZCM_EINVALID;
-        }
+    unique_lock<mutex> lk1(recvModeMutex);
+    if (recvMode != RECV_MODE_NONE && recvMode != RECV_MODE_HANDLE) {
+        ZCM_DEBUG("Err: call to handle() when 'recvMode != RECV_MODE_NONE && recvMode != RECV_MODE_HANDLE'");
+        return ZCM_EINVALID;
+    }
 
-        // If this is the first time handle() is called, we need to start the recv thread
-        if (recvMode == RECV_MODE_NONE) {
-            recvMode = RECV_MODE_HANDLE;
+    // If this is the first time handle() is called, we need to start the recv thread
+    if (recvMode == RECV_MODE_NONE) {
+        recvMode = RECV_MODE_HANDLE;
 
-            unique_lock<mutex> lk2(recvStateMutex);
-            lk1.unlock();
-            // Spawn the recv thread
-            recvThreadState = THREAD_STATE_RUNNING;
-            recvQueue.enable();
-            recvThread = thread{&zcm_blocking::recvThreadFunc, this};
-        }
+        unique_lock<mutex> lk2(recvStateMutex);
+        lk1.unlock();
+        // Spawn the recv thread
+        recvThreadState = THREAD_STATE_RUNNING;
+        recvQueue.enable();
+        dispatchToWorkers = false;
+        recvThread = thread{&zcm_blocking::recvThreadFunc, this};
     }
 
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::handle()
+{
+    int rc = enterHandleMode();
+    if (rc != ZCM_EOK) return rc;
+
     unique_lock<mutex> lk(dispOneMutex);
     return dispatchOneMessage(true) ? ZCM_EOK : ZCM_EAGAIN;
 }
 
+int zcm_blocking_t::handleBatch(uint32_t maxMsgs, int timeout, uint32_t* ndispatched)
+{
+    *ndispatched = 0;
+    if (maxMsgs == 0) return ZCM_EINVALID;
+
+    int rc = enterHandleMode();
+    if (rc != ZCM_EOK) return rc;
+
+    unique_lock<mutex> lk(dispOneMutex);
+    *ndispatched = dispatchMessages(recvQueue, dispMatchCache, maxMsgs, true, timeout);
+    return ZCM_EOK;
+}
+
 void zcm_blocking_t::pause()
 {
     unique_lock<mutex> lk1(sendStateMutex);
@@ -375,46 +909,175 @@ void zcm_blocking_t::resume()
 // Note: We use a lock on publish() to make sure it can be
 // called concurrently. Without the lock, there is a potential
 // race to block on sendQueue.push()
-int zcm_blocking_t::publish(const string& channel, const uint8_t* data, uint32_t len)
+int zcm_blocking_t::publish(const char* channel, const uint8_t* data, uint32_t len)
 {
     // Check the validity of the request
     if (len > mtu) return ZCM_EINVALID;
-    if (channel.size() > ZCM_CHANNEL_MAXLEN) return ZCM_EINVALID;
+    if (strnlen(channel, ZCM_CHANNEL_MAXLEN + 1) > ZCM_CHANNEL_MAXLEN) return ZCM_EINVALID;
 
-    // If needed: spawn the send thread
-    {
-        unique_lock<mutex> lk(sendStateMutex);
-        if (sendThreadState == THREAD_STATE_STOPPED) {
-            sendThreadState = THREAD_STATE_RUNNING;
-            sendThread = thread{&zcm_blocking::sendThreadFunc, this};
-        }
+    // Only a channel that is already interned travels by id. Publishing never adds to
+    // the table, so a Msg on any other channel carries its own copy of the name.
+    uint32_t channelId = channels.find(channel);
+    if (channelId != ChannelTable::NONE) channel = channels.name(channelId);
+
+    if (shouldSendInline()) {
+        zcm_msg_t msg;
+        msg.utime = TimeUtil::utime();
+        msg.channel = channel;
+        msg.len = len;
+        msg.buf = (uint8_t*) data;
+        msg.channel_id = channelId;
+        msg.trace_utime = 0;
+        msg.trace_seqno = 0;
+        return sendInline(msg);
+    }
+
+    bool success = sendQueue.pushIfRoom(pool, TimeUtil::utime(), channel, channelId, len, data);
+    countQueued(channelId, len, success);
+    return success ? ZCM_EOK : ZCM_EAGAIN;
+}
+
+int zcm_blocking_t::publishAcquire(const char* channel, uint32_t len, uint8_t** buf)
+{
+    *buf = nullptr;
+    if (len > mtu) return ZCM_EINVALID;
+    if (strnlen(channel, ZCM_CHANNEL_MAXLEN + 1) > ZCM_CHANNEL_MAXLEN) return ZCM_EINVALID;
+
+    // Like a queued Msg, the block carries its own copy of the name if it has no id
+    uint32_t channelId = channels.find(channel);
+    size_t chanlen = channelId == ChannelTable::NONE ? strlen(channel) + 1 : 0;
+    size_t memsz = PublishLoan::HDR_SIZE + len + chanlen;
+    char* mem = pool.alloc(memsz);
+
+    PublishLoan* loan = (PublishLoan*) mem;
+    loan->mem = mem;
+    loan->memsz = memsz;
+    loan->channelId = channelId;
+    loan->len = len;
+    if (chanlen == 0) {
+        loan->channel = channels.name(channelId);
+    } else {
+        char* chan = (char*) loan->buf() + len;
+        memcpy(chan, channel, chanlen);
+        loan->channel = chan;
+    }
+
+    *buf = loan->buf();
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::publishCommit(uint8_t* buf, uint32_t len)
+{
+    PublishLoan* loan = PublishLoan::of(buf);
+    if (len > loan->len) {
+        publishAbort(buf);
+        return ZCM_EINVALID;
     }
 
-    bool success = sendQueue.pushIfRoom(TimeUtil::utime(), channel.c_str(), len, data);
-    if (!success) ZCM_DEBUG("sendQueue has no free space");
+    zcm_msg_t msg;
+    msg.utime = TimeUtil::utime();
+    msg.channel = loan->channel;
+    msg.len = len;
+    msg.buf = buf;
+    msg.channel_id = loan->channelId;
+    msg.trace_utime = 0;
+    msg.trace_seqno = 0;
+
+    if (shouldSendInline()) {
+        int ret = sendInline(msg);
+        publishAbort(buf);
+        return ret;
+    }
+
+    // On success, the queued Msg owns the block (header included) from here on
+    char* mem = loan->mem;
+    size_t memsz = loan->memsz;
+    bool success = sendQueue.pushIfRoom(pool, mem, memsz, msg);
+    countQueued(msg.channel_id, len, success);
+    if (!success) pool.free(mem, memsz);
     return success ? ZCM_EOK : ZCM_EAGAIN;
 }
 
+void zcm_blocking_t::publishAbort(uint8_t* buf)
+{
+    PublishLoan* loan = PublishLoan::of(buf);
+    pool.free(loan->mem, loan->memsz);
+}
+
+bool zcm_blocking_t::shouldSendInline()
+{
+    // Messages still in the sendQueue must go out first, so those force queueing
+    unique_lock<mutex> lk(sendStateMutex);
+    bool ret = publishMode == ZCM_PUBLISH_INLINE && !paused && sendQueue.numMessages() == 0;
+    // If needed: spawn the send thread
+    if (!ret && sendThreadState == THREAD_STATE_STOPPED) {
+        sendThreadState = THREAD_STATE_RUNNING;
+        sendThread = thread{&zcm_blocking::sendThreadFunc, this};
+    }
+    return ret;
+}
+
+int zcm_blocking_t::sendInline(const zcm_msg_t& msg)
+{
+    unique_lock<mutex> lk(sendOneMutex, defer_lock);
+    if (!sendConcurrent) lk.lock();
+    int ret = zcm_trans_sendmsg(zt, msg);
+    if (lk.owns_lock()) lk.unlock();
+    if (ret == ZCM_EOK) stats.countOut(msg.channel_id, msg.len);
+    else                stats.countDrop(msg.channel_id, ZCM_DROP_SEND_FAILED);
+    return ret;
+}
+
+void zcm_blocking_t::countQueued(uint32_t channelId, size_t len, bool success)
+{
+    if (!success) {
+        ZCM_DEBUG("sendQueue has no free space");
+        stats.countDrop(channelId, ZCM_DROP_SEND_QUEUE_FULL);
+        return;
+    }
+    stats.countOut(channelId, len);
+    size_t depth = sendQueue.numMessages();
+    stats.sendQueueDepth(depth);
+    stats.queueDepth(channelId, depth);
+}
+
 // Note: We use a lock on subscribe() to make sure it can be
-// called concurrently. Without the lock, there is a race
-// on modifying and reading the 'subs' and 'subRegex' containers
+// called concurrently. Without the lock, two writers could
+// each publish a table that is missing the other's change
 zcm_sub_t* zcm_blocking_t::subscribe(const string& channel,
                                      zcm_msg_handler_t cb, void* usr,
-                                     bool block)
+                                     bool block, const SubQueueOpts& opts)
 {
-    unique_lock<mutex> lk1(subDispMutex, std::defer_lock);
-    unique_lock<mutex> lk2(subRecvMutex, std::defer_lock);
+    if (opts.kind == SubQueueOpts::BOUNDED) {
+        if (opts.depth == 0) return nullptr;
+        if (opts.policy != ZCM_QUEUE_BLOCK && opts.policy != ZCM_QUEUE_DROP_OLDEST &&
+            opts.policy != ZCM_QUEUE_DROP_NEWEST) {
+            ZCM_DEBUG("invalid queue policy %d, can't subscribe to %s",
+                      opts.policy, channel.c_str());
+            return nullptr;
+        }
+    }
+
+    unique_lock<mutex> lk(subWriteMutex, std::defer_lock);
     if (block) {
-        lk1.lock();
-        lk2.lock();
-    } else if (!lk1.try_lock() || !lk2.try_lock()) {
+        lk.lock();
+    } else if (!lk.try_lock()) {
         return nullptr;
     }
     int rc;
 
+    const SubTable* cur = subTable.load(memory_order_acquire);
+
     bool regex = isRegexChannel(channel);
+    uint32_t channelId = ChannelTable::NONE;
+    if (!regex) {
+        channelId = channels.intern(channel.c_str());
+        if (channelId == ChannelTable::NONE)
+            ZCM_DEBUG("too many distinct channels, looking up %s by name", channel.c_str());
+    }
+
     if (regex) {
-        if (subRegex.size() == 0) {
+        if (cur->subRegex.size() == 0) {
             rc = zcm_trans_recvmsg_enable(zt, NULL, true);
         } else {
             rc = ZCM_EOK;
@@ -428,7 +1091,7 @@ zcm_sub_t* zcm_blocking_t::subscribe(const string& channel,
         return nullptr;
     }
 
-    zcm_sub_t* sub = new zcm_sub_t();
+    Sub* sub = new Sub();
     ZCM_ASSERT(sub);
     strncpy(sub->channel, channel.c_str(), ZCM_CHANNEL_MAXLEN);
     sub->channel[ZCM_CHANNEL_MAXLEN] = '\0';
@@ -436,51 +1099,149 @@ zcm_sub_t* zcm_blocking_t::subscribe(const string& channel,
     sub->regexobj = nullptr;
     sub->callback = cb;
     sub->usr = usr;
+    sub->channelId = channelId;
+    switch (opts.kind) {
+        case SubQueueOpts::SHARED:
+            break;
+        case SubQueueOpts::BOUNDED:
+            sub->queue = make_shared<BoundedSubQueue>(pool, opts.depth, opts.policy);
+            break;
+        case SubQueueOpts::LATEST:
+            sub->queue = make_shared<LatestSubQueue>(channelId);
+            break;
+    }
+
+    SubTable* next = new SubTable(*cur);
+    if (sub->queue) next->queued.push_back(sub);
     if (regex) {
-        sub->regexobj = (void*) new std::regex(sub->channel);
-        ZCM_ASSERT(sub->regexobj);
-        subRegex.push_back(sub);
+        next->subRegex.push_back(sub);
+        next->matcher = compileMatcher(next->subRegex);
+    } else if (channelId != ChannelTable::NONE) {
+        next->subs[channelId].push_back(sub);
     } else {
-        subs[channel].push_back(sub);
+        next->subsByName[channel].push_back(sub);
     }
 
+    // Nothing was removed, so there is no reason to wait for readers here
+    publishSubTable(next, nullptr);
+
     return sub;
 }
 
 // Note: We use a lock on unsubscribe() to make sure it can be
-// called concurrently. Without the lock, there is a race
-// on modifying and reading the 'subs' and 'subRegex' containers
-int zcm_blocking_t::unsubscribe(zcm_sub_t* sub, bool block)
+// called concurrently. Without the lock, two writers could
+// each publish a table that is missing the other's change
+int zcm_blocking_t::unsubscribe(zcm_sub_t* zsub, bool block)
 {
-    unique_lock<mutex> lk1(subDispMutex, std::defer_lock);
-    unique_lock<mutex> lk2(subRecvMutex, std::defer_lock);
+    unique_lock<mutex> lk(subWriteMutex, std::defer_lock);
     if (block) {
-        lk1.lock();
-        lk2.lock();
-    } else if (!lk1.try_lock() || !lk2.try_lock()) {
+        lk.lock();
+    } else if (!lk.try_lock()) {
         return ZCM_EAGAIN;
     }
 
-    bool success = true;
+    Sub* sub = (Sub*) zsub;
+    const SubTable* cur = subTable.load(memory_order_acquire);
+    SubTable* next = new SubTable(*cur);
+
+    int rc;
     if (sub->regex) {
-        success = deleteFromSubList(subRegex, sub);
-    } else {
-        auto it = subs.find(sub->channel);
-        if (it == subs.end()) {
+        if (!removeFromSubList(next->subRegex, sub)) {
+            ZCM_DEBUG("failed to find the subscription entry in unsubscribe()");
+            delete next;
+            return ZCM_EINVALID;
+        }
+        next->matcher = compileMatcher(next->subRegex);
+        rc = next->subRegex.empty() ? zcm_trans_recvmsg_enable(zt, NULL, false) : ZCM_EOK;
+    } else if (sub->channelId != ChannelTable::NONE) {
+        auto it = next->subs.find(sub->channelId);
+        if (it == next->subs.end()) {
             ZCM_DEBUG("failed to find the subscription channel in unsubscribe()");
+            delete next;
+            return ZCM_EINVALID;
+        }
+        if (!removeFromSubList(it->second, sub)) {
+            ZCM_DEBUG("failed to find the subscription entry in unsubscribe()");
+            delete next;
+            return ZCM_EINVALID;
+        }
+        if (it->second.empty()) next->subs.erase(it);
+        rc = zcm_trans_recvmsg_enable(zt, sub->channel, false);
+    } else {
+        auto it = next->subsByName.find(sub->channel);
+        if (it == next->subsByName.end() || !removeFromSubList(it->second, sub)) {
+            ZCM_DEBUG("failed to find the subscription entry in unsubscribe()");
+            delete next;
             return ZCM_EINVALID;
         }
+        if (it->second.empty()) next->subsByName.erase(it);
+        rc = zcm_trans_recvmsg_enable(zt, sub->channel, false);
+    }
 
-        SubList& slist = it->second;
-        success = deleteFromSubList(slist, sub);
+    if (sub->queue) {
+        removeFromSubList(next->queued, sub);
+        // Wakes the recvThread if it is waiting for room in the queue
+        sub->queue->disable();
     }
 
-    if (!success) {
-        ZCM_DEBUG("failed to find the subscription entry in unsubscribe()");
+    // Keeps a dispatcher that is still using an older table from calling it
+    sub->removed.store(true, memory_order_release);
+    publishSubTable(next, sub);
+    lk.unlock();
+
+    // Unless we are inside a callback (where waiting would deadlock on ourselves),
+    // wait for in-flight dispatches so no callback for 'sub' runs after we return
+    if (block && tlsDispatching != this) reclaimRetired(true);
+
+    if (rc != ZCM_EOK) {
+        ZCM_DEBUG("zcm_trans_recvmsg_enable() didn't return ZCM_EOK: %d", rc);
         return ZCM_EINVALID;
     }
 
-    return 0;
+    return ZCM_EOK;
+}
+
+void zcm_blocking_t::publishSubTable(SubTable* next, Sub* removed)
+{
+    // Readers notice the new generation and drop whatever they cached for the old one
+    next->generation = ++subTableGeneration;
+    const SubTable* prev = subTable.exchange(next, memory_order_acq_rel);
+    retiredTables.push_back(prev);
+    if (removed) retiredSubs.push_back(removed);
+    reclaimPending.store(true, memory_order_release);
+}
+
+void zcm_blocking_t::reclaimRetired(bool block)
+{
+    unique_lock<mutex> lk(reclaimMutex, std::defer_lock);
+    if (block) lk.lock();
+    else if (!lk.try_lock()) return;
+
+    while (true) {
+        if (!graceTables.empty() || !graceSubs.empty()) {
+            if (!subRcu.gracePeriodDone(graceToken)) {
+                // Leaves reclaimPending set so that a later batch checks again
+                if (!block) return;
+                std::this_thread::yield();
+                continue;
+            }
+            for (auto* tbl : graceTables) delete tbl;
+            for (auto* sub : graceSubs) delete sub;
+            graceTables.clear();
+            graceSubs.clear();
+        }
+
+        {
+            unique_lock<mutex> lk2(subWriteMutex);
+            graceTables.swap(retiredTables);
+            graceSubs.swap(retiredSubs);
+            if (graceTables.empty() && graceSubs.empty()) {
+                reclaimPending.store(false, memory_order_relaxed);
+                return;
+            }
+        }
+        graceToken = subRcu.startGracePeriod();
+    }
 }
 
 int zcm_blocking_t::flush(bool block)
@@ -500,28 +1261,57 @@ int zcm_blocking_t::flush(bool block)
 
         sendQueue.enable();
         n = sendQueue.numMessages();
-        for (size_t i = 0; i < n; ++i) sendOneMessage(false);
+        while (n > 0) {
+            size_t sent = sendMessages(n, false);
+            if (sent == 0) break;
+            n -= sent;
+        }
     }
 
-    {
-        recvQueue.disable();
+    int rc = flushRecvQueue(recvQueue, dispOneMutex, dispMatchCache, block);
+    if (rc != ZCM_EOK) return rc;
 
-        unique_lock<mutex> lk(dispOneMutex, defer_lock);
+    for (auto& w : workers) {
+        rc = flushRecvQueue(w->queue, w->dispMutex, w->matchCache, block);
+        if (rc != ZCM_EOK) return rc;
+    }
 
-        if (block) lk.lock();
-        else if (!lk.try_lock()) {
-            recvQueue.enable();
-            return ZCM_EAGAIN;
-        }
+    return ZCM_EOK;
+}
 
-        recvQueue.enable();
-        n = recvQueue.numMessages();
-        for (size_t i = 0; i < n; ++i) dispatchOneMessage(false);
+int zcm_blocking_t::flushRecvQueue(SpscQueue<Msg>& q, mutex& dispMutex, MatchCache& cache,
+                                   bool block)
+{
+    q.disable();
+
+    unique_lock<mutex> lk(dispMutex, defer_lock);
+
+    if (block) lk.lock();
+    else if (!lk.try_lock()) {
+        q.enable();
+        return ZCM_EAGAIN;
+    }
+
+    q.enable();
+    size_t n = q.numMessages() + subQueueBacklog(q);
+    if (n > 0) {
+        q.wake();
+        dispatchMessages(q, cache, n, false);
     }
 
     return ZCM_EOK;
 }
 
+size_t zcm_blocking_t::subQueueBacklog(SpscQueue<Msg>& q)
+{
+    size_t n = 0;
+    unsigned token = subRcu.readLock();
+    for (Sub* sub : subTable.load(memory_order_acquire)->queued)
+        if (&dispatchQueueFor(sub->channelId) == &q) n += sub->queue->size();
+    subRcu.readUnlock(token);
+    return n;
+}
+
 int zcm_blocking_t::setQueueSize(uint32_t numMsgs, bool block)
 {
     if (sendQueue.getCapacity() != numMsgs) {
@@ -540,27 +1330,310 @@ int zcm_blocking_t::setQueueSize(uint32_t numMsgs, bool block)
         sendQueue.enable();
     }
 
-    if (recvQueue.getCapacity() != numMsgs) {
+    int rc = resizeRecvQueue(recvQueue, dispOneMutex, numMsgs, block);
+    if (rc != ZCM_EOK) return rc;
 
-        recvQueue.disable();
+    for (auto& w : workers) {
+        rc = resizeRecvQueue(w->queue, w->dispMutex, numMsgs, block);
+        if (rc != ZCM_EOK) return rc;
+    }
 
-        unique_lock<mutex> lk(dispOneMutex, defer_lock);
+    return ZCM_EOK;
+}
 
-        if (block) lk.lock();
-        else if (!lk.try_lock()) {
-            recvQueue.enable();
-            return ZCM_EAGAIN;
+int zcm_blocking_t::resizeRecvQueue(SpscQueue<Msg>& q, mutex& dispMutex, uint32_t numMsgs,
+                                    bool block)
+{
+    if (q.getCapacity() == numMsgs) return ZCM_EOK;
+
+    q.disable();
+
+    unique_lock<mutex> lk(dispMutex, defer_lock);
+
+    if (block) lk.lock();
+    else if (!lk.try_lock()) {
+        q.enable();
+        return ZCM_EAGAIN;
+    }
+
+    q.setCapacity(numMsgs);
+    q.enable();
+
+    return ZCM_EOK;
+}
+
+// Note: Any messages still queued for the previous workers are dropped
+int zcm_blocking_t::setDispatchThreads(uint32_t nthreads)
+{
+    if (nthreads == 0) return ZCM_EINVALID;
+
+    unique_lock<mutex> lk(recvModeMutex);
+    if (recvMode != RECV_MODE_NONE) {
+        ZCM_DEBUG("Err: call to setDispatchThreads() when 'recvMode != RECV_MODE_NONE'");
+        return ZCM_EINVALID;
+    }
+
+    workers.clear();
+    // A single dispatch thread is just the hndlThread working off of 'recvQueue'
+    if (nthreads == 1) return ZCM_EOK;
+
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        Worker* w = new Worker();
+        w->queue.setCapacity(recvQueue.getCapacity());
+        workers.emplace_back(w);
+    }
+
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setChannelUnordered(const char* channel, bool unordered)
+{
+    if (isRegexChannel(channel)) return ZCM_EINVALID;
+    uint32_t channelId = channels.intern(channel);
+    if (channelId == ChannelTable::NONE) return ZCM_EINVALID;
+
+    unique_lock<mutex> lk(subWriteMutex);
+
+    SubTable* next = new SubTable(*subTable.load(memory_order_acquire));
+    if (next->unordered.size() <= channelId) next->unordered.resize(channelId + 1, false);
+    next->unordered[channelId] = unordered;
+    publishSubTable(next, nullptr);
+
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setPublishMode(zcm_publish_mode mode)
+{
+    if (mode != ZCM_PUBLISH_QUEUED && mode != ZCM_PUBLISH_INLINE) return ZCM_EINVALID;
+    unique_lock<mutex> lk(sendStateMutex);
+    publishMode = mode;
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setBusyPoll(int64_t spinUs)
+{
+    busyPollUs.store(spinUs, memory_order_relaxed);
+    return ZCM_EOK;
+}
+
+static bool validThreadOpts(const zcm_thread_opts_t* opts)
+{
+    if (opts->cpu < -1) return false;
+    if (opts->cpu >= 0 && (uint64_t)opts->cpu + max(opts->ncpus, 1u) > CPU_SETSIZE)
+        return false;
+    if (memchr(opts->name, '\0', sizeof(opts->name)) == nullptr) return false;
+    switch (opts->policy) {
+        case ZCM_SCHED_DEFAULT: return true;
+        case ZCM_SCHED_FIFO:
+            return opts->priority >= sched_get_priority_min(SCHED_FIFO) &&
+                   opts->priority <= sched_get_priority_max(SCHED_FIFO);
+        case ZCM_SCHED_RR:
+            return opts->priority >= sched_get_priority_min(SCHED_RR) &&
+                   opts->priority <= sched_get_priority_max(SCHED_RR);
+    }
+    return false;
+}
+
+int zcm_blocking_t::setThreadOpts(zcm_thread which, const zcm_thread_opts_t* opts)
+{
+    if ((size_t)which >= NUM_THREAD_KINDS || !validThreadOpts(opts)) return ZCM_EINVALID;
+    unique_lock<mutex> lk(threadOptsMutex);
+    threadOpts[which] = *opts;
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::getThreadOpts(zcm_thread which, zcm_thread_opts_t* opts)
+{
+    if ((size_t)which >= NUM_THREAD_KINDS) return ZCM_EINVALID;
+    unique_lock<mutex> lk(threadOptsMutex);
+    *opts = threadOpts[which];
+    return ZCM_EOK;
+}
+
+// "<cpu>" or "<first cpu>-<last cpu>"
+static bool parseCpus(const char* str, zcm_thread_opts_t& opts)
+{
+    char* end;
+    long first = strtol(str, &end, 10);
+    long last = first;
+    if (end == str) return false;
+    if (*end == '-') {
+        const char* s = end + 1;
+        last = strtol(s, &end, 10);
+        if (end == s) return false;
+    }
+    if (*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) return false;
+    opts.cpu = first;
+    opts.ncpus = last - first + 1;
+    return true;
+}
+
+// "fifo:<priority>", "rr:<priority>" or "default"
+static bool parseSched(const char* str, zcm_thread_opts_t& opts)
+{
+    if (strcmp(str, "default") == 0) {
+        opts.policy = ZCM_SCHED_DEFAULT;
+        opts.priority = 0;
+        return true;
+    }
+    const char* prio;
+    if (strncmp(str, "fifo:", 5) == 0) {
+        opts.policy = ZCM_SCHED_FIFO;
+        prio = str + 5;
+    } else if (strncmp(str, "rr:", 3) == 0) {
+        opts.policy = ZCM_SCHED_RR;
+        prio = str + 3;
+    } else {
+        return false;
+    }
+    char* end;
+    opts.priority = strtol(prio, &end, 10);
+    return end != prio && *end == '\0';
+}
+
+void zcm_blocking_t::setUrlOpts(const zcm_url_opts_t* opts)
+{
+    static const char* const prefixes[NUM_THREAD_KINDS] = { "send_", "recv_", "dispatch_" };
+
+    for (size_t t = 0; t < NUM_THREAD_KINDS; ++t) {
+        zcm_thread_opts_t o;
+        getThreadOpts((zcm_thread) t, &o);
+        bool changed = false;
+
+        // The catch-all "sched" first so that "<thread>_sched" overrides it
+        for (size_t i = 0; i < opts->numopts; ++i) {
+            if (strcmp(opts->name[i], "sched") != 0) continue;
+            if (parseSched(opts->value[i], o)) changed = true;
+            else ZCM_DEBUG("bad url option 'sched=%s'", opts->value[i]);
         }
 
-        recvQueue.setCapacity(numMsgs);
-        recvQueue.enable();
+        size_t plen = strlen(prefixes[t]);
+        for (size_t i = 0; i < opts->numopts; ++i) {
+            const char* name = opts->name[i];
+            const char* value = opts->value[i];
+            if (strncmp(name, prefixes[t], plen) != 0) continue;
+            const char* key = name + plen;
+            bool ok;
+            if (strcmp(key, "cpu") == 0) {
+                ok = parseCpus(value, o);
+            } else if (strcmp(key, "sched") == 0) {
+                ok = parseSched(value, o);
+            } else if (strcmp(key, "name") == 0) {
+                ok = strlen(value) < sizeof(o.name);
+                if (ok) strcpy(o.name, value);
+            } else {
+                continue;
+            }
+            if (ok) changed = true;
+            else ZCM_DEBUG("bad url option '%s=%s'", name, value);
+        }
+
+        if (changed && setThreadOpts((zcm_thread) t, &o) != ZCM_EOK)
+            ZCM_DEBUG("bad url options for the %sthread", prefixes[t]);
     }
+}
+
+void zcm_blocking_t::applyThreadOpts(zcm_thread which, size_t index)
+{
+    static const char* const defaultNames[NUM_THREAD_KINDS] =
+        { "zcm-send", "zcm-recv", "zcm-dispatch" };
+
+    zcm_thread_opts_t opts;
+    getThreadOpts(which, &opts);
+
+    // Names longer than 15 characters are cut short
+    char name[sizeof(opts.name)];
+    const char* base = opts.name[0] ? opts.name : defaultNames[which];
+    if (index == 0) snprintf(name, sizeof(name), "%s", base);
+    else            snprintf(name, sizeof(name), "%.12s-%u", base, (unsigned) (index % 100));
 
+    pthread_t self = pthread_self();
+    int rc;
+#ifdef __linux__
+    pthread_setname_np(self, name);
+
+    if (opts.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (uint32_t i = 0; i < max(opts.ncpus, 1u); ++i) CPU_SET(opts.cpu + i, &cpus);
+        rc = pthread_setaffinity_np(self, sizeof(cpus), &cpus);
+        if (rc != 0)
+            ZCM_DEBUG("failed to set the cpu affinity of %s: %s", name, strerror(rc));
+    }
+#endif
+
+    if (opts.policy != ZCM_SCHED_DEFAULT) {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = opts.priority;
+        int policy = opts.policy == ZCM_SCHED_FIFO ? SCHED_FIFO : SCHED_RR;
+        rc = pthread_setschedparam(self, policy, &param);
+        if (rc != 0)
+            ZCM_DEBUG("failed to set the scheduling policy of %s: %s", name, strerror(rc));
+    }
+    (void) rc;
+}
+
+void zcm_blocking_t::getPoolStats(zcm_pool_stats_t* stats)
+{
+    stats->hits = pool.getHits();
+    stats->misses = pool.getMisses();
+}
+
+void zcm_blocking_t::getStats(zcm_stats_t* out)
+{
+    stats.collect(out);
+}
+
+int zcm_blocking_t::setStatsPublish(uint32_t periodMs)
+{
+    thread done;
+    {
+        unique_lock<mutex> lk(statsMutex);
+        bool running = statsPeriodMs != 0;
+        statsPeriodMs = periodMs;
+        if (periodMs != 0 && !running) {
+            statsThread = thread{&zcm_blocking::statsThreadFunc, this, statsRun};
+        } else if (periodMs == 0 && running) {
+            ++statsRun;
+            done = std::move(statsThread);
+        }
+    }
+    statsCond.notify_all();
+    if (done.joinable()) done.join();
     return ZCM_EOK;
 }
 
+void zcm_blocking_t::statsThreadFunc(uint64_t run)
+{
+#ifdef __linux__
+    pthread_setname_np(pthread_self(), "zcm-stats");
+#endif
+
+    unique_lock<mutex> lk(statsMutex);
+    while (statsRun == run) {
+        uint32_t period = statsPeriodMs;
+        auto due = chrono::steady_clock::now() + chrono::milliseconds(period);
+        // Start over if the period changes
+        if (statsCond.wait_until(lk, due, [&]{
+                return statsRun != run || statsPeriodMs != period; }))
+            continue;
+
+        lk.unlock();
+        zcm_stats_t s;
+        stats.collect(&s);
+        string json = StatsRegistry::toJson(s);
+        free(s.channels);
+        int ret = publish(ZCM_STATS_CHANNEL, (const uint8_t*) json.data(), json.size());
+        if (ret != ZCM_EOK) ZCM_DEBUG("failed to publish stats: %d", ret);
+        lk.lock();
+    }
+}
+
 void zcm_blocking_t::sendThreadFunc()
 {
+    applyThreadOpts(ZCM_THREAD_SEND, 0);
+
     while (true) {
         {
             unique_lock<mutex> lk(sendStateMutex);
@@ -570,7 +1643,7 @@ void zcm_blocking_t::sendThreadFunc()
             if (sendThreadState == THREAD_STATE_HALTING) break;
         }
         unique_lock<mutex> lk(sendOneMutex);
-        sendOneMessage(true);
+        sendMessages(SIZE_MAX, true);
     }
 
     unique_lock<mutex> lk(sendStateMutex);
@@ -579,71 +1652,147 @@ void zcm_blocking_t::sendThreadFunc()
 
 void zcm_blocking_t::recvThreadFunc()
 {
+    applyThreadOpts(ZCM_THREAD_RECV, 0);
+
+    // While busy polling, the time until which to keep polling. The window only
+    // opens when a message arrives, so an idle receiver stays blocked.
+    uint64_t spinUntil = 0;
+    bool spinning = false;
+    static const bool multicore = thread::hardware_concurrency() > 1;
+
     while (true) {
         {
             unique_lock<mutex> lk(recvStateMutex);
             if (recvThreadState == THREAD_STATE_HALTING) break;
         }
+
+        int timeout = RECV_TIMEOUT;
+        int64_t spinUs = busyPollUs.load(memory_order_relaxed);
+        if (spinning) {
+            if (spinUs < 0 || (spinUs > 0 && TimeUtil::utime() < spinUntil))
+                timeout = 0;
+            else
+                spinning = false;
+        }
+
         zcm_msg_t msg;
-        int rc = zcm_trans_recvmsg(zt, &msg, RECV_TIMEOUT);
-        if (rc == ZCM_EOK) {
+        msg.channel_id = ZCM_CHANNEL_ID_NONE;
+        msg.trace_utime = 0;
+        msg.trace_seqno = 0;
+        void* loan = nullptr;
+        int rc = useLoan ? zcm_trans_recvmsg_loan(zt, &msg, &loan, timeout)
+                         : zcm_trans_recvmsg(zt, &msg, timeout);
+        if (rc != ZCM_EOK) {
+            // A blocking receive that timed out leaves the spin window closed
+            if (timeout != 0) continue;
+            if (multicore) {
+                cpuRelax();
+            } else {
+                // With a single core, whoever we are polling for can't run while we spin
+                this_thread::yield();
+            }
+        } else {
+            // Any message (re)opens the spin window
+            if (spinUs != 0) {
+                spinning = true;
+                if (spinUs > 0) spinUntil = TimeUtil::utime() + spinUs;
+            }
+
+            // Whether any sub without its own queue wants the message
+            bool wanted = false;
+            bool unordered;
             {
-                unique_lock<mutex> lk(subRecvMutex);
-
-                // Check if message matches a non regex channel
-                auto it = subs.find(msg.channel);
-                if (it == subs.end()) {
-                    // Check if message matches a regex channel
-                    bool foundRegex = false;
-                    for (zcm_sub_t* sub : subRegex) {
-                        regex* r = (regex*)sub->regexobj;
-                        if (regex_match(msg.channel, *r)) {
-                            foundRegex = true;
-                            break;
-                        }
-                    }
-                    // No subscription actually wants the message
-                    if (!foundRegex) continue;
+                unsigned token = subRcu.readLock();
+                const SubTable* tbl = subTable.load(memory_order_acquire);
+                msg.channel_id = resolveChannelId(tbl, msg);
+                // From here on, the name is referenced rather than copied
+                if (msg.channel_id != ChannelTable::NONE)
+                    msg.channel = channels.name(msg.channel_id);
+                for (Sub* sub : lookupSubs(recvMatchCache, tbl, msg.channel_id, msg.channel)) {
+                    if (sub->queue)
+                        recvSubQueues.push_back({sub->queue, &dispatchQueueFor(sub->channelId)});
+                    else
+                        wanted = true;
                 }
+                unordered = tbl->isUnordered(msg.channel_id);
+                subRcu.readUnlock(token);
+            }
+            stats.countIn(msg.channel_id, msg.len);
+
+            // Sub queues are filled outside of the read-side section, since a full
+            // one may make us wait. They copy the message, so they go before any loan
+            // is handed over below.
+            bool queued = !recvSubQueues.empty();
+            for (auto& t : recvSubQueues) {
+                bool dropped;
+                size_t depth;
+                if (t.queue->push(&msg, dropped, depth)) t.dispatchQueue->wake();
+                if (dropped) stats.countDrop(msg.channel_id, ZCM_DROP_SUB_QUEUE);
+                stats.queueDepth(msg.channel_id, depth);
+            }
+            recvSubQueues.clear();
+
+            // No subscription actually wants the message
+            if (!wanted) {
+                if (!queued) stats.countDrop(msg.channel_id, ZCM_DROP_NO_SUBSCRIBER);
+                if (loan) zcm_trans_release_loan(zt, loan);
+                continue;
             }
 
             // Note: After this returns, you have either successfully pushed a message
             //       into the queue, or the queue was disabled and you will quit out of
             //       this loop when you re-check the running condition
-            recvQueue.push(&msg);
+            SpscQueue<Msg>& q = dispatchToWorkers ? workerFor(msg.channel_id, unordered).queue
+                                                  : recvQueue;
+            bool pushed;
+            if (loan) {
+                pushed = q.push(zt, &msg, loan);
+                if (!pushed) zcm_trans_release_loan(zt, loan);
+            } else {
+                pushed = q.push(pool, &msg);
+            }
+            if (pushed) {
+                size_t depth = q.numMessages();
+                stats.recvQueueDepth(depth);
+                stats.queueDepth(msg.channel_id, depth);
+            } else {
+                stats.countDrop(msg.channel_id, ZCM_DROP_RECV_QUEUE);
+            }
         }
     }
     unique_lock<mutex> lk(recvStateMutex);
     recvThreadState = THREAD_STATE_HALTED;
 }
 
-void zcm_blocking_t::hndlThreadFunc()
+void zcm_blocking_t::hndlThreadFunc(bool spawned)
 {
     {
         // Spawn the recv thread
         unique_lock<mutex> lk(recvStateMutex);
         recvThreadState = THREAD_STATE_RUNNING;
+        dispatchToWorkers = !workers.empty();
         recvThread = thread{&zcm_blocking::recvThreadFunc, this};
     }
 
-    // Become the handle thread
-    while (true) {
-        {
-            unique_lock<mutex> lk(hndlStateMutex);
-            hndlPauseCond.wait(lk, [&]{
-                return !paused || hndlThreadState == THREAD_STATE_HALTING;
-            });
-            if (hndlThreadState == THREAD_STATE_HALTING) break;
-        }
-        unique_lock<mutex> lk(dispOneMutex);
-        dispatchOneMessage(true);
+    // Only after spawning the recvThread, which would otherwise inherit our options
+    if (spawned) applyThreadOpts(ZCM_THREAD_DISPATCH, 0);
+
+    // Become the handle thread (and the first worker of the dispatch pool, if any)
+    if (workers.empty()) {
+        dispatchLoop(recvQueue, dispOneMutex, dispMatchCache);
+    } else {
+        for (size_t i = 1; i < workers.size(); ++i)
+            workers[i]->thr = thread{&zcm_blocking::workerThreadFunc, this, workers[i].get(), i};
+        workerThreadFunc(workers[0].get(), 0);
+        for (size_t i = 1; i < workers.size(); ++i)
+            workers[i]->thr.join();
     }
 
     {
         // Shutdown recv thread
         unique_lock<mutex> lk(recvStateMutex);
         recvThreadState = THREAD_STATE_HALTING;
-        recvQueue.disable();
+        disableRecvQueues();
         lk.unlock();
         recvThread.join();
     }
@@ -652,54 +1801,197 @@ void zcm_blocking_t::hndlThreadFunc()
     hndlThreadState = THREAD_STATE_HALTED;
 }
 
-void zcm_blocking_t::dispatchMsg(zcm_msg_t* msg)
+void zcm_blocking_t::workerThreadFunc(Worker* w, size_t index)
 {
+    // Worker 0 is the hndlThread, which is already set up
+    if (index != 0) applyThreadOpts(ZCM_THREAD_DISPATCH, index);
+    dispatchLoop(w->queue, w->dispMutex, w->matchCache);
+}
+
+void zcm_blocking_t::dispatchLoop(SpscQueue<Msg>& q, mutex& dispMutex, MatchCache& cache)
+{
+    while (true) {
+        {
+            unique_lock<mutex> lk(hndlStateMutex);
+            hndlPauseCond.wait(lk, [&]{
+                return !paused || hndlThreadState == THREAD_STATE_HALTING;
+            });
+            if (hndlThreadState == THREAD_STATE_HALTING) break;
+        }
+        unique_lock<mutex> lk(dispMutex);
+        dispatchMessages(q, cache, DISPATCH_BATCH_SIZE, true);
+    }
+}
+
+void zcm_blocking_t::enableRecvQueues()
+{
+    recvQueue.enable();
+    for (auto& w : workers) w->queue.enable();
+
+    unsigned token = subRcu.readLock();
+    for (Sub* sub : subTable.load(memory_order_acquire)->queued) sub->queue->enable();
+    subRcu.readUnlock(token);
+}
+
+void zcm_blocking_t::disableRecvQueues()
+{
+    recvQueue.disable();
+    for (auto& w : workers) w->queue.disable();
+
+    // Subs queues that are full could be holding up the recvThread too
+    unsigned token = subRcu.readLock();
+    for (Sub* sub : subTable.load(memory_order_acquire)->queued) sub->queue->disable();
+    subRcu.readUnlock(token);
+}
+
+SpscQueue<Msg>& zcm_blocking_t::dispatchQueueFor(uint32_t channelId)
+{
+    return dispatchToWorkers ? workerFor(channelId, false).queue : recvQueue;
+}
+
+zcm_blocking_t::Worker& zcm_blocking_t::workerFor(uint32_t channelId, bool unordered)
+{
+    // Nothing ties an order-insensitive channel to one worker, so send it to
+    // whichever worker has the shortest backlog
+    if (unordered) {
+        Worker* best = workers[0].get();
+        size_t bestLen = best->queue.numMessages();
+        for (size_t i = 1; i < workers.size() && bestLen > 0; ++i) {
+            size_t len = workers[i]->queue.numMessages();
+            if (len < bestLen) {
+                best = workers[i].get();
+                bestLen = len;
+            }
+        }
+        return *best;
+    }
+
+    // Otherwise a channel always maps to the same worker, which keeps it in order.
+    // Note: Channels without an id all end up on the first worker.
+    return *workers[channelId % workers.size()];
+}
+
+void zcm_blocking_t::dispatchMsg(const SubTable* tbl, MatchCache& cache, zcm_msg_t* msg)
+{
+    // Note: A callback may (un)subscribe, but that publishes a new table rather than
+    //       touching the cache entry we are iterating over
+    for (Sub* sub : lookupSubs(cache, tbl, msg->channel_id, msg->channel)) {
+        // Subs with their own queue got a copy of the message in there instead
+        if (sub->queue) continue;
+        dispatchToSub(sub, msg);
+    }
+}
+
+void zcm_blocking_t::dispatchToSub(Sub* sub, zcm_msg_t* msg)
+{
+    if (sub->removed.load(memory_order_acquire)) return;
+
+    // Only a traced message knows when it was published. The receive time of an
+    // untraced one would measure something else, so it stays out of the histogram.
+    stats.countDispatch(msg->channel_id, msg->trace_utime ?
+                        (int64_t) (TimeUtil::utime() - msg->trace_utime) : -1);
+
     zcm_recv_buf_t rbuf;
     rbuf.recv_utime = msg->utime;
     rbuf.zcm = z;
     rbuf.data = msg->buf;
     rbuf.data_size = msg->len;
+    rbuf.trace_utime = msg->trace_utime;
+    rbuf.trace_seqno = msg->trace_seqno;
 
-    // Note: We use a lock on dispatch to ensure there is not
-    // a race on modifying and reading the 'subs' container.
-    // This means users cannot call zcm_subscribe or
-    // zcm_unsubscribe from a callback without deadlocking.
-    {
-        unique_lock<mutex> lk(subDispMutex);
-
-        // dispatch to a non regex channel
-        auto it = subs.find(msg->channel);
-        if (it != subs.end()) {
-            for (zcm_sub_t* sub : it->second) {
-                sub->callback(&rbuf, msg->channel, sub->usr);
-            }
-        }
+    unique_lock<recursive_mutex> lk(sub->dispatchMutex, defer_lock);
+    if (sub->channelId == ChannelTable::NONE && !workers.empty()) lk.lock();
+    sub->callback(&rbuf, msg->channel, sub->usr);
+}
 
-        // dispatch to any regex channels
-        for (zcm_sub_t* sub : subRegex) {
-            regex* r = (regex*)sub->regexobj;
-            if (regex_match(msg->channel, *r)) {
-                sub->callback(&rbuf, msg->channel, sub->usr);
-            }
+// Takes one message at a time from each of the sub queues that 'q' is responsible
+// for, so a busy sub can't starve the others
+size_t zcm_blocking_t::dispatchSubQueues(SpscQueue<Msg>& q, size_t maxMsgs)
+{
+    const SubTable* tbl = subTable.load(memory_order_acquire);
+
+    size_t n = 0;
+    bool more = true;
+    while (more && n < maxMsgs) {
+        more = false;
+        for (Sub* sub : tbl->queued) {
+            if (&dispatchQueueFor(sub->channelId) != &q) continue;
+            zcm_msg_t* msg = sub->queue->front();
+            if (msg == nullptr) continue;
+            dispatchToSub(sub, msg);
+            sub->queue->done();
+            more = true;
+            if (++n == maxMsgs) break;
         }
     }
+
+    // We may have left messages behind: make sure the next top() comes right back
+    if (n == maxMsgs) q.wake();
+
+    return n;
 }
 
 bool zcm_blocking_t::dispatchOneMessage(bool returnIfPaused)
 {
-    Msg* m = recvQueue.top();
+    return dispatchMessages(recvQueue, dispMatchCache, 1, returnIfPaused) > 0;
+}
+
+// Waits for the first message (up to 'timeout' ms, or forever if negative)
+// and then dispatches up to 'maxMsgs' messages that are already queued.
+// Returns the number of messages dispatched.
+size_t zcm_blocking_t::dispatchMessages(SpscQueue<Msg>& q, MatchCache& cache, size_t maxMsgs,
+                                        bool returnIfPaused, int timeout)
+{
+    Msg* m;
+    bool woken;
+    do {
+        m = timeout < 0 ? q.top() : q.topFor(timeout);
+        // A wake-up means that one of the sub queues may have a message for us,
+        // unless an earlier dispatch already took care of it
+        woken = q.takeWake();
+    } while (m == nullptr && woken && subQueueBacklog(q) == 0);
     // If the Queue was forcibly woken-up, recheck the
     // running condition, and then retry.
-    if (m == nullptr) return false;
+    if (m == nullptr && !woken) return 0;
 
     if (returnIfPaused) {
         unique_lock<mutex> lk(hndlStateMutex);
-        if (paused || hndlThreadState == THREAD_STATE_HALTING) return false;
+        if (paused || hndlThreadState == THREAD_STATE_HALTING) {
+            // Leave the wake-up for whoever dispatches next
+            if (woken) q.wake();
+            return 0;
+        }
     }
 
-    dispatchMsg(m->get());
-    recvQueue.pop();
-    return true;
+    // The whole batch runs inside one read-side section. The table is reloaded
+    // per message so that subscriptions made by a callback take effect right away.
+    const void* prevDispatching = tlsDispatching;
+    tlsDispatching = this;
+    unsigned token = subRcu.readLock();
+
+    size_t n = 0;
+    while (m != nullptr) {
+        dispatchMsg(subTable.load(memory_order_acquire), cache, m->get());
+        q.pop();
+        if (++n == maxMsgs || !q.hasMessage()) break;
+        m = q.top();
+    }
+
+    if (q.takeWake()) woken = true;
+    if (woken) {
+        if (n < maxMsgs) n += dispatchSubQueues(q, maxMsgs - n);
+        else q.wake();
+    }
+
+    subRcu.readUnlock(token);
+    tlsDispatching = prevDispatching;
+
+    // Free what (un)subscribe calls retired, if no reader can still see it. This
+    // never waits for the callbacks running on other threads
+    if (reclaimPending.load(memory_order_acquire) && tlsDispatching != this)
+        reclaimRetired(false);
+
+    return n;
 }
 
 bool zcm_blocking_t::sendOneMessage(bool returnIfPaused)
@@ -716,27 +2008,118 @@ bool zcm_blocking_t::sendOneMessage(bool returnIfPaused)
 
     zcm_msg_t* msg = m->get();
     int ret = zcm_trans_sendmsg(zt, *msg);
-    if (ret != ZCM_EOK) ZCM_DEBUG("zcm_trans_sendmsg() returned error, dropping the msg!");
+    if (ret != ZCM_EOK) {
+        ZCM_DEBUG("zcm_trans_sendmsg() returned error, dropping the msg!");
+        stats.countDrop(msg->channel_id, ZCM_DROP_SEND_FAILED);
+    }
     sendQueue.pop();
     return true;
 }
 
-bool zcm_blocking_t::deleteSubEntry(zcm_sub_t* sub, size_t nentriesleft)
+size_t zcm_blocking_t::sendMessages(size_t maxMsgs, bool returnIfPaused)
 {
-    int rc = ZCM_EOK;
-    if (sub->regex) {
-        delete (std::regex*) sub->regexobj;
-        if (nentriesleft == 0) {
-            rc = zcm_trans_recvmsg_enable(zt, NULL, false);
+    if (!zcm_trans_can_send_batch(zt)) return sendOneMessage(returnIfPaused) ? 1 : 0;
+
+    Msg* m = sendQueue.top();
+    if (m == nullptr) return 0;
+
+    if (returnIfPaused) {
+        unique_lock<mutex> lk(sendStateMutex);
+        if (paused || sendThreadState == THREAD_STATE_HALTING) return 0;
+    }
+
+    // Only take what has been fully pushed: never wait on a producer mid-push
+    sendBatch.clear();
+    for (size_t i = 0; m != nullptr && i < maxMsgs; m = sendQueue.peek(++i))
+        sendBatch.push_back(*m->get());
+
+    size_t n = 0;
+    int ret = zcm_trans_sendmsg_batch(zt, sendBatch.data(), sendBatch.size(), &n);
+    if (ret != ZCM_EOK) {
+        // A transport that fails a batch yet claims to have sent all of it broke
+        // its contract; blame the last message rather than index past the batch
+        if (n >= sendBatch.size()) n = sendBatch.size() - 1;
+        ZCM_DEBUG("zcm_trans_sendmsg_batch() returned error, dropping the failed msg!");
+        // Drop the message that failed, the ones after it are retried
+        stats.countDrop(sendBatch[n].channel_id, ZCM_DROP_SEND_FAILED);
+        ++n;
+    }
+
+    for (size_t i = 0; i < n; ++i) sendQueue.pop();
+    return n;
+}
+
+uint32_t zcm_blocking_t::resolveChannelId(const SubTable* tbl, const zcm_msg_t& msg)
+{
+    uint32_t id = zcm_msg_channel_id(&msg);
+    if (id != ChannelTable::NONE) return id;
+
+    id = channels.find(msg.channel);
+    if (id != ChannelTable::NONE) return id;
+
+    // Worth an id only if a regex wants the channel, so its matches can be cached.
+    // Regex subs may see any number of channels, so they leave half the table to
+    // later exact subs, and channels beyond that are matched per message.
+    if (tbl->matcher && tbl->matcher->matchesAny(msg.channel))
+        return channels.intern(msg.channel, ChannelTable::MAX_CHANNELS / 2);
+    return ChannelTable::NONE;
+}
+
+const zcm_blocking_t::SubList& zcm_blocking_t::lookupSubs(MatchCache& cache,
+                                                           const SubTable* tbl,
+                                                           uint32_t channelId,
+                                                           const char* channel)
+{
+    if (cache.generation != tbl->generation) {
+        cache.valid.assign(cache.valid.size(), false);
+        cache.generation = tbl->generation;
+    }
+
+    if (channelId == ChannelTable::NONE) {
+        cache.uncached.clear();
+        if (!tbl->subsByName.empty()) {
+            auto exact = tbl->subsByName.find(channel);
+            if (exact != tbl->subsByName.end()) cache.uncached = exact->second;
         }
-    } else {
-        rc = zcm_trans_recvmsg_enable(zt, sub->channel, false);
+        if (tbl->matcher) {
+            cache.matched.clear();
+            tbl->matcher->match(channel, cache.matched);
+            for (size_t i : cache.matched) cache.uncached.push_back(tbl->subRegex[i]);
+        }
+        return cache.uncached;
+    }
+
+    if (channelId >= cache.valid.size()) {
+        cache.valid.resize(channelId + 1, false);
+        cache.entries.resize(channelId + 1);
+    }
+
+    SubList& subs = cache.entries[channelId];
+    if (cache.valid[channelId]) return subs;
+
+    // Subs on the exact channel come first, followed by the matching regex subs
+    subs.clear();
+    auto exact = tbl->subs.find(channelId);
+    if (exact != tbl->subs.end()) subs = exact->second;
+    if (tbl->matcher) {
+        cache.matched.clear();
+        tbl->matcher->match(channel, cache.matched);
+        for (size_t i : cache.matched) subs.push_back(tbl->subRegex[i]);
     }
-    delete sub;
-    return rc == ZCM_EOK;
+    cache.valid[channelId] = true;
+
+    return subs;
 }
 
-bool zcm_blocking_t::deleteFromSubList(SubList& slist, zcm_sub_t* sub)
+shared_ptr<const ChannelMatcher> zcm_blocking_t::compileMatcher(const SubList& subRegex)
+{
+    if (subRegex.empty()) return nullptr;
+    vector<string> patterns;
+    for (Sub* sub : subRegex) patterns.push_back(sub->channel);
+    return make_shared<const ChannelMatcher>(patterns);
+}
+
+bool zcm_blocking_t::removeFromSubList(SubList& slist, Sub* sub)
 {
     for (size_t i = 0; i < slist.size(); i++) {
         if (slist[i] == sub) {
@@ -744,8 +2127,7 @@ bool zcm_blocking_t::deleteFromSubList(SubList& slist, zcm_sub_t* sub)
             size_t last = slist.size()-1;
             slist[i] = slist[last];
             slist.resize(last);
-            // delete the element
-            return deleteSubEntry(sub, slist.size());
+            return true;
         }
     }
     return false;
@@ -769,6 +2151,22 @@ int zcm_blocking_publish(zcm_blocking_t* zcm, const char* channel, const uint8_t
     return zcm->publish(channel, data, len);
 }
 
+int zcm_blocking_publish_acquire(zcm_blocking_t* zcm, const char* channel, uint32_t len,
+                                 uint8_t** buf)
+{
+    return zcm->publishAcquire(channel, len, buf);
+}
+
+int zcm_blocking_publish_commit(zcm_blocking_t* zcm, uint8_t* buf, uint32_t len)
+{
+    return zcm->publishCommit(buf, len);
+}
+
+void zcm_blocking_publish_abort(zcm_blocking_t* zcm, uint8_t* buf)
+{
+    zcm->publishAbort(buf);
+}
+
 zcm_sub_t* zcm_blocking_subscribe(zcm_blocking_t* zcm, const char* channel,
                                   zcm_msg_handler_t cb, void* usr)
 {
@@ -781,6 +2179,48 @@ zcm_sub_t* zcm_blocking_try_subscribe(zcm_blocking_t* zcm, const char* channel,
     return zcm->subscribe(channel, cb, usr, false);
 }
 
+static SubQueueOpts boundedOpts(uint32_t depth, enum zcm_queue_policy policy)
+{
+    SubQueueOpts opts;
+    opts.kind = SubQueueOpts::BOUNDED;
+    opts.depth = depth;
+    opts.policy = policy;
+    return opts;
+}
+
+static SubQueueOpts latestOpts()
+{
+    SubQueueOpts opts;
+    opts.kind = SubQueueOpts::LATEST;
+    return opts;
+}
+
+zcm_sub_t* zcm_blocking_subscribe_queued(zcm_blocking_t* zcm, const char* channel,
+                                         zcm_msg_handler_t cb, void* usr,
+                                         uint32_t depth, enum zcm_queue_policy policy)
+{
+    return zcm->subscribe(channel, cb, usr, true, boundedOpts(depth, policy));
+}
+
+zcm_sub_t* zcm_blocking_try_subscribe_queued(zcm_blocking_t* zcm, const char* channel,
+                                             zcm_msg_handler_t cb, void* usr,
+                                             uint32_t depth, enum zcm_queue_policy policy)
+{
+    return zcm->subscribe(channel, cb, usr, false, boundedOpts(depth, policy));
+}
+
+zcm_sub_t* zcm_blocking_subscribe_latest(zcm_blocking_t* zcm, const char* channel,
+                                         zcm_msg_handler_t cb, void* usr)
+{
+    return zcm->subscribe(channel, cb, usr, true, latestOpts());
+}
+
+zcm_sub_t* zcm_blocking_try_subscribe_latest(zcm_blocking_t* zcm, const char* channel,
+                                             zcm_msg_handler_t cb, void* usr)
+{
+    return zcm->subscribe(channel, cb, usr, false, latestOpts());
+}
+
 int zcm_blocking_unsubscribe(zcm_blocking_t* zcm, zcm_sub_t* sub)
 {
     return zcm->unsubscribe(sub, true);
@@ -836,6 +2276,12 @@ int zcm_blocking_handle(zcm_blocking_t* zcm)
     return zcm->handle();
 }
 
+int zcm_blocking_handle_batch(zcm_blocking_t* zcm, uint32_t maxMsgs, int timeout,
+                              uint32_t* ndispatched)
+{
+    return zcm->handleBatch(maxMsgs, timeout, ndispatched);
+}
+
 void zcm_blocking_set_queue_size(zcm_blocking_t* zcm, uint32_t sz)
 {
     zcm->setQueueSize(sz, true);
@@ -846,4 +2292,57 @@ int  zcm_blocking_try_set_queue_size(zcm_blocking_t* zcm, uint32_t sz)
     return zcm->setQueueSize(sz, false);
 }
 
+int  zcm_blocking_set_dispatch_threads(zcm_blocking_t* zcm, uint32_t nthreads)
+{
+    return zcm->setDispatchThreads(nthreads);
+}
+
+int  zcm_blocking_set_channel_unordered(zcm_blocking_t* zcm, const char* channel,
+                                        int unordered)
+{
+    return zcm->setChannelUnordered(channel, unordered != 0);
+}
+
+int  zcm_blocking_set_publish_mode(zcm_blocking_t* zcm, enum zcm_publish_mode mode)
+{
+    return zcm->setPublishMode(mode);
+}
+
+int  zcm_blocking_set_busy_poll(zcm_blocking_t* zcm, int64_t spin_us)
+{
+    return zcm->setBusyPoll(spin_us);
+}
+
+int  zcm_blocking_set_thread_opts(zcm_blocking_t* zcm, enum zcm_thread thread,
+                                  const zcm_thread_opts_t* opts)
+{
+    return zcm->setThreadOpts(thread, opts);
+}
+
+int  zcm_blocking_get_thread_opts(zcm_blocking_t* zcm, enum zcm_thread thread,
+                                  zcm_thread_opts_t* opts)
+{
+    return zcm->getThreadOpts(thread, opts);
+}
+
+void zcm_blocking_set_url_opts(zcm_blocking_t* zcm, zcm_url_opts_t* opts)
+{
+    zcm->setUrlOpts(opts);
+}
+
+void zcm_blocking_get_pool_stats(zcm_blocking_t* zcm, zcm_pool_stats_t* stats)
+{
+    zcm->getPoolStats(stats);
+}
+
+void zcm_blocking_get_stats(zcm_blocking_t* zcm, zcm_stats_t* stats)
+{
+    zcm->getStats(stats);
+}
+
+int  zcm_blocking_set_stats_publish(zcm_blocking_t* zcm, uint32_t period_ms)
+{
+    return zcm->setStatsPublish(period_ms);
+}
+
 }
@@ -3,6 +3,7 @@
 
 #include "zcm/zcm.h"
 #include "zcm/transport.h"
+#include "zcm/url.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,11 +15,25 @@ void            zcm_blocking_destroy(zcm_blocking_t* zcm);
 
 int zcm_blocking_publish(zcm_blocking_t* zcm, const char* channel,
                          const uint8_t* data, uint32_t len);
+int  zcm_blocking_publish_acquire(zcm_blocking_t* zcm, const char* channel, uint32_t len,
+                                  uint8_t** buf);
+int  zcm_blocking_publish_commit(zcm_blocking_t* zcm, uint8_t* buf, uint32_t len);
+void zcm_blocking_publish_abort(zcm_blocking_t* zcm, uint8_t* buf);
 
 zcm_sub_t* zcm_blocking_subscribe(zcm_blocking_t* zcm, const char* channel,
                                   zcm_msg_handler_t cb, void* usr);
 zcm_sub_t* zcm_blocking_try_subscribe(zcm_blocking_t* zcm, const char* channel,
                                       zcm_msg_handler_t cb, void* usr);
+zcm_sub_t* zcm_blocking_subscribe_queued(zcm_blocking_t* zcm, const char* channel,
+                                         zcm_msg_handler_t cb, void* usr,
+                                         uint32_t depth, enum zcm_queue_policy policy);
+zcm_sub_t* zcm_blocking_try_subscribe_queued(zcm_blocking_t* zcm, const char* channel,
+                                             zcm_msg_handler_t cb, void* usr,
+                                             uint32_t depth, enum zcm_queue_policy policy);
+zcm_sub_t* zcm_blocking_subscribe_latest(zcm_blocking_t* zcm, const char* channel,
+                                         zcm_msg_handler_t cb, void* usr);
+zcm_sub_t* zcm_blocking_try_subscribe_latest(zcm_blocking_t* zcm, const char* channel,
+                                             zcm_msg_handler_t cb, void* usr);
 
 int zcm_blocking_unsubscribe(zcm_blocking_t* zcm, zcm_sub_t* sub);
 int zcm_blocking_try_unsubscribe(zcm_blocking_t* zcm, zcm_sub_t* sub);
@@ -33,8 +48,24 @@ void zcm_blocking_stop(zcm_blocking_t* zcm);
 void zcm_blocking_pause(zcm_blocking_t* zcm);
 void zcm_blocking_resume(zcm_blocking_t* zcm);
 int  zcm_blocking_handle(zcm_blocking_t* zcm);
+int  zcm_blocking_handle_batch(zcm_blocking_t* zcm, uint32_t max_msgs, int timeout,
+                               uint32_t* ndispatched);
 void zcm_blocking_set_queue_size(zcm_blocking_t* zcm, uint32_t numMsgs);
 int  zcm_blocking_try_set_queue_size(zcm_blocking_t* zcm, uint32_t numMsgs);
+int  zcm_blocking_set_dispatch_threads(zcm_blocking_t* zcm, uint32_t nthreads);
+int  zcm_blocking_set_channel_unordered(zcm_blocking_t* zcm, const char* channel,
+                                        int unordered);
+int  zcm_blocking_set_publish_mode(zcm_blocking_t* zcm, enum zcm_publish_mode mode);
+int  zcm_blocking_set_busy_poll(zcm_blocking_t* zcm, int64_t spin_us);
+int  zcm_blocking_set_thread_opts(zcm_blocking_t* zcm, enum zcm_thread thread,
+                                  const zcm_thread_opts_t* opts);
+int  zcm_blocking_get_thread_opts(zcm_blocking_t* zcm, enum zcm_thread thread,
+                                  zcm_thread_opts_t* opts);
+/* Applies the core's own url options, such as thread options. Bad ones are skipped */
+void zcm_blocking_set_url_opts(zcm_blocking_t* zcm, zcm_url_opts_t* opts);
+void zcm_blocking_get_pool_stats(zcm_blocking_t* zcm, zcm_pool_stats_t* stats);
+void zcm_blocking_get_stats(zcm_blocking_t* zcm, zcm_stats_t* stats);
+int  zcm_blocking_set_stats_publish(zcm_blocking_t* zcm, uint32_t period_ms);
 
 #ifdef __cplusplus
 }
@@ -4,11 +4,37 @@
 
 #include <string.h>
 
-/* TODO remove malloc for preallocated mem and linked-lists */
 #ifndef ZCM_NONBLOCK_SUBS_MAX
 #define ZCM_NONBLOCK_SUBS_MAX 512
 #endif
 
+/* Number of slots in the channel index. Must be larger than ZCM_NONBLOCK_SUBS_MAX;
+   lookups stay short as long as the index is at most about half full */
+#ifndef ZCM_NONBLOCK_SUBS_HASH_SIZE
+#define ZCM_NONBLOCK_SUBS_HASH_SIZE (2 * ZCM_NONBLOCK_SUBS_MAX)
+#endif
+
+#if ZCM_NONBLOCK_SUBS_MAX >= 0xffff
+#error "ZCM_NONBLOCK_SUBS_MAX must be less than 65535"
+#endif
+#if ZCM_NONBLOCK_SUBS_HASH_SIZE <= ZCM_NONBLOCK_SUBS_MAX
+#error "ZCM_NONBLOCK_SUBS_HASH_SIZE must be larger than ZCM_NONBLOCK_SUBS_MAX"
+#endif
+
+/* Index into zcm_nonblocking.subs */
+typedef uint16_t sub_idx_t;
+#define SUB_NONE ((sub_idx_t) 0xffff)
+
+/* What a slot of zcm_nonblocking.subs holds */
+enum sub_state
+{
+    SUB_FREE,
+    SUB_LIVE,
+    /* Unsubscribed during a dispatch: left on its list, but skipped, until the
+       outermost dispatch is done walking the lists */
+    SUB_DEAD
+};
+
 struct zcm_nonblocking
 {
     zcm_t* z;
@@ -16,12 +42,97 @@ struct zcm_nonblocking
 
     bool allChannelsEnabled;
 
-    /* TODO speed this up */
+    /* All memory for subscriptions is part of this struct, nothing is malloc'd.
+       Each sub is in exactly one singly linked list (through subNext): the free
+       list, the list of "prefix.*" subs, or the list of subs on one channel,
+       which the channel index points at. Lists are kept in subscription order. */
     zcm_sub_t subs[ZCM_NONBLOCK_SUBS_MAX];
-    bool      subInUse[ZCM_NONBLOCK_SUBS_MAX];
-    size_t    subInUseEnd;
+    uint8_t   subState[ZCM_NONBLOCK_SUBS_MAX]; /* enum sub_state */
+    sub_idx_t subNext[ZCM_NONBLOCK_SUBS_MAX];
+    /* The channel hash for plain subs, the prefix length for "prefix.*" subs */
+    uint32_t  subKey[ZCM_NONBLOCK_SUBS_MAX];
+
+    sub_idx_t freeHead;
+    sub_idx_t prefixHead;
+
+    /* Nesting depth of dispatch_message() (callbacks may handle messages too),
+       and how many SUB_DEAD subs wait for it to drop back to 0 */
+    uint32_t dispatchDepth;
+    uint32_t numDead;
+
+    /* Open addressing (linear probing) over channel names. A slot holds the
+       first sub of a channel, or SUB_NONE */
+    sub_idx_t chanIndex[ZCM_NONBLOCK_SUBS_HASH_SIZE];
 };
 
+/* 32-bit FNV-1a, also returns the length of 'c' */
+static uint32_t hashChannel(const char* c, size_t* clen)
+{
+    uint32_t h = 2166136261u;
+    size_t i;
+    for (i = 0; c[i] != '\0'; ++i) {
+        h ^= (uint8_t) c[i];
+        h *= 16777619u;
+    }
+    *clen = i;
+    return h;
+}
+
+/* Returns the index slot of 'channel', or the empty slot where it would go */
+static size_t findChanSlot(zcm_nonblocking_t* zcm, const char* channel, uint32_t hash)
+{
+    size_t slot = hash % ZCM_NONBLOCK_SUBS_HASH_SIZE;
+    sub_idx_t head;
+    while ((head = zcm->chanIndex[slot]) != SUB_NONE) {
+        if (zcm->subKey[head] == hash && strcmp(zcm->subs[head].channel, channel) == 0)
+            break;
+        slot = (slot + 1) % ZCM_NONBLOCK_SUBS_HASH_SIZE;
+    }
+    return slot;
+}
+
+/* Empties 'slot', shifting back any later entries that would otherwise
+   become unreachable (so that the index never needs tombstones) */
+static void clearChanSlot(zcm_nonblocking_t* zcm, size_t slot)
+{
+    size_t next = slot;
+    size_t home;
+    sub_idx_t head;
+
+    while (true) {
+        zcm->chanIndex[slot] = SUB_NONE;
+        while (true) {
+            next = (next + 1) % ZCM_NONBLOCK_SUBS_HASH_SIZE;
+            head = zcm->chanIndex[next];
+            if (head == SUB_NONE) return;
+            home = zcm->subKey[head] % ZCM_NONBLOCK_SUBS_HASH_SIZE;
+            /* Entries whose home lies cyclically in (slot, next] can stay */
+            if (slot <= next ? (slot < home && home <= next)
+                             : (slot < home || home <= next)) continue;
+            break;
+        }
+        zcm->chanIndex[slot] = head;
+        slot = next;
+    }
+}
+
+/* Appends 'idx' to the list starting at '*head' */
+static void appendSub(zcm_nonblocking_t* zcm, sub_idx_t* head, sub_idx_t idx)
+{
+    zcm->subNext[idx] = SUB_NONE;
+    while (*head != SUB_NONE) head = &zcm->subNext[*head];
+    *head = idx;
+}
+
+/* Removes 'idx' from the list starting at '*head'. Returns false if it isn't there */
+static bool removeSub(zcm_nonblocking_t* zcm, sub_idx_t* head, sub_idx_t idx)
+{
+    while (*head != SUB_NONE && *head != idx) head = &zcm->subNext[*head];
+    if (*head == SUB_NONE) return false;
+    *head = zcm->subNext[idx];
+    return true;
+}
+
 static bool isRegexChannel(const char* c, size_t clen)
 {
     /* These chars are considered regex */
@@ -56,6 +167,7 @@ static bool isSupportedRegex(const char* c, size_t clen)
 zcm_nonblocking_t* zcm_nonblocking_create(zcm_t* z, zcm_trans_t* zt)
 {
     zcm_nonblocking_t* zcm;
+    size_t i;
 
     zcm = malloc(sizeof(zcm_nonblocking_t));
     if (!zcm) return NULL;
@@ -63,11 +175,18 @@ zcm_nonblocking_t* zcm_nonblocking_create(zcm_t* z, zcm_trans_t* zt)
     zcm->zt = zt;
     zcm->allChannelsEnabled = false;
 
-    size_t i;
-    for (i = 0; i < ZCM_NONBLOCK_SUBS_MAX; ++i)
-        zcm->subInUse[i] = false;
+    for (i = 0; i < ZCM_NONBLOCK_SUBS_MAX; ++i) {
+        zcm->subState[i] = SUB_FREE;
+        zcm->subNext[i] = i + 1 < ZCM_NONBLOCK_SUBS_MAX ? (sub_idx_t)(i + 1) : SUB_NONE;
+    }
+    zcm->freeHead = 0;
+    zcm->prefixHead = SUB_NONE;
+    zcm->dispatchDepth = 0;
+    zcm->numDead = 0;
+
+    for (i = 0; i < ZCM_NONBLOCK_SUBS_HASH_SIZE; ++i)
+        zcm->chanIndex[i] = SUB_NONE;
 
-    zcm->subInUseEnd = 0;
     return zcm;
 }
 
@@ -85,7 +204,9 @@ int zcm_nonblocking_publish(zcm_nonblocking_t* z, const char* channel,
 {
     zcm_msg_t msg;
 
+    msg.utime = 0;
     msg.channel = channel;
+    msg.channel_id = ZCM_CHANNEL_ID_NONE;
     msg.len = len;
     /* Casting away constness okay because msg isn't used past end of function */
     msg.buf = (uint8_t*) data;
@@ -96,7 +217,9 @@ zcm_sub_t* zcm_nonblocking_subscribe(zcm_nonblocking_t* zcm, const char* channel
                                      zcm_msg_handler_t cb, void* usr)
 {
     int rc;
-    size_t i;
+    sub_idx_t idx;
+    size_t slot;
+    zcm_sub_t* sub;
 
     size_t clen = strlen(channel);
     bool regex = isRegexChannel(channel, clen);
@@ -116,93 +239,142 @@ zcm_sub_t* zcm_nonblocking_subscribe(zcm_nonblocking_t* zcm, const char* channel
         return NULL;
     }
 
-    for (i = 0; i <= zcm->subInUseEnd && i < ZCM_NONBLOCK_SUBS_MAX; ++i) {
-        if (!zcm->subInUse[i]) {
+    idx = zcm->freeHead;
+    if (idx == SUB_NONE) return NULL;
+    zcm->freeHead = zcm->subNext[idx];
+
+    sub = &zcm->subs[idx];
+    strncpy(sub->channel, channel, ZCM_CHANNEL_MAXLEN);
+    sub->channel[ZCM_CHANNEL_MAXLEN] = '\0';
+    sub->regex = regex;
+    sub->regexobj = NULL;
+    sub->callback = cb;
+    sub->usr = usr;
+    zcm->subState[idx] = SUB_LIVE;
 
-            strncpy(zcm->subs[i].channel, channel, ZCM_CHANNEL_MAXLEN);
-            zcm->subs[i].channel[ZCM_CHANNEL_MAXLEN] = '\0';
-            zcm->subs[i].callback = cb;
-            zcm->subs[i].usr = usr;
-            zcm->subInUse[i] = true;
+    if (regex) {
+        /* This only works because isSupportedRegex() was called above */
+        zcm->subKey[idx] = strlen(sub->channel) - 2;
+        appendSub(zcm, &zcm->prefixHead, idx);
+    } else {
+        zcm->subKey[idx] = hashChannel(sub->channel, &clen);
+        slot = findChanSlot(zcm, sub->channel, zcm->subKey[idx]);
+        appendSub(zcm, &zcm->chanIndex[slot], idx);
+    }
 
-            if (i == zcm->subInUseEnd) ++zcm->subInUseEnd;
+    return sub;
+}
 
-            return &zcm->subs[i];
-        }
+/* Takes 'idx' off its list and puts it back on the free list */
+static void releaseSub(zcm_nonblocking_t* zcm, sub_idx_t idx)
+{
+    zcm_sub_t* sub = &zcm->subs[idx];
+    size_t slot;
+
+    if (sub->regex) {
+        removeSub(zcm, &zcm->prefixHead, idx);
+    } else {
+        slot = findChanSlot(zcm, sub->channel, zcm->subKey[idx]);
+        removeSub(zcm, &zcm->chanIndex[slot], idx);
+        if (zcm->chanIndex[slot] == SUB_NONE) clearChanSlot(zcm, slot);
     }
-    return NULL;
+
+    zcm->subState[idx] = SUB_FREE;
+    zcm->subNext[idx] = zcm->freeHead;
+    zcm->freeHead = idx;
 }
 
 int zcm_nonblocking_unsubscribe(zcm_nonblocking_t* zcm, zcm_sub_t* sub)
 {
-    size_t i;
-    int    match_idx = sub - zcm->subs;
+    size_t slot;
+    sub_idx_t i;
+    sub_idx_t idx;
     size_t num_chan_matches = 0;
     int rc = ZCM_EOK;
-    for (i = 0; i < zcm->subInUseEnd; ++i) {
-        /* Note: it would be nice if we didn't have to do a string comp to unsubscribe, but
-                 we need to count the number of channel matches so we know when we can disable
-                 the transport's recvmsg_enable */
-        if (strncmp(sub->channel, zcm->subs[i].channel,
-                    sizeof(zcm->subs[i].channel)/sizeof(zcm->subs[i].channel[0])) == 0) {
-            ++num_chan_matches;
-        }
+
+    if (sub < zcm->subs || sub >= zcm->subs + ZCM_NONBLOCK_SUBS_MAX) return ZCM_EINVALID;
+    idx = (sub_idx_t)(sub - zcm->subs);
+    if (zcm->subState[idx] != SUB_LIVE) return ZCM_EINVALID;
+
+    /* Count the subs on this channel so we know when we can disable
+       the transport's recvmsg_enable */
+    if (sub->regex) {
+        for (i = zcm->prefixHead; i != SUB_NONE; i = zcm->subNext[i])
+            if (zcm->subState[i] == SUB_LIVE &&
+                strcmp(sub->channel, zcm->subs[i].channel) == 0) ++num_chan_matches;
+    } else {
+        slot = findChanSlot(zcm, sub->channel, zcm->subKey[idx]);
+        for (i = zcm->chanIndex[slot]; i != SUB_NONE; i = zcm->subNext[i])
+            if (zcm->subState[i] == SUB_LIVE) ++num_chan_matches;
     }
 
-    if (0 <= match_idx && match_idx < zcm->subInUseEnd) {
-        if (num_chan_matches <= 1) {
-            rc = zcm_trans_recvmsg_enable(zcm->zt, sub->channel, false);
-        }
+    if (num_chan_matches <= 1) {
+        rc = zcm_trans_recvmsg_enable(zcm->zt, sub->channel, false);
+    }
 
-        zcm->subInUse[match_idx] = false;
-        while (zcm->subInUseEnd > 0 && !zcm->subInUse[zcm->subInUseEnd - 1]) {
-            --zcm->subInUseEnd;
-        }
+    /* A dispatch (maybe several, nested) may be walking this sub's list
+       right now, so it has to stay on it until they are done */
+    if (zcm->dispatchDepth > 0) {
+        zcm->subState[idx] = SUB_DEAD;
+        ++zcm->numDead;
     } else {
-        rc = ZCM_EINVALID;
+        releaseSub(zcm, idx);
     }
 
     return rc;
 }
 
-static void dispatch_message(zcm_nonblocking_t* zcm, zcm_msg_t* msg)
+static void dispatch_to(zcm_nonblocking_t* zcm, zcm_msg_t* msg, zcm_sub_t* sub)
 {
     zcm_recv_buf_t rbuf;
-    zcm_sub_t* sub;
 
-    size_t i;
-    for (i = 0; i < zcm->subInUseEnd; ++i) {
-        if (!zcm->subInUse[i]) continue;
-
-        size_t subsChanLen = strlen(zcm->subs[i].channel);
-        if (isRegexChannel(zcm->subs[i].channel, subsChanLen)) {
-            size_t msgLen = strlen(msg->channel);
-            /* This only works because isSupportedRegex() is called on subscribe */
-            if (msgLen > 2 &&
-                strncmp(zcm->subs[i].channel, msg->channel, subsChanLen - 2) == 0) {
-
-                rbuf.zcm = zcm->z;
-                rbuf.data = msg->buf;
-                rbuf.data_size = msg->len;
-                rbuf.recv_utime = msg->utime;
-
-                sub = &zcm->subs[i];
-                sub->callback(&rbuf, msg->channel, sub->usr);
-            }
-        } else {
-            if (strcmp(zcm->subs[i].channel, msg->channel) == 0) {
-                rbuf.zcm = zcm->z;
-                rbuf.data = msg->buf;
-                rbuf.data_size = msg->len;
-                rbuf.recv_utime = msg->utime;
-
-                sub = &zcm->subs[i];
-                sub->callback(&rbuf, msg->channel, sub->usr);
-            }
-        }
+    rbuf.zcm = zcm->z;
+    rbuf.data = msg->buf;
+    rbuf.data_size = msg->len;
+    rbuf.recv_utime = msg->utime;
+    rbuf.trace_utime = msg->trace_utime;
+    rbuf.trace_seqno = msg->trace_seqno;
+
+    sub->callback(&rbuf, msg->channel, sub->usr);
+}
+
+/* Callbacks may (un)subscribe. Subscriptions they add to the list being walked
+   are appended, and see the message too; the ones they remove are SUB_DEAD until
+   the outermost dispatch is done, so the walk can always follow subNext. */
+static void dispatch_message(zcm_nonblocking_t* zcm, zcm_msg_t* msg)
+{
+    size_t msgLen;
+    uint32_t hash = hashChannel(msg->channel, &msgLen);
+    size_t slot = findChanSlot(zcm, msg->channel, hash);
+    sub_idx_t i;
+
+    ++zcm->dispatchDepth;
+
+    for (i = zcm->chanIndex[slot]; i != SUB_NONE; i = zcm->subNext[i])
+        if (zcm->subState[i] == SUB_LIVE) dispatch_to(zcm, msg, &zcm->subs[i]);
+
+    if (msgLen > 2) {
+        for (i = zcm->prefixHead; i != SUB_NONE; i = zcm->subNext[i])
+            if (zcm->subState[i] == SUB_LIVE &&
+                strncmp(zcm->subs[i].channel, msg->channel, zcm->subKey[i]) == 0)
+                dispatch_to(zcm, msg, &zcm->subs[i]);
+    }
+
+    if (--zcm->dispatchDepth == 0 && zcm->numDead > 0) {
+        for (i = 0; i < ZCM_NONBLOCK_SUBS_MAX; ++i)
+            if (zcm->subState[i] == SUB_DEAD) releaseSub(zcm, i);
+        zcm->numDead = 0;
     }
 }
 
+static int recv_message(zcm_nonblocking_t* zcm, zcm_msg_t* msg)
+{
+    /* Transports that don't trace leave these alone */
+    msg->trace_utime = 0;
+    msg->trace_seqno = 0;
+    return zcm_trans_recvmsg(zcm->zt, msg, 0);
+}
+
 int zcm_nonblocking_handle_nonblock(zcm_nonblocking_t* zcm)
 {
     int ret;
@@ -212,13 +384,36 @@ int zcm_nonblocking_handle_nonblock(zcm_nonblocking_t* zcm)
     zcm_trans_update(zcm->zt);
 
     /* Try to receive a messages from the transport and dispatch them */
-    if ((ret = zcm_trans_recvmsg(zcm->zt, &msg, 0)) != ZCM_EOK) return ret;
+    if ((ret = recv_message(zcm, &msg)) != ZCM_EOK) return ret;
 
     dispatch_message(zcm, &msg);
 
     return ZCM_EOK;
 }
 
+int zcm_nonblocking_handle_nonblock_budget(zcm_nonblocking_t* zcm, uint32_t max_msgs,
+                                           uint64_t max_us,
+                                           uint64_t (*time_now)(void* usr), void* usr)
+{
+    uint32_t n = 0;
+    uint64_t start = 0;
+    zcm_msg_t msg;
+
+    /* The transport-level update is done once for the whole batch */
+    zcm_trans_update(zcm->zt);
+
+    if (time_now) start = time_now(usr);
+
+    while (n < max_msgs) {
+        if (recv_message(zcm, &msg) != ZCM_EOK) break;
+        dispatch_message(zcm, &msg);
+        ++n;
+        if (time_now && time_now(usr) - start >= max_us) break;
+    }
+
+    return (int) n;
+}
+
 void zcm_nonblocking_flush(zcm_nonblocking_t* zcm)
 {
     /* Call twice because we need to make sure publish and subscribe are both handled */
@@ -226,6 +421,6 @@ void zcm_nonblocking_flush(zcm_nonblocking_t* zcm)
     zcm_trans_update(zcm->zt);
 
     zcm_msg_t msg;
-    while (zcm_trans_recvmsg(zcm->zt, &msg, 0) == ZCM_EOK)
+    while (recv_message(zcm, &msg) == ZCM_EOK)
         dispatch_message(zcm, &msg);
 }
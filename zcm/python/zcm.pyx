@@ -23,6 +23,13 @@ cdef extern from "zcm/zcm.h":
         uint32_t data_size
         pass
     ctypedef void (*zcm_msg_handler_t)(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+    cdef enum zcm_queue_policy:
+        ZCM_QUEUE_BLOCK,
+        ZCM_QUEUE_DROP_OLDEST,
+        ZCM_QUEUE_DROP_NEWEST
+    cdef enum zcm_publish_mode:
+        ZCM_PUBLISH_QUEUED,
+        ZCM_PUBLISH_INLINE
 
     zcm_t* zcm_create (const char* url)
     void   zcm_destroy(zcm_t* zcm)
@@ -32,6 +39,9 @@ cdef extern from "zcm/zcm.h":
     const char* zcm_strerrno(int err)
 
     zcm_sub_t* zcm_try_subscribe  (zcm_t* zcm, const char* channel, zcm_msg_handler_t cb, void* usr)
+    zcm_sub_t* zcm_try_subscribe_queued(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb, void* usr,
+                                        uint32_t depth, zcm_queue_policy policy)
+    zcm_sub_t* zcm_try_subscribe_latest(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb, void* usr)
     int        zcm_try_unsubscribe(zcm_t* zcm, zcm_sub_t* sub)
 
     int  zcm_publish(zcm_t* zcm, const char* channel, const uint8_t* data, uint32_t dlen)
@@ -44,7 +54,12 @@ cdef extern from "zcm/zcm.h":
     void zcm_pause             (zcm_t* zcm)
     void zcm_resume            (zcm_t* zcm)
     int  zcm_handle            (zcm_t* zcm)
+    int  zcm_handle_batch      (zcm_t* zcm, uint32_t max_msgs, int timeout)
     int  zcm_try_set_queue_size(zcm_t* zcm, uint32_t numMsgs)
+    int  zcm_set_dispatch_threads(zcm_t* zcm, uint32_t nthreads)
+    int  zcm_set_channel_unordered(zcm_t* zcm, const char* channel, int unordered)
+    int  zcm_set_publish_mode(zcm_t* zcm, zcm_publish_mode mode)
+    int  zcm_set_busy_poll(zcm_t* zcm, int64_t spin_us)
 
     int  zcm_handle_nonblock(zcm_t* zcm)
 
@@ -70,6 +85,13 @@ cdef extern from "zcm/zcm.h":
     int                   zcm_eventlog_write_event(zcm_eventlog_t* eventlog, \
                                                    const zcm_eventlog_event_t* event)
 
+QUEUE_BLOCK       = ZCM_QUEUE_BLOCK
+QUEUE_DROP_OLDEST = ZCM_QUEUE_DROP_OLDEST
+QUEUE_DROP_NEWEST = ZCM_QUEUE_DROP_NEWEST
+
+PUBLISH_QUEUED = ZCM_PUBLISH_QUEUED
+PUBLISH_INLINE = ZCM_PUBLISH_INLINE
+
 cdef class ZCMSubscription:
     cdef zcm_sub_t* sub
     cdef object handler
@@ -126,6 +148,35 @@ cdef class ZCM:
                 self.subscriptions.append(subs)
                 return subs
             time.sleep(0) # yield the gil
+    # Like subscribe() (or subscribe_raw() if msgtype is None), with the subscription
+    # getting its own queue of 'depth' messages. See zcm_subscribe_queued()
+    def subscribe_queued(self, str channel, msgtype, handler, depth, policy=QUEUE_BLOCK):
+        cdef ZCMSubscription subs = ZCMSubscription()
+        cdef zcm_msg_handler_t cb = handler_cb_raw if msgtype is None else handler_cb
+        if depth == 0:
+            return None
+        subs.handler = handler
+        subs.msgtype = msgtype
+        while True:
+            subs.sub = zcm_try_subscribe_queued(self.zcm, channel.encode('utf-8'), cb, <void*> subs,
+                                                depth, policy)
+            if subs.sub != NULL:
+                self.subscriptions.append(subs)
+                return subs
+            time.sleep(0) # yield the gil
+    # Like subscribe() (or subscribe_raw() if msgtype is None), but only the newest
+    # message of each channel is dispatched. See zcm_subscribe_latest()
+    def subscribe_latest(self, str channel, msgtype, handler):
+        cdef ZCMSubscription subs = ZCMSubscription()
+        cdef zcm_msg_handler_t cb = handler_cb_raw if msgtype is None else handler_cb
+        subs.handler = handler
+        subs.msgtype = msgtype
+        while True:
+            subs.sub = zcm_try_subscribe_latest(self.zcm, channel.encode('utf-8'), cb, <void*> subs)
+            if subs.sub != NULL:
+                self.subscriptions.append(subs)
+                return subs
+            time.sleep(0) # yield the gil
     def unsubscribe(self, ZCMSubscription subs):
         while zcm_try_unsubscribe(self.zcm, subs.sub) != ZCM_EOK:
             time.sleep(0) # yield the gil
@@ -150,9 +201,19 @@ cdef class ZCM:
         zcm_resume(self.zcm)
     def handle(self):
         return zcm_handle(self.zcm)
+    def handleBatch(self, maxMsgs, timeout):
+        return zcm_handle_batch(self.zcm, maxMsgs, timeout)
     def setQueueSize(self, numMsgs):
         while zcm_try_set_queue_size(self.zcm, numMsgs) != ZCM_EOK:
             time.sleep(0) # yield the gil
+    def setDispatchThreads(self, nthreads):
+        return zcm_set_dispatch_threads(self.zcm, nthreads)
+    def setChannelUnordered(self, basestring channel, unordered):
+        return zcm_set_channel_unordered(self.zcm, channel.encode('utf-8'), 1 if unordered else 0)
+    def setPublishMode(self, mode):
+        return zcm_set_publish_mode(self.zcm, mode)
+    def setBusyPoll(self, spinUs):
+        return zcm_set_busy_poll(self.zcm, spinUs)
     def handleNonblock(self):
         return zcm_handle_nonblock(self.zcm)
 
@@ -106,6 +106,73 @@
  *      --------------------------------------------------------------------
  *         Close the transport and cleanup any resources used.
  *
+ *      int recvmsg_loan(zcm_trans_t* zt, zcm_msg_t* msg, void** loan, int timeout)
+ *      --------------------------------------------------------------------
+ *         OPTIONAL: This method may be set to NULL. It has the same semantics
+ *         as recvmsg() except that the memory referenced by 'msg' is loaned to
+ *         the caller instead of only being valid until the next recvmsg() call.
+ *         On ZCM_EOK, the transport sets '*loan' to an opaque handle for the
+ *         loaned memory. The 'msg' fields stay valid until the caller hands
+ *         this handle back via release_loan(). This allows the core to queue
+ *         the received message without copying it.
+ *         NOTE: Any number of loans may be outstanding at once. The transport
+ *         should fall back to blocking or dropping (not failing) if it runs low
+ *         on buffers. All loans are released before destroy() is called.
+ *
+ *      void release_loan(zcm_trans_t* zt, void* loan)
+ *      --------------------------------------------------------------------
+ *         OPTIONAL: Must be non-NULL iff recvmsg_loan() is non-NULL.
+ *         Returns memory previously loaned by recvmsg_loan() to the transport.
+ *         NOTE: This method may be called from any thread and must work
+ *         concurrently and correctly with recvmsg_loan().
+ *
+ *      int sendmsg_batch(zcm_trans_t* zt, const zcm_msg_t* msgs, size_t n,
+ *                        size_t* nsent)
+ *      --------------------------------------------------------------------
+ *         OPTIONAL: This method may be set to NULL. Sends 'msgs[0..n)' in
+ *         order, with the same per-message semantics as sendmsg(), and
+ *         stops at the first message that fails. This lets the transport
+ *         amortize its per-message cost (e.g. one syscall for the whole
+ *         batch). Sets '*nsent' to the number of messages sent. Returns
+ *         ZCM_EOK if all messages were sent, otherwise the error of
+ *         'msgs[*nsent]', the message that failed (the ones after it were
+ *         not attempted).
+ *         NOTE: The core only calls this from its send thread or from
+ *         zcm_flush(), never concurrently with sendmsg().
+ *
+ *      bool sendmsg_concurrent(zcm_trans_t* zt)
+ *      --------------------------------------------------------------------
+ *         OPTIONAL: This method may be set to NULL, which means false.
+ *         Returns true if sendmsg() may be called from several threads at
+ *         once (and concurrently with sendmsg_batch()). The core uses this in
+ *         ZCM_PUBLISH_INLINE mode, where sendmsg() runs on the publishing
+ *         thread: if false, inline sends are serialized by the core.
+ *
+ *      Channel ids
+ *      --------------------------------------------------------------------
+ *         Channel names can be interned process-wide with zcm_channel_intern(),
+ *         which returns a small integer id (ZCM_CHANNEL_ID_NONE if the table is
+ *         full). The interned name, from zcm_channel_name(), is never freed and
+ *         is unique per id. A zcm_msg_t carries an id in 'channel_id', which is
+ *         only meaningful if 'channel' points at the interned name for that id
+ *         (see zcm_msg_channel_id()), so callers that don't know about ids are
+ *         unaffected. The blocking core passes ids to sendmsg(). Transports that
+ *         know their channels ahead of time can intern them once and deliver
+ *         ids from recvmsg(), sparing the core a lookup by name per message.
+ *
+ *      Tracing
+ *      --------------------------------------------------------------------
+ *         A transport may carry the publisher's 'utime' and a per-sender
+ *         sequence number alongside each message, so receivers can measure
+ *         publish-to-callback latency across processes. Transports that
+ *         support it send traced messages when given the url option
+ *         'trace=true'. Whatever their own setting, they set 'trace_utime' and
+ *         'trace_seqno' in recvmsg() for every traced message they receive.
+ *         The core zeroes both fields before each recvmsg(), so transports
+ *         that don't trace can ignore them. A sender that doesn't trace must
+ *         produce exactly the framing it did before tracing existed; receivers
+ *         that predate tracing may not understand traced messages.
+ *
  *******************************************************************************
  * Non-Blocking Transport API:
  *
@@ -176,6 +243,10 @@
  *      --------------------------------------------------------------------
  *         Close the transport and cleanup any resources used.
  *
+ *      recvmsg_loan(), release_loan(), sendmsg_batch() and sendmsg_concurrent()
+ *      --------------------------------------------------------------------
+ *         Unused (in this mode). These fields should be NULL.
+ *
  ******************************************************************************/
 
 #ifdef __cplusplus
@@ -207,8 +278,14 @@ struct zcm_msg_t
     const char* channel;
     size_t len;
     uint8_t* buf;
+    uint32_t channel_id; /* See "Channel ids" above, ZCM_CHANNEL_ID_NONE if unknown */
+    /* See "Tracing" above. Only read on receive, 0 if the message wasn't traced */
+    uint64_t trace_utime;
+    uint32_t trace_seqno;
 };
 
+#define ZCM_CHANNEL_ID_NONE 0
+
 struct zcm_trans_t
 {
     enum zcm_type trans_type;
@@ -223,6 +300,14 @@ struct zcm_trans_methods_t
     int     (*recvmsg)(zcm_trans_t* zt, zcm_msg_t* msg, int timeout);
     int     (*update)(zcm_trans_t* zt);
     void    (*destroy)(zcm_trans_t* zt);
+
+    /* Optional methods: transports may leave these NULL (or omit them from a
+       static initializer) if they are unsupported */
+    int     (*recvmsg_loan)(zcm_trans_t* zt, zcm_msg_t* msg, void** loan, int timeout);
+    void    (*release_loan)(zcm_trans_t* zt, void* loan);
+    int     (*sendmsg_batch)(zcm_trans_t* zt, const zcm_msg_t* msgs, size_t n,
+                             size_t* nsent);
+    bool    (*sendmsg_concurrent)(zcm_trans_t* zt);
 };
 
 /* Helper functions to make the VTbl dispatch cleaner */
@@ -244,6 +329,40 @@ static INLINE int zcm_trans_update(zcm_trans_t* zt)
 static INLINE void zcm_trans_destroy(zcm_trans_t* zt)
 { return zt->vtbl->destroy(zt); }
 
+static INLINE bool zcm_trans_can_loan(zcm_trans_t* zt)
+{ return zt->vtbl->recvmsg_loan != NULL && zt->vtbl->release_loan != NULL; }
+
+static INLINE int zcm_trans_recvmsg_loan(zcm_trans_t* zt, zcm_msg_t* msg, void** loan, int timeout)
+{ return zt->vtbl->recvmsg_loan(zt, msg, loan, timeout); }
+
+static INLINE void zcm_trans_release_loan(zcm_trans_t* zt, void* loan)
+{ return zt->vtbl->release_loan(zt, loan); }
+
+static INLINE bool zcm_trans_can_send_batch(zcm_trans_t* zt)
+{ return zt->vtbl->sendmsg_batch != NULL; }
+
+static INLINE int zcm_trans_sendmsg_batch(zcm_trans_t* zt, const zcm_msg_t* msgs, size_t n,
+                                          size_t* nsent)
+{ return zt->vtbl->sendmsg_batch(zt, msgs, n, nsent); }
+
+static INLINE bool zcm_trans_sendmsg_concurrent(zcm_trans_t* zt)
+{ return zt->vtbl->sendmsg_concurrent != NULL && zt->vtbl->sendmsg_concurrent(zt); }
+
+#ifndef ZCM_EMBEDDED
+/* Channel interning (see "Channel ids" above) */
+uint32_t    zcm_channel_intern(const char* channel);
+uint32_t    zcm_channel_find(const char* channel); /* Never adds 'channel' */
+const char* zcm_channel_name(uint32_t id);         /* NULL if 'id' is unknown */
+
+/* Returns msg->channel_id if it is valid for msg->channel, else ZCM_CHANNEL_ID_NONE */
+static INLINE uint32_t zcm_msg_channel_id(const zcm_msg_t* msg)
+{
+    if (msg->channel_id != ZCM_CHANNEL_ID_NONE &&
+        zcm_channel_name(msg->channel_id) == msg->channel) return msg->channel_id;
+    return ZCM_CHANNEL_ID_NONE;
+}
+#endif
+
 #ifdef __cplusplus
 }
 #endif
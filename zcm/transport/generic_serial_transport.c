@@ -24,22 +24,41 @@
 //   sum2(*chan, *data)
 #define FRAME_BYTES 9
 
+// A traced frame (see "Tracing" in transport.h) has 0x01 in place of the 0x00,
+// followed by the trace right after data_len (size = 21 + chan_len + data_len)
+//   utime     (8 bytes)
+//   seqno     (4 bytes)
+// which is covered by the checksum, ahead of *chan and *data
+#define TRACE_BYTES 12
+
 // Note: there is little to no error checking in this, misuse will cause problems
+//
+// At most capacity - 1 bytes are ever held. front and back stay below capacity;
+// when capacity is a power of two they wrap with a mask, otherwise with a compare.
 typedef struct circBuffer_t circBuffer_t;
 struct circBuffer_t
 {
     uint8_t* data;
     size_t capacity;
+    size_t mask; // capacity - 1 if capacity is a power of two, else 0
     size_t front;
     size_t back;
 };
 
+// Wraps an index below 2 * capacity back into the buffer
+static inline size_t cb_wrap(circBuffer_t* cb, size_t idx)
+{
+    if (cb->mask != 0) return idx & cb->mask;
+    return idx >= cb->capacity ? idx - cb->capacity : idx;
+}
+
 bool cb_init(circBuffer_t* cb, size_t sz)
 {
     cb->capacity = sz;
     cb->front = 0;
     cb->back  = 0;
     if (cb->capacity == 0) return false;
+    cb->mask = (sz & (sz - 1)) == 0 ? sz - 1 : 0;
     cb->data = malloc(cb->capacity * sizeof(uint8_t));
     if (cb->data == NULL) {
         cb->capacity = 0;
@@ -68,35 +87,40 @@ size_t cb_room(circBuffer_t* cb)
 
 void cb_push(circBuffer_t* cb, uint8_t d)
 {
-    ASSERT((cb->capacity > cb_size(cb) + 1) && "cb_push 1");
-    ASSERT((cb_room(cb) > 0) && "cb_push 2");
-    cb->data[cb->back++] = d;
-    ASSERT((cb->back <= cb->capacity) && "cb_push 3");
-    if (cb->back == cb->capacity) cb->back = 0;
+    ASSERT((cb_room(cb) > 0) && "cb_push 1");
+    cb->data[cb->back] = d;
+    cb->back = cb_wrap(cb, cb->back + 1);
+}
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+// NOTE: This function should never be called w/ num > cb_room(cb)
+void cb_push_n(circBuffer_t* cb, const uint8_t* d, size_t num)
+{
+    ASSERT((cb_room(cb) >= num) && "cb_push_n 1");
+    size_t contiguous = MIN(cb->capacity - cb->back, num);
+    memcpy(cb->data + cb->back, d, contiguous);
+    memcpy(cb->data, d + contiguous, num - contiguous);
+    cb->back = cb_wrap(cb, cb->back + num);
 }
 
 uint8_t cb_top(circBuffer_t* cb, size_t offset)
 {
     ASSERT((cb_size(cb) > offset) && "cb_top 1");
-    size_t idx = cb->front + offset;
-    if (idx >= cb->capacity) idx -= cb->capacity;
-    return cb->data[idx];
+    return cb->data[cb_wrap(cb, cb->front + offset)];
 }
 
 void cb_pop(circBuffer_t* cb, size_t num)
 {
     ASSERT((cb_size(cb) >= num) && "cb_pop 1");
-    cb->front += num;
-    if (cb->front >= cb->capacity) cb->front -= cb->capacity;
+    cb->front = cb_wrap(cb, cb->front + num);
 }
 
-#define MIN(a, b) (((a) < (b)) ? (a) : (b))
 size_t cb_flush_out(circBuffer_t* cb,
                     size_t (*write)(const uint8_t* data, size_t num, void* usr),
                     void* usr)
 {
-	size_t written = 0;
-	size_t n;
+    size_t written = 0;
+    size_t n;
     size_t sz = cb_size(cb);
 
     if (sz == 0) return 0;
@@ -124,44 +148,41 @@ size_t cb_flush_in(circBuffer_t* cb, size_t bytes,
                    void* usr)
 {
     ASSERT((bytes <= cb_room(cb)) && "cb_flush_in 1");
-	size_t bytesRead = 0;
-	size_t n;
-
-    // Find out how much room is left between back and end of buffer or back and front
-    // of buffer. Because we already know there's room for whatever we're about to place,
-    // if back < front, we can just read in every byte starting at "back".
-    if (cb->back < cb->front) {
-    	bytesRead += read(cb->data + cb->back, bytes, usr);
-        ASSERT((bytesRead <= bytes) && "cb_flush_in 2");
-        cb->back += bytesRead;
-        return bytesRead;
-    }
+    size_t bytesRead = 0;
+    size_t n;
 
-    // Otherwise, we need to be a bit more careful about overflowing the back of the buffer.
+    // Read up to the end of the storage first, then wrap around to its start
     size_t contiguous = MIN(cb->capacity - cb->back, bytes);
     size_t wrapped    = bytes - contiguous;
 
     n = read(cb->data + cb->back, contiguous, usr);
-    ASSERT((n <= contiguous) && "cb_flush_in 3");
+    ASSERT((n <= contiguous) && "cb_flush_in 2");
     bytesRead += n;
-    ASSERT((bytesRead <= bytes) && "cb_flush_in 4");
-    cb->back += n;
-    if (n != contiguous) return bytesRead; // back could NOT have hit BUFFER_SIZE in this case
-
-    // may need to wrap back here (if bytes >= BUFFER_SIZE - cb->back) but not otherwise
-    ASSERT((cb->back <= cb->capacity) && "cb_flush_in 5");
-    if (cb->back == cb->capacity) cb->back = 0;
-    if (wrapped == 0) return bytesRead;
+    cb->back = cb_wrap(cb, cb->back + n);
+    if (n != contiguous || wrapped == 0) return bytesRead;
 
     n = read(cb->data, wrapped, usr);
-    ASSERT((n <= wrapped) && "cb_flush_in 6");
+    ASSERT((n <= wrapped) && "cb_flush_in 3");
     bytesRead += n;
-    ASSERT((bytesRead <= bytes) && "cb_flush_in 7");
     cb->back += n;
     return bytesRead;
 }
 #undef MIN
 
+// Pushes 'num' bytes, doubling every escape character. Copies the runs between
+// escape characters in one go. The caller must have checked for room.
+static void cb_push_escaped(circBuffer_t* cb, const uint8_t* d, size_t num)
+{
+    while (num > 0) {
+        const uint8_t* esc = memchr(d, ZCM_GENERIC_SERIAL_ESCAPE_CHAR, num);
+        size_t run = esc ? (size_t)(esc - d) + 1 : num;
+        cb_push_n(cb, d, run);
+        if (esc) cb_push(cb, ZCM_GENERIC_SERIAL_ESCAPE_CHAR);
+        d   += run;
+        num -= run;
+    }
+}
+
 static uint16_t fletcherUpdate(uint8_t b, uint16_t prevSum)
 {
     uint16_t sumHigh = (prevSum >> 8) & 0xff;
@@ -195,6 +216,9 @@ struct zcm_trans_generic_serial_t
 
     uint64_t (*time)(void* usr);
     void* time_usr;
+
+    bool     trace;
+    uint32_t traceSeqno;
 };
 
 static zcm_trans_generic_serial_t *cast(zcm_trans_t *zt);
@@ -205,64 +229,60 @@ size_t serial_get_mtu(zcm_trans_generic_serial_t *zt)
 int serial_sendmsg(zcm_trans_generic_serial_t *zt, zcm_msg_t msg)
 {
     size_t chan_len = strlen(msg.channel);
-    size_t nPushed = 0;
-
-    if (chan_len > ZCM_CHANNEL_MAXLEN)                               return ZCM_EINVALID;
-    if (msg.len > zt->mtu)                                           return ZCM_EINVALID;
-    if (FRAME_BYTES + chan_len + msg.len > cb_room(&zt->sendBuffer)) return ZCM_EAGAIN;
-
-    cb_push(&zt->sendBuffer, ZCM_GENERIC_SERIAL_ESCAPE_CHAR); ++nPushed;
-    cb_push(&zt->sendBuffer, 0x00);                           ++nPushed;
-    cb_push(&zt->sendBuffer, chan_len);                       ++nPushed;
-
-    uint32_t len = (uint32_t)msg.len;
-    cb_push(&zt->sendBuffer, (len>>24)&0xff); ++nPushed;
-    cb_push(&zt->sendBuffer, (len>>16)&0xff); ++nPushed;
-    cb_push(&zt->sendBuffer, (len>> 8)&0xff); ++nPushed;
-    cb_push(&zt->sendBuffer, (len>> 0)&0xff); ++nPushed;
-
+    size_t nEscapes = 0;
     uint16_t checksum = 0xffff;
+    uint8_t header[7];
+    uint8_t trace[TRACE_BYTES];
+    size_t traceLen = zt->trace ? TRACE_BYTES : 0;
+    uint8_t trailer[2];
     size_t i;
-    for (i = 0; i < chan_len; ++i) {
-        uint8_t c = (uint8_t) msg.channel[i];
 
-        cb_push(&zt->sendBuffer, c); ++nPushed;
+    if (chan_len > ZCM_CHANNEL_MAXLEN) return ZCM_EINVALID;
+    if (msg.len > zt->mtu)             return ZCM_EINVALID;
 
-        if (c == ZCM_GENERIC_SERIAL_ESCAPE_CHAR) {
-        	// the escape character doesn't count, so we have chan_len - i characters
-        	// remaining in channel + the msg + the checksum.
-            if (cb_room(&zt->sendBuffer) > chan_len - i + msg.len + 1) {
-                cb_push(&zt->sendBuffer, c); ++nPushed;
-            } else {
-                cb_pop(&zt->sendBuffer, nPushed);
-                return ZCM_EAGAIN;
-            }
-        }
+    if (zt->trace) {
+        uint64_t utime = msg.utime ? msg.utime : zt->time(zt->time_usr);
+        for (i = 0; i < 8; ++i) trace[i]     = (utime >> (56 - 8 * i)) & 0xff;
+        for (i = 0; i < 4; ++i) trace[8 + i] = (zt->traceSeqno >> (24 - 8 * i)) & 0xff;
+        for (i = 0; i < TRACE_BYTES; ++i) checksum = fletcherUpdate(trace[i], checksum);
+    }
 
+    // Checksum and count the escape characters (which get doubled on the wire)
+    // first, so the whole frame is known to fit before anything is pushed
+    for (i = 0; i < chan_len; ++i) {
+        uint8_t c = (uint8_t) msg.channel[i];
+        if (c == ZCM_GENERIC_SERIAL_ESCAPE_CHAR) ++nEscapes;
         checksum = fletcherUpdate(c, checksum);
     }
-
     for (i = 0; i < msg.len; ++i) {
         uint8_t c = (uint8_t) msg.buf[i];
+        if (c == ZCM_GENERIC_SERIAL_ESCAPE_CHAR) ++nEscapes;
+        checksum = fletcherUpdate(c, checksum);
+    }
 
-        cb_push(&zt->sendBuffer, c); ++nPushed;
-
-        if (c == ZCM_GENERIC_SERIAL_ESCAPE_CHAR) {
-        	// the escape character doesn't count, so we have msg.len - i characters
-        	// remaining in the msg + the checksum.
-            if (cb_room(&zt->sendBuffer) > msg.len - i + 1) {
-                cb_push(&zt->sendBuffer, c); ++nPushed;
-            } else {
-                cb_pop(&zt->sendBuffer, nPushed);
-                return ZCM_EAGAIN;
-            }
-        }
+    if (FRAME_BYTES + traceLen + chan_len + msg.len + nEscapes > cb_room(&zt->sendBuffer))
+        return ZCM_EAGAIN;
 
-        checksum = fletcherUpdate(c, checksum);
+    uint32_t len = (uint32_t)msg.len;
+    header[0] = ZCM_GENERIC_SERIAL_ESCAPE_CHAR;
+    header[1] = zt->trace ? 0x01 : 0x00;
+    header[2] = chan_len;
+    header[3] = (len>>24)&0xff;
+    header[4] = (len>>16)&0xff;
+    header[5] = (len>> 8)&0xff;
+    header[6] = (len>> 0)&0xff;
+    cb_push_n(&zt->sendBuffer, header, sizeof(header));
+    if (zt->trace) {
+        cb_push_n(&zt->sendBuffer, trace, sizeof(trace));
+        ++zt->traceSeqno;
     }
 
-    cb_push(&zt->sendBuffer, (checksum >> 8) & 0xff); ++nPushed;
-    cb_push(&zt->sendBuffer,  checksum       & 0xff); ++nPushed;
+    cb_push_escaped(&zt->sendBuffer, (const uint8_t*) msg.channel, chan_len);
+    cb_push_escaped(&zt->sendBuffer, msg.buf, msg.len);
+
+    trailer[0] = (checksum >> 8) & 0xff;
+    trailer[1] =  checksum       & 0xff;
+    cb_push_n(&zt->sendBuffer, trailer, sizeof(trailer));
 
     return ZCM_EOK;
 }
@@ -283,6 +303,8 @@ int serial_recvmsg(zcm_trans_generic_serial_t *zt, zcm_msg_t *msg, int timeout)
         return ZCM_EAGAIN;
 
     size_t consumed = 0;
+    bool traced = false;
+    size_t traceLen = 0;
     uint8_t chan_len = 0;
     uint16_t checksum = 0;
     uint8_t expectedHighCS = 0;
@@ -291,7 +313,11 @@ int serial_recvmsg(zcm_trans_generic_serial_t *zt, zcm_msg_t *msg, int timeout)
 
     // Sync
     if (cb_top(&zt->recvBuffer, consumed++) != ZCM_GENERIC_SERIAL_ESCAPE_CHAR) goto fail;
-    if (cb_top(&zt->recvBuffer, consumed++) != 0x00)                           goto fail;
+    switch (cb_top(&zt->recvBuffer, consumed++)) {
+        case 0x00: break;
+        case 0x01: traced = true; traceLen = TRACE_BYTES; break;
+        default: goto fail;
+    }
 
     // Msg sizes
     chan_len  = cb_top(&zt->recvBuffer, consumed++);
@@ -303,12 +329,20 @@ int serial_recvmsg(zcm_trans_generic_serial_t *zt, zcm_msg_t *msg, int timeout)
     if (chan_len > ZCM_CHANNEL_MAXLEN)     goto fail;
     if (msg->len > zt->mtu)                goto fail;
 
-    if (incomingSize < FRAME_BYTES + chan_len + msg->len) return ZCM_EAGAIN;
+    if (incomingSize < FRAME_BYTES + traceLen + chan_len + msg->len) return ZCM_EAGAIN;
 
     memset(&zt->recvChanName, '\0', ZCM_CHANNEL_MAXLEN);
 
     checksum = 0xffff;
     int i;
+    uint64_t traceUtime = 0;
+    uint32_t traceSeqno = 0;
+    for (i = 0; i < (int)traceLen; ++i) {
+        uint8_t c = cb_top(&zt->recvBuffer, consumed++);
+        if (i < 8) traceUtime = (traceUtime << 8) | c;
+        else       traceSeqno = (traceSeqno << 8) | c;
+        checksum = fletcherUpdate(c, checksum);
+    }
     for (i = 0; i < chan_len; ++i) {
 
         uint8_t c = cb_top(&zt->recvBuffer, consumed++);
@@ -361,6 +395,10 @@ int serial_recvmsg(zcm_trans_generic_serial_t *zt, zcm_msg_t *msg, int timeout)
         msg->channel = (char*) zt->recvChanName;
         msg->buf     = zt->recvMsgData;
         msg->utime   = utime;
+        if (traced) {
+            msg->trace_utime = traceUtime;
+            msg->trace_seqno = traceSeqno;
+        }
         cb_pop(&zt->recvBuffer, consumed);
         return ZCM_EOK;
     }
@@ -464,9 +502,17 @@ zcm_trans_t *zcm_trans_generic_serial_create(
     zt->time = timestamp_now;
     zt->time_usr = time_usr;
 
+    zt->trace = false;
+    zt->traceSeqno = 0;
+
     return (zcm_trans_t*) zt;
 }
 
+void zcm_trans_generic_serial_set_trace(zcm_trans_t* zt, bool enable)
+{
+    cast(zt)->trace = enable;
+}
+
 void zcm_trans_generic_serial_destroy(zcm_trans_t* _zt)
 {
     zcm_trans_generic_serial_t *zt = cast(_zt);
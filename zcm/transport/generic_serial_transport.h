@@ -10,6 +10,7 @@ extern "C" {
 #include "zcm/zcm.h"
 #include "zcm/transport.h"
 
+// The send and receive buffers each hold up to bufSize - 1 bytes
 zcm_trans_t *zcm_trans_generic_serial_create(
         size_t (*get)(uint8_t* data, size_t nData, void* usr),
         size_t (*put)(const uint8_t* data, size_t nData, void* usr),
@@ -18,6 +19,10 @@ zcm_trans_t *zcm_trans_generic_serial_create(
         void* time_usr,
         size_t MTU, size_t bufSize);
 
+// Sends traced frames from now on if 'enable' (see "Tracing" in transport.h).
+// Traced frames are always received, whatever this is set to.
+void zcm_trans_generic_serial_set_trace(zcm_trans_t* zt, bool enable);
+
 // frees all resources inside of zt and frees zt itself
 void zcm_trans_generic_serial_destroy(zcm_trans_t* zt);
 
@@ -2,7 +2,7 @@
 #include "zcm/transport_registrar.h"
 #include "zcm/transport_register.hpp"
 
-#include "zcm/zcm-cpp.hpp"
+#include "zcm/eventlog.h"
 #include "zcm/util/debug.h"
 //#include "zcm/util/lockfile.h"
 
@@ -10,7 +10,9 @@
 #include "util/TimeUtil.hpp"
 
 #include <cstdio>
+#include <cstring>
 #include <cassert>
+#include <string>
 #include <unordered_map>
 #include <mutex>
 #include <unistd.h>
@@ -23,7 +25,9 @@ using namespace std;
 
 struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
 {
-    zcm::LogFile *log = nullptr;
+    zcm_eventlog_t *log = nullptr;
+    // The last event handed out by recvmsg() (loaned events are owned by the caller)
+    zcm_eventlog_event_t *lastEvent = nullptr;
     unordered_map<string, string> options;
 
     string mode = "r";
@@ -69,8 +73,8 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
 
         auto filename = zcm_url_address(url);
         ZCM_DEBUG("Opening zcm logfile: \"%s\"", filename);
-        log = new zcm::LogFile(filename, string(mode));
-        if (!log->good()) {
+        log = zcm_eventlog_create(filename, mode.c_str());
+        if (!log) {
             fprintf(stderr, "Unable to open logfile %s\n", filename);
             return;
         }
@@ -78,12 +82,13 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
 
     ~ZCM_TRANS_CLASSNAME()
     {
-        if (log) delete log;
+        if (lastEvent) zcm_eventlog_free_event(lastEvent);
+        if (log) zcm_eventlog_destroy(log);
     }
 
     bool good()
     {
-        return log ? log->good() : false;
+        return log != nullptr;
     }
 
     /********************** METHODS **********************/
@@ -100,23 +105,43 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         if (msg.len > get_mtu())
             return ZCM_EINVALID;
 
-        zcm::LogEvent le;
+        zcm_eventlog_event_t le;
         le.timestamp = msg.utime;
+        le.channellen = strlen(msg.channel);
         le.datalen = msg.len;
-        le.channel = string(msg.channel);
+        le.channel = (char*) msg.channel;
         le.data = msg.buf;
 
-        log->writeEvent(&le);
+        zcm_eventlog_write_event(log, &le);
 
         return ZCM_EOK;
     }
 
+    // Writes the whole run while holding the stream lock once, rather than
+    // taking it again for every field of every event
+    int sendmsg_batch(const zcm_msg_t *msgs, size_t n, size_t *nsent)
+    {
+        int ret = ZCM_EOK;
+        FILE *f = zcm_eventlog_get_fileptr(log);
+        flockfile(f);
+        size_t i = 0;
+        for (; i < n; ++i) {
+            ret = sendmsg(msgs[i]);
+            if (ret != ZCM_EOK) break;
+        }
+        funlockfile(f);
+        *nsent = i;
+        return ret;
+    }
+
     int recvmsg_enable(const char *channel, bool enable)
     {
         return ZCM_EOK;
     }
 
-    int recvmsg(zcm_msg_t *msg, int timeout)
+    // Reads the next event from the log and paces playback according to 'speed'.
+    // On success, the caller owns the returned event
+    int readEvent(zcm_msg_t *msg, zcm_eventlog_event_t **evt, int timeout)
     {
         assert(mode == "r");
         if (!good()) {
@@ -128,15 +153,18 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             return ZCM_ECONNECT;
         }
 
-        const zcm::LogEvent* le = log->readNextEvent();
+        zcm_eventlog_event_t *le = zcm_eventlog_read_next_event(log);
         if (!le) {
-            delete log;
+            zcm_eventlog_destroy(log);
             log = nullptr;
             return ZCM_ECONNECT;
         }
 
         msg->utime = le->timestamp;
-        msg->channel = le->channel.c_str();
+        // A log only holds so many channels, so hand them to the core already interned
+        msg->channel_id = zcm_channel_intern(le->channel);
+        msg->channel = msg->channel_id != ZCM_CHANNEL_ID_NONE ? zcm_channel_name(msg->channel_id)
+                                                               : le->channel;
         msg->len = le->datalen;
         msg->buf = le->data;
 
@@ -159,9 +187,33 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         lastDispatchUtime = TimeUtil::utime();
         lastMsgUtime = msg->utime;
 
+        *evt = le;
         return ZCM_EOK;
     }
 
+    int recvmsg(zcm_msg_t *msg, int timeout)
+    {
+        if (lastEvent) {
+            zcm_eventlog_free_event(lastEvent);
+            lastEvent = nullptr;
+        }
+        return readEvent(msg, &lastEvent, timeout);
+    }
+
+    // The event already lives in its own heap allocation, so just hand it over
+    int recvmsg_loan(zcm_msg_t *msg, void **loan, int timeout)
+    {
+        zcm_eventlog_event_t *le = nullptr;
+        int rc = readEvent(msg, &le, timeout);
+        if (rc == ZCM_EOK) *loan = le;
+        return rc;
+    }
+
+    void release_loan(void *loan)
+    {
+        zcm_eventlog_free_event((zcm_eventlog_event_t*) loan);
+    }
+
     /********************** STATICS **********************/
     static zcm_trans_methods_t methods;
     static ZCM_TRANS_CLASSNAME *cast(zcm_trans_t *zt)
@@ -176,12 +228,21 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static int _sendmsg(zcm_trans_t *zt, zcm_msg_t msg)
     { return cast(zt)->sendmsg(msg); }
 
+    static int _sendmsg_batch(zcm_trans_t *zt, const zcm_msg_t *msgs, size_t n, size_t *nsent)
+    { return cast(zt)->sendmsg_batch(msgs, n, nsent); }
+
     static int _recvmsg_enable(zcm_trans_t *zt, const char *channel, bool enable)
     { return cast(zt)->recvmsg_enable(channel, enable); }
 
     static int _recvmsg(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
     { return cast(zt)->recvmsg(msg, timeout); }
 
+    static int _recvmsg_loan(zcm_trans_t *zt, zcm_msg_t *msg, void **loan, int timeout)
+    { return cast(zt)->recvmsg_loan(msg, loan, timeout); }
+
+    static void _release_loan(zcm_trans_t *zt, void *loan)
+    { cast(zt)->release_loan(loan); }
+
     static void _destroy(zcm_trans_t *zt)
     { delete cast(zt); }
 
@@ -195,6 +256,9 @@ zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
     &ZCM_TRANS_CLASSNAME::_recvmsg,
     NULL,
     &ZCM_TRANS_CLASSNAME::_destroy,
+    &ZCM_TRANS_CLASSNAME::_recvmsg_loan,
+    &ZCM_TRANS_CLASSNAME::_release_loan,
+    &ZCM_TRANS_CLASSNAME::_sendmsg_batch,
 };
 
 static zcm_trans_t *create(zcm_url_t *url)
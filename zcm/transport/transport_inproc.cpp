@@ -20,7 +20,8 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
 {
     // Messages are queued into a deque and then dispatched one at a time through recvmsg
     // using the "inFlight" pointers to store their memory until the next message is dispatched
-    // Note: Have to use free() to clean up chan memory in these because we create them via strdup
+    // Note: Have to use free() to clean up chan memory in these because we create them via strdup,
+    //       unless the channel is interned (channel_id is set), in which case it is never freed
     deque<zcm_msg_t*> msgs;
     const char*    inFlightChanMem = nullptr;
           uint8_t* inFlightDataMem = nullptr;
@@ -28,16 +29,30 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     condition_variable msgCond;
     mutex msgLock;
 
+    // Set by the url option 'trace=true', see "Tracing" in transport.h
+    bool trace = false;
+    uint32_t traceSeqno = 0;
+
     ZCM_TRANS_CLASSNAME(zcm_url_t *url, bool blocking)
     {
         trans_type = blocking ? ZCM_BLOCKING : ZCM_NONBLOCKING;
         vtbl = &methods;
+
+        auto *opts = zcm_url_opts(url);
+        for (size_t i = 0; i < opts->numopts; ++i) {
+            if (strcmp(opts->name[i], "trace") != 0) continue;
+            if (strcmp(opts->value[i], "true") == 0) {
+                trace = true;
+            } else if (strcmp(opts->value[i], "false") != 0) {
+                ZCM_DEBUG("expected boolean argument for 'trace'");
+            }
+        }
     }
 
     ~ZCM_TRANS_CLASSNAME()
     {
         for (auto msg: msgs) {
-            free((void*) msg->channel);
+            if (msg->channel_id == ZCM_CHANNEL_ID_NONE) free((void*) msg->channel);
             delete [] msg->buf;
             delete msg;
         }
@@ -70,12 +85,17 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         zcm_msg_t *newMsg = new zcm_msg_t();
         newMsg->utime = msg.utime;
         newMsg->len = msg.len;
-        newMsg->channel = strdup(msg.channel);
+        newMsg->channel_id = zcm_msg_channel_id(&msg);
+        newMsg->channel = newMsg->channel_id != ZCM_CHANNEL_ID_NONE ? msg.channel
+                                                                    : strdup(msg.channel);
         newMsg->buf = new uint8_t[msg.len];
         std::copy_n(msg.buf, msg.len, newMsg->buf);
+        // Nothing goes on a wire here, so the message itself carries the trace
+        if (trace) newMsg->trace_utime = msg.utime ? msg.utime : TimeUtil::utime();
 
         std::unique_lock<mutex> lk(msgLock, defer_lock);
         if (trans_type == ZCM_BLOCKING) lk.lock();
+        if (trace) newMsg->trace_seqno = traceSeqno++;
         msgs.push_back(newMsg);
         if (trans_type == ZCM_BLOCKING) {
             lk.unlock();
@@ -108,7 +128,7 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         // ptrs via the "inFlight" ptrs so we can clean it up later
         *msg = *(msgs.front());
         msg->utime = TimeUtil::utime();
-        inFlightChanMem = msg->channel;
+        inFlightChanMem = msg->channel_id == ZCM_CHANNEL_ID_NONE ? msg->channel : nullptr;
         inFlightDataMem = msg->buf;
 
         delete msgs.front();
@@ -133,6 +153,10 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static int _sendmsg(zcm_trans_t *zt, zcm_msg_t msg)
     { return cast(zt)->sendmsg(msg); }
 
+    // Blocking mode guards the queue with msgLock
+    static bool _sendmsg_concurrent(zcm_trans_t *zt)
+    { return cast(zt)->trans_type == ZCM_BLOCKING; }
+
     static int _recvmsg_enable(zcm_trans_t *zt, const char *channel, bool enable)
     { return cast(zt)->recvmsg_enable(channel, enable); }
 
@@ -156,6 +180,10 @@ zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
     &ZCM_TRANS_CLASSNAME::_recvmsg,
     &ZCM_TRANS_CLASSNAME::_update,
     &ZCM_TRANS_CLASSNAME::_destroy,
+    NULL, // recvmsg_loan
+    NULL, // release_loan
+    NULL, // sendmsg_batch
+    &ZCM_TRANS_CLASSNAME::_sendmsg_concurrent,
 };
 
 static zcm_trans_t *create_blocking(zcm_url_t *url)
@@ -284,6 +284,16 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             }
         }
 
+        bool trace = false;
+        auto *traceStr = findOption("trace");
+        if (traceStr) {
+            if (*traceStr == "true") {
+                trace = true;
+            } else if (*traceStr != "false") {
+                ZCM_DEBUG("expected boolean argument for 'trace'");
+            }
+        }
+
         address = zcm_url_address(url);
         ser.open(address, baud, hwFlowControl);
 
@@ -293,6 +303,7 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
                                               &ZCM_TRANS_CLASSNAME::timestamp_now,
                                               nullptr,
                                               MTU, MTU * 10);
+        if (gst && trace) zcm_trans_generic_serial_set_trace(gst, true);
     }
 
     ~ZCM_TRANS_CLASSNAME()
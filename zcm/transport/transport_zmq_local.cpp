@@ -43,8 +43,13 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     string subnet;
 
     unordered_map<string, void*> pubsocks;
-    // socket pair contains the socket + whether it was subscribed to explicitly or not
-    unordered_map<string, pair<void*, bool>> subsocks;
+    struct SubSock
+    {
+        void* sock;
+        bool subExplicit;   // Whether it was subscribed to explicitly or not
+        uint32_t channelId; // ZCM_CHANNEL_ID_NONE if the channel couldn't be interned
+    };
+    unordered_map<string, SubSock> subsocks;
     bool recvAllChannels = false;
 
     string recvmsgChannel;
@@ -56,11 +61,28 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     // concurrently
     mutex mut;
 
+    // Set by the url option 'trace=true', see "Tracing" in transport.h. A traced
+    // message is sent as two parts: the publisher's utime and a sequence number
+    // (big-endian), then the message itself. Untraced ones are a single part.
+    bool trace = false;
+    uint32_t traceSeqno = 0;
+    static const size_t TRACE_SIZE = 12;
+
     ZCM_TRANS_CLASSNAME(Type type_, zcm_url_t *url)
     {
         trans_type = ZCM_BLOCKING;
         vtbl = &methods;
 
+        auto *opts = zcm_url_opts(url);
+        for (size_t i = 0; i < opts->numopts; ++i) {
+            if (strcmp(opts->name[i], "trace") != 0) continue;
+            if (strcmp(opts->value[i], "true") == 0) {
+                trace = true;
+            } else if (strcmp(opts->value[i], "false") != 0) {
+                ZCM_DEBUG("expected boolean argument for 'trace'");
+            }
+        }
+
         subnet = zcm_url_address(url);
         // Make directory with all permissions
         mkdir(string("/tmp/" + subnet).c_str(), S_IRWXO | S_IRWXG | S_IRWXU);
@@ -98,12 +120,12 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         for (auto it = subsocks.begin(); it != subsocks.end(); ++it) {
             address = getAddress(it->first);
 
-            rc = zmq_disconnect(it->second.first, address.c_str());
+            rc = zmq_disconnect(it->second.sock, address.c_str());
             if (rc == -1) {
                 ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
             }
 
-            rc = zmq_close(it->second.first);
+            rc = zmq_close(it->second.sock);
             if (rc == -1) {
                 ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
             }
@@ -178,8 +200,8 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     {
         auto it = subsocks.find(channel);
         if (it != subsocks.end()) {
-            it->second.second |= subExplicit;
-            return it->second.first;
+            it->second.subExplicit |= subExplicit;
+            return it->second.sock;
         }
         void *sock = zmq_socket(ctx, ZMQ_SUB);
         if (sock == nullptr) {
@@ -198,7 +220,8 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             ZCM_DEBUG("failed to setsockopt on subsock: %s", zmq_strerror(errno));
             return nullptr;
         }
-        subsocks.emplace(channel, make_pair(sock, subExplicit));
+        // Intern the channel once here so recvmsg() can hand out ids without copying names
+        subsocks.emplace(channel, SubSock{sock, subExplicit, zcm_channel_intern(channel.c_str())});
         return sock;
     }
 
@@ -241,6 +264,27 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         }
     }
 
+    static void writeTrace(uint8_t *hdr, uint64_t utime, uint32_t seqno)
+    {
+        for (int i = 0; i < 8; ++i) hdr[i]     = (utime >> (56 - 8 * i)) & 0xff;
+        for (int i = 0; i < 4; ++i) hdr[8 + i] = (seqno >> (24 - 8 * i)) & 0xff;
+    }
+
+    static void readTrace(const uint8_t *hdr, zcm_msg_t *msg)
+    {
+        msg->trace_utime = 0;
+        msg->trace_seqno = 0;
+        for (int i = 0; i < 8; ++i) msg->trace_utime = (msg->trace_utime << 8) | hdr[i];
+        for (int i = 0; i < 4; ++i) msg->trace_seqno = (msg->trace_seqno << 8) | hdr[8 + i];
+    }
+
+    static bool hasMoreParts(void *sock)
+    {
+        int more = 0;
+        size_t moreSize = sizeof(more);
+        return zmq_getsockopt(sock, ZMQ_RCVMORE, &more, &moreSize) == 0 && more;
+    }
+
     /********************** METHODS **********************/
     size_t getMtu()
     {
@@ -258,6 +302,14 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         void *sock = pubsockFindOrCreate(channel);
         if (sock == nullptr)
             return ZCM_ECONNECT;
+        if (trace) {
+            uint8_t hdr[TRACE_SIZE];
+            writeTrace(hdr, msg.utime ? msg.utime : TimeUtil::utime(), traceSeqno++);
+            if (zmq_send(sock, hdr, TRACE_SIZE, ZMQ_SNDMORE) != (int)TRACE_SIZE) {
+                ZCM_DEBUG("zmq_send failed with: %s", zmq_strerror(errno));
+                return ZCM_EUNKNOWN;
+            }
+        }
         int rc = zmq_send(sock, msg.buf, msg.len, 0);
         if (rc == (int)msg.len)
             return ZCM_EOK;
@@ -279,15 +331,15 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
                 recvAllChannels = enable;
             } else {
                 for (auto it = subsocks.begin(); it != subsocks.end(); ) {
-                    if (!it->second.second) { // This channel is only subscribed to implicitly
+                    if (!it->second.subExplicit) { // This channel is only subscribed to implicitly
                         string address = getAddress(it->first);
-                        int rc = zmq_disconnect(it->second.first, address.c_str());
+                        int rc = zmq_disconnect(it->second.sock, address.c_str());
                         if (rc == -1) {
                             ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
                             return ZCM_ECONNECT;
                         }
 
-                        rc = zmq_close(it->second.first);
+                        rc = zmq_close(it->second.sock);
                         if (rc == -1) {
                             ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
                             return ZCM_ECONNECT;
@@ -307,18 +359,18 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             } else {
                 auto it = subsocks.find(channel);
                 if (it != subsocks.end()) {
-                    if (it->second.second) { // This channel has been subscribed to explicitly
+                    if (it->second.subExplicit) { // This channel has been subscribed to explicitly
                         if (recvAllChannels) {
-                            it->second.second = false;
+                            it->second.subExplicit = false;
                         } else {
                             string address = getAddress(it->first);
-                            int rc = zmq_disconnect(it->second.first, address.c_str());
+                            int rc = zmq_disconnect(it->second.sock, address.c_str());
                             if (rc == -1) {
                                 ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
                                 return ZCM_ECONNECT;
                             }
 
-                            rc = zmq_close(it->second.first);
+                            rc = zmq_close(it->second.sock);
                             if (rc == -1) {
                                 ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
                                 return ZCM_ECONNECT;
@@ -336,6 +388,8 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     {
         // Build up a list of poll items
         vector<zmq_pollitem_t> pitems;
+        vector<uint32_t> pchannelIds;
+        // Only filled in for channels without an id
         vector<string> pchannels;
         {
             // Mutex used to protect 'subsocks' while allowing
@@ -354,12 +408,14 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             int i = 0;
             for (auto& elt : subsocks) {
                 auto& channel = elt.first;
-                auto& sock = elt.second.first;
+                auto& sock = elt.second.sock;
                 auto *p = &pitems[i];
                 memset(p, 0, sizeof(*p));
                 p->socket = sock;
                 p->events = ZMQ_POLLIN;
-                pchannels.emplace_back(channel);
+                pchannelIds.emplace_back(elt.second.channelId);
+                pchannels.emplace_back(elt.second.channelId == ZCM_CHANNEL_ID_NONE ? channel
+                                                                                    : string());
                 ++i;
             }
         }
@@ -384,6 +440,11 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
                     //       larger than recvmsgBufferSize
                     int rc = zmq_recv(p.socket, recvmsgBuffer, recvmsgBufferSize, 0);
                     msg->utime = TimeUtil::utime();
+                    if (rc != -1 && hasMoreParts(p.socket)) {
+                        // A traced message, the trace came first (see sendmsg())
+                        if (rc == (int)TRACE_SIZE) readTrace(recvmsgBuffer, msg);
+                        rc = zmq_recv(p.socket, recvmsgBuffer, recvmsgBufferSize, 0);
+                    }
                     if (rc == -1) {
                         fprintf(stderr, "zmq_recv failed with: %s", zmq_strerror(errno));
                         // TODO: implement error handling, don't just assert
@@ -398,8 +459,13 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
                         recvmsgBuffer = new uint8_t[recvmsgBufferSize];
                         return ZCM_EAGAIN;
                     }
-                    recvmsgChannel = pchannels[i];
-                    msg->channel = recvmsgChannel.c_str();
+                    msg->channel_id = pchannelIds[i];
+                    if (msg->channel_id != ZCM_CHANNEL_ID_NONE) {
+                        msg->channel = zcm_channel_name(msg->channel_id);
+                    } else {
+                        recvmsgChannel = pchannels[i];
+                        msg->channel = recvmsgChannel.c_str();
+                    }
                     msg->len = rc;
                     msg->buf = recvmsgBuffer;
 
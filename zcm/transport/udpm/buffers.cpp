@@ -1,24 +1,15 @@
 #include "buffers.hpp"
 
-static bool sockaddrEqual(struct sockaddr_in *a, struct sockaddr_in *b)
-{
-    return a->sin_addr.s_addr == b->sin_addr.s_addr &&
-           a->sin_port        == b->sin_port &&
-           a->sin_family      == b->sin_family;
-}
-
-bool FragBuf::matchesSockaddr(struct sockaddr_in *addr)
-{
-    return sockaddrEqual(&from, addr);
-}
-
 MessagePool::MessagePool(size_t maxSize, size_t maxBuffers)
     : maxSize(maxSize), maxBuffers(maxBuffers)
 {
+    fragbufs.reserve(maxBuffers + 1);
 }
 
 MessagePool::~MessagePool()
 {
+    while (lruHead)
+        removeFragBuf(lruHead);
 }
 
 Buffer MessagePool::allocBuffer(size_t sz)
@@ -82,69 +73,86 @@ void MessagePool::freeMessage(Message *b)
 }
 
 
-FragBuf *MessagePool::addFragBuf(u32 data_size)
+void MessagePool::_lruUnlink(FragBuf *fbuf)
 {
-    FragBuf *fbuf = new (mempool.alloc<FragBuf>()) FragBuf{};
-    fbuf->buf = this->allocBuffer(data_size);
-
-    while (totalSize > maxSize || fragbufs.size() > maxBuffers) {
-        // find and remove the least recently updated fragment buffer
-        int idx = -1;
-        FragBuf *eldest = nullptr;
-        for (size_t i = 0; i < fragbufs.size(); i++) {
-            FragBuf *f = fragbufs[i];
-            if (idx == -1 || f->last_packet_utime < eldest->last_packet_utime) {
-                idx = (int)i;
-                eldest = f;
-            }
-        }
-        if (eldest) {
-            _removeFragBuf((size_t)idx);
-            // XXX Need to free the removed FragBuf*
-        }
+    if (fbuf->lruPrev) fbuf->lruPrev->lruNext = fbuf->lruNext;
+    else               lruHead = fbuf->lruNext;
+    if (fbuf->lruNext) fbuf->lruNext->lruPrev = fbuf->lruPrev;
+    else               lruTail = fbuf->lruPrev;
+    fbuf->lruPrev = fbuf->lruNext = nullptr;
+}
+
+void MessagePool::_lruPushFront(FragBuf *fbuf)
+{
+    fbuf->lruPrev = nullptr;
+    fbuf->lruNext = lruHead;
+    if (lruHead) lruHead->lruPrev = fbuf;
+    else         lruTail = fbuf;
+    lruHead = fbuf;
+}
+
+FragBuf *MessagePool::addFragBuf(struct sockaddr_in *from, u32 msg_seqno, u32 data_size)
+{
+    FragKey key {from, msg_seqno};
+    assert(fragbufs.find(key) == fragbufs.end());
+
+    size_t bufsize = data_size + ZCM_CHANNEL_MAXLEN + 1;
+
+    // make room by dropping the least recently updated fragment buffers
+    while (lruTail && (totalSize + bufsize > maxSize || fragbufs.size() >= maxBuffers)) {
+        ZCM_DEBUG("Evicting incomplete message (missing %d fragments)",
+                  lruTail->fragments_remaining);
+        removeFragBuf(lruTail);
     }
 
-    fragbufs.push_back(fbuf);
-    totalSize += data_size;
+    FragBuf *fbuf = new (mempool.alloc<FragBuf>()) FragBuf{};
+    fbuf->msg_seqno = msg_seqno;
+    fbuf->data_size = data_size;
+    fbuf->from = *from;
+    fbuf->buf = this->allocBuffer(bufsize);
+    fbuf->bufsize = bufsize;
+
+    fragbufs.emplace(key, fbuf);
+    _lruPushFront(fbuf);
+    totalSize += bufsize;
 
     return fbuf;
 }
 
-FragBuf *MessagePool::lookupFragBuf(struct sockaddr_in *key)
+FragBuf *MessagePool::lookupFragBuf(struct sockaddr_in *from, u32 msg_seqno)
 {
-    for (auto& elt : fragbufs)
-        if (elt->matchesSockaddr(key))
-            return elt;
-    return nullptr;
+    auto it = fragbufs.find(FragKey{from, msg_seqno});
+    return it != fragbufs.end() ? it->second : nullptr;
 }
 
-void MessagePool::_removeFragBuf(size_t index)
+void MessagePool::touchFragBuf(FragBuf *fbuf)
 {
-    assert(index < fragbufs.size());
-
-    // Update the total_size of the fragment buffers
-    FragBuf *fbuf = fragbufs[index];
-    totalSize -= fbuf->buf.size;
-
-    // delete old element, move last element to this slot, and shrink by 1
-    size_t lastIdx = fragbufs.size()-1;
-    fragbufs[index] = fragbufs[lastIdx];
-    fragbufs.pop_back();
+    if (fbuf == lruHead) return;
+    _lruUnlink(fbuf);
+    _lruPushFront(fbuf);
+}
 
-    this->freeBuffer(fbuf->buf);
-    mempool.free(fbuf);
+void MessagePool::expireFragBufs(i64 utime)
+{
+    // the LRU list is ordered by last update, so the expired ones are at the tail
+    while (lruTail && lruTail->last_packet_utime < utime) {
+        ZCM_DEBUG("Dropping timed out message (missing %d fragments)",
+                  lruTail->fragments_remaining);
+        removeFragBuf(lruTail);
+    }
 }
 
 void MessagePool::removeFragBuf(FragBuf *fbuf)
 {
-    // NOTE: this is kinda slow...
-    // Search for the fragbuf index
-    for (size_t idx = 0; idx < fragbufs.size(); idx++)
-        if (fragbufs[idx] == fbuf)
-            return this->_removeFragBuf(idx);
+    size_t n = fragbufs.erase(FragKey{&fbuf->from, fbuf->msg_seqno});
+    assert(n == 1 && "Tried to remove invalid fragbuf");
+    (void)n;
 
-    // Did not find
-    assert(0 && "Tried to remove invalid fragbuf");
+    _lruUnlink(fbuf);
+    totalSize -= fbuf->bufsize;
+
+    this->freeBuffer(fbuf->buf);
+    mempool.free(fbuf);
 }
 
 void MessagePool::transferBufffer(Message *to, FragBuf *from)
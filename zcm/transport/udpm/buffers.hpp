@@ -64,6 +64,45 @@ struct MsgHeaderLong
 // ASCII-encoded channel name, followed by the payload data
 // if fragment_no > 0, then header is immediately followed by the payload data
 
+// Precedes every packet of a traced message (see "Tracing" in transport.h), which
+// is otherwise the usual LC02 or LC03 packet. The sequence number is the msg_seqno
+// of the packet's own header.
+struct TraceHeader
+{
+    // Layout
+  private:
+    u32 magic;
+    u32 utime_hi;
+    u32 utime_lo;
+
+    // Converted data
+  public:
+    u32  getMagic() { return ntohl(magic); }
+    u64  getUtime() { return ((u64)ntohl(utime_hi) << 32) | ntohl(utime_lo); }
+    void set(u64 utime)
+    {
+        magic = htonl(ZCM_MAGIC_TRACE);
+        utime_hi = htonl((u32)(utime >> 32));
+        utime_lo = htonl((u32)utime);
+    }
+};
+
+// A packet header laid out right behind its trace, so that either can be sent
+// as a single buffer
+template <typename Header>
+struct TracedHeader
+{
+    TraceHeader trace;
+    Header hdr;
+
+    char *data(bool traced) { return traced ? (char*)&trace : (char*)&hdr; }
+    size_t size(bool traced) { return (traced ? sizeof(trace) : 0) + sizeof(hdr); }
+};
+static_assert(sizeof(TracedHeader<MsgHeaderShort>) == sizeof(TraceHeader) + sizeof(MsgHeaderShort),
+              "TracedHeader must not be padded");
+static_assert(sizeof(TracedHeader<MsgHeaderLong>) == sizeof(TraceHeader) + sizeof(MsgHeaderLong),
+              "TracedHeader must not be padded");
+
 /******************** message buffer **********************/
 struct Buffer
 {
@@ -102,6 +141,9 @@ struct Message
     char             *data;        // points into 'buf'
     size_t            datalen;     // length of data
 
+    u64               trace_utime; // 0 unless the message was traced
+    u32               trace_seqno;
+
     // Backing store buffer that contains the actual data
     Buffer buf;
 
@@ -116,30 +158,71 @@ struct Packet
     struct sockaddr from;       // sender
     socklen_t       fromlen;
 
+    // Where the LC02 or LC03 packet starts, past the TraceHeader of a traced one
+    size_t          off;
+    u64             trace_utime; // 0 unless the packet was traced
+
     // Backing store buffer that contains the actual data
     Buffer          buf;
 
     Packet() { memset(this, 0, sizeof(*this)); }
-    MsgHeaderShort *asHeaderShort() { return (MsgHeaderShort*)buf.data; }
-    MsgHeaderLong  *asHeaderLong()  { return (MsgHeaderLong* )buf.data; }
+    TraceHeader    *asTraceHeader() { return (TraceHeader*)buf.data; }
+    MsgHeaderShort *asHeaderShort() { return (MsgHeaderShort*)(buf.data + off); }
+    MsgHeaderLong  *asHeaderLong()  { return (MsgHeaderLong* )(buf.data + off); }
 };
 
 /******************** fragment buffer **********************/
+// Identifies one in-flight fragmented message: a sender may have several
+struct FragKey
+{
+    u32 addr;
+    u16 port;
+    u32 msg_seqno;
+
+    FragKey(struct sockaddr_in *from, u32 msg_seqno)
+        : addr(from->sin_addr.s_addr), port(from->sin_port), msg_seqno(msg_seqno) {}
+
+    bool operator==(const FragKey& o) const
+    { return addr == o.addr && port == o.port && msg_seqno == o.msg_seqno; }
+};
+
+struct FragKeyHash
+{
+    size_t operator()(const FragKey& k) const
+    {
+        u64 v = ((u64)k.addr << 32) ^ ((u64)k.port << 16) ^ k.msg_seqno;
+        return std::hash<u64>()(v * 0x9e3779b97f4a7c15ull);
+    }
+};
+
 struct FragBuf
 {
     i64     last_packet_utime;
     u32     msg_seqno;
+    u32     data_size;
+    u16     fragments_in_msg;
     u16     fragments_remaining;
+    u64     trace_utime;
 
-    // The channel starts at the beginning of the buffer. The data
-    // follows immediately after the channel and its NULL
+    // The data starts at the beginning of the buffer, so fragments can be
+    // copied in before fragment 0 tells us the channel. The channel and its
+    // NULL follow in a slot of ZCM_CHANNEL_MAXLEN+1 bytes after the data
     size_t  channellen;
     struct sockaddr_in from;
 
+    // One bit per fragment received, to catch duplicates. FragBufs come
+    // from the MemPool, whose smallest block is 64KB anyway
+    u8      received[(1 << 16) / 8];
+
     // Fields set by the allocator object
     Buffer buf;
+    size_t bufsize;        // buf.size, kept after buf is moved into a Message
+    FragBuf *lruPrev;      // toward the most recently updated FragBuf
+    FragBuf *lruNext;      // toward the least recently updated FragBuf
 
-    bool matchesSockaddr(struct sockaddr_in *addr);
+    char *getChannelPtr() { return buf.data + data_size; }
+    bool hasFragment(u16 no) { return received[no / 8] & (1 << (no % 8)); }
+    void setFragment(u16 no) { received[no / 8] |= (1 << (no % 8)); }
 };
 
 /************** A pool to handle every alloc/dealloc operation on Message objects ******/
@@ -162,20 +245,28 @@ struct MessagePool
     void freeMessage(Message *b);
 
     // FragBuf
-    FragBuf *addFragBuf(u32 data_size);
-    FragBuf *lookupFragBuf(struct sockaddr_in *key);
+    // Evicts the least recently updated FragBufs as needed to stay in budget
+    FragBuf *addFragBuf(struct sockaddr_in *from, u32 msg_seqno, u32 data_size);
+    FragBuf *lookupFragBuf(struct sockaddr_in *from, u32 msg_seqno);
+    // Marks fbuf as the most recently updated
+    void touchFragBuf(FragBuf *fbuf);
     void removeFragBuf(FragBuf *fbuf);
+    // Drops every FragBuf last updated before 'utime'
+    void expireFragBufs(i64 utime);
 
     void transferBufffer(Message *to, FragBuf *from);
     void moveBuffer(Buffer& to, Buffer& from);
 
   private:
     void _freeMessageBuffer(Message *b);
-    void _removeFragBuf(size_t index);
+    void _lruUnlink(FragBuf *fbuf);
+    void _lruPushFront(FragBuf *fbuf);
 
   private:
     MemPool mempool;
-    vector<FragBuf*> fragbufs;
+    unordered_map<FragKey, FragBuf*, FragKeyHash> fragbufs;
+    FragBuf *lruHead = nullptr; // most recently updated
+    FragBuf *lruTail = nullptr; // least recently updated, evicted first
     size_t maxSize;
     size_t maxBuffers;
     size_t totalSize = 0;
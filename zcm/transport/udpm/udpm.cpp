@@ -7,6 +7,8 @@
 #include "zcm/transport_registrar.h"
 #include "zcm/transport_register.hpp"
 
+#include "util/TimeUtil.hpp"
+
 #define MTU (1<<28)
 
 static i32 utimeInSeconds()
@@ -26,6 +28,13 @@ static i32 utimeInSeconds()
  *                  don't use > 1.  that's just rude.
  * @recv_buf_size:  requested size of the kernel receive buffer, set with
  *                  SO_RCVBUF.  0 indicates to use the default settings.
+ * @trace:          if true, every packet sent is preceded by a TraceHeader
+ * @frag_timeout_ms: partially received messages are dropped after this long
+ *                  without a new fragment.  0 disables the timeout.
+ * @channel_groups: if 0, every channel is sent to and received from the group
+ *                  at 'ip'.  Otherwise each channel hashes onto one of the
+ *                  groups ip+1 .. ip+channel_groups, and receivers only join
+ *                  the groups of the channels they subscribe to.
  *
  */
 struct Params
@@ -35,8 +44,12 @@ struct Params
     u16            port;
     u8             ttl;
     size_t         recv_buf_size;
+    bool           trace;
+    u32            frag_timeout_ms;
+    u32            channel_groups;
 
-    Params(const string& ip, u16 port, size_t recv_buf_size, u8 ttl)
+    Params(const string& ip, u16 port, size_t recv_buf_size, u8 ttl, bool trace,
+           u32 frag_timeout_ms, u32 channel_groups)
     {
         // TODO verify that the IP and PORT are vaild
         this->ip = ip;
@@ -44,6 +57,9 @@ struct Params
         this->port = port;
         this->recv_buf_size = recv_buf_size;
         this->ttl = ttl;
+        this->trace = trace;
+        this->frag_timeout_ms = frag_timeout_ms;
+        this->channel_groups = channel_groups;
     }
 };
 
@@ -72,23 +88,65 @@ struct UDPM
     u32          msg_seqno = 0; // rolling counter of how many messages transmitted
 
     /***** Methods ******/
-    UDPM(const string& ip, u16 port, size_t recv_buf_size, u8 ttl);
+    UDPM(const string& ip, u16 port, size_t recv_buf_size, u8 ttl, bool trace,
+         u32 frag_timeout_ms, u32 channel_groups);
     bool init();
     ~UDPM();
 
     int handle();
 
     int sendmsg(zcm_msg_t msg);
+    int sendmsgBatch(const zcm_msg_t *msgs, size_t n, size_t *nsent);
     int recvmsg(zcm_msg_t *msg, int timeout);
+    int recvmsgLoan(zcm_msg_t *msg, void **loan, int timeout);
+    void releaseLoan(void *loan);
+    int recvmsgEnable(const char *channel, bool enable);
 
   private:
+    // With params.channel_groups, the group of every channel and how many
+    // enabled channels (or the NULL 'all channels') currently need it joined
+    vector<UDPMAddress> groupAddrs;
+    vector<struct in_addr> groupInAddrs;
+    vector<u32> groupRefs;
+    bool groupsAllEnabled = false;
+    mutex groupLock;
+    size_t channelGroup(const char *channel);
+    const UDPMAddress& destFor(const char *channel);
+    bool setGroupRef(size_t group, bool ref);
+
+    // Sends a run of short messages with as few sendDatagrams() calls as
+    // their destinations allow, stopping at the first that fails
+    int sendShortBatch(const zcm_msg_t *msgs, size_t n, size_t& nsent);
+    vector<TracedHeader<MsgHeaderShort>> batchHdrs;
+    vector<UDPMDatagram> batchDgrams;
+    // The fragments of the large message being sent by sendmsg()
+    vector<TracedHeader<MsgHeaderLong>> fragHdrs;
+    vector<UDPMDatagram> fragDgrams;
+
     // These returns non-null when a full message has been received
     Message *recvShort(Packet *pkt, u32 sz);
     Message *recvFragment(Packet *pkt, u32 sz);
     Message *readMessage(int timeout);
 
+    // Packets are received in batches of up to ZCM_RECV_BATCH_SIZE into 'rxPkts'.
+    // readMessage() works through them from 'rxNext' and only receives the next
+    // batch once all 'rxCount' of them are used up.
+    vector<Packet*> rxPkts;
+    size_t rxNext = 0;
+    size_t rxCount = 0;
+    // Returns false if no packet arrived within 'timeout'
+    bool recvBatch(int timeout);
+
     Message *m = nullptr;
 
+    // Loaned messages handed back by releaseLoan(). Loans may be released from
+    // any thread, but the pool is not thread-safe, so they are only returned to
+    // the pool from the recv thread (see freeReleased())
+    mutex releasedLock;
+    vector<Message*> released;
+    vector<Message*> releasedSwap;
+    void freeReleased();
+
     bool selftest();
     void checkForMessageLoss();
 };
@@ -112,6 +170,8 @@ Message *UDPM::recvShort(Packet *pkt, u32 sz)
     msg->channellen = clen;
     msg->data = hdr->getDataPtr();
     msg->datalen = hdr->getDataLen(sz);
+    msg->trace_utime = pkt->trace_utime;
+    if (msg->trace_utime) msg->trace_seqno = hdr->getMsgSeqno();
     pool.moveBuffer(msg->buf, pkt->buf);
 
     return msg;
@@ -121,9 +181,6 @@ Message *UDPM::recvFragment(Packet *pkt, u32 sz)
 {
     MsgHeaderLong *hdr = pkt->asHeaderLong();
 
-    // any existing fragment buffer for this message source?
-    FragBuf *fbuf = pool.lookupFragBuf((struct sockaddr_in*)&pkt->from);
-
     u32 msg_seqno = hdr->getMsgSeqno();
     u32 data_size = hdr->getMsgSize();
     u32 fragment_offset = hdr->getFragmentOffset();
@@ -132,65 +189,92 @@ Message *UDPM::recvFragment(Packet *pkt, u32 sz)
     u32 frag_size = hdr->getFragmentSize(sz);
     char *data_start = hdr->getDataPtr();
 
-    // discard any stale fragments from previous messages
-    if (fbuf && ((fbuf->msg_seqno != msg_seqno) ||
-                 (fbuf->buf.size != data_size + fbuf->channellen+1))) {
-        pool.removeFragBuf(fbuf);
-        ZCM_DEBUG("Dropping message (missing %d fragments)", fbuf->fragments_remaining);
-        fbuf = NULL;
-    }
+    // give up on messages that have stopped receiving fragments
+    if (params.frag_timeout_ms > 0)
+        pool.expireFragBufs(pkt->utime - (i64)params.frag_timeout_ms * 1000);
 
     if (data_size > MTU) {
         ZCM_DEBUG("rejecting huge message (%d bytes)", data_size);
         return NULL;
     }
 
-    // create a new fragment buffer if necessary
-    if (!fbuf && fragment_no == 0) {
-        char *channel = (char*) (hdr + 1);
-        int channel_sz = strlen(channel);
-        if (channel_sz > ZCM_CHANNEL_MAXLEN) {
+    if (fragment_no >= fragments_in_msg) {
+        ZCM_DEBUG("dropping invalid fragment (%d / %d)", fragment_no, fragments_in_msg);
+        udp_discarded_bad++;
+        return NULL;
+    }
+
+    // fragment 0 carries the channel ahead of its data
+    char *channel = NULL;
+    size_t channel_sz = 0;
+    if (fragment_no == 0) {
+        channel = data_start;
+        channel_sz = strnlen(channel, frag_size);
+        if (channel_sz > ZCM_CHANNEL_MAXLEN || channel_sz == frag_size) {
             ZCM_DEBUG("bad channel name length");
             udp_discarded_bad++;
             return NULL;
         }
+        data_start += channel_sz + 1;
+        frag_size -= channel_sz + 1;
+    }
 
-        fbuf = pool.addFragBuf(channel_sz + 1 + data_size);
-        fbuf->last_packet_utime = pkt->utime;
-        fbuf->msg_seqno = msg_seqno;
-        fbuf->fragments_remaining = fragments_in_msg;
-        fbuf->channellen = channel_sz;
-        fbuf->from = *(struct sockaddr_in*)&pkt->from;
-        memcpy(fbuf->buf.data, data_start, frag_size);
+    // any existing fragment buffer for this message?
+    struct sockaddr_in *from = (struct sockaddr_in*)&pkt->from;
+    FragBuf *fbuf = pool.lookupFragBuf(from, msg_seqno);
 
-        --fbuf->fragments_remaining;
+    // discard the fragments if they disagree about the message
+    if (fbuf && (fbuf->data_size != data_size ||
+                 fbuf->fragments_in_msg != fragments_in_msg)) {
+        ZCM_DEBUG("Dropping message (missing %d fragments)", fbuf->fragments_remaining);
+        pool.removeFragBuf(fbuf);
+        fbuf = NULL;
+    }
+
+    if ((u64)fragment_offset + frag_size > data_size) {
+        ZCM_DEBUG("dropping invalid fragment (off: %d, %d / %d)",
+                  fragment_offset, frag_size, data_size);
+        udp_discarded_bad++;
         return NULL;
     }
 
-    if (!fbuf) return NULL;
-    recvfd.checkAndWarnAboutSmallBuffer(data_size, kernel_rbuf_sz);
+    // create a new fragment buffer for whichever fragment shows up first
+    if (!fbuf) {
+        recvfd.checkAndWarnAboutSmallBuffer(data_size, kernel_rbuf_sz);
+        fbuf = pool.addFragBuf(from, msg_seqno, data_size);
+        fbuf->fragments_in_msg = fragments_in_msg;
+        fbuf->fragments_remaining = fragments_in_msg;
+        fbuf->trace_utime = pkt->trace_utime;
+    }
 
-    if (fbuf->channellen+1 + fragment_offset + frag_size > fbuf->buf.size) {
-        ZCM_DEBUG("dropping invalid fragment (off: %d, %d / %zu)",
-                fragment_offset, frag_size, fbuf->buf.size);
-        pool.removeFragBuf(fbuf);
+    if (fbuf->hasFragment(fragment_no)) {
+        ZCM_DEBUG("dropping duplicate fragment %d of message %u", fragment_no, msg_seqno);
         return NULL;
     }
+    fbuf->setFragment(fragment_no);
+
+    if (fragment_no == 0) {
+        memcpy(fbuf->getChannelPtr(), channel, channel_sz + 1);
+        fbuf->channellen = channel_sz;
+    }
 
     // copy data
-    memcpy(fbuf->buf.data + fbuf->channellen+1 + fragment_offset, data_start, frag_size);
+    memcpy(fbuf->buf.data + fragment_offset, data_start, frag_size);
 
     fbuf->last_packet_utime = pkt->utime;
+    pool.touchFragBuf(fbuf);
     if (--fbuf->fragments_remaining > 0)
         return NULL;
 
     // we've received all the fragments, return a new Message
     Message *msg = pool.allocMessageEmpty();
     msg->utime = fbuf->last_packet_utime;
-    msg->channel = fbuf->buf.data;
+    msg->channel = fbuf->getChannelPtr();
     msg->channellen = fbuf->channellen;
-    msg->data = fbuf->buf.data + fbuf->channellen + 1;
-    msg->datalen = fbuf->buf.size - (fbuf->channellen + 1);
+    msg->data = fbuf->buf.data;
+    msg->datalen = fbuf->data_size;
+    msg->trace_utime = fbuf->trace_utime;
+    if (msg->trace_utime) msg->trace_seqno = fbuf->msg_seqno;
     pool.moveBuffer(msg->buf, fbuf->buf);
 
     // don't need the fragment buffer anymore
@@ -230,27 +314,55 @@ void UDPM::checkForMessageLoss()
     // }
 }
 
+bool UDPM::recvBatch(int timeout)
+{
+    // Packets whose buffer went into a Message need a new one
+    for (size_t i = 0; i < rxCount; ++i)
+        if (!rxPkts[i]->buf.data)
+            rxPkts[i]->buf = pool.allocBuffer(ZCM_MAX_UNFRAGMENTED_PACKET_SIZE);
+    rxNext = rxCount = 0;
+
+    // A poll skips the select() and lets recvmmsg() tell us there is nothing
+    if (timeout != 0 && !recvfd.waitUntilData(timeout))
+        return false;
+
+    int n = recvfd.recvPackets(rxPkts.data(), rxPkts.size());
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            ZCM_DEBUG("udp_read_packet -- recvmmsg");
+            udp_discarded_bad++;
+        }
+        return false;
+    }
+
+    rxCount = n;
+    return true;
+}
+
 // read continuously until a complete message arrives
 Message *UDPM::readMessage(int timeout)
 {
-    Packet *pkt = pool.allocPacket(ZCM_MAX_UNFRAGMENTED_PACKET_SIZE);
     UDPM::checkForMessageLoss();
 
     Message *msg = NULL;
     while (!msg) {
-        // // wait for either incoming UDP data, or for an abort message
-        if (!recvfd.waitUntilData(timeout))
+        if (rxNext == rxCount && !recvBatch(timeout))
             break;
 
-        int sz = recvfd.recvPacket(pkt);
-        if (sz < 0) {
-            ZCM_DEBUG("udp_read_packet -- recvmsg");
-            udp_discarded_bad++;
-            continue;
-        }
-
+        Packet *pkt = rxPkts[rxNext++];
+        int sz = pkt->sz;
         ZCM_DEBUG("Got packet of size %d", sz);
 
+        // Look past the trace of a traced packet
+        pkt->off = 0;
+        pkt->trace_utime = 0;
+        if (sz >= (int)sizeof(TraceHeader) &&
+            pkt->asTraceHeader()->getMagic() == ZCM_MAGIC_TRACE) {
+            pkt->trace_utime = pkt->asTraceHeader()->getUtime();
+            pkt->off = sizeof(TraceHeader);
+            sz -= sizeof(TraceHeader);
+        }
+
         if (sz < (int)sizeof(MsgHeaderShort)) {
             // packet too short to be ZCM
             udp_discarded_bad++;
@@ -269,10 +381,79 @@ Message *UDPM::readMessage(int timeout)
         }
     }
 
-    pool.freePacket(pkt);
     return msg;
 }
 
+size_t UDPM::channelGroup(const char *channel)
+{
+    // FNV-1a, so that every process maps a channel to the same group
+    u32 hash = 2166136261u;
+    for (const char *c = channel; *c; ++c) {
+        hash ^= (u8)*c;
+        hash *= 16777619u;
+    }
+    return hash % params.channel_groups;
+}
+
+const UDPMAddress& UDPM::destFor(const char *channel)
+{
+    if (params.channel_groups == 0) return destAddr;
+    return groupAddrs[channelGroup(channel)];
+}
+
+bool UDPM::setGroupRef(size_t group, bool ref)
+{
+    bool wasJoined = groupsAllEnabled || groupRefs[group] > 0;
+    if (ref) {
+        groupRefs[group]++;
+    } else {
+        if (groupRefs[group] == 0) return true;
+        groupRefs[group]--;
+    }
+    bool joined = groupsAllEnabled || groupRefs[group] > 0;
+    if (joined == wasJoined) return true;
+
+    if (joined) {
+        if (recvfd.addMembership(groupInAddrs[group])) return true;
+        groupRefs[group]--;
+        return false;
+    }
+    return recvfd.dropMembership(groupInAddrs[group]);
+}
+
+int UDPM::recvmsgEnable(const char *channel, bool enable)
+{
+    // Everything arrives on the one group otherwise
+    if (params.channel_groups == 0) return ZCM_EOK;
+
+    unique_lock<mutex> lk(groupLock);
+
+    if (channel) {
+        if (!setGroupRef(channelGroup(channel), enable)) {
+            ZCM_DEBUG("failed to join the multicast group of %s", channel);
+            return ZCM_EUNKNOWN;
+        }
+        return ZCM_EOK;
+    }
+
+    if (enable == groupsAllEnabled) return ZCM_EOK;
+
+    for (size_t g = 0; g < groupAddrs.size(); ++g) {
+        if (groupRefs[g] > 0) continue;
+        if (enable && !recvfd.addMembership(groupInAddrs[g])) {
+            ZCM_DEBUG("failed to join multicast group %s", groupAddrs[g].getIP().c_str());
+            // undo the joins so far
+            for (size_t j = 0; j < g; ++j)
+                if (groupRefs[j] == 0) recvfd.dropMembership(groupInAddrs[j]);
+            return ZCM_EUNKNOWN;
+        }
+        if (!enable) recvfd.dropMembership(groupInAddrs[g]);
+    }
+    groupsAllEnabled = enable;
+
+    return ZCM_EOK;
+}
+
 int UDPM::sendmsg(zcm_msg_t msg)
 {
     int channel_size = strlen(msg.channel);
@@ -281,20 +462,27 @@ int UDPM::sendmsg(zcm_msg_t msg)
         return ZCM_EINVALID;
     }
 
+    // The trace takes its room out of every packet's payload
+    bool trace = params.trace;
+    int trace_size = trace ? sizeof(TraceHeader) : 0;
+    u64 trace_utime = 0;
+    if (trace) trace_utime = msg.utime ? msg.utime : TimeUtil::utime();
+
     int payload_size = channel_size + 1 + msg.len;
-    if (payload_size <= ZCM_SHORT_MESSAGE_MAX_SIZE) {
+    if (payload_size <= ZCM_SHORT_MESSAGE_MAX_SIZE - trace_size) {
         // message is short.  send in a single packet
 
-        MsgHeaderShort hdr;
-        hdr.setMagic(ZCM_MAGIC_SHORT);
-        hdr.setMsgSeqno(msg_seqno);
+        TracedHeader<MsgHeaderShort> th;
+        if (trace) th.trace.set(trace_utime);
+        th.hdr.setMagic(ZCM_MAGIC_SHORT);
+        th.hdr.setMsgSeqno(msg_seqno);
 
-        ssize_t status = sendfd.sendBuffers(destAddr,
-                              (char*)&hdr, sizeof(hdr),
+        ssize_t status = sendfd.sendBuffers(destFor(msg.channel),
+                              th.data(trace), th.size(trace),
                               (char*)msg.channel, channel_size+1,
                               (char*)msg.buf, msg.len);
 
-        int packet_size = sizeof(hdr) + payload_size;
+        int packet_size = th.size(trace) + payload_size;
         ZCM_DEBUG("transmitting %zu byte [%s] payload (%d byte pkt)",
                   msg.len, msg.channel, packet_size);
         msg_seqno++;
@@ -305,7 +493,7 @@ int UDPM::sendmsg(zcm_msg_t msg)
 
     else {
         // message is large.  fragment into multiple packets
-        int fragment_size = ZCM_FRAGMENT_MAX_PAYLOAD;
+        int fragment_size = ZCM_FRAGMENT_MAX_PAYLOAD - trace_size;
         int nfragments = payload_size / fragment_size +
             !!(payload_size % fragment_size);
 
@@ -314,58 +502,136 @@ int UDPM::sendmsg(zcm_msg_t msg)
             return -1;
         }
 
-        // acquire transmit lock so that all fragments are transmitted
-        // together, and so that no other message uses the same sequence number
-        // (at least until the sequence # rolls over)
-
         ZCM_DEBUG("transmitting %d byte [%s] payload in %d fragments",
                   payload_size, msg.channel, nfragments);
 
+        // Every fragment gets its own header so they can all go out in one
+        // sendDatagrams() call
+        fragHdrs.resize(nfragments);
+        fragDgrams.resize(nfragments);
+
         u32 fragment_offset = 0;
+        for (int frag_no = 0; frag_no < nfragments; frag_no++) {
+            TracedHeader<MsgHeaderLong>& th = fragHdrs[frag_no];
+            if (trace) th.trace.set(trace_utime);
+            MsgHeaderLong& hdr = th.hdr;
+            hdr.magic = htonl(ZCM_MAGIC_LONG);
+            hdr.msg_seqno = htonl(msg_seqno);
+            hdr.msg_size = htonl(msg.len);
+            hdr.fragment_offset = htonl(fragment_offset);
+            hdr.fragment_no = htons(frag_no);
+            hdr.fragments_in_msg = htons(nfragments);
+
+            UDPMDatagram& dg = fragDgrams[frag_no];
+            dg.iov[0].iov_base = th.data(trace);
+            dg.iov[0].iov_len = th.size(trace);
+            dg.iovlen = 1;
+
+            // first fragment is special.  insert channel before data
+            int fraglen = fragment_size;
+            if (frag_no == 0) {
+                dg.iov[dg.iovlen].iov_base = (char*)msg.channel;
+                dg.iov[dg.iovlen].iov_len = channel_size + 1;
+                ++dg.iovlen;
+                fraglen -= channel_size + 1;
+                assert((size_t)fraglen <= msg.len);
+            }
+            fraglen = std::min(fraglen, (int)msg.len - (int)fragment_offset);
+
+            dg.iov[dg.iovlen].iov_base = (char*)(msg.buf + fragment_offset);
+            dg.iov[dg.iovlen].iov_len = fraglen;
+            ++dg.iovlen;
 
-        MsgHeaderLong hdr;
-        hdr.magic = htonl(ZCM_MAGIC_LONG);
-        hdr.msg_seqno = htonl(msg_seqno);
-        hdr.msg_size = htonl(msg.len);
-        hdr.fragment_offset = 0;
-        hdr.fragment_no = 0;
-        hdr.fragments_in_msg = htons(nfragments);
+            fragment_offset += fraglen;
+        }
+        assert(fragment_offset == msg.len);
 
-        // first fragment is special.  insert channel before data
-        size_t firstfrag_datasize = fragment_size - (channel_size + 1);
-        assert(firstfrag_datasize <= msg.len);
+        size_t sent = sendfd.sendDatagrams(destFor(msg.channel),
+                                           fragDgrams.data(), nfragments);
+        msg_seqno++;
 
-        int packet_size = sizeof(hdr) + (channel_size + 1) + firstfrag_datasize;
-        fragment_offset += firstfrag_datasize;
+        if (sent != (size_t)nfragments) {
+            ZCM_DEBUG("only sent %zu of %d fragments", sent, nfragments);
+            return ZCM_EUNKNOWN;
+        }
+    }
 
-        ssize_t status = sendfd.sendBuffers(destAddr,
-                                            (char*)&hdr, sizeof(hdr),
-                                            (char*)msg.channel, channel_size+1,
-                                            (char*)msg.buf, firstfrag_datasize);
+    return 0;
+}
 
-        // transmit the rest of the fragments
-        for (u16 frag_no = 1; packet_size == status && frag_no < nfragments; frag_no++) {
-            hdr.fragment_offset = htonl(fragment_offset);
-            hdr.fragment_no = htons(frag_no);
+int UDPM::sendShortBatch(const zcm_msg_t *msgs, size_t n, size_t& nsent)
+{
+    nsent = 0;
+    if (n == 0) return ZCM_EOK;
+
+    bool trace = params.trace;
+    batchHdrs.resize(n);
+    batchDgrams.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        TracedHeader<MsgHeaderShort>& th = batchHdrs[i];
+        if (trace) th.trace.set(msgs[i].utime ? msgs[i].utime : TimeUtil::utime());
+        th.hdr.setMagic(ZCM_MAGIC_SHORT);
+        th.hdr.setMsgSeqno(msg_seqno++);
+
+        UDPMDatagram& dg = batchDgrams[i];
+        dg.iov[0].iov_base = th.data(trace);
+        dg.iov[0].iov_len = th.size(trace);
+        dg.iov[1].iov_base = (char*)msgs[i].channel;
+        dg.iov[1].iov_len = strlen(msgs[i].channel) + 1;
+        dg.iov[2].iov_base = (char*)msgs[i].buf;
+        dg.iov[2].iov_len = msgs[i].len;
+        dg.iovlen = 3;
+    }
 
-            int fraglen = std::min(fragment_size, (int)msg.len - (int)fragment_offset);
-            status = sendfd.sendBuffers(destAddr,
-                                        (char*)&hdr, sizeof(hdr),
-                                        (char*)(msg.buf + fragment_offset), fraglen);
+    ZCM_DEBUG("transmitting %zu short messages in one batch", n);
+
+    // Consecutive messages to the same group share a sendDatagrams() call
+    size_t start = 0;
+    const UDPMAddress *dest = &destFor(msgs[0].channel);
+    for (size_t i = 1; i <= n; ++i) {
+        const UDPMAddress *next = (i < n) ? &destFor(msgs[i].channel) : nullptr;
+        if (next == dest) continue;
+        size_t sent = sendfd.sendDatagrams(*dest, &batchDgrams[start], i - start);
+        nsent += sent;
+        if (sent != i - start) return ZCM_EUNKNOWN;
+        start = i;
+        dest = next;
+    }
+    return ZCM_EOK;
+}
 
-            fragment_offset += fraglen;
-            packet_size = sizeof(hdr) + fraglen;
+int UDPM::sendmsgBatch(const zcm_msg_t *msgs, size_t n, size_t *nsent)
+{
+    // Runs of short messages go out together. Anything else (fragmented or
+    // invalid messages) ends the run and goes through sendmsg() on its own.
+    size_t max_payload = ZCM_SHORT_MESSAGE_MAX_SIZE - (params.trace ? sizeof(TraceHeader) : 0);
+    size_t start = 0;
+    for (size_t i = 0; i <= n; ++i) {
+        if (i < n) {
+            size_t channel_size = strlen(msgs[i].channel);
+            if (channel_size <= ZCM_CHANNEL_MAXLEN &&
+                channel_size + 1 + msgs[i].len <= max_payload)
+                continue;
         }
 
-        // sanity check
-        if (0 == status) {
-            assert(fragment_offset == msg.len);
+        size_t sent;
+        int rc = sendShortBatch(msgs + start, i - start, sent);
+        if (rc != ZCM_EOK) {
+            *nsent = start + sent;
+            return rc;
         }
-
-        msg_seqno++;
+        if (i < n) {
+            rc = sendmsg(msgs[i]);
+            if (rc != ZCM_EOK) {
+                *nsent = i;
+                return rc;
+            }
+        }
+        start = i + 1;
     }
 
-    return 0;
+    *nsent = n;
+    return ZCM_EOK;
 }
 
 int UDPM::recvmsg(zcm_msg_t *msg, int timeout)
@@ -381,19 +647,73 @@ int UDPM::recvmsg(zcm_msg_t *msg, int timeout)
     msg->channel = m->channel;
     msg->len = m->datalen;
     msg->buf = (uint8_t*) m->data;
+    msg->trace_utime = m->trace_utime;
+    msg->trace_seqno = m->trace_seqno;
 
     return ZCM_EOK;
 }
 
+int UDPM::recvmsgLoan(zcm_msg_t *msg, void **loan, int timeout)
+{
+    freeReleased();
+
+    Message *lm = readMessage(timeout);
+    if (lm == nullptr)
+        return ZCM_EAGAIN;
+
+    msg->utime = lm->utime;
+    msg->channel = lm->channel;
+    msg->len = lm->datalen;
+    msg->buf = (uint8_t*) lm->data;
+    msg->trace_utime = lm->trace_utime;
+    msg->trace_seqno = lm->trace_seqno;
+    *loan = lm;
+
+    return ZCM_EOK;
+}
+
+void UDPM::releaseLoan(void *loan)
+{
+    unique_lock<mutex> lk(releasedLock);
+    released.push_back((Message*) loan);
+}
+
+void UDPM::freeReleased()
+{
+    {
+        unique_lock<mutex> lk(releasedLock);
+        if (released.empty())
+            return;
+        released.swap(releasedSwap);
+    }
+    for (Message *lm : releasedSwap)
+        pool.freeMessage(lm);
+    releasedSwap.clear();
+}
+
 UDPM::~UDPM()
 {
     ZCM_DEBUG("closing zcm context");
+    freeReleased();
+    if (m)
+        pool.freeMessage(m);
+    for (Packet *pkt : rxPkts)
+        pool.freePacket(pkt);
 }
 
-UDPM::UDPM(const string& ip, u16 port, size_t recv_buf_size, u8 ttl)
-    : params(ip, port, recv_buf_size, ttl),
+UDPM::UDPM(const string& ip, u16 port, size_t recv_buf_size, u8 ttl, bool trace,
+           u32 frag_timeout_ms, u32 channel_groups)
+    : params(ip, port, recv_buf_size, ttl, trace, frag_timeout_ms, channel_groups),
       destAddr(ip, port)
 {
+    u32 base = ntohl(params.addr.s_addr);
+    for (u32 i = 0; i < channel_groups; ++i) {
+        struct in_addr group;
+        group.s_addr = htonl(base + 1 + i);
+        groupAddrs.emplace_back(inet_ntoa(group), port);
+        groupInAddrs.push_back(group);
+    }
+    groupRefs.resize(channel_groups, 0);
 }
 
 bool UDPM::init()
@@ -406,10 +726,19 @@ bool UDPM::init()
     if (!sendfd.isOpen()) return false;
     kernel_sbuf_sz = sendfd.getSendBufSize();
 
-    recvfd = UDPMSocket::createRecvSocket(params.addr, params.port);
+    if (params.channel_groups == 0) {
+        recvfd = UDPMSocket::createRecvSocket(params.addr, params.port);
+    } else {
+        ZCM_DEBUG("Hashing channels onto groups %s .. %s",
+                  groupAddrs.front().getIP().c_str(), groupAddrs.back().getIP().c_str());
+        recvfd = UDPMSocket::createGroupRecvSocket(params.port);
+    }
     if (!recvfd.isOpen()) return false;
     kernel_rbuf_sz = recvfd.getRecvBufSize();
 
+    for (size_t i = 0; i < ZCM_RECV_BATCH_SIZE; ++i)
+        rxPkts.push_back(pool.allocPacket(ZCM_MAX_UNFRAGMENTED_PACKET_SIZE));
+
     if (!this->selftest()) {
         // self test failed.  destroy the read thread
         fprintf(stderr, "ZCM self test failed!!\n"
@@ -436,8 +765,9 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
 {
     UDPM udpm;
 
-    ZCM_TRANS_CLASSNAME(const string& ip, u16 port, size_t recv_buf_size, u8 ttl)
-        : udpm(ip, port, recv_buf_size, ttl)
+    ZCM_TRANS_CLASSNAME(const string& ip, u16 port, size_t recv_buf_size, u8 ttl, bool trace,
+                        u32 frag_timeout_ms, u32 channel_groups)
+        : udpm(ip, port, recv_buf_size, ttl, trace, frag_timeout_ms, channel_groups)
     {
         trans_type = ZCM_BLOCKING;
         vtbl = &methods;
@@ -459,12 +789,21 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static int _sendmsg(zcm_trans_t *zt, zcm_msg_t msg)
     { return cast(zt)->udpm.sendmsg(msg); }
 
+    static int _sendmsgBatch(zcm_trans_t *zt, const zcm_msg_t *msgs, size_t n, size_t *nsent)
+    { return cast(zt)->udpm.sendmsgBatch(msgs, n, nsent); }
+
     static int _recvmsgEnable(zcm_trans_t *zt, const char *channel, bool enable)
-    { return ZCM_EOK; }
+    { return cast(zt)->udpm.recvmsgEnable(channel, enable); }
 
     static int _recvmsg(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
     { return cast(zt)->udpm.recvmsg(msg, timeout); }
 
+    static int _recvmsgLoan(zcm_trans_t *zt, zcm_msg_t *msg, void **loan, int timeout)
+    { return cast(zt)->udpm.recvmsgLoan(msg, loan, timeout); }
+
+    static void _releaseLoan(zcm_trans_t *zt, void *loan)
+    { cast(zt)->udpm.releaseLoan(loan); }
+
     static void _destroy(zcm_trans_t *zt)
     { delete cast(zt); }
 
@@ -478,6 +817,9 @@ zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
     &ZCM_TRANS_CLASSNAME::_recvmsg,
     NULL, // update
     &ZCM_TRANS_CLASSNAME::_destroy,
+    &ZCM_TRANS_CLASSNAME::_recvmsgLoan,
+    &ZCM_TRANS_CLASSNAME::_releaseLoan,
+    &ZCM_TRANS_CLASSNAME::_sendmsgBatch,
 };
 
 static const char *optFind(zcm_url_opts_t *opts, const string& key)
@@ -506,6 +848,28 @@ static vector<string> split(const string& str, char delimiter)
     return v;
 }
 
+// The multicast scopes (RFC 2365, RFC 5771) a range of channel groups has to stay
+// inside of, narrowest first
+static const struct { u32 prefix; int bits; } multicastScopes[] = {
+    {0xE0000000, 24}, // 224.0.0.0/24   local network control
+    {0xE0000100, 24}, // 224.0.1.0/24   internetwork control
+    {0xEFFF0000, 16}, // 239.255.0.0/16 local scope
+    {0xEFC00000, 14}, // 239.192.0.0/14 organization local scope
+    {0xEF000000,  8}, // 239.0.0.0/8    administratively scoped
+    {0xE0000000,  4}, // 224.0.0.0/4    every other multicast address
+};
+
+// Whether base+1 .. base+n are multicast addresses in the same scope as base
+static bool groupsInScope(u32 base, u32 n)
+{
+    for (auto& scope : multicastScopes) {
+        u32 mask = ~0u << (32 - scope.bits);
+        if ((base & mask) != scope.prefix) continue;
+        return (u64)base + n <= (u64)(scope.prefix | ~mask);
+    }
+    return false;
+}
+
 static zcm_trans_t *createUdpm(zcm_url_t *url)
 {
     auto *ip = zcm_url_address(url);
@@ -523,8 +887,47 @@ static zcm_trans_t *createUdpm(zcm_url_t *url)
         ZCM_DEBUG("No ttl specified. Using default ttl=0");
         ttl = "0";
     }
+    bool trace = false;
+    auto *traceStr = optFind(opts, "trace");
+    if (traceStr) {
+        if (string(traceStr) == "true") {
+            trace = true;
+        } else if (string(traceStr) != "false") {
+            ZCM_DEBUG("expected boolean argument for 'trace'");
+        }
+    }
+    u32 frag_timeout_ms = DEFAULT_FRAG_TIMEOUT_MS;
+    auto *fragTimeoutStr = optFind(opts, "frag_timeout");
+    if (fragTimeoutStr) {
+        char *end;
+        long v = strtol(fragTimeoutStr, &end, 10);
+        if (*fragTimeoutStr == '\0' || *end != '\0' || v < 0) {
+            ZCM_DEBUG("expected a number of milliseconds for 'frag_timeout'");
+        } else {
+            frag_timeout_ms = (u32)v;
+        }
+    }
+    u32 channel_groups = 0;
+    auto *channelGroupsStr = optFind(opts, "channel_groups");
+    if (channelGroupsStr) {
+        char *end;
+        long v = strtol(channelGroupsStr, &end, 10);
+        if (*channelGroupsStr == '\0' || *end != '\0' || v < 0 || v > MAX_CHANNEL_GROUPS) {
+            ZCM_DEBUG("expected 0 to %d for 'channel_groups'", MAX_CHANNEL_GROUPS);
+            return nullptr;
+        }
+        channel_groups = (u32)v;
+
+        struct in_addr addr;
+        if (channel_groups != 0 && (!inet_aton(address.c_str(), &addr) ||
+                                    !groupsInScope(ntohl(addr.s_addr), channel_groups))) {
+            ZCM_DEBUG("'channel_groups' would leave the multicast scope of %s", address.c_str());
+            return nullptr;
+        }
+    }
     size_t recv_buf_size = 1024;
-    auto *trans = new ZCM_TRANS_CLASSNAME(address, atoi(port.c_str()), recv_buf_size, atoi(ttl));
+    auto *trans = new ZCM_TRANS_CLASSNAME(address, atoi(port.c_str()), recv_buf_size,
+                                          atoi(ttl), trace, frag_timeout_ms, channel_groups);
     if (!trans->init()) {
         delete trans;
         return nullptr;
@@ -87,6 +87,7 @@ typedef int64_t  i64;
 /************************* Important Defines *******************/
 #define ZCM_MAGIC_SHORT 0x4c433032   // hex repr of ascii "LC02"
 #define ZCM_MAGIC_LONG  0x4c433033   // hex repr of ascii "LC03"
+#define ZCM_MAGIC_TRACE 0x4c543031   // hex repr of ascii "LT01"
 
 #ifdef __APPLE__
 # define ZCM_SHORT_MESSAGE_MAX_SIZE 1435
@@ -99,8 +100,11 @@ typedef int64_t  i64;
 #define ZCM_RINGBUF_SIZE (200*1024)
 #define ZCM_DEFAULT_RECV_BUFS 2000
 #define ZCM_MAX_UNFRAGMENTED_PACKET_SIZE 65536
+#define ZCM_RECV_BATCH_SIZE 32
 
 #define MAX_FRAG_BUF_TOTAL_SIZE (1 << 24)// 16 megabytes
 #define MAX_NUM_FRAG_BUFS 1000
+#define DEFAULT_FRAG_TIMEOUT_MS 1000
+#define MAX_CHANNEL_GROUPS 256
 
 #define SELF_TEST_CHANNEL "LCM_SELF_TEST"
@@ -28,6 +28,20 @@ struct Platform
         return true;
     }
 
+    static bool dropMulticastGroup(int fd, struct in_addr multiaddr)
+    {
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr = multiaddr;
+        mreq.imr_interface.s_addr = INADDR_ANY;
+        ZCM_DEBUG("ZCM: leaving multicast group");
+        int ret = setsockopt(fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, (char*)&mreq, sizeof(mreq));
+        if (ret < 0) {
+            perror("setsockopt (IPPROTO_IP, IP_DROP_MEMBERSHIP)");
+            return false;
+        }
+        return true;
+    }
+
     static void checkRoutingTable(UDPMAddress& addr)
     {
         // UNIMPL
@@ -51,6 +65,19 @@ struct Platform
         }
         return true;
     }
+    static bool dropMulticastGroup(int fd, struct in_addr multiaddr)
+    {
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr = multiaddr;
+        mreq.imr_interface.s_addr = INADDR_ANY;
+        ZCM_DEBUG("ZCM: leaving multicast group");
+        int ret = setsockopt(fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, (char*)&mreq, sizeof(mreq));
+        if (ret < 0) {
+            perror("setsockopt (IPPROTO_IP, IP_DROP_MEMBERSHIP)");
+            return false;
+        }
+        return true;
+    }
     static void checkRoutingTable(UDPMAddress& addr)
     {
 #ifdef __linux__
@@ -105,6 +132,31 @@ bool UDPMSocket::joinMulticastGroup(struct in_addr multiaddr)
     return true;
 }
 
+bool UDPMSocket::addMembership(struct in_addr multiaddr)
+{
+    return Platform::setMulticastGroup(fd, multiaddr);
+}
+
+bool UDPMSocket::dropMembership(struct in_addr multiaddr)
+{
+    return Platform::dropMulticastGroup(fd, multiaddr);
+}
+
+bool UDPMSocket::disableMulticastAll()
+{
+#if defined(__linux__) && defined(IP_MULTICAST_ALL)
+    // By default linux hands a socket bound to INADDR_ANY the packets of every
+    // group joined by any socket on the host, not just its own
+    int opt = 0;
+    ZCM_DEBUG("ZCM: clearing IP_MULTICAST_ALL");
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, (char*)&opt, sizeof(opt)) < 0) {
+        perror("setsockopt (IPPROTO_IP, IP_MULTICAST_ALL)");
+        return false;
+    }
+#endif
+    return true;
+}
+
 bool UDPMSocket::setTTL(u8 ttl)
 {
     if (ttl == 0)
@@ -231,7 +283,7 @@ bool UDPMSocket::waitUntilData(int timeout)
     }
 }
 
-int UDPMSocket::recvPacket(Packet *pkt)
+int UDPMSocket::recvPacket(Packet *pkt, bool dontWait)
 {
     struct iovec vec;
     vec.iov_base = pkt->buf.data;
@@ -254,32 +306,77 @@ int UDPMSocket::recvPacket(Packet *pkt)
     msg.msg_flags = 0;
 #endif
 
-    int ret = ::recvmsg(fd, &msg, 0);
+    int ret = ::recvmsg(fd, &msg, dontWait ? MSG_DONTWAIT : 0);
+    if (ret < 0) return ret;
     pkt->fromlen = msg.msg_namelen;
+    setPacketUtime(pkt, &msg);
 
-    bool got_utime = false;
+    return ret;
+}
+
+int UDPMSocket::recvPackets(Packet **pkts, size_t n)
+{
+#ifdef __linux__
+    recvMmsgs.resize(n);
+    recvIovs.resize(n);
+    recvControl.resize(n * RECV_CONTROL_SIZE);
+    for (size_t i = 0; i < n; ++i) {
+        Packet *pkt = pkts[i];
+        recvIovs[i].iov_base = pkt->buf.data;
+        recvIovs[i].iov_len = pkt->buf.size;
+
+        struct msghdr& mhdr = recvMmsgs[i].msg_hdr;
+        memset(&mhdr, 0, sizeof(mhdr));
+        mhdr.msg_name = &pkt->from;
+        mhdr.msg_namelen = sizeof(struct sockaddr);
+        mhdr.msg_iov = &recvIovs[i];
+        mhdr.msg_iovlen = 1;
+#ifdef MSG_EXT_HDR
+        mhdr.msg_control = &recvControl[i * RECV_CONTROL_SIZE];
+        mhdr.msg_controllen = RECV_CONTROL_SIZE;
+#endif
+        recvMmsgs[i].msg_len = 0;
+    }
+
+    int ret = ::recvmmsg(fd, recvMmsgs.data(), n, MSG_DONTWAIT, NULL);
+    if (ret < 0) return ret;
+
+    for (int i = 0; i < ret; ++i) {
+        Packet *pkt = pkts[i];
+        pkt->sz = recvMmsgs[i].msg_len;
+        pkt->fromlen = recvMmsgs[i].msg_hdr.msg_namelen;
+        setPacketUtime(pkt, &recvMmsgs[i].msg_hdr);
+    }
+    return ret;
+#else
+    size_t i = 0;
+    for (; i < n; ++i) {
+        int sz = recvPacket(pkts[i], true);
+        if (sz < 0) break;
+        pkts[i]->sz = sz;
+    }
+    // On failure, errno is left as the first recvPacket() set it
+    return i == 0 ? -1 : (int)i;
+#endif
+}
+
+void UDPMSocket::setPacketUtime(Packet *pkt, struct msghdr *msg)
+{
 #ifdef SO_TIMESTAMP
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
     /* Get the receive timestamp out of the packet headers if possible */
-    while (!pkt->utime && cmsg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
         if (cmsg->cmsg_level == SOL_SOCKET &&
             cmsg->cmsg_type == SCM_TIMESTAMP) {
             struct timeval *t = (struct timeval*) CMSG_DATA (cmsg);
             pkt->utime = (int64_t) t->tv_sec * 1000000 + t->tv_usec;
-            got_utime = true;
-            break;
+            return;
         }
-        cmsg = CMSG_NXTHDR(&msg, cmsg);
     }
 #endif
 
-    if (!got_utime) {
-        struct timeval tv;
-        gettimeofday(&tv, NULL);
-        pkt->utime = (i64)tv.tv_sec * 1000000 + tv.tv_usec;
-    }
-
-    return ret;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    pkt->utime = (i64)tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
 ssize_t UDPMSocket::sendBuffers(const UDPMAddress& dest, const char *a, size_t alen)
@@ -344,6 +441,47 @@ ssize_t UDPMSocket::sendBuffers(const UDPMAddress& dest, const char *a, size_t a
     return::sendmsg(fd, &mhdr, 0);
 }
 
+size_t UDPMSocket::sendDatagrams(const UDPMAddress& dest, UDPMDatagram *dgrams, size_t n)
+{
+#ifdef __linux__
+    mmsgs.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        struct msghdr& mhdr = mmsgs[i].msg_hdr;
+        mhdr.msg_name = dest.getAddrPtr();
+        mhdr.msg_namelen = dest.getAddrSize();
+        mhdr.msg_iov = dgrams[i].iov;
+        mhdr.msg_iovlen = dgrams[i].iovlen;
+        mhdr.msg_control = NULL;
+        mhdr.msg_controllen = 0;
+        mhdr.msg_flags = 0;
+        mmsgs[i].msg_len = 0;
+    }
+
+    // sendmmsg() may stop early (e.g. at UIO_MAXIOV datagrams), so keep going
+    // until everything is sent or a datagram fails
+    size_t sent = 0;
+    while (sent < n) {
+        int ret = ::sendmmsg(fd, &mmsgs[sent], n - sent, 0);
+        if (ret <= 0) break;
+        sent += ret;
+    }
+    return sent;
+#else
+    for (size_t i = 0; i < n; ++i) {
+        struct msghdr mhdr;
+        mhdr.msg_name = dest.getAddrPtr();
+        mhdr.msg_namelen = dest.getAddrSize();
+        mhdr.msg_iov = dgrams[i].iov;
+        mhdr.msg_iovlen = dgrams[i].iovlen;
+        mhdr.msg_control = NULL;
+        mhdr.msg_controllen = 0;
+        mhdr.msg_flags = 0;
+        if (::sendmsg(fd, &mhdr, 0) < 0) return i;
+    }
+    return n;
+#endif
+}
+
 bool UDPMSocket::checkConnection(const string& ip, u16 port)
 {
     UDPMAddress addr{ip, port};
@@ -399,3 +537,16 @@ UDPMSocket UDPMSocket::createRecvSocket(struct in_addr multiaddr, u16 port)
     if (!sock.joinMulticastGroup(multiaddr)) { sock.close(); return sock; }
     return sock;
 }
+
+UDPMSocket UDPMSocket::createGroupRecvSocket(u16 port)
+{
+    UDPMSocket sock;
+    if (!sock.init())                        { sock.close(); return sock; }
+    if (!sock.setReuseAddr())                { sock.close(); return sock; }
+    if (!sock.setReusePort())                { sock.close(); return sock; }
+    if (!sock.enablePacketTimestamp())       { sock.close(); return sock; }
+    if (!sock.bindPort(port))                { sock.close(); return sock; }
+    if (!sock.disableMulticastAll())         { sock.close(); return sock; }
+    Platform::setKernelBuffers(sock.fd);
+    return sock;
+}
@@ -27,6 +27,13 @@ class UDPMAddress
     struct sockaddr_in addr;
 };
 
+// One datagram of a batch, gathered from up to three buffers
+struct UDPMDatagram
+{
+    struct iovec iov[3];
+    size_t iovlen;
+};
+
 class UDPMSocket
 {
   public:
@@ -37,6 +44,11 @@ class UDPMSocket
 
     bool init();
     bool joinMulticastGroup(struct in_addr multiaddr);
+    // Unlike joinMulticastGroup(), these leave the socket open on failure
+    bool addMembership(struct in_addr multiaddr);
+    bool dropMembership(struct in_addr multiaddr);
+    // Only deliver packets of the groups this socket joined (linux only)
+    bool disableMulticastAll();
     bool setTTL(u8 ttl);
     bool bindPort(u16 port);
     bool setReuseAddr();
@@ -50,23 +62,47 @@ class UDPMSocket
 
     // Returns true when there is a packet available for receiving
     bool waitUntilData(int timeout);
-    int recvPacket(Packet *pkt);
+    // With 'dontWait', returns -1 with errno EAGAIN right away if there is no packet
+    int recvPacket(Packet *pkt, bool dontWait = false);
+    // Receives up to 'n' packets that are already waiting, without blocking, with
+    // as few syscalls as the platform allows (one recvmmsg() on linux). Sets the
+    // 'sz' of each. Returns how many were received, or -1 with errno set (EAGAIN
+    // if there were none).
+    int recvPackets(Packet **pkts, size_t n);
 
     ssize_t sendBuffers(const UDPMAddress& dest, const char *a, size_t alen);
     ssize_t sendBuffers(const UDPMAddress& dest, const char *a, size_t alen,
                             const char *b, size_t blen);
     ssize_t sendBuffers(const UDPMAddress& dest, const char *a, size_t alen,
                         const char *b, size_t blen, const char *c, size_t clen);
+    // Sends every datagram to 'dest', in order, with as few syscalls as the platform
+    // allows (one sendmmsg() per batch on linux). Returns the number of datagrams
+    // sent, which is less than 'n' only if a send failed.
+    size_t sendDatagrams(const UDPMAddress& dest, UDPMDatagram *dgrams, size_t n);
 
     static bool checkConnection(const string& ip, u16 port);
     void checkAndWarnAboutSmallBuffer(size_t datalen, size_t kbufsize);
 
     static UDPMSocket createSendSocket(struct in_addr multiaddr, u8 ttl);
     static UDPMSocket createRecvSocket(struct in_addr multiaddr, u16 port);
+    // A receive socket that starts out in no group; see addMembership()
+    static UDPMSocket createGroupRecvSocket(u16 port);
+
+  private:
+    // Sets the packet's utime from the kernel's timestamp in 'msg', if there is one
+    static void setPacketUtime(Packet *pkt, struct msghdr *msg);
 
   private:
     SOCKET fd = -1;
     bool warnedAboutSmallBuffer = false;
+#ifdef __linux__
+    vector<struct mmsghdr> mmsgs;
+
+    static const size_t RECV_CONTROL_SIZE = 64;
+    vector<struct mmsghdr> recvMmsgs;
+    vector<struct iovec> recvIovs;
+    vector<char> recvControl;
+#endif
 
   private:
     // Disallow copies
@@ -0,0 +1,103 @@
+#include "zcm/util/buffer_pool.hpp"
+#include <cassert>
+#include <climits>
+
+BufferPool::BufferPool()
+{
+}
+
+BufferPool::~BufferPool()
+{
+    for (size_t i = 0; i < NUMLISTS; i++) {
+        Block *blk = sizelists[i].head;
+        while (blk) {
+            auto *next = blk->next;
+            std::free(blk);
+            blk = next;
+        }
+    }
+}
+
+// Returns NUMLISTS if 'sz' is too large to be pooled
+static size_t computeSlot(size_t sz, size_t minbits, size_t numlists)
+{
+    static_assert(sizeof(unsigned long long) * CHAR_BIT == 64, "Unexpected word size");
+    if (sz <= ((size_t)1 << minbits))
+        return 0;
+    size_t bits = 64 - __builtin_clzll((unsigned long long)(sz - 1));
+    size_t slot = bits - minbits;
+    return slot < numlists ? slot : numlists;
+}
+
+char *BufferPool::alloc(size_t sz)
+{
+    size_t slot = computeSlot(sz, MINBITS, NUMLISTS);
+    if (slot == NUMLISTS) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return (char*)malloc(sz);
+    }
+
+    SizeList& list = sizelists[slot];
+    {
+        std::unique_lock<std::mutex> lk(list.lock);
+        Block *mem = list.head;
+        if (mem) {
+            list.head = mem->next;
+            list.count--;
+            lk.unlock();
+            hits.fetch_add(1, std::memory_order_relaxed);
+            return (char*)mem;
+        }
+    }
+
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return (char*)malloc((size_t)1 << (slot + MINBITS));
+}
+
+void BufferPool::free(char *mem, size_t sz)
+{
+    if (!mem) return;
+
+    size_t slot = computeSlot(sz, MINBITS, NUMLISTS);
+    if (slot == NUMLISTS) {
+        std::free(mem);
+        return;
+    }
+
+    size_t blockSize = (size_t)1 << (slot + MINBITS);
+    SizeList& list = sizelists[slot];
+    {
+        std::unique_lock<std::mutex> lk(list.lock);
+        if ((list.count + 1) * blockSize <= MAX_CACHED_BYTES) {
+            Block *newblock = (Block*)mem;
+            newblock->next = list.head;
+            list.head = newblock;
+            list.count++;
+            return;
+        }
+    }
+    std::free(mem);
+}
+
+void BufferPool::test()
+{
+    BufferPool pool;
+
+    char *buf = pool.alloc(100);
+    assert(buf);
+    pool.free(buf, 100);
+    char *buf2 = pool.alloc(128);
+    assert(buf == buf2);
+    assert(pool.getHits() == 1 && pool.getMisses() == 1);
+    pool.free(buf2, 128);
+    char *buf3 = pool.alloc(129);
+    assert(buf3 && buf3 != buf);
+    pool.free(buf3, 129);
+    char *buf4 = pool.alloc(1);
+    assert(buf4);
+    pool.free(buf4, 1);
+    char *buf5 = pool.alloc((1 << 20) + 1);
+    assert(buf5);
+    pool.free(buf5, (1 << 20) + 1);
+    assert(pool.getMisses() == 4);
+}
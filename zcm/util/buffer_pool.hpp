@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdlib>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+
+// A thread-safe memory pool for the blocking core's send and recv queues.
+// Buffers are handed out from power-of-two size classes (2^6 to 2^20) so
+// steady-state publish and receive reuse memory instead of hitting malloc.
+// Larger requests fall through to malloc and are counted as misses.
+class BufferPool
+{
+  public:
+    BufferPool();
+    ~BufferPool();
+
+    char *alloc(size_t sz);
+    void free(char *mem, size_t sz);
+
+    // Number of alloc() calls served from (hits) or not from (misses) the pool
+    uint64_t getHits() const { return hits.load(std::memory_order_relaxed); }
+    uint64_t getMisses() const { return misses.load(std::memory_order_relaxed); }
+
+    static void test();
+
+  private:
+    struct Block { Block *next; };
+    struct SizeList
+    {
+        std::mutex lock;
+        Block *head = nullptr;
+        size_t count = 0;
+    };
+
+    static const size_t MINBITS = 6;
+    static const size_t NUMLISTS = 15; // Pow2 blocks from 2^6 to 2^20
+    // Each size class stops caching once it holds this many bytes
+    static const size_t MAX_CACHED_BYTES = 1 << 24;
+    SizeList sizelists[NUMLISTS];
+
+    std::atomic<uint64_t> hits {0};
+    std::atomic<uint64_t> misses {0};
+
+  private:
+    // Disallow copies and moves
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+    BufferPool(BufferPool&& other) = delete;
+    BufferPool& operator=(BufferPool&& other) = delete;
+};
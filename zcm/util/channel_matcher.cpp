@@ -0,0 +1,455 @@
+#include "zcm/util/channel_matcher.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <map>
+
+using std::bitset;
+using std::string;
+using std::vector;
+
+// Recursive descent parser that compiles one pattern into Thompson NFA fragments.
+// Every fragment has a single EPS end state whose 'out' is patched by the caller.
+class ChannelMatcher::Parser
+{
+  public:
+    Parser(ChannelMatcher& m, const string& p) : m(m), p(p) {}
+
+    // Returns false if the pattern uses syntax outside of the supported subset
+    // (which includes invalid patterns: std::regex gets to report those)
+    bool parse(Frag& f) { return alt(f) && pos == p.size(); }
+
+  private:
+    bool more() const { return pos < p.size(); }
+
+    Frag emptyFrag()
+    {
+        int s = m.addState(NfaState::EPS);
+        return Frag{s, s};
+    }
+
+    Frag charFrag(const bitset<256>& set)
+    {
+        m.charsets.push_back(set);
+        int end = m.addState(NfaState::EPS);
+        int s = m.addState(NfaState::CHAR, end, -1, m.charsets.size() - 1);
+        return Frag{s, end};
+    }
+
+    bool alt(Frag& f)
+    {
+        if (!concat(f)) return false;
+        while (more() && p[pos] == '|') {
+            pos++;
+            Frag b;
+            if (!concat(b)) return false;
+            int end = m.addState(NfaState::EPS);
+            int s = m.addState(NfaState::SPLIT, f.start, b.start);
+            m.nfa[f.end].out = end;
+            m.nfa[b.end].out = end;
+            f = Frag{s, end};
+        }
+        return true;
+    }
+
+    bool concat(Frag& f)
+    {
+        f = emptyFrag();
+        while (more() && p[pos] != '|' && p[pos] != ')') {
+            Frag r;
+            if (!repeat(r)) return false;
+            m.nfa[f.end].out = r.start;
+            f.end = r.end;
+        }
+        return true;
+    }
+
+    bool repeat(Frag& f)
+    {
+        if (!atom(f)) return false;
+        if (!more()) return true;
+
+        char q = p[pos];
+        if (q == '{') return false;
+        if (q != '*' && q != '+' && q != '?') return true;
+        pos++;
+        // Laziness doesn't change whether the pattern matches the whole channel
+        if (more() && p[pos] == '?') pos++;
+
+        int end = m.addState(NfaState::EPS);
+        int s = m.addState(NfaState::SPLIT, f.start, end);
+        if (q == '*') {
+            m.nfa[f.end].out = s;
+            f = Frag{s, end};
+        } else if (q == '+') {
+            m.nfa[f.end].out = s;
+            f = Frag{f.start, end};
+        } else {
+            m.nfa[f.end].out = end;
+            f = Frag{s, end};
+        }
+
+        // Stacked quantifiers are an error
+        return !(more() && (p[pos] == '*' || p[pos] == '+' || p[pos] == '?' || p[pos] == '{'));
+    }
+
+    bool atom(Frag& f)
+    {
+        bitset<256> set;
+        char c = p[pos];
+        switch (c) {
+            case '(': {
+                pos++;
+                if (p.compare(pos, 2, "?:") == 0) pos += 2;
+                else if (more() && p[pos] == '?') return false; // Lookaheads
+                if (!alt(f)) return false;
+                if (!more() || p[pos] != ')') return false;
+                pos++;
+                return true;
+            }
+            case '[': {
+                pos++;
+                if (!bracket(set)) return false;
+                break;
+            }
+            case '.': {
+                pos++;
+                set.set();
+                set.reset('\n');
+                set.reset('\r');
+                break;
+            }
+            case '\\': {
+                pos++;
+                if (!more()) return false;
+                int single;
+                if (!escape(p[pos++], set, single)) return false;
+                if (single >= 0) set.set(single);
+                break;
+            }
+            case '*': case '+': case '?': case '{': case '}':
+            case ']': case '^': case '$':
+                return false;
+            default: {
+                pos++;
+                set.set((uint8_t)c);
+                break;
+            }
+        }
+        f = charFrag(set);
+        return true;
+    }
+
+    // Sets 'single' to the escaped character, or to -1 if 'set' was filled in instead
+    static bool escape(char e, bitset<256>& set, int& single)
+    {
+        single = -1;
+        switch (e) {
+            case 'd': case 'D':
+                for (int b = '0'; b <= '9'; b++) set.set(b);
+                break;
+            case 'w': case 'W':
+                for (int b = 0; b < 256; b++)
+                    if (isalnum(b) || b == '_') set.set(b);
+                break;
+            case 's': case 'S':
+                for (int b = 0; b < 256; b++)
+                    if (isspace(b)) set.set(b);
+                break;
+            case 't': single = '\t'; return true;
+            case 'n': single = '\n'; return true;
+            case 'r': single = '\r'; return true;
+            case 'f': single = '\f'; return true;
+            case 'v': single = '\v'; return true;
+            default:
+                // Anything else that is alphanumeric has a special meaning we don't support
+                if (isalnum((uint8_t)e)) return false;
+                single = (uint8_t)e;
+                return true;
+        }
+        if (isupper((uint8_t)e)) set.flip();
+        return true;
+    }
+
+    // Parses one member of a bracket expression
+    bool classAtom(bitset<256>& set, int& single)
+    {
+        if (!more()) return false;
+        char c = p[pos++];
+        if (c == '\\') {
+            if (!more()) return false;
+            return escape(p[pos++], set, single);
+        }
+        // POSIX style "[[:alpha:]]" classes
+        if (c == '[' && more() && (p[pos] == ':' || p[pos] == '.' || p[pos] == '='))
+            return false;
+        single = (uint8_t)c;
+        return true;
+    }
+
+    bool bracket(bitset<256>& set)
+    {
+        bool negate = more() && p[pos] == '^';
+        if (negate) pos++;
+
+        while (true) {
+            if (!more()) return false;
+            // Note: ECMAScript's "[]" is an empty class, not a literal ']'
+            if (p[pos] == ']') {
+                pos++;
+                break;
+            }
+
+            bitset<256> lhs;
+            int lo;
+            if (!classAtom(lhs, lo)) return false;
+
+            bool range = pos + 1 < p.size() && p[pos] == '-' && p[pos + 1] != ']';
+            if (!range) {
+                if (lo >= 0) set.set(lo);
+                else set |= lhs;
+                continue;
+            }
+            pos++;
+
+            bitset<256> rhs;
+            int hi;
+            if (!classAtom(rhs, hi)) return false;
+            if (lo < 0 || hi < 0 || hi < lo) return false;
+            for (int b = lo; b <= hi; b++) set.set(b);
+        }
+
+        if (negate) set.flip();
+        return true;
+    }
+
+    ChannelMatcher& m;
+    const string& p;
+    size_t pos = 0;
+};
+
+ChannelMatcher::ChannelMatcher(const vector<string>& patterns)
+{
+    npatterns = patterns.size();
+
+    for (size_t i = 0; i < patterns.size(); i++) {
+        size_t nstates = nfa.size();
+        size_t nsets = charsets.size();
+        Frag f;
+        Parser parser(*this, patterns[i]);
+        if (parser.parse(f)) {
+            int accept = addState(NfaState::MATCH, -1, -1, i);
+            nfa[f.end].out = accept;
+            starts.push_back(f.start);
+        } else {
+            nfa.resize(nstates);
+            charsets.resize(nsets);
+            fallback.emplace_back(i, std::regex(patterns[i]));
+        }
+    }
+
+    buildByteClasses();
+    useDfa = buildDfa();
+}
+
+int ChannelMatcher::addState(NfaState::Type type, int out, int out1, size_t arg)
+{
+    nfa.push_back(NfaState{type, out, out1, arg});
+    return (int)nfa.size() - 1;
+}
+
+// Adds the CHAR and MATCH states reachable from 'state' without consuming input
+void ChannelMatcher::addClosure(int state, vector<int>& set, vector<uint32_t>& marks,
+                                uint32_t mark) const
+{
+    if (state < 0 || marks[state] == mark) return;
+    marks[state] = mark;
+
+    const NfaState& s = nfa[state];
+    switch (s.type) {
+        case NfaState::EPS:
+            addClosure(s.out, set, marks, mark);
+            break;
+        case NfaState::SPLIT:
+            addClosure(s.out, set, marks, mark);
+            addClosure(s.out1, set, marks, mark);
+            break;
+        case NfaState::CHAR:
+        case NfaState::MATCH:
+            set.push_back(state);
+            break;
+    }
+}
+
+void ChannelMatcher::step(const vector<int>& from, uint8_t c, vector<int>& to,
+                          vector<uint32_t>& marks, uint32_t mark) const
+{
+    to.clear();
+    for (int state : from) {
+        const NfaState& s = nfa[state];
+        if (s.type == NfaState::CHAR && charsets[s.arg][c])
+            addClosure(s.out, to, marks, mark);
+    }
+}
+
+void ChannelMatcher::acceptsOf(const vector<int>& set, vector<size_t>& out) const
+{
+    size_t first = out.size();
+    for (int state : set)
+        if (nfa[state].type == NfaState::MATCH)
+            out.push_back(nfa[state].arg);
+    std::sort(out.begin() + first, out.end());
+    out.erase(std::unique(out.begin() + first, out.end()), out.end());
+}
+
+void ChannelMatcher::buildByteClasses()
+{
+    std::map<vector<bool>, uint8_t> classes;
+    for (int b = 0; b < 256; b++) {
+        vector<bool> sig(charsets.size());
+        for (size_t i = 0; i < charsets.size(); i++)
+            sig[i] = charsets[i][b];
+        auto it = classes.emplace(std::move(sig), (uint8_t)classes.size()).first;
+        byteClass[b] = it->second;
+    }
+    nclasses = classes.size();
+}
+
+// Subset construction. Returns false if the DFA would be too large.
+bool ChannelMatcher::buildDfa()
+{
+    vector<uint8_t> rep(nclasses);
+    for (int b = 255; b >= 0; b--) rep[byteClass[b]] = (uint8_t)b;
+
+    vector<uint32_t> marks(nfa.size(), 0);
+    uint32_t mark = 1;
+
+    vector<vector<int>> sets(1);
+    for (int s : starts) addClosure(s, sets[0], marks, mark);
+    std::sort(sets[0].begin(), sets[0].end());
+    std::map<vector<int>, int32_t> ids;
+    ids.emplace(sets[0], 0);
+
+    vector<int> next;
+    for (size_t i = 0; i < sets.size(); i++) {
+        dfaAccepts.emplace_back();
+        acceptsOf(sets[i], dfaAccepts.back());
+
+        for (size_t cls = 0; cls < nclasses; cls++) {
+            step(sets[i], rep[cls], next, marks, ++mark);
+            if (next.empty()) {
+                dfaNext.push_back(-1);
+                continue;
+            }
+            std::sort(next.begin(), next.end());
+            auto it = ids.find(next);
+            if (it == ids.end()) {
+                if (sets.size() == MAX_DFA_STATES) {
+                    dfaNext.clear();
+                    dfaAccepts.clear();
+                    return false;
+                }
+                it = ids.emplace(next, (int32_t)sets.size()).first;
+                sets.push_back(next);
+            }
+            dfaNext.push_back(it->second);
+        }
+    }
+
+    return true;
+}
+
+void ChannelMatcher::matchNfa(const char* channel, vector<size_t>& out) const
+{
+    vector<uint32_t> marks(nfa.size(), 0);
+    uint32_t mark = 1;
+    vector<int> cur, next;
+    for (int s : starts) addClosure(s, cur, marks, mark);
+
+    for (const char* c = channel; *c && !cur.empty(); c++) {
+        step(cur, (uint8_t)*c, next, marks, ++mark);
+        cur.swap(next);
+    }
+    acceptsOf(cur, out);
+}
+
+void ChannelMatcher::match(const char* channel, vector<size_t>& out) const
+{
+    size_t first = out.size();
+
+    if (useDfa) {
+        int32_t s = 0;
+        for (const char* c = channel; *c && s >= 0; c++)
+            s = dfaNext[s * nclasses + byteClass[(uint8_t)*c]];
+        if (s >= 0)
+            out.insert(out.end(), dfaAccepts[s].begin(), dfaAccepts[s].end());
+    } else {
+        matchNfa(channel, out);
+    }
+
+    if (fallback.empty()) return;
+    for (auto& fb : fallback)
+        if (std::regex_match(channel, fb.second))
+            out.push_back(fb.first);
+    std::sort(out.begin() + first, out.end());
+}
+
+bool ChannelMatcher::matchesAny(const char* channel) const
+{
+    if (useDfa) {
+        int32_t s = 0;
+        for (const char* c = channel; *c && s >= 0; c++)
+            s = dfaNext[s * nclasses + byteClass[(uint8_t)*c]];
+        if (s >= 0 && !dfaAccepts[s].empty()) return true;
+    } else {
+        vector<size_t> out;
+        matchNfa(channel, out);
+        if (!out.empty()) return true;
+    }
+
+    for (auto& fb : fallback)
+        if (std::regex_match(channel, fb.second))
+            return true;
+    return false;
+}
+
+void ChannelMatcher::test()
+{
+    const vector<string> patterns = {
+        ".*", "FOO.*", "FOO_[0-9]+", "(BAR|BAZ)_\\d*", "a+b?c", "[^A-Z]+",
+        "^FOO$", "x{2,3}", "FOO\\.BAR", "(?:ab)*", "[a-c-]+", "(a*)*b",
+    };
+    const vector<string> channels = {
+        "", "FOO", "FOO_12", "FOO_", "BAR_", "BAZ_99", "BAX_1", "abc", "aac", "ab",
+        "hello", "xx", "xxxx", "FOO.BAR", "FOOxBAR", "abab", "a-b-c", "aaab", "b",
+    };
+
+    ChannelMatcher m(patterns);
+    assert(m.numPatterns() == patterns.size());
+    assert(m.useDfa);
+    assert(m.fallback.size() == 2); // "^FOO$" and "x{2,3}"
+
+    vector<size_t> got;
+    for (auto& c : channels) {
+        vector<size_t> expected;
+        for (size_t i = 0; i < patterns.size(); i++)
+            if (std::regex_match(c, std::regex(patterns[i])))
+                expected.push_back(i);
+
+        got.clear();
+        m.match(c.c_str(), got);
+        assert(got == expected);
+        assert(m.matchesAny(c.c_str()) == !expected.empty());
+
+        // The NFA simulation must agree with the DFA
+        got.clear();
+        m.matchNfa(c.c_str(), got);
+        vector<size_t> native;
+        for (size_t i : expected)
+            if (i != 6 && i != 7) native.push_back(i);
+        assert(got == native);
+    }
+
+    ChannelMatcher none({});
+    assert(!none.matchesAny("FOO"));
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <bitset>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Matches channel names against a set of subscription patterns all at once.
+//
+// Patterns use the std::regex ECMAScript syntax with regex_match() (whole string)
+// semantics. All patterns are compiled together into a single DFA, so matching a
+// channel costs one table lookup per character no matter how many patterns there
+// are. The common subset is supported natively: literals, '.', '*', '+', '?', '|',
+// groups, bracket expressions and the \d \w \s escapes (and their negations).
+// Patterns using anything else (anchors, counted repetition, backreferences, ...)
+// are evaluated with std::regex instead. If the combined DFA would grow past
+// MAX_DFA_STATES, matching falls back to simulating the NFA, which is still linear
+// in the length of the channel.
+//
+// Instances are immutable once constructed and safe to use from many threads.
+class ChannelMatcher
+{
+  public:
+    // Throws std::regex_error if a pattern is not a valid regex
+    explicit ChannelMatcher(const std::vector<std::string>& patterns);
+
+    size_t numPatterns() const { return npatterns; }
+
+    // Appends the index of every pattern that matches 'channel' to 'out', in order
+    void match(const char* channel, std::vector<size_t>& out) const;
+    bool matchesAny(const char* channel) const;
+
+    static void test();
+
+  private:
+    struct NfaState
+    {
+        enum Type { EPS, SPLIT, CHAR, MATCH } type;
+        int out;
+        int out1;    // Second branch of a SPLIT
+        size_t arg;  // Index into 'charsets' for CHAR, the pattern index for MATCH
+    };
+    struct Frag { int start; int end; };
+
+    class Parser;
+
+    int  addState(NfaState::Type type, int out = -1, int out1 = -1, size_t arg = 0);
+    void addClosure(int state, std::vector<int>& set, std::vector<uint32_t>& marks,
+                    uint32_t mark) const;
+    void step(const std::vector<int>& from, uint8_t c, std::vector<int>& to,
+              std::vector<uint32_t>& marks, uint32_t mark) const;
+    void acceptsOf(const std::vector<int>& set, std::vector<size_t>& out) const;
+    void buildByteClasses();
+    bool buildDfa();
+    void matchNfa(const char* channel, std::vector<size_t>& out) const;
+
+    size_t npatterns;
+
+    std::vector<NfaState> nfa;
+    std::vector<std::bitset<256>> charsets;
+    std::vector<int> starts;
+
+    // Bytes that no pattern tells apart share a class, which keeps the DFA narrow
+    uint8_t byteClass[256];
+    size_t nclasses = 0;
+
+    static const size_t MAX_DFA_STATES = 4096;
+    bool useDfa = false;
+    // Row 'state * nclasses + class' holds the next state, or -1 once nothing can match
+    std::vector<int32_t> dfaNext;
+    std::vector<std::vector<size_t>> dfaAccepts;
+
+    // Patterns outside of the supported subset
+    std::vector<std::pair<size_t, std::regex>> fallback;
+};
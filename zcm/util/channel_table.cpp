@@ -0,0 +1,115 @@
+#include "zcm/util/channel_table.hpp"
+#include "zcm/transport.h"
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+ChannelTable::ChannelTable()
+{
+    for (size_t i = 0; i < NUM_SLOTS; i++) slots[i].store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i < MAX_CHANNELS; i++) names[i].store(nullptr, std::memory_order_relaxed);
+}
+
+ChannelTable& ChannelTable::instance()
+{
+    // Intentionally never destroyed: ids and names must outlive every zcm instance,
+    // including ones torn down by other static destructors
+    static ChannelTable* table = new ChannelTable();
+    return *table;
+}
+
+// 32-bit FNV-1a
+uint32_t ChannelTable::hash(const char* channel)
+{
+    uint32_t h = 2166136261u;
+    for (const char* c = channel; *c; c++) {
+        h ^= (uint8_t)*c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+uint32_t ChannelTable::find(const char* channel, uint32_t h) const
+{
+    size_t idx = h & (NUM_SLOTS - 1);
+    while (true) {
+        uint64_t e = slots[idx].load(std::memory_order_acquire);
+        if (e == 0) return NONE;
+        uint32_t id = (uint32_t)e;
+        if ((uint32_t)(e >> 32) == h && strcmp(name(id), channel) == 0) return id;
+        idx = (idx + 1) & (NUM_SLOTS - 1);
+    }
+}
+
+uint32_t ChannelTable::find(const char* channel) const
+{
+    return find(channel, hash(channel));
+}
+
+uint32_t ChannelTable::intern(const char* channel, size_t reserve)
+{
+    uint32_t h = hash(channel);
+    uint32_t id = find(channel, h);
+    if (id != NONE) return id;
+
+    std::unique_lock<std::mutex> lk(lock);
+
+    // Somebody may have beaten us to it
+    id = find(channel, h);
+    if (id != NONE) return id;
+
+    if (count + 1 + reserve >= MAX_CHANNELS) return NONE;
+    id = ++count;
+
+    // The name must be visible before the slot that leads to it
+    names[id].store(strdup(channel), std::memory_order_release);
+    size_t idx = h & (NUM_SLOTS - 1);
+    while (slots[idx].load(std::memory_order_relaxed) != 0)
+        idx = (idx + 1) & (NUM_SLOTS - 1);
+    slots[idx].store(((uint64_t)h << 32) | id, std::memory_order_release);
+
+    return id;
+}
+
+void ChannelTable::test()
+{
+    ChannelTable& tbl = instance();
+
+    uint32_t foo = tbl.intern("FOO");
+    assert(foo != NONE);
+    assert(tbl.intern("FOO") == foo);
+    assert(tbl.find("FOO") == foo);
+    assert(strcmp(tbl.name(foo), "FOO") == 0);
+    assert(tbl.name(foo) == tbl.name(tbl.intern("FOO")));
+
+    uint32_t bar = tbl.intern("BAR");
+    assert(bar != NONE && bar != foo);
+    assert(tbl.find("BAZ_NEVER_INTERNED") == NONE);
+    assert(tbl.name(NONE) == nullptr);
+    assert(tbl.name(MAX_CHANNELS) == nullptr);
+
+    // Holding back the whole table only finds what is already there
+    assert(tbl.intern("FOO", MAX_CHANNELS) == foo);
+    assert(tbl.intern("BAZ_NEVER_INTERNED", MAX_CHANNELS) == NONE);
+    assert(tbl.find("BAZ_NEVER_INTERNED") == NONE);
+}
+
+/////////////// C Interface Functions ////////////////
+extern "C" {
+
+uint32_t zcm_channel_intern(const char* channel)
+{
+    return ChannelTable::instance().intern(channel);
+}
+
+uint32_t zcm_channel_find(const char* channel)
+{
+    return ChannelTable::instance().find(channel);
+}
+
+const char* zcm_channel_name(uint32_t id)
+{
+    return ChannelTable::instance().name(id);
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+
+// Process-wide table that interns channel names as small integer ids.
+//
+// Ids are handed out on first sight (starting at 1, 0 means "no id") and stay
+// valid for the life of the process, as do the name strings they map to, so a
+// name pointer obtained from name() can be kept and compared by address.
+// Looking up a name or an id never takes a lock; only interning a new name does.
+// The table holds at most MAX_CHANNELS - 1 names, after which intern() returns 0.
+// Names are never removed, so code that interns whatever it comes across (rather
+// than what it was asked for) should hold back some room with 'reserve'.
+class ChannelTable
+{
+  public:
+    static const uint32_t NONE = 0;
+    static const size_t MAX_CHANNELS = 1 << 14;
+
+    static ChannelTable& instance();
+
+    // Returns NONE rather than leave fewer than 'reserve' ids for later names
+    uint32_t intern(const char* channel, size_t reserve = 0);
+    // Like intern(), but never adds 'channel' to the table
+    uint32_t find(const char* channel) const;
+    // Returns nullptr if 'id' is not in the table
+    const char* name(uint32_t id) const
+    {
+        if (id == NONE || id >= MAX_CHANNELS) return nullptr;
+        return names[id].load(std::memory_order_acquire);
+    }
+
+    static void test();
+
+  private:
+    ChannelTable();
+
+    static uint32_t hash(const char* channel);
+    uint32_t find(const char* channel, uint32_t h) const;
+
+    // Open addressing, at most half full. Each slot holds (hash << 32 | id),
+    // or 0 if empty, and never changes once set.
+    static const size_t NUM_SLOTS = MAX_CHANNELS * 2;
+    std::atomic<uint64_t> slots[NUM_SLOTS];
+    std::atomic<const char*> names[MAX_CHANNELS];
+
+    // Serializes intern() calls that add a name
+    std::mutex lock;
+    uint32_t count = 0;
+
+  private:
+    // Disallow copies and moves
+    ChannelTable(const ChannelTable&) = delete;
+    ChannelTable& operator=(const ChannelTable&) = delete;
+    ChannelTable(ChannelTable&& other) = delete;
+    ChannelTable& operator=(ChannelTable&& other) = delete;
+};
@@ -0,0 +1,605 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+
+#include "zcm/util/queue.hpp"
+
+// Lock-free bounded queues designed as drop-in replacements for ThreadsafeQueue
+// on the hot paths of the blocking core:
+//   - SpscQueue: exactly one producer thread and one consumer at a time
+//   - MpscQueue: any number of producer threads and one consumer at a time
+// "One consumer at a time" means that top()/pop() may be called from different
+// threads as long as the caller serializes them (e.g. with a mutex).
+//
+// Both queues hold up to 'capacity' elements and keep the ThreadsafeQueue
+// semantics for disable()/enable(): a disabled queue never returns an element
+// from top(), and push() will still push if there is room. setCapacity()
+// requires that the caller has excluded all consumers; producers are held off
+// internally while the storage is swapped.
+//
+// Elements are relocated with memcpy by setCapacity(), so they must not hold
+// pointers into themselves.
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Adaptive spin-then-park wait. A waiter first spins on its predicate and only
+// parks on the condition variable if spinning did not pay off. The spin budget
+// grows when spinning succeeds and shrinks when it doesn't. On single-core
+// machines spinning can never succeed, so waiters park right away. Notifiers
+// only touch the mutex when somebody is actually parked.
+class SpinParker
+{
+    std::mutex mut;
+    std::condition_variable cond;
+    std::atomic<int> parked {0};
+    std::atomic<int> spinLimit {MIN_SPINS};
+
+    static constexpr int MIN_SPINS = 16;
+    static constexpr int MAX_SPINS = 4096;
+
+    static bool canSpin()
+    {
+        static const bool multicore = std::thread::hardware_concurrency() > 1;
+        return multicore;
+    }
+
+    // Returns true if pred() became true while spinning
+    template<class Pred>
+    bool spin(Pred pred)
+    {
+        int limit = canSpin() ? spinLimit.load(std::memory_order_relaxed) : 0;
+        for (int i = 0; i < limit; ++i) {
+            if (pred()) {
+                if (limit < MAX_SPINS)
+                    spinLimit.store(limit * 2, std::memory_order_relaxed);
+                return true;
+            }
+            cpuRelax();
+        }
+        if (pred()) return true;
+        if (limit > MIN_SPINS)
+            spinLimit.store(limit / 2, std::memory_order_relaxed);
+        return false;
+    }
+
+  public:
+    template<class Pred>
+    void wait(Pred pred)
+    {
+        if (spin(pred)) return;
+
+        std::unique_lock<std::mutex> lk(mut);
+        parked.fetch_add(1, std::memory_order_seq_cst);
+        // Pairs with the fence in notify(): either we observe the state change
+        // in pred() or the notifier observes that we are parked
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cond.wait(lk, pred);
+        parked.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Like wait(), but gives up after 'timeoutMs'. Returns the final value of pred()
+    template<class Pred>
+    bool waitFor(Pred pred, int timeoutMs)
+    {
+        if (spin(pred)) return true;
+
+        std::unique_lock<std::mutex> lk(mut);
+        parked.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool ret = cond.wait_for(lk, std::chrono::milliseconds(timeoutMs), pred);
+        parked.fetch_sub(1, std::memory_order_relaxed);
+        return ret;
+    }
+
+    // Must be called after the state that a waiter's predicate checks is updated
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked.load(std::memory_order_relaxed) == 0) return;
+        { std::lock_guard<std::mutex> lk(mut); }
+        cond.notify_all();
+    }
+};
+
+// Lets producers run concurrently with each other but not with setCapacity()
+class ProducerGate
+{
+    std::atomic<int>  producers {0};
+    std::atomic<bool> resizing {false};
+    SpinParker        resized;
+
+  public:
+    void enter()
+    {
+        while (true) {
+            producers.fetch_add(1, std::memory_order_seq_cst);
+            if (!resizing.load(std::memory_order_seq_cst)) return;
+            producers.fetch_sub(1, std::memory_order_seq_cst);
+            resized.wait([&](){ return !resizing.load(std::memory_order_acquire); });
+        }
+    }
+
+    void exit()
+    {
+        producers.fetch_sub(1, std::memory_order_release);
+    }
+
+    void close()
+    {
+        resizing.store(true, std::memory_order_seq_cst);
+        while (producers.load(std::memory_order_seq_cst) != 0)
+            std::this_thread::yield();
+    }
+
+    void open()
+    {
+        resizing.store(false, std::memory_order_seq_cst);
+        resized.notify();
+    }
+};
+
+template<class Element>
+class SpscQueue
+{
+    using Storage = typename std::aligned_storage<sizeof(Element), alignof(Element)>::type;
+
+    // The storage is rounded up to a power of two so indices wrap with a mask;
+    // 'capacity' is what limits the number of queued elements
+    Storage* queue;
+    size_t   mask;
+    size_t   capacity;
+
+    // head is only written by the consumer and tail only by the producer.
+    // Keep them on separate cache lines so the two sides don't false-share.
+    char pad0[64];
+    std::atomic<size_t> head {0};
+    char pad1[64];
+    std::atomic<size_t> tail {0};
+    char pad2[64];
+
+    // Mirrors 'capacity' for producers waiting outside of the gate
+    std::atomic<size_t> capacityHint;
+
+    std::atomic<bool> disabled {false};
+    std::atomic<bool> woken {false};
+    ProducerGate gate;
+    SpinParker notEmpty;
+    SpinParker notFull;
+
+    Element* at(size_t i) { return (Element*) &queue[i & mask]; }
+
+    bool full()
+    {
+        return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) >= capacity;
+    }
+
+    template<class... Args>
+    void emplace(Args&&... args)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        new (at(t)) Element(std::forward<Args>(args)...);
+        tail.store(t + 1, std::memory_order_release);
+        notEmpty.notify();
+    }
+
+  public:
+    SpscQueue(size_t capacity) : capacity(capacity), capacityHint(capacity)
+    {
+        assert(capacity > 0);
+        size_t size = ringStorageSize(capacity);
+        queue = new Storage[size];
+        mask = size - 1;
+    }
+
+    ~SpscQueue()
+    {
+        while (hasMessage()) pop();
+        delete[] queue;
+    }
+
+    size_t getCapacity()
+    {
+        return capacity;
+    }
+
+    // Requires that no consumer is concurrently in top() or pop()
+    void setCapacity(size_t capacity)
+    {
+        assert(capacity > 0);
+        gate.close();
+
+        size_t size = ringStorageSize(capacity);
+        Storage* newQueue = new Storage[size];
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t n = 0;
+        for (; h != t; ++h) {
+            if (n < capacity) memcpy((void*) &newQueue[n++], (void*) at(h), sizeof(Element));
+            else at(h)->~Element();
+        }
+
+        delete[] queue;
+        queue = newQueue;
+        mask = size - 1;
+        this->capacity = capacity;
+        capacityHint.store(capacity, std::memory_order_relaxed);
+        head.store(0, std::memory_order_relaxed);
+        tail.store(n, std::memory_order_release);
+
+        gate.open();
+        notFull.notify();
+    }
+
+    bool hasFreeSpace()
+    {
+        return numMessages() < capacityHint.load(std::memory_order_relaxed);
+    }
+
+    bool hasMessage()
+    {
+        return tail.load(std::memory_order_acquire) != head.load(std::memory_order_relaxed);
+    }
+
+    size_t numMessages()
+    {
+        size_t h = head.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) - h;
+    }
+
+    // Wait for hasFreeSpace() and then push the new element
+    // Returns true if the value was pushed, otherwise the queue was disabled
+    template<class... Args>
+    bool push(Args&&... args)
+    {
+        while (true) {
+            gate.enter();
+            if (!full()) {
+                emplace(std::forward<Args>(args)...);
+                gate.exit();
+                return true;
+            }
+            gate.exit();
+            if (disabled.load(std::memory_order_acquire)) return false;
+            notFull.wait([&](){
+                return disabled.load(std::memory_order_acquire) ||
+                       numMessages() < capacityHint.load(std::memory_order_relaxed);
+            });
+        }
+    }
+
+    // Check for hasFreeSpace() and if so, push the new element
+    // Returns true if the value was pushed, returns false if no room
+    template<class... Args>
+    bool pushIfRoom(Args&&... args)
+    {
+        gate.enter();
+        bool room = !full();
+        if (room) emplace(std::forward<Args>(args)...);
+        gate.exit();
+        return room;
+    }
+
+    // Wait for hasMessage() and then return the top element
+    // Returns nullptr if the queue is disabled or was woken up while empty
+    Element* top()
+    {
+        notEmpty.wait([&](){
+            return disabled.load(std::memory_order_acquire) ||
+                   woken.load(std::memory_order_acquire) || hasMessage();
+        });
+        if (disabled.load(std::memory_order_acquire) || !hasMessage()) return nullptr;
+        return at(head.load(std::memory_order_relaxed));
+    }
+
+    // Same as top(), but also returns nullptr if nothing arrives within 'timeoutMs'
+    Element* topFor(int timeoutMs)
+    {
+        notEmpty.waitFor([&](){
+            return disabled.load(std::memory_order_acquire) ||
+                   woken.load(std::memory_order_acquire) || hasMessage();
+        }, timeoutMs);
+        if (disabled.load(std::memory_order_acquire) || !hasMessage()) return nullptr;
+        return at(head.load(std::memory_order_relaxed));
+    }
+
+    // Lets the consumer know that something outside of the queue needs its attention:
+    // top() stops waiting for an element until the consumer calls takeWake().
+    // Unlike the rest of the producer side, this may be called from any thread.
+    void wake()
+    {
+        woken.store(true, std::memory_order_release);
+        notEmpty.notify();
+    }
+
+    // Returns whether wake() was called since the last call
+    bool takeWake()
+    {
+        return woken.load(std::memory_order_acquire) &&
+               woken.exchange(false, std::memory_order_acq_rel);
+    }
+
+    // Requires that hasMessage() == true
+    void pop()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        at(h)->~Element();
+        head.store(h + 1, std::memory_order_release);
+        notFull.notify();
+    }
+
+    void disable()
+    {
+        disabled.store(true, std::memory_order_release);
+        notEmpty.notify();
+        notFull.notify();
+    }
+
+    void enable()
+    {
+        disabled.store(false, std::memory_order_release);
+    }
+
+  private:
+    SpscQueue(const SpscQueue& other) = delete;
+    SpscQueue(SpscQueue&& other) = delete;
+    SpscQueue& operator=(const SpscQueue& other) = delete;
+    SpscQueue& operator=(SpscQueue&& other) = delete;
+};
+
+// Bounded MPSC queue based on Dmitry Vyukov's sequenced ring: each cell carries
+// a sequence number that tells producers whether it is free for position 'pos'
+// (seq == pos) and the consumer whether it has been filled (seq == pos + 1).
+template<class Element>
+class MpscQueue
+{
+    using Storage = typename std::aligned_storage<sizeof(Element), alignof(Element)>::type;
+
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        Storage data;
+    };
+
+    // A ring of one cell can't tell a full cell from a free one (both have
+    // seq == pos), so there are always at least two cells. With fewer elements
+    // allowed than there are cells, producers also check the distance to head.
+    Cell*  cells;
+    size_t ncells;
+    size_t capacity;
+
+    char pad0[64];
+    std::atomic<size_t> head {0};
+    char pad1[64];
+    std::atomic<size_t> tail {0};
+    char pad2[64];
+
+    // Mirrors 'capacity' for producers waiting outside of the gate
+    std::atomic<size_t> capacityHint;
+
+    std::atomic<bool> disabled {false};
+    ProducerGate gate;
+    SpinParker notEmpty;
+    SpinParker notFull;
+
+    static size_t cellsFor(size_t capacity) { return capacity < 2 ? 2 : capacity; }
+
+    static Cell* makeCells(size_t ncells)
+    {
+        Cell* c = new Cell[ncells];
+        for (size_t i = 0; i < ncells; ++i)
+            c[i].seq.store(i, std::memory_order_relaxed);
+        return c;
+    }
+
+    Element* at(Cell& c) { return (Element*) &c.data; }
+
+    bool full()
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (capacity < ncells && t - head.load(std::memory_order_acquire) >= capacity) return true;
+        Cell& c = cells[t % ncells];
+        return (intptr_t)(c.seq.load(std::memory_order_acquire) - t) < 0;
+    }
+
+    // Returns false if the queue was full
+    template<class... Args>
+    bool tryEmplace(Args&&... args)
+    {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Cell* c;
+        while (true) {
+            c = &cells[pos % ncells];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)(seq - pos);
+            if (diff == 0) {
+                if (capacity < ncells && pos - head.load(std::memory_order_acquire) >= capacity)
+                    return false;
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (at(*c)) Element(std::forward<Args>(args)...);
+        c->seq.store(pos + 1, std::memory_order_release);
+        notEmpty.notify();
+        return true;
+    }
+
+  public:
+    MpscQueue(size_t capacity)
+        : ncells(cellsFor(capacity)), capacity(capacity), capacityHint(capacity)
+    {
+        assert(capacity > 0);
+        cells = makeCells(ncells);
+    }
+
+    ~MpscQueue()
+    {
+        while (hasMessage()) pop();
+        delete[] cells;
+    }
+
+    size_t getCapacity()
+    {
+        return capacity;
+    }
+
+    // Requires that no consumer is concurrently in top() or pop()
+    void setCapacity(size_t capacity)
+    {
+        assert(capacity > 0);
+        gate.close();
+
+        size_t newNcells = cellsFor(capacity);
+        Cell* newCells = makeCells(newNcells);
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t n = 0;
+        while (true) {
+            Cell& c = cells[h % ncells];
+            if (c.seq.load(std::memory_order_acquire) != h + 1) break;
+            if (n < capacity) {
+                memcpy((void*) &newCells[n].data, (void*) &c.data, sizeof(Element));
+                newCells[n].seq.store(n + 1, std::memory_order_relaxed);
+                ++n;
+            } else {
+                at(c)->~Element();
+            }
+            ++h;
+        }
+
+        delete[] cells;
+        cells = newCells;
+        ncells = newNcells;
+        this->capacity = capacity;
+        capacityHint.store(capacity, std::memory_order_relaxed);
+        head.store(0, std::memory_order_relaxed);
+        tail.store(n, std::memory_order_release);
+
+        gate.open();
+        notFull.notify();
+    }
+
+    bool hasFreeSpace()
+    {
+        return numMessages() < capacityHint.load(std::memory_order_relaxed);
+    }
+
+    bool hasMessage()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        return cells[h % ncells].seq.load(std::memory_order_acquire) == h + 1;
+    }
+
+    // Note: includes elements that producers are in the middle of pushing
+    size_t numMessages()
+    {
+        size_t h = head.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) - h;
+    }
+
+    // Wait for hasFreeSpace() and then push the new element
+    // Returns true if the value was pushed, otherwise the queue was disabled
+    template<class... Args>
+    bool push(Args&&... args)
+    {
+        while (true) {
+            gate.enter();
+            bool pushed = tryEmplace(std::forward<Args>(args)...);
+            gate.exit();
+            if (pushed) return true;
+            if (disabled.load(std::memory_order_acquire)) return false;
+            notFull.wait([&](){
+                return disabled.load(std::memory_order_acquire) ||
+                       numMessages() < capacityHint.load(std::memory_order_relaxed);
+            });
+        }
+    }
+
+    // Check for hasFreeSpace() and if so, push the new element
+    // Returns true if the value was pushed, returns false if no room
+    template<class... Args>
+    bool pushIfRoom(Args&&... args)
+    {
+        gate.enter();
+        bool pushed = tryEmplace(std::forward<Args>(args)...);
+        gate.exit();
+        return pushed;
+    }
+
+    // Wait for hasMessage() and then return the top element
+    // Returns nullptr if the queue is disabled
+    Element* top()
+    {
+        notEmpty.wait([&](){ return disabled.load(std::memory_order_acquire) || hasMessage(); });
+        if (disabled.load(std::memory_order_acquire)) return nullptr;
+        return at(cells[head.load(std::memory_order_relaxed) % ncells]);
+    }
+
+    // Same as top(), but also returns nullptr if nothing arrives within 'timeoutMs'
+    Element* topFor(int timeoutMs)
+    {
+        notEmpty.waitFor([&](){ return disabled.load(std::memory_order_acquire) || hasMessage(); },
+                         timeoutMs);
+        if (disabled.load(std::memory_order_acquire) || !hasMessage()) return nullptr;
+        return at(cells[head.load(std::memory_order_relaxed) % ncells]);
+    }
+
+    // Returns the element 'i' places behind top() without waiting, or nullptr if
+    // it has not been fully pushed yet. Only the consumer may call this.
+    Element* peek(size_t i)
+    {
+        size_t pos = head.load(std::memory_order_relaxed) + i;
+        Cell& c = cells[pos % ncells];
+        if (i >= capacity || c.seq.load(std::memory_order_acquire) != pos + 1) return nullptr;
+        return at(c);
+    }
+
+    // Requires that hasMessage() == true
+    void pop()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        Cell& c = cells[h % ncells];
+        at(c)->~Element();
+        c.seq.store(h + ncells, std::memory_order_release);
+        head.store(h + 1, std::memory_order_release);
+        notFull.notify();
+    }
+
+    void disable()
+    {
+        disabled.store(true, std::memory_order_release);
+        notEmpty.notify();
+        notFull.notify();
+    }
+
+    void enable()
+    {
+        disabled.store(false, std::memory_order_release);
+    }
+
+  private:
+    MpscQueue(const MpscQueue& other) = delete;
+    MpscQueue(MpscQueue&& other) = delete;
+    MpscQueue& operator=(const MpscQueue& other) = delete;
+    MpscQueue& operator=(MpscQueue&& other) = delete;
+};
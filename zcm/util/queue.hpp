@@ -2,9 +2,19 @@
 
 #include <utility>
 #include <memory>
+#include <type_traits>
+#include <cstdint>
 #include <cstring>
 #include <cassert>
 
+// Smallest power of two that is >= n (and at least 1)
+static inline size_t ringStorageSize(size_t n)
+{
+    size_t s = 1;
+    while (s < n) s <<= 1;
+    return s;
+}
+
 // A C++ queue implementation designed for efficiency.
 // No unneeded copies or initializations.
 // Note: Nothing about this queue is thread-safe
@@ -122,3 +132,170 @@ class Queue
     Queue& operator=(const Queue& other) = delete;
     Queue& operator=(Queue&& other) = delete;
 };
+
+// Same interface as Queue, plus bulk pushN()/popN(), but laid out for speed:
+// the storage is rounded up to a power of two so indices wrap with a mask, and
+// front and back are free-running counters kept on separate cache lines. The
+// queue still never holds more than 'capacity' elements.
+//
+// Trivially copyable elements are moved in bulk with memcpy by setCapacity()
+// and pushN()/popN(); any other element is moved or copied one at a time.
+// Note: Nothing about this queue is thread-safe
+template<class Element>
+class RingQueue
+{
+    using Storage = typename std::aligned_storage<sizeof(Element), alignof(Element)>::type;
+
+    Storage* queue;
+    size_t   mask;
+    size_t   capacity;
+
+    char   pad0[64];
+    size_t front = 0;
+    char   pad1[64];
+    size_t back = 0;
+    char   pad2[64];
+
+    Element* at(size_t i) { return (Element*) &queue[i & mask]; }
+
+    // Number of contiguous slots starting at counter 'i', capped at 'n'
+    size_t contiguous(size_t i, size_t n) const
+    {
+        size_t toEnd = mask + 1 - (i & mask);
+        return n < toEnd ? n : toEnd;
+    }
+
+  public:
+    RingQueue(size_t capacity) : capacity(capacity)
+    {
+        assert(capacity > 0);
+        size_t size = ringStorageSize(capacity);
+        queue = new Storage[size];
+        mask = size - 1;
+    }
+
+    ~RingQueue()
+    {
+        while (hasMessage()) pop();
+        delete[] queue;
+    }
+
+    size_t getCapacity()
+    {
+        return capacity;
+    }
+
+    // Keeps the oldest 'capacity' elements and destroys the rest
+    void setCapacity(size_t capacity)
+    {
+        assert(capacity > 0);
+        while (numMessages() > capacity) {
+            --back;
+            at(back)->~Element();
+        }
+
+        size_t size = ringStorageSize(capacity);
+        if (size != mask + 1) {
+            Storage* newQueue = new Storage[size];
+            size_t n = 0;
+            for (size_t i = front; i != back; ++i, ++n) {
+                if (std::is_trivially_copyable<Element>::value) {
+                    memcpy((void*) &newQueue[n], (void*) at(i), sizeof(Element));
+                } else {
+                    new (&newQueue[n]) Element(std::move(*at(i)));
+                    at(i)->~Element();
+                }
+            }
+            delete[] queue;
+            queue = newQueue;
+            mask = size - 1;
+            front = 0;
+            back = n;
+        }
+        this->capacity = capacity;
+    }
+
+    bool hasFreeSpace()
+    {
+        return back - front < capacity;
+    }
+
+    bool hasMessage()
+    {
+        return front != back;
+    }
+
+    size_t numMessages()
+    {
+        return back - front;
+    }
+
+    // Requires that hasFreeSpace() == true
+    template<class... Args>
+    void push(Args&&... args)
+    {
+        assert(hasFreeSpace());
+        new (at(back)) Element(std::forward<Args>(args)...);
+        ++back;
+    }
+
+    // Copies in as many of the 'n' elements at 'src' as there is room for.
+    // Returns the number of elements pushed.
+    size_t pushN(const Element* src, size_t n)
+    {
+        size_t room = capacity - numMessages();
+        if (n > room) n = room;
+
+        if (std::is_trivially_copyable<Element>::value) {
+            size_t first = contiguous(back, n);
+            memcpy((void*) at(back), (const void*) src, first * sizeof(Element));
+            memcpy((void*) &queue[0], (const void*) (src + first), (n - first) * sizeof(Element));
+        } else {
+            for (size_t i = 0; i < n; ++i) new (at(back + i)) Element(src[i]);
+        }
+        back += n;
+        return n;
+    }
+
+    // Requires that hasMessage() == true
+    Element& top()
+    {
+        assert(hasMessage());
+        return *at(front);
+    }
+
+    // Requires that hasMessage() == true
+    void pop()
+    {
+        assert(hasMessage());
+        at(front)->~Element();
+        ++front;
+    }
+
+    // Moves up to 'n' elements out into 'dst'. Returns the number of elements popped.
+    size_t popN(Element* dst, size_t n)
+    {
+        size_t avail = numMessages();
+        if (n > avail) n = avail;
+
+        if (std::is_trivially_copyable<Element>::value) {
+            size_t first = contiguous(front, n);
+            memcpy((void*) dst, (const void*) at(front), first * sizeof(Element));
+            memcpy((void*) (dst + first), (const void*) &queue[0], (n - first) * sizeof(Element));
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                Element* e = at(front + i);
+                dst[i] = std::move(*e);
+                e->~Element();
+            }
+        }
+        front += n;
+        return n;
+    }
+
+  private:
+    RingQueue(const RingQueue& other) = delete;
+    RingQueue(RingQueue&& other) = delete;
+    RingQueue& operator=(const RingQueue& other) = delete;
+    RingQueue& operator=(RingQueue&& other) = delete;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+// A minimal read-copy-update domain.
+//
+// Readers bracket their accesses to shared data with readLock()/readUnlock().
+// Both are a couple of atomic ops and never block on writers. A writer
+// publishes a new version of the data, then calls synchronize(), which waits
+// until every reader that could have observed the old version has left its
+// read-side section. After that, the old version can be freed.
+//
+// Readers are counted in one of two buckets selected by the low bit of the
+// epoch. synchronize() flips the epoch and waits for the old bucket to drain,
+// so readers arriving after the flip never delay it.
+//
+// startGracePeriod() and gracePeriodDone() split synchronize() in two for
+// callers that must not wait: free the old version once gracePeriodDone()
+// returns true for the token of a grace period started after it was replaced.
+//
+// NOTE: synchronize() must not be called from inside a read-side section of
+//       the same domain (it would wait on itself). Grace periods must be
+//       serialized by the caller: don't start one (or call synchronize())
+//       until the previous one is done.
+class Rcu
+{
+    std::atomic<unsigned> epoch {0};
+    std::atomic<size_t>   readers[2];
+
+  public:
+    Rcu()
+    {
+        readers[0].store(0, std::memory_order_relaxed);
+        readers[1].store(0, std::memory_order_relaxed);
+    }
+
+    // Returns a token that must be passed to readUnlock()
+    unsigned readLock()
+    {
+        while (true) {
+            unsigned e = epoch.load(std::memory_order_seq_cst);
+            readers[e & 1].fetch_add(1, std::memory_order_seq_cst);
+            // If the epoch flipped in between, the writer might not wait on the
+            // bucket we just entered, so go again with the new epoch
+            if (epoch.load(std::memory_order_seq_cst) == e) return e;
+            readers[e & 1].fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    void readUnlock(unsigned token)
+    {
+        readers[token & 1].fetch_sub(1, std::memory_order_release);
+    }
+
+    // Returns a token that must be passed to gracePeriodDone()
+    unsigned startGracePeriod()
+    {
+        return epoch.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    bool gracePeriodDone(unsigned token)
+    {
+        return readers[token & 1].load(std::memory_order_acquire) == 0;
+    }
+
+    void synchronize()
+    {
+        unsigned token = startGracePeriod();
+        while (!gracePeriodDone(token))
+            std::this_thread::yield();
+    }
+
+  private:
+    Rcu(const Rcu& other) = delete;
+    Rcu& operator=(const Rcu& other) = delete;
+};
@@ -0,0 +1,317 @@
+#include "zcm/util/stats.hpp"
+#include "util/TimeUtil.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static std::atomic<uint64_t> nextRegistryId {1};
+
+StatsRegistry::Shard::Shard()
+{
+    for (size_t i = 0; i < NUM_CHUNKS; ++i) chunks[i].store(nullptr, std::memory_order_relaxed);
+}
+
+StatsRegistry::Shard::~Shard()
+{
+    for (size_t i = 0; i < NUM_CHUNKS; ++i) delete[] chunks[i].load(std::memory_order_relaxed);
+}
+
+StatsRegistry::Counters& StatsRegistry::Shard::at(uint32_t channelId)
+{
+    std::atomic<Counters*>& chunk = chunks[channelId / CHUNK_SIZE];
+    Counters* c = chunk.load(std::memory_order_relaxed);
+    if (c == nullptr) {
+        // Value-initialized, so every counter starts out at zero
+        c = new Counters[CHUNK_SIZE]();
+        chunk.store(c, std::memory_order_release);
+    }
+    return c[channelId % CHUNK_SIZE];
+}
+
+// Every live registry, so an exiting thread can hand its shards back
+static std::mutex& registriesMutex()
+{
+    static std::mutex m;
+    return m;
+}
+
+static std::vector<StatsRegistry*>& registries()
+{
+    static std::vector<StatsRegistry*> r;
+    return r;
+}
+
+StatsRegistry::StatsRegistry() : id(nextRegistryId.fetch_add(1))
+{
+    std::unique_lock<std::mutex> lk(registriesMutex());
+    registries().push_back(this);
+}
+
+StatsRegistry::~StatsRegistry()
+{
+    std::unique_lock<std::mutex> lk(registriesMutex());
+    auto& r = registries();
+    r.erase(std::find(r.begin(), r.end(), this));
+}
+
+// A thread's cache of its shards in the last few registries it recorded into.
+// Destroyed when the thread exits, which retires the thread's shards in every
+// registry that is still around.
+struct StatsRegistry::ThreadShards
+{
+    struct Cached
+    {
+        uint64_t registry;
+        Shard* shard;
+    };
+    static const size_t MAX_CACHED = 16;
+    std::vector<Cached> cache;
+
+    ~ThreadShards()
+    {
+        std::unique_lock<std::mutex> lk(registriesMutex());
+        for (StatsRegistry* r : registries()) r->retire(std::this_thread::get_id());
+    }
+};
+
+StatsRegistry::Shard& StatsRegistry::local()
+{
+    static thread_local ThreadShards local;
+    auto& cache = local.cache;
+
+    for (size_t i = 0; i < cache.size(); ++i) {
+        if (cache[i].registry != id) continue;
+        // Keep the busiest registries up front
+        if (i != 0) std::swap(cache[i], cache[i - 1]);
+        return *cache[i == 0 ? 0 : i - 1].shard;
+    }
+
+    // Not cached: this thread may still have a shard here from before it was
+    // pushed out of the cache, so look it up before starting a new one
+    Shard* s;
+    {
+        std::unique_lock<std::mutex> lk(shardsMutex);
+        auto& owned = shards[std::this_thread::get_id()];
+        if (!owned) owned.reset(new Shard());
+        s = owned.get();
+    }
+    if (cache.size() == ThreadShards::MAX_CACHED) cache.pop_back();
+    cache.push_back({id, s});
+    return *s;
+}
+
+void StatsRegistry::retire(std::thread::id thread)
+{
+    std::unique_lock<std::mutex> lk(shardsMutex);
+    auto it = shards.find(thread);
+    if (it == shards.end()) return;
+    Shard& s = *it->second;
+
+    auto load = [](const std::atomic<uint64_t>& c) { return c.load(std::memory_order_relaxed); };
+
+    raise(retired.sendQueueHighWater, load(s.sendQueueHighWater));
+    raise(retired.recvQueueHighWater, load(s.recvQueueHighWater));
+    for (size_t chunk = 0; chunk < NUM_CHUNKS; ++chunk) {
+        const Counters* c = s.chunks[chunk].load(std::memory_order_acquire);
+        if (c == nullptr) continue;
+        for (size_t i = 0; i < CHUNK_SIZE; ++i) {
+            Counters& sum = retired.at(chunk * CHUNK_SIZE + i);
+            add(sum.msgsOut,    load(c[i].msgsOut));
+            add(sum.bytesOut,   load(c[i].bytesOut));
+            add(sum.msgsIn,     load(c[i].msgsIn));
+            add(sum.bytesIn,    load(c[i].bytesIn));
+            add(sum.dispatched, load(c[i].dispatched));
+            raise(sum.queueHighWater, load(c[i].queueHighWater));
+            for (size_t d = 0; d < ZCM_DROP_NUM_REASONS; ++d)
+                add(sum.drops[d], load(c[i].drops[d]));
+            for (size_t b = 0; b < ZCM_STATS_LATENCY_BUCKETS; ++b)
+                add(sum.latency[b], load(c[i].latency[b]));
+        }
+    }
+
+    shards.erase(it);
+}
+
+void StatsRegistry::countOut(uint32_t channelId, size_t bytes)
+{
+    Counters& c = local().at(channelId);
+    add(c.msgsOut, 1);
+    add(c.bytesOut, bytes);
+}
+
+void StatsRegistry::countIn(uint32_t channelId, size_t bytes)
+{
+    Counters& c = local().at(channelId);
+    add(c.msgsIn, 1);
+    add(c.bytesIn, bytes);
+}
+
+void StatsRegistry::countDispatch(uint32_t channelId, int64_t latencyUs)
+{
+    Counters& c = local().at(channelId);
+    add(c.dispatched, 1);
+    if (latencyUs < 0) return;
+
+    size_t bucket = 0;
+    if (latencyUs != 0) bucket = 64 - __builtin_clzll((uint64_t) latencyUs);
+    if (bucket >= ZCM_STATS_LATENCY_BUCKETS) bucket = ZCM_STATS_LATENCY_BUCKETS - 1;
+    add(c.latency[bucket], 1);
+}
+
+void StatsRegistry::countDrop(uint32_t channelId, enum zcm_drop_reason reason)
+{
+    add(local().at(channelId).drops[reason], 1);
+}
+
+void StatsRegistry::queueDepth(uint32_t channelId, size_t depth)
+{
+    raise(local().at(channelId).queueHighWater, depth);
+}
+
+void StatsRegistry::sendQueueDepth(size_t depth)
+{
+    raise(local().sendQueueHighWater, depth);
+}
+
+void StatsRegistry::recvQueueDepth(size_t depth)
+{
+    raise(local().recvQueueHighWater, depth);
+}
+
+void StatsRegistry::collect(zcm_stats_t* stats) const
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->utime = TimeUtil::utime();
+
+    std::vector<zcm_channel_stats_t> out;
+    zcm_channel_stats_t sums[CHUNK_SIZE];
+
+    std::unique_lock<std::mutex> lk(shardsMutex);
+
+    auto load = [](const std::atomic<uint64_t>& c) { return c.load(std::memory_order_relaxed); };
+
+    // The shards of live threads, and what exited threads left behind
+    std::vector<const Shard*> all;
+    all.reserve(shards.size() + 1);
+    for (auto& s : shards) all.push_back(s.second.get());
+    all.push_back(&retired);
+
+    for (const Shard* s : all) {
+        uint64_t hw = load(s->sendQueueHighWater);
+        if (hw > stats->send_queue_high_water) stats->send_queue_high_water = hw;
+        hw = load(s->recvQueueHighWater);
+        if (hw > stats->recv_queue_high_water) stats->recv_queue_high_water = hw;
+    }
+
+    for (size_t chunk = 0; chunk < NUM_CHUNKS; ++chunk) {
+        bool any = false;
+        for (const Shard* s : all) {
+            const Counters* c = s->chunks[chunk].load(std::memory_order_acquire);
+            if (c == nullptr) continue;
+            if (!any) memset(sums, 0, sizeof(sums));
+            any = true;
+
+            for (size_t i = 0; i < CHUNK_SIZE; ++i) {
+                zcm_channel_stats_t& sum = sums[i];
+                sum.msgs_out        += load(c[i].msgsOut);
+                sum.bytes_out       += load(c[i].bytesOut);
+                sum.msgs_in         += load(c[i].msgsIn);
+                sum.bytes_in        += load(c[i].bytesIn);
+                sum.msgs_dispatched += load(c[i].dispatched);
+                uint64_t hw = load(c[i].queueHighWater);
+                if (hw > sum.queue_high_water) sum.queue_high_water = hw;
+                for (size_t d = 0; d < ZCM_DROP_NUM_REASONS; ++d)
+                    sum.drops[d] += load(c[i].drops[d]);
+                for (size_t b = 0; b < ZCM_STATS_LATENCY_BUCKETS; ++b)
+                    sum.latency_hist[b] += load(c[i].latency[b]);
+            }
+        }
+        if (!any) continue;
+
+        for (size_t i = 0; i < CHUNK_SIZE; ++i) {
+            zcm_channel_stats_t& sum = sums[i];
+            bool active = sum.msgs_out || sum.msgs_in || sum.msgs_dispatched;
+            for (size_t d = 0; d < ZCM_DROP_NUM_REASONS; ++d) active |= sum.drops[d] != 0;
+            if (!active) continue;
+
+            sum.channel = ChannelTable::instance().name(chunk * CHUNK_SIZE + i);
+            out.push_back(sum);
+        }
+    }
+
+    lk.unlock();
+
+    if (out.empty()) return;
+    stats->channels = (zcm_channel_stats_t*) malloc(out.size() * sizeof(zcm_channel_stats_t));
+    memcpy(stats->channels, out.data(), out.size() * sizeof(zcm_channel_stats_t));
+    stats->nchannels = out.size();
+}
+
+static void appendJsonString(std::string& s, const char* str)
+{
+    if (str == nullptr) {
+        s += "null";
+        return;
+    }
+    s += '"';
+    for (const char* c = str; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            s += '\\';
+            s += *c;
+        } else if ((uint8_t) *c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", (unsigned) (uint8_t) *c);
+            s += esc;
+        } else {
+            s += *c;
+        }
+    }
+    s += '"';
+}
+
+static void appendJsonField(std::string& s, const char* name, uint64_t value, bool first = false)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s\"%s\":%" PRIu64, first ? "" : ",", name, value);
+    s += buf;
+}
+
+std::string StatsRegistry::toJson(const zcm_stats_t& stats)
+{
+    static const char* const dropNames[ZCM_DROP_NUM_REASONS] = {
+        "send_queue_full", "send_failed", "no_subscriber", "sub_queue", "recv_queue"
+    };
+
+    std::string s = "{";
+    appendJsonField(s, "utime", stats.utime, true);
+    appendJsonField(s, "send_queue_high_water", stats.send_queue_high_water);
+    appendJsonField(s, "recv_queue_high_water", stats.recv_queue_high_water);
+    s += ",\"channels\":[";
+    for (size_t i = 0; i < stats.nchannels; ++i) {
+        const zcm_channel_stats_t& c = stats.channels[i];
+        s += i == 0 ? "{" : ",{";
+        s += "\"channel\":";
+        appendJsonString(s, c.channel);
+        appendJsonField(s, "msgs_out", c.msgs_out);
+        appendJsonField(s, "bytes_out", c.bytes_out);
+        appendJsonField(s, "msgs_in", c.msgs_in);
+        appendJsonField(s, "bytes_in", c.bytes_in);
+        appendJsonField(s, "msgs_dispatched", c.msgs_dispatched);
+        appendJsonField(s, "queue_high_water", c.queue_high_water);
+        s += ",\"drops\":{";
+        for (size_t d = 0; d < ZCM_DROP_NUM_REASONS; ++d)
+            appendJsonField(s, dropNames[d], c.drops[d], d == 0);
+        s += "},\"latency_hist\":[";
+        for (size_t b = 0; b < ZCM_STATS_LATENCY_BUCKETS; ++b) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%s%" PRIu64, b == 0 ? "" : ",", c.latency_hist[b]);
+            s += buf;
+        }
+        s += "]}";
+    }
+    s += "]}";
+    return s;
+}
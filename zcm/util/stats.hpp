@@ -0,0 +1,100 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "zcm/zcm.h"
+#include "zcm/util/channel_table.hpp"
+
+// Per-channel runtime statistics of a zcm instance (see zcm_get_stats()).
+//
+// Every thread that records something gets a shard of its own, so recording is
+// a couple of plain loads and stores on memory no other thread writes. The
+// shards are only summed up when somebody asks for the totals. Counters are
+// kept per channel id (see ChannelTable), in chunks that a shard allocates the
+// first time its thread sees a channel in the chunk's range. When a thread
+// exits, its shards are folded into each registry's retired totals and freed.
+class StatsRegistry
+{
+  public:
+    StatsRegistry();
+    ~StatsRegistry();
+
+    void countOut(uint32_t channelId, size_t bytes);
+    void countIn(uint32_t channelId, size_t bytes);
+    // A negative latency is unknown and left out of the histogram
+    void countDispatch(uint32_t channelId, int64_t latencyUs);
+    void countDrop(uint32_t channelId, enum zcm_drop_reason reason);
+    void queueDepth(uint32_t channelId, size_t depth);
+    void sendQueueDepth(size_t depth);
+    void recvQueueDepth(size_t depth);
+
+    // Fills 'stats', whose 'channels' must be released with zcm_free_stats()
+    void collect(zcm_stats_t* stats) const;
+
+    static std::string toJson(const zcm_stats_t& stats);
+
+  private:
+    struct Counters
+    {
+        std::atomic<uint64_t> msgsOut;
+        std::atomic<uint64_t> bytesOut;
+        std::atomic<uint64_t> msgsIn;
+        std::atomic<uint64_t> bytesIn;
+        std::atomic<uint64_t> dispatched;
+        std::atomic<uint64_t> queueHighWater;
+        std::atomic<uint64_t> drops[ZCM_DROP_NUM_REASONS];
+        std::atomic<uint64_t> latency[ZCM_STATS_LATENCY_BUCKETS];
+    };
+
+    static const size_t CHUNK_SIZE = 64;
+    static const size_t NUM_CHUNKS = ChannelTable::MAX_CHANNELS / CHUNK_SIZE;
+
+    struct Shard
+    {
+        std::atomic<Counters*> chunks[NUM_CHUNKS];
+        std::atomic<uint64_t> sendQueueHighWater {0};
+        std::atomic<uint64_t> recvQueueHighWater {0};
+
+        Shard();
+        ~Shard();
+        Counters& at(uint32_t channelId);
+    };
+
+    // The calling thread's shard
+    Shard& local();
+
+    // Folds the shard of a thread that is exiting into 'retired' and frees it
+    void retire(std::thread::id thread);
+    struct ThreadShards;
+
+    // Only the owning thread writes a counter, so no read-modify-write is needed
+    static void add(std::atomic<uint64_t>& c, uint64_t n)
+    {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void raise(std::atomic<uint64_t>& c, uint64_t n)
+    {
+        if (n > c.load(std::memory_order_relaxed)) c.store(n, std::memory_order_relaxed);
+    }
+
+    // Tells registries apart in the threads' shard caches, even once one is gone
+    const uint64_t id;
+
+    mutable std::mutex shardsMutex;
+    std::unordered_map<std::thread::id, std::unique_ptr<Shard>> shards;
+    Shard retired;
+
+  private:
+    // Disallow copies and moves
+    StatsRegistry(const StatsRegistry&) = delete;
+    StatsRegistry& operator=(const StatsRegistry&) = delete;
+    StatsRegistry(StatsRegistry&& other) = delete;
+    StatsRegistry& operator=(StatsRegistry&& other) = delete;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "cxxtest/TestSuite.h"
+
+#include "zcm/util/buffer_pool.hpp"
+
+class BufferPoolTest : public CxxTest::TestSuite
+{
+  public:
+    void setUp() override {}
+    void tearDown() override {}
+
+    void testSelfTest()
+    {
+        BufferPool::test();
+    }
+
+    void testSteadyStateHasNoMisses()
+    {
+        BufferPool pool;
+        const size_t sizes[] = { 1, 64, 65, 1000, 4096, 70000, 1 << 20 };
+
+        for (size_t round = 0; round < 10; ++round) {
+            std::vector<char*> bufs;
+            for (size_t sz : sizes) {
+                char* buf = pool.alloc(sz);
+                TS_ASSERT(buf != nullptr);
+                // The whole requested size must be usable
+                memset(buf, 0xab, sz);
+                bufs.push_back(buf);
+            }
+            for (size_t i = 0; i < bufs.size(); ++i) pool.free(bufs[i], sizes[i]);
+        }
+
+        size_t n = sizeof(sizes) / sizeof(sizes[0]);
+        TS_ASSERT_EQUALS(pool.getMisses(), n);
+        TS_ASSERT_EQUALS(pool.getHits(), 9 * n);
+    }
+
+    void testTooLargeIsNeverPooled()
+    {
+        BufferPool pool;
+        for (size_t i = 0; i < 3; ++i) {
+            char* buf = pool.alloc((1 << 20) + 1);
+            TS_ASSERT(buf != nullptr);
+            pool.free(buf, (1 << 20) + 1);
+        }
+        TS_ASSERT_EQUALS(pool.getMisses(), 3u);
+        TS_ASSERT_EQUALS(pool.getHits(), 0u);
+    }
+
+    void testConcurrentAllocFree()
+    {
+        BufferPool pool;
+        const size_t NTHREADS = 4;
+        const size_t NITERS = 10000;
+
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < NTHREADS; ++t) {
+            threads.emplace_back([&pool, t]() {
+                for (size_t i = 0; i < NITERS; ++i) {
+                    size_t sz = 32 + (i % 8) * 100;
+                    char* buf = pool.alloc(sz);
+                    memset(buf, (int) t, sz);
+                    for (size_t j = 0; j < sz; ++j) {
+                        if (buf[j] != (char) t) {
+                            TS_ASSERT(false);
+                            break;
+                        }
+                    }
+                    pool.free(buf, sz);
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+
+        TS_ASSERT_EQUALS(pool.getHits() + pool.getMisses(), NTHREADS * NITERS);
+        // Each thread holds at most one buffer at a time
+        TS_ASSERT_LESS_THAN_EQUALS(pool.getMisses(), NTHREADS * 5);
+    }
+};
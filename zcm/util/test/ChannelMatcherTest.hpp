@@ -0,0 +1,123 @@
+#pragma once
+
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "cxxtest/TestSuite.h"
+
+#include "zcm/util/channel_matcher.hpp"
+
+class ChannelMatcherTest : public CxxTest::TestSuite
+{
+    std::mt19937 rng {1234};
+
+    size_t pick(size_t n) { return std::uniform_int_distribution<size_t>(0, n - 1)(rng); }
+
+    // A random pattern within the subset that is compiled into the DFA
+    std::string randomPattern(int depth = 0)
+    {
+        static const char* const atoms[] = {
+            "a", "b", "A", "_", "0", ".", "[ab]", "[^a]", "[0-9A]", "\\d", "\\w", "\\s", "\\.",
+        };
+        static const char* const quantifiers[] = { "", "", "*", "+", "?" };
+
+        std::string p;
+        size_t npieces = 1 + pick(3);
+        for (size_t i = 0; i < npieces; ++i) {
+            if (depth < 2 && pick(5) == 0) p += "(" + randomPattern(depth + 1) + ")";
+            else                           p += atoms[pick(sizeof(atoms) / sizeof(atoms[0]))];
+            p += quantifiers[pick(sizeof(quantifiers) / sizeof(quantifiers[0]))];
+        }
+        if (pick(4) == 0) p += "|" + randomPattern(depth + 1);
+        return p;
+    }
+
+    std::string randomChannel()
+    {
+        static const char chars[] = "abA_0 .9";
+        std::string c;
+        size_t len = pick(7);
+        for (size_t i = 0; i < len; ++i) c += chars[pick(sizeof(chars) - 1)];
+        return c;
+    }
+
+    // Checks 'm' against std::regex_match() for every channel
+    void checkAgainstStdRegex(const std::vector<std::string>& patterns,
+                              const std::vector<std::string>& channels)
+    {
+        ChannelMatcher m(patterns);
+        std::vector<std::regex> regexes;
+        for (auto& p : patterns) regexes.emplace_back(p);
+
+        std::vector<size_t> got;
+        for (auto& c : channels) {
+            std::vector<size_t> expected;
+            for (size_t i = 0; i < regexes.size(); ++i)
+                if (std::regex_match(c, regexes[i])) expected.push_back(i);
+
+            got.clear();
+            m.match(c.c_str(), got);
+            TS_ASSERT(got == expected);
+            TS_ASSERT_EQUALS(m.matchesAny(c.c_str()), !expected.empty());
+            if (got != expected) {
+                fprintf(stderr, "mismatch on channel '%s'\n", c.c_str());
+                return;
+            }
+        }
+    }
+
+  public:
+    void setUp() override {}
+    void tearDown() override {}
+
+    void testSelfTest()
+    {
+        ChannelMatcher::test();
+    }
+
+    void testRandomPatternsMatchStdRegex()
+    {
+        for (size_t round = 0; round < 50; ++round) {
+            std::vector<std::string> patterns;
+            size_t npatterns = 1 + pick(8);
+            for (size_t i = 0; i < npatterns; ++i) patterns.push_back(randomPattern());
+
+            std::vector<std::string> channels;
+            for (size_t i = 0; i < 200; ++i) channels.push_back(randomChannel());
+
+            checkAgainstStdRegex(patterns, channels);
+        }
+    }
+
+    void testTooManyDfaStatesStillMatches()
+    {
+        // "The 12th character from the end is an 'a'" needs 2^12 DFA states, so
+        // this has to be answered by the NFA simulation
+        std::string p = "(a|b)*a";
+        for (size_t i = 0; i < 12; ++i) p += "(a|b)";
+
+        std::vector<std::string> channels;
+        for (size_t i = 0; i < 500; ++i) {
+            std::string c;
+            size_t len = 10 + pick(10);
+            for (size_t j = 0; j < len; ++j) c += pick(2) ? 'a' : 'b';
+            channels.push_back(c);
+        }
+        checkAgainstStdRegex({ p, "a*", "b.*" }, channels);
+    }
+
+    void testFallbackPatterns()
+    {
+        // Anchors and counted repetition go to std::regex, next to native ones
+        checkAgainstStdRegex({ "^FOO$", "x{2,3}", "FOO.*", "(a)\\1" },
+                             { "", "FOO", "FOOBAR", "xx", "xxx", "xxxx", "aa", "ab" });
+    }
+
+    void testInvalidPatternThrows()
+    {
+        TS_ASSERT_THROWS_ANYTHING(ChannelMatcher({ "FOO", "(unbalanced" }));
+        TS_ASSERT_THROWS_ANYTHING(ChannelMatcher({ "[z-a]" }));
+    }
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "cxxtest/TestSuite.h"
+
+#include "zcm/zcm.h"
+#include "zcm/transport.h"
+#include "zcm/util/channel_table.hpp"
+
+class ChannelTableTest : public CxxTest::TestSuite
+{
+    struct Received
+    {
+        std::string expected;
+        std::atomic<int> count {0};
+        std::atomic<int> wrongName {0};
+    };
+
+    static void handler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+    {
+        Received* r = (Received*) usr;
+        if (r->expected != channel) r->wrongName++;
+        r->count++;
+    }
+
+  public:
+    void setUp() override {}
+    void tearDown() override {}
+
+    void testSelfTest()
+    {
+        ChannelTable::test();
+    }
+
+    void testCInterface()
+    {
+        uint32_t id = zcm_channel_intern("CHANNEL_TABLE_TEST");
+        TS_ASSERT_DIFFERS(id, (uint32_t) ZCM_CHANNEL_ID_NONE);
+        TS_ASSERT_EQUALS(zcm_channel_find("CHANNEL_TABLE_TEST"), id);
+        TS_ASSERT_EQUALS(strcmp(zcm_channel_name(id), "CHANNEL_TABLE_TEST"), 0);
+        TS_ASSERT_EQUALS(zcm_channel_find("CHANNEL_TABLE_TEST_NEVER"),
+                         (uint32_t) ZCM_CHANNEL_ID_NONE);
+        TS_ASSERT(zcm_channel_name(ZCM_CHANNEL_ID_NONE) == nullptr);
+
+        // A message carries its id only if its channel is the interned name itself
+        zcm_msg_t msg;
+        msg.channel = zcm_channel_name(id);
+        msg.channel_id = id;
+        TS_ASSERT_EQUALS(zcm_msg_channel_id(&msg), id);
+        std::string copy = msg.channel;
+        msg.channel = copy.c_str();
+        TS_ASSERT_EQUALS(zcm_msg_channel_id(&msg), (uint32_t) ZCM_CHANNEL_ID_NONE);
+    }
+
+    void testConcurrentInternAgrees()
+    {
+        const size_t NTHREADS = 4;
+        const size_t NCHANNELS = 499; // Prime, so every stride below visits all of them
+        std::vector<std::vector<uint32_t>> ids(NTHREADS, std::vector<uint32_t>(NCHANNELS));
+
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < NTHREADS; ++t) {
+            threads.emplace_back([&ids, t]() {
+                for (size_t i = 0; i < NCHANNELS; ++i) {
+                    // Each thread walks the names in a different order
+                    size_t c = (i * (2 * t + 1)) % NCHANNELS;
+                    std::string name = "CONCURRENT_" + std::to_string(c);
+                    ids[t][c] = ChannelTable::instance().intern(name.c_str());
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+
+        for (size_t c = 0; c < NCHANNELS; ++c) {
+            std::string name = "CONCURRENT_" + std::to_string(c);
+            TS_ASSERT_DIFFERS(ids[0][c], ChannelTable::NONE);
+            for (size_t t = 1; t < NTHREADS; ++t) TS_ASSERT_EQUALS(ids[t][c], ids[0][c]);
+            TS_ASSERT_EQUALS(std::string(ChannelTable::instance().name(ids[0][c])), name);
+        }
+    }
+
+    void testDispatchByChannel()
+    {
+        const size_t NCHANNELS = 100;
+        zcm_t* zcm = zcm_create("block-inproc");
+        TS_ASSERT(zcm);
+        if (!zcm) return;
+        zcm_set_queue_size(zcm, 2 * NCHANNELS);
+
+        std::vector<Received> received(NCHANNELS);
+        for (size_t i = 0; i < NCHANNELS; ++i) {
+            received[i].expected = "DISPATCH_" + std::to_string(i);
+            TS_ASSERT(zcm_subscribe(zcm, received[i].expected.c_str(), handler, &received[i]));
+        }
+
+        zcm_start(zcm);
+        uint8_t data = 0;
+        for (size_t i = 0; i < NCHANNELS; ++i) {
+            // A fresh copy of the name, so nothing can get by on comparing pointers
+            std::string channel = received[i].expected;
+            TS_ASSERT_EQUALS(zcm_publish(zcm, channel.c_str(), &data, 1), ZCM_EOK);
+        }
+        for (int i = 0; i < 2000 && received[NCHANNELS - 1].count == 0; ++i) usleep(1000);
+        zcm_stop(zcm);
+        zcm_destroy(zcm);
+
+        for (auto& r : received) {
+            TS_ASSERT_EQUALS(r.count.load(), 1);
+            TS_ASSERT_EQUALS(r.wrongName.load(), 0);
+        }
+    }
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cxxtest/TestSuite.h"
+
+#include "zcm/zcm.h"
+#include "zcm/util/lockfree_queue.hpp"
+
+class LockfreeQueueTest : public CxxTest::TestSuite
+{
+  public:
+    void setUp() override {}
+    void tearDown() override {}
+
+    void testSpscKeepsOrder()
+    {
+        const int N = 100000;
+        SpscQueue<int> q(16);
+
+        std::thread producer([&q]() {
+            for (int i = 0; i < N; ++i) q.push(i);
+        });
+
+        int expected = 0;
+        while (expected < N) {
+            int* v = q.top();
+            TS_ASSERT(v != nullptr);
+            if (!v) break;
+            TS_ASSERT_EQUALS(*v, expected);
+            q.pop();
+            ++expected;
+        }
+        producer.join();
+        TS_ASSERT(!q.hasMessage());
+    }
+
+    void testMpscKeepsOrderPerProducer()
+    {
+        const int NPRODUCERS = 4;
+        const int N = 50000;
+        MpscQueue<std::pair<int, int>> q(16);
+
+        std::vector<std::thread> producers;
+        for (int p = 0; p < NPRODUCERS; ++p) {
+            producers.emplace_back([&q, p]() {
+                for (int i = 0; i < N; ++i) q.push(p, i);
+            });
+        }
+
+        std::vector<int> next(NPRODUCERS, 0);
+        for (int n = 0; n < NPRODUCERS * N; ++n) {
+            auto* v = q.top();
+            TS_ASSERT(v != nullptr);
+            if (!v) break;
+            TS_ASSERT_EQUALS(v->second, next[v->first]);
+            next[v->first] = v->second + 1;
+            q.pop();
+        }
+        for (auto& t : producers) t.join();
+
+        for (int p = 0; p < NPRODUCERS; ++p) TS_ASSERT_EQUALS(next[p], N);
+        TS_ASSERT(!q.hasMessage());
+    }
+
+    void testCapacityIsExact()
+    {
+        // Not a power of two, which the SPSC storage is rounded up to
+        SpscQueue<int> spsc(5);
+        MpscQueue<int> mpsc(5);
+        for (int i = 0; i < 5; ++i) {
+            TS_ASSERT(spsc.pushIfRoom(i));
+            TS_ASSERT(mpsc.pushIfRoom(i));
+        }
+        TS_ASSERT(!spsc.pushIfRoom(5));
+        TS_ASSERT(!mpsc.pushIfRoom(5));
+        TS_ASSERT(!spsc.hasFreeSpace());
+        TS_ASSERT(!mpsc.hasFreeSpace());
+
+        spsc.pop();
+        mpsc.pop();
+        TS_ASSERT(spsc.pushIfRoom(5));
+        TS_ASSERT(mpsc.pushIfRoom(5));
+        for (int i = 1; i <= 5; ++i) {
+            TS_ASSERT_EQUALS(*spsc.top(), i);
+            TS_ASSERT_EQUALS(*mpsc.top(), i);
+            spsc.pop();
+            mpsc.pop();
+        }
+    }
+
+    void testCapacityOfOne()
+    {
+        MpscQueue<int> q(1);
+        TS_ASSERT(q.pushIfRoom(1));
+        TS_ASSERT(!q.pushIfRoom(2));
+        TS_ASSERT_EQUALS(*q.top(), 1);
+        q.pop();
+        TS_ASSERT(q.pushIfRoom(3));
+        TS_ASSERT(!q.pushIfRoom(4));
+        TS_ASSERT_EQUALS(*q.top(), 3);
+        q.pop();
+        TS_ASSERT(!q.hasMessage());
+
+        q.setCapacity(2);
+        TS_ASSERT(q.pushIfRoom(5));
+        TS_ASSERT(q.pushIfRoom(6));
+        TS_ASSERT(!q.pushIfRoom(7));
+        q.setCapacity(1);
+        TS_ASSERT_EQUALS(q.numMessages(), 1u);
+        TS_ASSERT_EQUALS(*q.top(), 5);
+    }
+
+    void testSetCapacityKeepsOldest()
+    {
+        MpscQueue<int> q(8);
+        for (int i = 0; i < 6; ++i) q.push(i);
+        q.setCapacity(3);
+        TS_ASSERT_EQUALS(q.numMessages(), 3u);
+        for (int i = 0; i < 3; ++i) {
+            TS_ASSERT_EQUALS(*q.top(), i);
+            q.pop();
+        }
+        TS_ASSERT(!q.hasMessage());
+
+        SpscQueue<int> s(3);
+        for (int i = 0; i < 3; ++i) s.push(i);
+        s.setCapacity(10);
+        for (int i = 3; i < 10; ++i) TS_ASSERT(s.pushIfRoom(i));
+        TS_ASSERT(!s.pushIfRoom(10));
+        for (int i = 0; i < 10; ++i) {
+            TS_ASSERT_EQUALS(*s.top(), i);
+            s.pop();
+        }
+    }
+
+    void testPeek()
+    {
+        MpscQueue<int> q(4);
+        q.push(7);
+        q.push(8);
+        TS_ASSERT_EQUALS(*q.peek(0), 7);
+        TS_ASSERT_EQUALS(*q.peek(1), 8);
+        TS_ASSERT(q.peek(2) == nullptr);
+        TS_ASSERT(q.peek(4) == nullptr);
+    }
+
+    void testDisableReleasesWaiters()
+    {
+        MpscQueue<int> q(1);
+        q.push(0);
+
+        std::atomic<int> results {0};
+        std::thread producer([&]() { if (!q.push(1)) results++; });
+        MpscQueue<int> empty(1);
+        std::thread consumer([&]() { if (empty.top() == nullptr) results++; });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        q.disable();
+        empty.disable();
+        producer.join();
+        consumer.join();
+        TS_ASSERT_EQUALS(results.load(), 2);
+
+        // A disabled queue hides its elements until it is enabled again
+        TS_ASSERT(q.top() == nullptr);
+        q.enable();
+        TS_ASSERT_EQUALS(*q.top(), 0);
+    }
+};
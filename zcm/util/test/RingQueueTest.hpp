@@ -0,0 +1,171 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "cxxtest/TestSuite.h"
+
+#include "zcm/zcm.h"
+#include "zcm/util/queue.hpp"
+
+class RingQueueTest : public CxxTest::TestSuite
+{
+    // Long enough to live on the heap, unlike the short strings kept in place
+    static std::string str(int i) { return std::string(i % 3 ? 4 : 40, 'a' + i % 26) +
+                                           std::to_string(i); }
+
+    template<class Element>
+    static void drainAndCompare(RingQueue<Element>& q, std::deque<Element>& ref)
+    {
+        TS_ASSERT_EQUALS(q.numMessages(), ref.size());
+        while (!ref.empty()) {
+            TS_ASSERT(q.hasMessage());
+            if (!q.hasMessage()) return;
+            TS_ASSERT_EQUALS(q.top(), ref.front());
+            q.pop();
+            ref.pop_front();
+        }
+        TS_ASSERT(!q.hasMessage());
+    }
+
+    // Pushes and pops in uneven chunks, so both wrap the storage at every offset
+    template<class Element, class Make>
+    static void bulkAgainstDeque(size_t capacity, Make make)
+    {
+        RingQueue<Element> q(capacity);
+        std::deque<Element> ref;
+        int next = 0;
+        for (size_t round = 0; round < 200; ++round) {
+            size_t npush = 1 + (round * 7) % capacity;
+            std::vector<Element> in;
+            for (size_t i = 0; i < npush; ++i) in.push_back(make(next + i));
+
+            size_t room = capacity - ref.size();
+            size_t pushed = q.pushN(in.data(), in.size());
+            TS_ASSERT_EQUALS(pushed, npush < room ? npush : room);
+            for (size_t i = 0; i < pushed; ++i) ref.push_back(in[i]);
+            next += pushed;
+
+            size_t npop = 1 + (round * 5) % capacity;
+            std::vector<Element> out(npop);
+            size_t popped = q.popN(out.data(), out.size());
+            TS_ASSERT_EQUALS(popped, npop < ref.size() ? npop : ref.size());
+            for (size_t i = 0; i < popped; ++i) {
+                TS_ASSERT_EQUALS(out[i], ref.front());
+                ref.pop_front();
+            }
+            TS_ASSERT_EQUALS(q.numMessages(), ref.size());
+        }
+        drainAndCompare(q, ref);
+    }
+
+  public:
+    void setUp() override {}
+    void tearDown() override {}
+
+    void testBulkWrapsTrivial()
+    {
+        // Exactly a power of two, and one that leaves unused storage past capacity
+        bulkAgainstDeque<int>(8, [](int i) { return i; });
+        bulkAgainstDeque<int>(5, [](int i) { return i; });
+    }
+
+    void testBulkWrapsNonTrivial()
+    {
+        bulkAgainstDeque<std::string>(8, str);
+        bulkAgainstDeque<std::string>(5, str);
+    }
+
+    void testPartialPushN()
+    {
+        RingQueue<int> q(5);
+        const int in[] = { 0, 1, 2, 3, 4, 5, 6 };
+        TS_ASSERT_EQUALS(q.pushN(in, 3), 3u);
+        TS_ASSERT_EQUALS(q.pushN(in + 3, 4), 2u);
+        TS_ASSERT(!q.hasFreeSpace());
+        TS_ASSERT_EQUALS(q.pushN(in + 5, 2), 0u);
+
+        // Room for one more, across the end of the storage
+        int out[7];
+        TS_ASSERT_EQUALS(q.popN(out, 1), 1u);
+        TS_ASSERT_EQUALS(q.pushN(in + 5, 2), 1u);
+        TS_ASSERT_EQUALS(q.popN(out, 7), 5u);
+        for (int i = 0; i < 5; ++i) TS_ASSERT_EQUALS(out[i], i + 1);
+        TS_ASSERT_EQUALS(q.popN(out, 7), 0u);
+    }
+
+    void testMixedSingleAndBulk()
+    {
+        RingQueue<std::string> q(4);
+        std::deque<std::string> ref;
+        for (int i = 0; i < 3; ++i) {
+            q.push(str(i));
+            ref.push_back(str(i));
+        }
+        std::string out[2];
+        TS_ASSERT_EQUALS(q.popN(out, 2), 2u);
+        ref.pop_front();
+        ref.pop_front();
+
+        std::string in[] = { str(3), str(4), str(5), str(6) };
+        TS_ASSERT_EQUALS(q.pushN(in, 4), 3u);
+        for (int i = 0; i < 3; ++i) ref.push_back(in[i]);
+        drainAndCompare(q, ref);
+    }
+
+    void testSetCapacityShrinkKeepsOldest()
+    {
+        RingQueue<std::string> q(8);
+        std::deque<std::string> ref;
+        // Wrap first, so the elements kept straddle the end of the storage
+        for (int i = 0; i < 6; ++i) q.push(str(i));
+        for (int i = 0; i < 6; ++i) q.pop();
+        for (int i = 6; i < 12; ++i) q.push(str(i));
+
+        q.setCapacity(3);
+        TS_ASSERT_EQUALS(q.getCapacity(), 3u);
+        TS_ASSERT(!q.hasFreeSpace());
+        for (int i = 6; i < 9; ++i) ref.push_back(str(i));
+        drainAndCompare(q, ref);
+
+        std::string in[] = { str(20), str(21), str(22), str(23) };
+        TS_ASSERT_EQUALS(q.pushN(in, 4), 3u);
+        for (int i = 0; i < 3; ++i) ref.push_back(in[i]);
+        drainAndCompare(q, ref);
+    }
+
+    void testSetCapacityGrowKeepsAll()
+    {
+        RingQueue<std::string> q(3);
+        std::deque<std::string> ref;
+        q.push(str(0));
+        q.pop();
+        for (int i = 1; i < 4; ++i) {
+            q.push(str(i));
+            ref.push_back(str(i));
+        }
+
+        q.setCapacity(10);
+        TS_ASSERT_EQUALS(q.getCapacity(), 10u);
+        std::vector<std::string> in;
+        for (int i = 4; i < 12; ++i) in.push_back(str(i));
+        TS_ASSERT_EQUALS(q.pushN(in.data(), in.size()), 7u);
+        for (int i = 0; i < 7; ++i) ref.push_back(in[i]);
+        TS_ASSERT(!q.hasFreeSpace());
+        drainAndCompare(q, ref);
+
+        // Same storage size, only the capacity changes
+        RingQueue<int> r(5);
+        for (int i = 0; i < 5; ++i) r.push(i);
+        r.setCapacity(7);
+        TS_ASSERT(r.hasFreeSpace());
+        r.push(5);
+        r.push(6);
+        TS_ASSERT(!r.hasFreeSpace());
+        for (int i = 0; i < 7; ++i) {
+            TS_ASSERT_EQUALS(r.top(), i);
+            r.pop();
+        }
+    }
+};
@@ -19,6 +19,9 @@
 inline ZCM::ZCM()
 {
     zcm = zcm_create(nullptr);
+    subQueueDepth = 0;
+    subQueuePolicy = ZCM_QUEUE_BLOCK;
+    subQueueLatest = false;
 }
 #endif
 
@@ -26,6 +29,9 @@ inline ZCM::ZCM()
 inline ZCM::ZCM(const std::string& transport)
 {
     zcm = zcm_create(transport.c_str());
+    subQueueDepth = 0;
+    subQueuePolicy = ZCM_QUEUE_BLOCK;
+    subQueueLatest = false;
 }
 #endif
 
@@ -33,6 +39,11 @@ inline ZCM::ZCM(zcm_trans_t* zt)
 {
     zcm = (zcm_t*) malloc(sizeof(zcm_t));
     zcm_init_trans(zcm, zt);
+    #ifndef ZCM_EMBEDDED
+    subQueueDepth = 0;
+    subQueuePolicy = ZCM_QUEUE_BLOCK;
+    subQueueLatest = false;
+    #endif
 }
 
 inline ZCM::~ZCM()
@@ -109,6 +120,13 @@ inline int ZCM::handle()
 }
 #endif
 
+#ifndef ZCM_EMBEDDED
+inline int ZCM::handleBatch(uint32_t maxMsgs, int timeout)
+{
+    return zcm_handle_batch(zcm, maxMsgs, timeout);
+}
+#endif
+
 #ifndef ZCM_EMBEDDED
 inline void ZCM::setQueueSize(uint32_t sz)
 {
@@ -116,11 +134,80 @@ inline void ZCM::setQueueSize(uint32_t sz)
 }
 #endif
 
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setDispatchThreads(uint32_t nthreads)
+{
+    return zcm_set_dispatch_threads(zcm, nthreads);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setChannelUnordered(const std::string& channel, bool unordered)
+{
+    return zcm_set_channel_unordered(zcm, channel.c_str(), unordered ? 1 : 0);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setPublishMode(enum zcm_publish_mode mode)
+{
+    return zcm_set_publish_mode(zcm, mode);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setBusyPoll(int64_t spinUs)
+{
+    return zcm_set_busy_poll(zcm, spinUs);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setThreadOpts(enum zcm_thread thread, const zcm_thread_opts_t* opts)
+{
+    return zcm_set_thread_opts(zcm, thread, opts);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::getThreadOpts(enum zcm_thread thread, zcm_thread_opts_t* opts)
+{
+    return zcm_get_thread_opts(zcm, thread, opts);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::getStats(zcm_stats_t* stats)
+{
+    return zcm_get_stats(zcm, stats);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setStatsPublish(uint32_t periodMs)
+{
+    return zcm_set_stats_publish(zcm, periodMs);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline void ZCM::getPoolStats(zcm_pool_stats_t* stats)
+{
+    return zcm_get_pool_stats(zcm, stats);
+}
+#endif
+
 inline int ZCM::handleNonblock()
 {
     return zcm_handle_nonblock(zcm);
 }
 
+inline int ZCM::handleNonblockBudget(uint32_t maxMsgs, uint64_t maxUs,
+                                     uint64_t (*timeNow)(void* usr), void* usr)
+{
+    return zcm_handle_nonblock_budget(zcm, maxMsgs, maxUs, timeNow, usr);
+}
+
 inline void ZCM::flush()
 {
     return zcm_flush(zcm);
@@ -135,14 +222,42 @@ template <class Msg>
 inline int ZCM::publish(const std::string& channel, const Msg* msg)
 {
     uint32_t len = msg->getEncodedSize();
+    #ifndef ZCM_EMBEDDED
+    uint8_t* buf = publishAcquire(channel, len);
+    if (!buf) return err();
+    int encoded = msg->encode(buf, 0, len);
+    if (encoded < 0) {
+        publishAbort(buf);
+        return encoded;
+    }
+    return publishCommit(buf, (uint32_t)encoded);
+    #else
     uint8_t* buf = new uint8_t[len];
     ZCM_ASSERT(buf);
     msg->encode(buf, 0, len);
     int status = publishRaw(channel, buf, len);
     delete[] buf;
     return status;
+    #endif
+}
+
+#ifndef ZCM_EMBEDDED
+inline uint8_t* ZCM::publishAcquire(const std::string& channel, uint32_t len)
+{
+    return zcm_publish_acquire(zcm, channel.c_str(), len);
 }
 
+inline int ZCM::publishCommit(uint8_t* buf, uint32_t len)
+{
+    return zcm_publish_commit(zcm, buf, len);
+}
+
+inline void ZCM::publishAbort(uint8_t* buf)
+{
+    zcm_publish_abort(zcm, buf);
+}
+#endif
+
 inline Subscription* ZCM::subscribe(const std::string& channel,
                                     void (*cb)(const ReceiveBuffer* rbuf,
                                                const std::string& channel, void* usr),
@@ -397,6 +512,30 @@ inline Subscription* ZCM::subscribe(const std::string& channel,
 }
 #endif
 
+#if !defined(ZCM_EMBEDDED) && __cplusplus > 199711L
+template <class... Args>
+inline Subscription* ZCM::subscribeQueued(uint32_t depth, enum zcm_queue_policy policy,
+                                          const std::string& channel, Args... args)
+{
+    if (depth == 0) return nullptr;
+
+    subQueueDepth = depth;
+    subQueuePolicy = policy;
+    Subscription* sub = subscribe(channel, args...);
+    subQueueDepth = 0;
+    return sub;
+}
+
+template <class... Args>
+inline Subscription* ZCM::subscribeLatest(const std::string& channel, Args... args)
+{
+    subQueueLatest = true;
+    Subscription* sub = subscribe(channel, args...);
+    subQueueLatest = false;
+    return sub;
+}
+#endif
+
 inline void ZCM::unsubscribe(Subscription* sub)
 {
     std::vector<Subscription*>::iterator end = subscriptions.end(),
@@ -419,7 +558,20 @@ inline int ZCM::publishRaw(const std::string& channel, const uint8_t* data, uint
 
 inline void ZCM::subscribeRaw(void*& rawSub, const std::string& channel,
                               MsgHandler cb, void* usr)
-{ rawSub = zcm_subscribe(zcm, channel.c_str(), cb, usr); }
+{
+    #ifndef ZCM_EMBEDDED
+    if (subQueueLatest) {
+        rawSub = zcm_subscribe_latest(zcm, channel.c_str(), cb, usr);
+        return;
+    }
+    if (subQueueDepth > 0) {
+        rawSub = zcm_subscribe_queued(zcm, channel.c_str(), cb, usr,
+                                      subQueueDepth, subQueuePolicy);
+        return;
+    }
+    #endif
+    rawSub = zcm_subscribe(zcm, channel.c_str(), cb, usr);
+}
 
 inline void ZCM::unsubscribeRaw(void*& rawSub)
 { zcm_unsubscribe(zcm, (zcm_sub_t*) rawSub); rawSub = nullptr; }
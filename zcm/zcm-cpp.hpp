@@ -42,9 +42,22 @@ class ZCM
     virtual inline void pause();
     virtual inline void resume();
     virtual inline int  handle();
+    virtual inline int  handleBatch(uint32_t maxMsgs, int timeout);
     virtual inline void setQueueSize(uint32_t sz);
+    virtual inline int  setDispatchThreads(uint32_t nthreads);
+    virtual inline int  setChannelUnordered(const std::string& channel, bool unordered);
+    virtual inline int  setPublishMode(enum zcm_publish_mode mode);
+    virtual inline int  setBusyPoll(int64_t spinUs);
+    virtual inline int  setThreadOpts(enum zcm_thread thread, const zcm_thread_opts_t* opts);
+    virtual inline int  getThreadOpts(enum zcm_thread thread, zcm_thread_opts_t* opts);
+    // 'stats' must be released with zcm_free_stats()
+    virtual inline int  getStats(zcm_stats_t* stats);
+    virtual inline int  setStatsPublish(uint32_t periodMs);
+    virtual inline void getPoolStats(zcm_pool_stats_t* stats);
     #endif
     virtual inline int  handleNonblock();
+    virtual inline int  handleNonblockBudget(uint32_t maxMsgs, uint64_t maxUs,
+                                             uint64_t (*timeNow)(void* usr), void* usr);
     virtual inline void flush();
 
   public:
@@ -58,6 +71,14 @@ class ZCM
     template <class Msg>
     inline int publish(const std::string& channel, const Msg* msg);
 
+    #ifndef ZCM_EMBEDDED
+    // Two-phase publish, see zcm_publish_acquire(). publish(channel, msg) uses these to
+    // encode straight into the buffer that gets sent
+    virtual inline uint8_t* publishAcquire(const std::string& channel, uint32_t len);
+    virtual inline int      publishCommit(uint8_t* buf, uint32_t len);
+    virtual inline void     publishAbort(uint8_t* buf);
+    #endif
+
     inline Subscription* subscribe(const std::string& channel,
                                    void (*cb)(const ReceiveBuffer* rbuf,
                                               const std::string& channel,
@@ -92,6 +113,19 @@ class ZCM
                                                        const Msg* msg)> cb);
     #endif
 
+    #if !defined(ZCM_EMBEDDED) && __cplusplus > 199711L
+    // Takes the arguments of any of the subscribe() overloads above after the settings
+    // of the subscription's own queue. See zcm_subscribe_queued()
+    template <class... Args>
+    inline Subscription* subscribeQueued(uint32_t depth, enum zcm_queue_policy policy,
+                                         const std::string& channel, Args... args);
+
+    // Takes the arguments of any of the subscribe() overloads above. The subscription
+    // only ever sees the newest message of each channel. See zcm_subscribe_latest()
+    template <class... Args>
+    inline Subscription* subscribeLatest(const std::string& channel, Args... args);
+    #endif
+
     inline void unsubscribe(Subscription* sub);
 
     virtual inline zcm_t* getUnderlyingZCM();
@@ -111,6 +145,13 @@ class ZCM
   private:
     zcm_t* zcm;
     std::vector<Subscription*> subscriptions;
+
+    #ifndef ZCM_EMBEDDED
+    // Queue settings for the subscription that subscribeRaw() is about to make
+    uint32_t subQueueDepth;
+    enum zcm_queue_policy subQueuePolicy;
+    bool subQueueLatest;
+    #endif
 };
 
 // New class required to allow the Handler callbacks and std::string channel names
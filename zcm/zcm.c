@@ -87,6 +87,8 @@ int zcm_init(zcm_t* zcm, const char* url)
         zcm_trans_t* trans = creator(u);
         if (trans) {
             ret = zcm_init_trans(zcm, trans);
+            if (ret == 0 && zcm->type == ZCM_BLOCKING)
+                zcm_blocking_set_url_opts(zcm->impl, zcm_url_opts(u));
         } else {
             ZCM_DEBUG("failed to create transport for '%s'", url);
         }
@@ -187,6 +189,74 @@ int zcm_publish(zcm_t* zcm, const char* channel, const uint8_t* data, uint32_t l
     return zcm_nonblocking_publish(zcm->impl, channel, data, len);
 }
 
+#ifndef ZCM_EMBEDDED
+/* Nonblocking instances have no buffer pool, so their zcm_publish_acquire() buffers
+   are plain heap blocks with this header in front (padded to keep the data aligned) */
+typedef union nonblock_loan_t nonblock_loan_t;
+union nonblock_loan_t
+{
+    struct {
+        const char* channel;
+        uint32_t len;
+    } hdr;
+    uint64_t align[2];
+};
+
+uint8_t* zcm_publish_acquire(zcm_t* zcm, const char* channel, uint32_t len)
+{
+    nonblock_loan_t* loan;
+    size_t chanlen;
+
+    if (zcm->type == ZCM_BLOCKING) {
+        uint8_t* buf = NULL;
+        zcm->err = zcm_blocking_publish_acquire(zcm->impl, channel, len, &buf);
+        return buf;
+    }
+
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    chanlen = strlen(channel) + 1;
+    loan = malloc(sizeof(nonblock_loan_t) + len + chanlen);
+    if (!loan) {
+        zcm->err = ZCM_EUNKNOWN;
+        return NULL;
+    }
+    loan->hdr.channel = memcpy((char*)(loan + 1) + len, channel, chanlen);
+    loan->hdr.len = len;
+    zcm->err = ZCM_EOK;
+    return (uint8_t*)(loan + 1);
+}
+
+int zcm_publish_commit(zcm_t* zcm, uint8_t* buf, uint32_t len)
+{
+    nonblock_loan_t* loan;
+    int ret;
+
+    if (zcm->type == ZCM_BLOCKING) {
+        zcm->err = zcm_blocking_publish_commit(zcm->impl, buf, len);
+        return zcm->err;
+    }
+
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    loan = (nonblock_loan_t*)buf - 1;
+    ret = len <= loan->hdr.len ? zcm_nonblocking_publish(zcm->impl, loan->hdr.channel, buf, len)
+                               : ZCM_EINVALID;
+    free(loan);
+    zcm->err = ret;
+    return ret;
+}
+
+void zcm_publish_abort(zcm_t* zcm, uint8_t* buf)
+{
+    if (zcm->type == ZCM_BLOCKING) {
+        zcm_blocking_publish_abort(zcm->impl, buf);
+        return;
+    }
+
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    free((nonblock_loan_t*)buf - 1);
+}
+#endif
+
 void zcm_flush(zcm_t* zcm)
 {
 #ifndef ZCM_EMBEDDED
@@ -236,6 +306,42 @@ zcm_sub_t* zcm_try_subscribe(zcm_t* zcm, const char* channel, zcm_msg_handler_t
     return zcm_nonblocking_subscribe(zcm->impl, channel, cb, usr);
 }
 
+#ifndef ZCM_EMBEDDED
+zcm_sub_t* zcm_subscribe_queued(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb,
+                                void* usr, uint32_t depth, enum zcm_queue_policy policy)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_subscribe_queued(zcm->impl, channel, cb, usr, depth, policy);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+zcm_sub_t* zcm_try_subscribe_queued(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb,
+                                    void* usr, uint32_t depth, enum zcm_queue_policy policy)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_try_subscribe_queued(zcm->impl, channel, cb, usr, depth, policy);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+zcm_sub_t* zcm_subscribe_latest(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb,
+                                void* usr)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_subscribe_latest(zcm->impl, channel, cb, usr);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+zcm_sub_t* zcm_try_subscribe_latest(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb,
+                                    void* usr)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_try_subscribe_latest(zcm->impl, channel, cb, usr);
+}
+#endif
+
 int zcm_unsubscribe(zcm_t* zcm, zcm_sub_t* sub)
 {
 #ifndef ZCM_EMBEDDED
@@ -316,6 +422,16 @@ int zcm_handle(zcm_t* zcm)
 }
 #endif
 
+#ifndef ZCM_EMBEDDED
+int zcm_handle_batch(zcm_t* zcm, uint32_t max_msgs, int timeout)
+{
+    uint32_t n = 0;
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    zcm->err = zcm_blocking_handle_batch(zcm->impl, max_msgs, timeout, &n);
+    return zcm->err == ZCM_EOK ? (int) n : -1;
+}
+#endif
+
 #ifndef ZCM_EMBEDDED
 void zcm_set_queue_size(zcm_t* zcm, uint32_t numMsgs)
 {
@@ -332,8 +448,97 @@ int  zcm_try_set_queue_size(zcm_t* zcm, uint32_t numMsgs)
 }
 #endif
 
+#ifndef ZCM_EMBEDDED
+int  zcm_set_dispatch_threads(zcm_t* zcm, uint32_t nthreads)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_dispatch_threads(zcm->impl, nthreads);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_channel_unordered(zcm_t* zcm, const char* channel, int unordered)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_channel_unordered(zcm->impl, channel, unordered);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_publish_mode(zcm_t* zcm, enum zcm_publish_mode mode)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_publish_mode(zcm->impl, mode);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_busy_poll(zcm_t* zcm, int64_t spin_us)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_busy_poll(zcm->impl, spin_us);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_thread_opts(zcm_t* zcm, enum zcm_thread thread, const zcm_thread_opts_t* opts)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_thread_opts(zcm->impl, thread, opts);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_get_thread_opts(zcm_t* zcm, enum zcm_thread thread, zcm_thread_opts_t* opts)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_get_thread_opts(zcm->impl, thread, opts);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+void zcm_get_pool_stats(zcm_t* zcm, zcm_pool_stats_t* stats)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    zcm_blocking_get_pool_stats(zcm->impl, stats);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_get_stats(zcm_t* zcm, zcm_stats_t* stats)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    zcm_blocking_get_stats(zcm->impl, stats);
+    return ZCM_EOK;
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+void zcm_free_stats(zcm_stats_t* stats)
+{
+    free(stats->channels);
+    stats->channels = NULL;
+    stats->nchannels = 0;
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_stats_publish(zcm_t* zcm, uint32_t period_ms)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_stats_publish(zcm->impl, period_ms);
+}
+#endif
+
 int zcm_handle_nonblock(zcm_t* zcm)
 {
     ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
     return zcm_nonblocking_handle_nonblock(zcm->impl);
 }
+
+int zcm_handle_nonblock_budget(zcm_t* zcm, uint32_t max_msgs, uint64_t max_us,
+                               uint64_t (*time_now)(void* usr), void* usr)
+{
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    return zcm_nonblocking_handle_nonblock_budget(zcm->impl, max_msgs, max_us, time_now, usr);
+}
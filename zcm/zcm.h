@@ -67,6 +67,10 @@ struct zcm_recv_buf_t
     zcm_t*   zcm;
     uint8_t* data; /* NOTE: do not free, the library manages this memory */
     uint32_t data_size;
+    /* The publisher's utime and sequence number, if the transport traced the message
+       (see the 'trace' url option of the transports), else 0 */
+    uint64_t trace_utime;
+    uint32_t trace_seqno;
 };
 
 #ifndef ZCM_EMBEDDED
@@ -116,6 +120,40 @@ zcm_sub_t* zcm_subscribe(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb,
    Does NOT set zcm errno on failure */
 zcm_sub_t* zcm_try_subscribe(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb, void* usr);
 
+#ifndef ZCM_EMBEDDED
+/* Blocking Mode Only: What to do with a message that arrives while a subscription's
+   queue is full (see zcm_subscribe_queued() below) */
+enum zcm_queue_policy {
+    ZCM_QUEUE_BLOCK,       /* Wait for room. Nothing is lost, but receiving stalls meanwhile */
+    ZCM_QUEUE_DROP_OLDEST, /* Discard the oldest queued message: keeps the latest values */
+    ZCM_QUEUE_DROP_NEWEST  /* Discard the message that just arrived */
+};
+
+/* Blocking Mode Only: Like zcm_subscribe(), but the subscription gets a queue of its own
+   that holds up to 'depth' messages instead of sharing the one of the zcm instance
+   (see zcm_set_queue_size()). A subscription that can't keep up then only affects
+   itself, as decided by 'policy', rather than holding up every other channel.
+   Messages are still dispatched in order for each subscription, but not necessarily
+   in the order they arrived relative to other subscriptions.
+   Returns a subscription object on success, and NULL on failure
+   Does NOT set zcm errno on failure */
+zcm_sub_t* zcm_subscribe_queued(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb,
+                                void* usr, uint32_t depth, enum zcm_queue_policy policy);
+zcm_sub_t* zcm_try_subscribe_queued(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb,
+                                    void* usr, uint32_t depth, enum zcm_queue_policy policy);
+
+/* Blocking Mode Only: Like zcm_subscribe_queued(), but only the newest message of each
+   channel is kept, in a buffer that is allocated once and then overwritten in place.
+   Messages that are replaced before they could be dispatched are never decoded or
+   handed to 'cb', which suits consumers that only care about the current state.
+   Returns a subscription object on success, and NULL on failure
+   Does NOT set zcm errno on failure */
+zcm_sub_t* zcm_subscribe_latest(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb,
+                                void* usr);
+zcm_sub_t* zcm_try_subscribe_latest(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb,
+                                    void* usr);
+#endif
+
 /* Unsubscribe to zcm messages, freeing the subscription object
    Returns ZCM_EOK on success, error code on failure
    Does NOT set zcm errno on failure */
@@ -134,6 +172,19 @@ int zcm_try_unsubscribe(zcm_t* zcm, zcm_sub_t* sub);
    Sets zcm errno on failure */
 int zcm_publish(zcm_t* zcm, const char* channel, const uint8_t* data, uint32_t len);
 
+#ifndef ZCM_EMBEDDED
+/* Two-phase publish that lets the caller build the message in place rather than
+   handing zcm a buffer to copy. zcm_publish_acquire() returns a writable buffer of
+   'len' bytes for a message on 'channel' (NULL on failure, and sets zcm errno). Fill
+   it in and pass it to zcm_publish_commit() with the number of bytes actually used
+   ('len' at most), which then behaves like zcm_publish(). To drop the message
+   instead, pass the buffer to zcm_publish_abort(). Either call gives the buffer
+   back, whatever the result, so it must not be touched afterwards. */
+uint8_t* zcm_publish_acquire(zcm_t* zcm, const char* channel, uint32_t len);
+int      zcm_publish_commit(zcm_t* zcm, uint8_t* buf, uint32_t len);
+void     zcm_publish_abort(zcm_t* zcm, uint8_t* buf);
+#endif
+
 /* Block until all published messages have been sent even if the underlying
    transport is nonblocking. Additionally, dispatches all messages that have
    already been received sequentially in this thread. */
@@ -153,6 +204,11 @@ int  zcm_try_stop(zcm_t* zcm); /* returns ZCM_EOK on success, error code on fail
 void zcm_pause(zcm_t* zcm); /* pauses message dispatch and publishing, not transport */
 void zcm_resume(zcm_t* zcm);
 int  zcm_handle(zcm_t* zcm); /* returns ZCM_EOK normally, error code on failure. */
+/* Like zcm_handle(), but waits at most 'timeout' milliseconds (forever if negative) for a
+   message and then dispatches up to 'max_msgs' messages in one go, amortizing the internal
+   locking across the batch. Returns the number of messages dispatched (0 on timeout), or
+   -1 on failure. Sets zcm errno on failure */
+int  zcm_handle_batch(zcm_t* zcm, uint32_t max_msgs, int timeout);
 /* Determines how many messages can be stored from the transport without being dispatched
    As well as the number of messages that may be stored from the user without being
    transmitted by the transport. Normal operation does not require the user to modify
@@ -163,6 +219,129 @@ int  zcm_handle(zcm_t* zcm); /* returns ZCM_EOK normally, error code on failure.
    issues depending on the transport. */
 void zcm_set_queue_size(zcm_t* zcm, uint32_t numMsgs);
 int  zcm_try_set_queue_size(zcm_t* zcm, uint32_t numMsgs); /* returns ZCM_EOK or ZCM_EAGAIN */
+/* Spreads message dispatch in zcm_run() and zcm_start() over 'nthreads' threads (1 by
+   default). Each channel is always dispatched by the same thread, so the callbacks for a
+   channel still run one at a time and in order, but callbacks for different channels may
+   run concurrently. A regex subscription's callback is never run concurrently with
+   itself, but it may be called from different threads for different channels, and the
+   messages of different channels are not ordered with respect to each other.
+   zcm_handle() and zcm_flush() are unaffected. May only be called while the instance is
+   not running. Returns ZCM_EOK or ZCM_EINVALID */
+int  zcm_set_dispatch_threads(zcm_t* zcm, uint32_t nthreads);
+/* Marks a (non regex) channel whose callbacks do not depend on message order. With more
+   than one dispatch thread, its messages go to whichever thread is least busy instead,
+   so they may be dispatched concurrently and out of order. Returns ZCM_EOK or
+   ZCM_EINVALID */
+int  zcm_set_channel_unordered(zcm_t* zcm, const char* channel, int unordered);
+/* How zcm_publish() hands messages to the transport */
+enum zcm_publish_mode {
+    ZCM_PUBLISH_QUEUED, /* Copy into the send queue and return, the send thread sends it */
+    ZCM_PUBLISH_INLINE  /* Send from the caller's thread, straight from the caller's buffer */
+};
+/* Selects the publish mode (ZCM_PUBLISH_QUEUED by default). In ZCM_PUBLISH_INLINE mode,
+   zcm_publish() returns once the transport has taken the message, saving a copy and a
+   thread hand-off. Inline sends run concurrently if the transport allows it, otherwise
+   they are serialized. While paused, or while older messages are still queued, messages
+   are queued as usual so they keep their order. Returns ZCM_EOK or ZCM_EINVALID */
+int  zcm_set_publish_mode(zcm_t* zcm, enum zcm_publish_mode mode);
+/* Makes the recv thread busy-poll the transport instead of waiting in it: after each
+   received message it keeps polling for 'spin_us' microseconds (forever if negative),
+   spinning with a pause instruction in between, before it falls back to a blocking
+   receive. This trades a core (best pinned to the recv thread) for lower and steadier
+   receive latency. 0 turns busy polling off, which is the default. Returns ZCM_EOK */
+int  zcm_set_busy_poll(zcm_t* zcm, int64_t spin_us);
+/* The internal threads of a blocking instance */
+enum zcm_thread {
+    ZCM_THREAD_SEND,     /* Hands queued messages to the transport */
+    ZCM_THREAD_RECV,     /* Receives messages from the transport */
+    ZCM_THREAD_DISPATCH  /* Runs callbacks for zcm_start() (all of them, see
+                            zcm_set_dispatch_threads()) */
+};
+enum zcm_sched_policy {
+    ZCM_SCHED_DEFAULT, /* Leave the scheduling policy and priority alone */
+    ZCM_SCHED_FIFO,
+    ZCM_SCHED_RR
+};
+typedef struct zcm_thread_opts_t zcm_thread_opts_t;
+struct zcm_thread_opts_t
+{
+    int32_t  cpu;      /* First CPU the thread may run on, or -1 for any CPU */
+    uint32_t ncpus;    /* Number of CPUs, counting up from 'cpu' (0 counts as 1) */
+    enum zcm_sched_policy policy;
+    int32_t  priority; /* Real-time priority for ZCM_SCHED_FIFO and ZCM_SCHED_RR */
+    char     name[16]; /* Thread name, or empty for the default ("zcm-recv" etc). Threads
+                          of a dispatch pool after the first get "-<n>" appended */
+};
+/* Sets the CPU affinity, scheduling and name of an internal thread. Options take effect
+   when the thread starts, so set them before zcm_start(). The thread calling zcm_run()
+   is left alone. The same options can be given in the url, e.g.
+   "udpm://239.255.76.67:7667?recv_cpu=3&dispatch_cpu=4-7&sched=fifo:50", with one of
+   'send', 'recv' or 'dispatch' before '_cpu', '_sched' or '_name', and 'sched' applying
+   to all threads. Failing to apply an option (e.g. without the privileges for a
+   real-time policy) is not fatal. Returns ZCM_EOK or ZCM_EINVALID */
+int  zcm_set_thread_opts(zcm_t* zcm, enum zcm_thread thread, const zcm_thread_opts_t* opts);
+/* Fills 'opts' with the current options of 'thread'. Returns ZCM_EOK or ZCM_EINVALID */
+int  zcm_get_thread_opts(zcm_t* zcm, enum zcm_thread thread, zcm_thread_opts_t* opts);
+/* Messages waiting in the send and recv queues are stored in buffers drawn from a
+   per-instance pool. These counters report how many of those allocations were
+   served from the pool (hits) and how many needed to go to the heap (misses).
+   In steady state, 'misses' should stop growing. */
+typedef struct zcm_pool_stats_t zcm_pool_stats_t;
+struct zcm_pool_stats_t
+{
+    uint64_t hits;
+    uint64_t misses;
+};
+void zcm_get_pool_stats(zcm_t* zcm, zcm_pool_stats_t* stats);
+/* Why a message was lost */
+enum zcm_drop_reason {
+    ZCM_DROP_SEND_QUEUE_FULL, /* zcm_publish() found the send queue full */
+    ZCM_DROP_SEND_FAILED,     /* The transport failed to send it */
+    ZCM_DROP_NO_SUBSCRIBER,   /* Received, but nothing subscribes to its channel */
+    ZCM_DROP_SUB_QUEUE,       /* A queued subscription made room (see zcm_queue_policy) */
+    ZCM_DROP_RECV_QUEUE,      /* The recv queue was shut down while it waited for room */
+    ZCM_DROP_NUM_REASONS
+};
+/* Bucket 0 of a latency histogram counts latencies under 1us, bucket i > 0 counts
+   [2^(i-1), 2^i) us and the last bucket also counts everything above */
+#define ZCM_STATS_LATENCY_BUCKETS 32
+typedef struct zcm_channel_stats_t zcm_channel_stats_t;
+struct zcm_channel_stats_t
+{
+    /* Never freed. NULL collects whatever couldn't be tied to a channel: channels
+       without an id and failed batch sends. Publishing doesn't give a channel an
+       id; subscribing to it by name or zcm_channel_intern() does. */
+    const char* channel;
+    uint64_t msgs_out;         /* Accepted by zcm_publish() */
+    uint64_t bytes_out;
+    uint64_t msgs_in;          /* Received from the transport */
+    uint64_t bytes_in;
+    uint64_t msgs_dispatched;  /* Callbacks run */
+    uint64_t queue_high_water; /* Deepest queue a message of the channel went into */
+    uint64_t drops[ZCM_DROP_NUM_REASONS];
+    /* Time from the publisher's utime to the start of its callback. Only traced
+       messages (see trace_utime) are counted, so this stays empty without tracing */
+    uint64_t latency_hist[ZCM_STATS_LATENCY_BUCKETS];
+};
+typedef struct zcm_stats_t zcm_stats_t;
+struct zcm_stats_t
+{
+    uint64_t utime;                 /* When these were collected, for computing rates */
+    uint64_t send_queue_high_water;
+    uint64_t recv_queue_high_water; /* Of the recv queues of all dispatch threads */
+    size_t   nchannels;
+    zcm_channel_stats_t* channels;  /* Only channels with any activity */
+};
+/* Collects the running totals of a blocking instance. The counters are kept per thread
+   and only summed up here, so keeping them costs next to nothing. 'stats' must be
+   released with zcm_free_stats(). Returns ZCM_EOK */
+int  zcm_get_stats(zcm_t* zcm, zcm_stats_t* stats);
+void zcm_free_stats(zcm_stats_t* stats);
+/* Channel that zcm_set_stats_publish() publishes on */
+#define ZCM_STATS_CHANNEL "ZCM_STATS"
+/* Publishes the stats as JSON text on ZCM_STATS_CHANNEL every 'period_ms' milliseconds,
+   from a thread of its own. 0 stops publishing, which is the default. Returns ZCM_EOK */
+int  zcm_set_stats_publish(zcm_t* zcm, uint32_t period_ms);
 #endif
 
 /* Non-Blocking Mode Only: Functions checking and dispatching messages
@@ -170,6 +349,14 @@ int  zcm_try_set_queue_size(zcm_t* zcm, uint32_t numMsgs); /* returns ZCM_EOK or
    error code otherwise */
 int zcm_handle_nonblock(zcm_t* zcm);
 
+/* Non-Blocking Mode Only: Updates the transport once and then dispatches messages
+   until there are none left, 'max_msgs' have been dispatched, or 'max_us' microseconds
+   have passed since the call started, as measured by 'time_now(usr)' (checked after each
+   message, so a single slow callback can overrun the budget). If 'time_now' is NULL,
+   only 'max_msgs' applies. Returns the number of messages dispatched */
+int zcm_handle_nonblock_budget(zcm_t* zcm, uint32_t max_msgs, uint64_t max_us,
+                               uint64_t (*time_now)(void* usr), void* usr);
+
 /*
  * Version: M.m.u
  *   M: Major